@@ -1,9 +1,32 @@
 #include "camera.h"
+#include <glm/gtc/matrix_access.hpp>
 
 using namespace std;
 using namespace glm;
 
 
+Frustum::Frustum(const mat4 &viewProjection)
+{
+	// Gribb and Hartmann: a clip space point is inside while -w <= x, y, z <= w, which makes each plane the sum
+	// or difference of the matrix's last row and one of the others
+	vec4 rowX = row(viewProjection, 0);
+	vec4 rowY = row(viewProjection, 1);
+	vec4 rowZ = row(viewProjection, 2);
+	vec4 rowW = row(viewProjection, 3);
+	planes[0] = rowW + rowX;
+	planes[1] = rowW - rowX;
+	planes[2] = rowW + rowY;
+	planes[3] = rowW - rowY;
+	planes[4] = rowW + rowZ;
+	planes[5] = rowW - rowZ;
+
+	for (int i = 0; i < 6; i++)
+	{
+		planes[i] /= length(vec3(planes[i]));
+	}
+}
+
+
 Camera::Camera(vec3 position, vec3 up, float yaw, float pitch) :
 	front(vec3(0.0f, 0.0f, -1.0f)),
 	movementSpeed(SPEED),
@@ -38,6 +61,12 @@ mat4 Camera::getViewMatrix() const
 }
 
 
+Frustum Camera::getFrustum(const mat4 &projection) const
+{
+	return Frustum(projection * getViewMatrix());
+}
+
+
 void Camera::updatePosition(float deltaTime)
 {
 	vec2 movement(0.0f);
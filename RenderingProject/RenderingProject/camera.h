@@ -23,6 +23,19 @@ const float SENSITIVITY = 0.05f;
 const float FOV = 45.0f;
 
 
+// Planes enclosing what a view and projection see, as (normal, distance) pairs with unit length normals pointing inwards,
+// so dot(normal, point) + distance is the signed distance of a point from a plane and positive on the inside
+struct Frustum {
+	glm::vec4 planes[6];  // Left, right, bottom, top, near and far
+
+	// Default constructor
+	Frustum() = default;
+
+	// Extract the planes from a combined projection * view matrix, they're in the space the view matrix transforms from
+	explicit Frustum(const glm::mat4 &viewProjection);
+};
+
+
 // An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
 // NOTE: Ideally cameras would be scene specific objects, but since I don't feel like refactoring things to work that way,
 //       I will simply go with the camera being a global object created once in the main function and then passed along to scenes
@@ -52,6 +65,9 @@ public:
 	// Returns the view matrix calculated using Euler Angles and the LookAt Matrix
 	glm::mat4 getViewMatrix() const;
 
+	// Returns the world space planes of the view frustum seen through a projection
+	Frustum getFrustum(const glm::mat4 &projection) const;
+
 	// Update camera position. Should be called every frame
 	void updatePosition(float deltaTime);
 
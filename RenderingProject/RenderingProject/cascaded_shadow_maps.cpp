@@ -0,0 +1,243 @@
+#include "cascaded_shadow_maps.h"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <glm/gtc/matrix_transform.hpp>
+#include "gl_state.h"
+
+using namespace std;
+using namespace glm;
+
+
+// Share of the logarithmic split scheme in the cascade splits, the rest is a uniform split
+// Logarithmic splits give every cascade the same texel density on screen but leave the distant ones huge
+static const float CASCADE_SPLIT_WEIGHT = 0.75f;
+
+// Frames between updates of every cascade and the frame of the period it's due in, staggered so the distant cascades take turns
+static const unsigned CASCADE_UPDATE_INTERVALS[SHADOW_CASCADE_COUNT] = { 1, 2, 4, 4 };
+static const unsigned CASCADE_UPDATE_PHASES[SHADOW_CASCADE_COUNT] = { 0, 1, 0, 2 };
+
+// Radii of the cascade spheres are rounded up to a multiple of this, so rounding errors don't change the texel size
+static const float CASCADE_RADIUS_STEP = 1.0f / 16.0f;
+
+// Depth offset of the casters while drawing, against shadow acne (slope scaled factor and constant units)
+static const float SHADOW_OFFSET_FACTOR = 2.0f;
+static const float SHADOW_OFFSET_UNITS = 4.0f;
+
+
+ShadowStats CascadedShadowMaps::frameStats;
+
+
+// View distance at which a cascade begins (or the previous one ends), blending logarithmic and uniform splits
+static float getSplitDistance(int split, float nearPlane, float shadowDistance)
+{
+	float share = (float)split / SHADOW_CASCADE_COUNT;
+	float logarithmic = nearPlane * pow(shadowDistance / nearPlane, share);
+	float uniform = nearPlane + (shadowDistance - nearPlane) * share;
+	return CASCADE_SPLIT_WEIGHT * logarithmic + (1.0f - CASCADE_SPLIT_WEIGHT) * uniform;
+}
+
+
+CascadedShadowMaps::CascadedShadowMaps(int resolution, GLuint textureUnit) :
+	resolution(resolution),
+	textureUnit(textureUnit)
+{
+	shadowMap = GpuResource(GPU_RESOURCE_TEXTURE);
+	GlState::global().bindTexture(GL_TEXTURE_2D_ARRAY, shadowMap.get());
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, SHADOW_CASCADE_COUNT, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	shadowMap.setMemory((size_t)resolution * resolution * SHADOW_CASCADE_COUNT * 4);
+
+	// Sampled with a comparison, linear filtering makes every lookup a bilinear blend of four depth tests
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+	// Depth only, every layer is attached before it's drawn
+	framebuffer = GpuResource(GPU_RESOURCE_FRAMEBUFFER);
+	GLuint previousFramebuffer = GlState::global().getFramebuffer();
+	GlState::global().bindFramebuffer(framebuffer.get());
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMap.get(), 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		cerr << "ERROR::CASCADED_SHADOW_MAPS::FRAMEBUFFER_INCOMPLETE" << endl;
+	}
+	GlState::global().bindFramebuffer(previousFramebuffer);
+
+	cout << "CascadedShadowMaps: " << SHADOW_CASCADE_COUNT << " cascades of " << resolution << "x" << resolution << ", "
+		<< (float)resolution * resolution * SHADOW_CASCADE_COUNT * 4 / (1024.0f * 1024.0f) << " MB" << endl;
+}
+
+
+void CascadedShadowMaps::update(const mat4 &view, const mat4 &projection, float nearPlane, float shadowDistance, const vec3 &lightDirection)
+{
+	frameIndex++;
+
+	// Light space has the light looking down its -z axis, the same for every cascade
+	vec3 direction = normalize(lightDirection);
+	if (direction != this->lightDirection)
+	{
+		this->lightDirection = direction;
+		invalidate();
+	}
+	vec3 up = abs(direction.y) < 0.99f ? vec3(0.0f, 1.0f, 0.0f) : vec3(1.0f, 0.0f, 0.0f);
+	mat4 lightRotation = lookAt(vec3(0.0f), direction, up);
+
+	// Squared tangent of the angle between the view axis and the frustum's corner edges
+	float cornerTangentSquared = 1.0f / (projection[0][0] * projection[0][0]) + 1.0f / (projection[1][1] * projection[1][1]);
+	mat4 inverseView = inverse(view);
+
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		Cascade &cascade = cascades[i];
+
+		// The nearest cascade is always drawn, the others when their time slice comes up or they're invalid
+		cascade.due = i == 0 || !cascade.valid || frameIndex % CASCADE_UPDATE_INTERVALS[i] == CASCADE_UPDATE_PHASES[i];
+		if (!cascade.due)
+		{
+			frameStats.cascadesSkipped++;
+			continue;
+		}
+
+		// Slice of the view the cascade covers
+		float sliceNear = getSplitDistance(i, nearPlane, shadowDistance);
+		float sliceFar = getSplitDistance(i + 1, nearPlane, shadowDistance);
+
+		// Smallest sphere around the slice, centered on the view axis where it's as far from the near corners as from the far ones
+		// (or at the far cap if that's beyond it). Its radius only depends on the slice, so the cascade keeps its size as the camera turns
+		float centerDepth = 0.5f * (sliceNear + sliceFar) * (1.0f + cornerTangentSquared);
+		float radius;
+		if (centerDepth >= sliceFar)
+		{
+			centerDepth = sliceFar;
+			radius = sliceFar * sqrt(cornerTangentSquared);
+		}
+		else
+		{
+			radius = sqrt((sliceFar - centerDepth) * (sliceFar - centerDepth) + sliceFar * sliceFar * cornerTangentSquared);
+		}
+		radius = ceil(radius / CASCADE_RADIUS_STEP) * CASCADE_RADIUS_STEP;
+
+		// Moving the center in whole texels keeps every texel covering the same part of the world, so edges don't shimmer
+		// (and in depth as well, so a cascade that barely moved can stay cached)
+		vec3 center = vec3(lightRotation * inverseView * vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+		float texelSize = 2.0f * radius / resolution;
+		center = floor(center / texelSize) * texelSize;
+
+		// Casters in front of the near plane are clamped onto it while drawing, so the depth range only has to cover the sphere
+		// (widened by the texel the center may have moved)
+		mat4 lightView = translate(mat4(1.0f), -center) * lightRotation;
+		float depthRange = radius + texelSize;
+		mat4 lightProjection = ortho(-radius, radius, -radius, radius, -depthRange, depthRange);
+
+		// A distant cascade that still shows the same is kept
+		if (i > 0 && cascade.valid && lightView == cascade.lightView && lightProjection == cascade.lightProjection)
+		{
+			cascade.due = false;
+			frameStats.cascadesCached++;
+			continue;
+		}
+		cascade.lightView = lightView;
+		cascade.lightProjection = lightProjection;
+	}
+}
+
+
+void CascadedShadowMaps::draw(const DrawCastersFunction &drawCasters, int viewportWidth, int viewportHeight)
+{
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+	GLuint previousFramebuffer = GlState::global().getFramebuffer();
+	bool drawn = false;
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		Cascade &cascade = cascades[i];
+		if (!cascade.due)
+		{
+			continue;
+		}
+
+		if (!drawn)
+		{
+			GlState::global().bindFramebuffer(framebuffer.get());
+			glViewport(0, 0, resolution, resolution);
+			GlState::global().enable(GL_DEPTH_CLAMP);
+			GlState::global().enable(GL_POLYGON_OFFSET_FILL);
+			GlState::global().polygonOffset(SHADOW_OFFSET_FACTOR, SHADOW_OFFSET_UNITS);
+			drawn = true;
+		}
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMap.get(), 0, i);
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		// Without a near plane the frustum reaches back to the light
+		Frustum casterFrustum(cascade.lightProjection * cascade.lightView);
+		casterFrustum.planes[4] = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+		frameStats.casters += drawCasters(cascade.lightView, cascade.lightProjection, casterFrustum);
+		frameStats.cascadesDrawn++;
+		cascade.valid = true;
+		cascade.due = false;
+	}
+
+	if (drawn)
+	{
+		GlState::global().disable(GL_POLYGON_OFFSET_FILL);
+		GlState::global().disable(GL_DEPTH_CLAMP);
+		GlState::global().bindFramebuffer(previousFramebuffer);
+		glViewport(0, 0, viewportWidth, viewportHeight);
+	}
+
+	frameStats.drawTimeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+}
+
+
+void CascadedShadowMaps::invalidate()
+{
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		cascades[i].valid = false;
+	}
+}
+
+
+void CascadedShadowMaps::bind(Shader &shader, const mat4 &view) const
+{
+	if (handleProgram != shader.ID.get())
+	{
+		shadowMapHandle = shader.getUniformHandle("shadowMap");
+		for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+		{
+			matrixHandles[i] = shader.getUniformHandle("shadowMatrices[" + to_string(i) + "]");
+		}
+		handleProgram = shader.ID.get();
+	}
+
+	GlState::global().bindTextureUnit(textureUnit, GL_TEXTURE_2D_ARRAY, shadowMap.get());
+	shader.setInt(shadowMapHandle, textureUnit);
+
+	// From view space to the texture coordinates and depth of every cascade
+	mat4 inverseView = inverse(view);
+	mat4 textureSpace = translate(mat4(1.0f), vec3(0.5f)) * scale(mat4(1.0f), vec3(0.5f));
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		shader.setMat4f(matrixHandles[i], textureSpace * cascades[i].lightProjection * cascades[i].lightView * inverseView);
+	}
+}
+
+
+const ShadowStats &CascadedShadowMaps::getFrameStats()
+{
+	return frameStats;
+}
+
+
+void CascadedShadowMaps::resetFrameStats()
+{
+	frameStats = ShadowStats();
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#ifndef CASCADED_SHADOW_MAPS_H
+#define CASCADED_SHADOW_MAPS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <functional>
+#include "camera.h"
+#include "gpu_resource.h"
+#include "shader.h"
+
+
+// Amount of cascades the view is split into, must match SHADOW_CASCADE_COUNT in the shaders
+const int SHADOW_CASCADE_COUNT = 4;
+
+// Texture unit the shadow map array is bound to, below the light clusters and above those used by materials
+const GLuint SHADOW_MAP_TEXTURE_UNIT = 7;
+
+
+// Work done by all cascaded shadow maps during the current frame
+struct ShadowStats {
+	unsigned cascadesDrawn = 0;    // Cascades whose shadow map was drawn
+	unsigned cascadesCached = 0;   // Cascades that were due but kept, as neither they nor what they show changed
+	unsigned cascadesSkipped = 0;  // Cascades that weren't due in their time slice and kept their shadow map
+	size_t casters = 0;            // Objects drawn into the shadow maps
+	double drawTimeMs = 0.0;       // Time spent drawing shadow maps (on the CPU, including culling the casters)
+};
+
+
+// Shadows of a directional light: the view from the near plane up to a shadow distance is split into slices, each covered by
+// its own shadow map (a layer of one depth texture array), so nearby shadows get small texels and distant ones still fit
+// Each cascade is fit to the bounding sphere of its slice, which keeps its size the same however the camera turns, and its center
+// is snapped to whole texels so shadow edges don't shimmer as the camera moves. Lit shaders pick the first cascade covering
+// a fragment and filter it with 3x3 taps of a comparison sampler (each itself a bilinear 2x2 test)
+// The nearest cascade is drawn every frame. The others are only due every few frames (staggered so at most one of them is due at a time),
+// and a due cascade is only drawn if its fit moved or it was invalidated by a change of the light or the shadow casters
+// Usage every frame: update with the view, draw the due cascades, then bind to the lit shaders
+// NOTE: Like OpenGL itself, the shadow maps may only be used on the main thread
+class CascadedShadowMaps
+{
+public:
+	// Function drawing the shadow casters of a cascade with a light view and projection, should only draw objects overlapping the frustum
+	// (which has no near plane, so casters between the light and the cascade are included). Returns the amount of objects drawn
+	typedef std::function<size_t(const glm::mat4 &lightView, const glm::mat4 &lightProjection, const Frustum &casterFrustum)> DrawCastersFunction;
+
+	// Constructor to create the shadow map array with cascades of resolution x resolution texels, bound to the given texture unit
+	CascadedShadowMaps(int resolution, GLuint textureUnit);
+
+	// Default constructor
+	CascadedShadowMaps() = default;
+
+	// Fit the cascades to the view of a perspective projection up to the shadow distance, and decide which ones are drawn this frame
+	// The light direction is in world space and the cascades are invalidated when it changes
+	void update(const glm::mat4 &view, const glm::mat4 &projection, float nearPlane, float shadowDistance, const glm::vec3 &lightDirection);
+
+	// Draw the cascades decided on by update, restoring the framebuffer and the viewport afterwards
+	void draw(const DrawCastersFunction &drawCasters, int viewportWidth, int viewportHeight);
+
+	// Have every cascade drawn again on the next update, should be called whenever the shadow casters change
+	void invalidate();
+
+	// Bind the shadow map array and set the shadow uniforms of a shader in use, the shader's positions are in view space
+	void bind(Shader &shader, const glm::mat4 &view) const;
+
+	// Work done during the current frame
+	static const ShadowStats &getFrameStats();
+
+	// Reset the work counts, should be called at the start of every frame
+	static void resetFrameStats();
+
+
+private:
+	// Shadow map of one slice of the view
+	struct Cascade {
+		glm::mat4 lightView = glm::mat4(1.0f);
+		glm::mat4 lightProjection = glm::mat4(1.0f);
+		bool valid = false;  // Whether the shadow map holds what the matrices above show
+		bool due = false;    // Whether it's drawn by the next draw
+	};
+
+	// Depth texture array with a layer per cascade and the framebuffer the layers are attached to in turn
+	GpuResource shadowMap;
+	GpuResource framebuffer;
+	int resolution = 0;
+	GLuint textureUnit = 0;
+
+	Cascade cascades[SHADOW_CASCADE_COUNT];
+	glm::vec3 lightDirection = glm::vec3(0.0f);
+	unsigned frameIndex = 0;
+
+	// Uniform handles of the last program bound to, retrieved again when another program is bound
+	mutable GLuint handleProgram = 0;
+	mutable UniformHandle shadowMapHandle = -1;
+	mutable UniformHandle matrixHandles[SHADOW_CASCADE_COUNT] = {};
+
+	// Work of the current frame
+	static ShadowStats frameStats;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include "deferred_renderer.h"
+#include <cmath>
+#include <iostream>
+#include <glm/gtc/matrix_transform.hpp>
+#include "gl_state.h"
+#include "lighting_buffer.h"
+
+using namespace std;
+using namespace glm;
+
+
+// Segments of the light volume meshes around their axis and, for the sphere, from pole to pole
+static const int VOLUME_SLICES = 16;
+static const int VOLUME_STACKS = 12;
+
+
+DeferredShadingStats DeferredRenderer::frameStats;
+
+
+// Indexed triangles of a sphere around the origin that encloses the unit sphere, counter-clockwise seen from outside
+// Vertices sit further out than 1 by as much as the flat triangles between them would cut into it
+static void buildSphere(int slices, int stacks, vector<vec3> &vertices, vector<GLuint> &indices)
+{
+	float halfSlice = pi<float>() / slices;
+	float halfStack = 0.5f * pi<float>() / stacks;
+	float radius = 1.0f / cos(sqrt(halfSlice * halfSlice + halfStack * halfStack));
+
+	// Poles first, then the rings between them from top to bottom
+	vertices.push_back(vec3(0.0f, radius, 0.0f));
+	vertices.push_back(vec3(0.0f, -radius, 0.0f));
+	for (int stack = 1; stack < stacks; stack++)
+	{
+		float latitude = pi<float>() * stack / stacks;
+		for (int slice = 0; slice < slices; slice++)
+		{
+			float longitude = 2.0f * pi<float>() * slice / slices;
+			vertices.push_back(radius * vec3(sin(latitude) * cos(longitude), cos(latitude), sin(latitude) * sin(longitude)));
+		}
+	}
+
+	for (int slice = 0; slice < slices; slice++)
+	{
+		GLuint next = (slice + 1) % slices;
+
+		// Top and bottom rows are fans around the poles
+		GLuint top = 2, bottom = 2 + (stacks - 2) * slices;
+		indices.insert(indices.end(), { 0, top + next, top + slice });
+		indices.insert(indices.end(), { bottom + slice, bottom + next, 1 });
+
+		for (int stack = 1; stack < stacks - 1; stack++)
+		{
+			GLuint upper = 2 + (stack - 1) * slices, lower = upper + slices;
+			indices.insert(indices.end(), { upper + slice, lower + next, lower + slice });
+			indices.insert(indices.end(), { upper + slice, upper + next, lower + next });
+		}
+	}
+}
+
+
+// Indexed triangles of a cone with its tip at the origin, pointing down -z to a base of radius 1 at z = -1,
+// counter-clockwise seen from outside. The base polygon is widened so that it encloses the circle
+static void buildCone(int slices, vector<vec3> &vertices, vector<GLuint> &indices)
+{
+	float radius = 1.0f / cos(pi<float>() / slices);
+
+	// Tip and base center first, then the base outline
+	vertices.push_back(vec3(0.0f));
+	vertices.push_back(vec3(0.0f, 0.0f, -1.0f));
+	for (int slice = 0; slice < slices; slice++)
+	{
+		float angle = 2.0f * pi<float>() * slice / slices;
+		vertices.push_back(vec3(radius * cos(angle), radius * sin(angle), -1.0f));
+	}
+
+	for (GLuint slice = 0; slice < (GLuint)slices; slice++)
+	{
+		GLuint current = 2 + slice, next = 2 + (slice + 1) % slices;
+		indices.insert(indices.end(), { 0, current, next });
+		indices.insert(indices.end(), { 1, next, current });
+	}
+}
+
+
+DeferredRenderer::DeferredRenderer(GLuint firstTextureUnit) :
+	firstTextureUnit(firstTextureUnit)
+{
+	gBuffer = GpuResource(GPU_RESOURCE_FRAMEBUFFER);
+
+	fullscreenShader = buildLightShader("LIGHT_VOLUME_FULLSCREEN");
+	fullscreenShadowShader = buildLightShader("LIGHT_VOLUME_FULLSCREEN", true);
+	pointLightShader = buildLightShader("LIGHT_VOLUME_POINT");
+	spotLightShader = buildLightShader("LIGHT_VOLUME_SPOT");
+
+	fullscreenInverseProjectionHandle = fullscreenShader.getUniformHandle("inverseProjection");
+	fullscreenShadowInverseProjectionHandle = fullscreenShadowShader.getUniformHandle("inverseProjection");
+	pointLightViewHandle = pointLightShader.getUniformHandle("view");
+	pointLightProjectionHandle = pointLightShader.getUniformHandle("projection");
+	pointLightInverseProjectionHandle = pointLightShader.getUniformHandle("inverseProjection");
+	spotLightModelHandle = spotLightShader.getUniformHandle("volumeModel");
+	spotLightProjectionHandle = spotLightShader.getUniformHandle("projection");
+	spotLightInverseProjectionHandle = spotLightShader.getUniformHandle("inverseProjection");
+
+	// The fullscreen triangle is generated from vertex indices, but drawing still needs a vertex array bound
+	fullscreenVAO = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+
+	vector<vec3> vertices;
+	vector<GLuint> indices;
+	buildSphere(VOLUME_SLICES, VOLUME_STACKS, vertices, indices);
+	uploadVolume(sphereVAO, sphereVBO, sphereEBO, vertices, indices);
+	sphereIndexCount = (GLsizei)indices.size();
+
+	// Point lights of the instance (still bound from uploading the sphere)
+	pointLightInstanceBuffer = InstanceBuffer(sizeof(LightVolumeInstance));
+	pointLightInstanceBuffer.addVec4Attribute(INSTANCE_MODEL_LOCATION, offsetof(LightVolumeInstance, positionRadius));
+	pointLightInstanceBuffer.addVec3Attribute(INSTANCE_MODEL_LOCATION + 1, offsetof(LightVolumeInstance, ambient));
+	pointLightInstanceBuffer.addVec3Attribute(INSTANCE_MODEL_LOCATION + 2, offsetof(LightVolumeInstance, diffuse));
+	pointLightInstanceBuffer.addVec3Attribute(INSTANCE_MODEL_LOCATION + 3, offsetof(LightVolumeInstance, specular));
+	pointLightInstanceBuffer.addVec3Attribute(INSTANCE_MODEL_LOCATION + 4, offsetof(LightVolumeInstance, attenuation));
+
+	vertices.clear();
+	indices.clear();
+	buildCone(VOLUME_SLICES, vertices, indices);
+	uploadVolume(coneVAO, coneVBO, coneEBO, vertices, indices);
+	coneIndexCount = (GLsizei)indices.size();
+}
+
+
+void DeferredRenderer::setPointLights(const vector<ClusteredPointLight> &lights)
+{
+	pointLightInstances.clear();
+	pointLightInstances.reserve(lights.size());
+	pointLightCuller.clear();
+	pointLightCuller.reserve(lights.size());
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		// Lights too dim to ever reach the cut-off have no volume
+		float radius = LightClusters::getLightRadius(lights[i]);
+		if (radius <= 0.0f)
+		{
+			continue;
+		}
+
+		LightVolumeInstance instance;
+		instance.positionRadius = vec4(lights[i].position, radius);
+		instance.ambient = lights[i].ambient;
+		instance.diffuse = lights[i].diffuse;
+		instance.specular = lights[i].specular;
+		instance.attenuation = vec3(lights[i].constant, lights[i].linear, lights[i].quadratic);
+		pointLightInstances.push_back(instance);
+		pointLightCuller.addSphere(lights[i].position, radius);
+	}
+
+	// The volumes in view are uploaded by the next shading pass
+	culledViewProjection = mat4(0.0f);
+}
+
+
+void DeferredRenderer::setSpotLight(bool enabled, vec3 position, vec3 direction, float range, float outerCutOff)
+{
+	spotLightEnabled = enabled && range > 0.0f;
+
+	// Turn the cone's -z axis into the light direction and stretch it to the light's range and cut-off
+	vec3 forward = normalize(direction);
+	vec3 up = abs(forward.y) < 0.99f ? vec3(0.0f, 1.0f, 0.0f) : vec3(1.0f, 0.0f, 0.0f);
+	vec3 right = normalize(cross(forward, up));
+	up = cross(right, forward);
+
+	float baseRadius = range * tan(outerCutOff);
+	spotLightModel = mat4(vec4(right * baseRadius, 0.0f), vec4(up * baseRadius, 0.0f), vec4(-forward * range, 0.0f), vec4(position, 1.0f));
+}
+
+
+void DeferredRenderer::beginGeometryPass(int viewportWidth, int viewportHeight)
+{
+	targetFramebuffer = GlState::global().getFramebuffer();
+
+	if (viewportWidth != width || viewportHeight != height)
+	{
+		createGBuffer(viewportWidth, viewportHeight);
+	}
+	GlState::global().bindFramebuffer(gBuffer.get());
+
+	// Pixels nothing is drawn to are recognized by their depth and skipped while shading, so the colors don't need clearing
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+
+void DeferredRenderer::shade(const mat4 &view, const mat4 &projection, const CascadedShadowMaps *shadowMaps)
+{
+	mat4 inverseProjection = inverse(projection);
+
+	GlState::global().bindFramebuffer(targetFramebuffer);
+
+	GlState::global().bindTextureUnit(firstTextureUnit, GL_TEXTURE_2D, albedoTexture.get());
+	GlState::global().bindTextureUnit(firstTextureUnit + 1, GL_TEXTURE_2D, normalTexture.get());
+	GlState::global().bindTextureUnit(firstTextureUnit + 2, GL_TEXTURE_2D, specularTexture.get());
+	GlState::global().bindTextureUnit(firstTextureUnit + 3, GL_TEXTURE_2D, emissionTexture.get());
+	GlState::global().bindTextureUnit(firstTextureUnit + 4, GL_TEXTURE_2D, depthTexture.get());
+
+	//-----------------------------------
+	// Directional light and emission
+	//-----------------------------------
+
+	// Every covered pixel is written along with its depth from the G-buffer
+	GlState::global().depthFunc(GL_ALWAYS);
+
+	if (shadowMaps)
+	{
+		fullscreenShadowShader.use();
+		fullscreenShadowShader.setMat4f(fullscreenShadowInverseProjectionHandle, inverseProjection);
+		shadowMaps->bind(fullscreenShadowShader, view);
+	}
+	else
+	{
+		fullscreenShader.use();
+		fullscreenShader.setMat4f(fullscreenInverseProjectionHandle, inverseProjection);
+	}
+
+	GlState::global().bindVertexArray(fullscreenVAO.get());
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+
+	//--------------
+	// Light volumes
+	//--------------
+
+	// Volumes add their light to what's there. Only their back faces are drawn and only where they're behind the lit surface,
+	// which also works with the camera inside a volume, and depth clamping keeps back faces beyond the far plane
+	GlState::global().enable(GL_BLEND);
+	GlState::global().blendFunc(GL_ONE, GL_ONE);
+	GlState::global().depthMask(false);
+	GlState::global().depthFunc(GL_GEQUAL);
+	GlState::global().enable(GL_CULL_FACE);
+	GlState::global().cullFace(GL_FRONT);
+	GlState::global().enable(GL_DEPTH_CLAMP);
+
+	updateVisiblePointLights(projection * view);
+	GLsizei pointLightCount = pointLightInstanceBuffer.getInstanceCount();
+	if (pointLightCount > 0)
+	{
+		pointLightShader.use();
+		pointLightShader.setMat4f(pointLightViewHandle, view);
+		pointLightShader.setMat4f(pointLightProjectionHandle, projection);
+		pointLightShader.setMat4f(pointLightInverseProjectionHandle, inverseProjection);
+
+		GlState::global().bindVertexArray(sphereVAO.get());
+		glDrawElementsInstanced(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_INT, (void*)0, pointLightCount);
+	}
+
+	if (spotLightEnabled)
+	{
+		spotLightShader.use();
+		spotLightShader.setMat4f(spotLightModelHandle, spotLightModel);
+		spotLightShader.setMat4f(spotLightProjectionHandle, projection);
+		spotLightShader.setMat4f(spotLightInverseProjectionHandle, inverseProjection);
+
+		GlState::global().bindVertexArray(coneVAO.get());
+		glDrawElements(GL_TRIANGLES, coneIndexCount, GL_UNSIGNED_INT, (void*)0);
+	}
+
+	GlState::global().disable(GL_DEPTH_CLAMP);
+	GlState::global().cullFace(GL_BACK);
+	GlState::global().disable(GL_CULL_FACE);
+	GlState::global().depthFunc(GL_LESS);
+	GlState::global().depthMask(true);
+	GlState::global().disable(GL_BLEND);
+
+	frameStats.shadingPasses++;
+	frameStats.pointLightVolumes += pointLightCount;
+	frameStats.spotLightVolumes += spotLightEnabled ? 1 : 0;
+	frameStats.gBufferBytes += gBufferBytes;
+}
+
+
+void DeferredRenderer::updateVisiblePointLights(const mat4 &viewProjection)
+{
+	if (viewProjection == culledViewProjection && culledWithCulling == FrustumCuller::isEnabled())
+	{
+		return;
+	}
+	culledViewProjection = viewProjection;
+	culledWithCulling = FrustumCuller::isEnabled();
+
+	pointLightCuller.cull(Frustum(viewProjection), visiblePointLights);
+	visiblePointLightInstances.resize(visiblePointLights.size());
+	for (size_t i = 0; i < visiblePointLights.size(); i++)
+	{
+		visiblePointLightInstances[i] = pointLightInstances[visiblePointLights[i]];
+	}
+	pointLightInstanceBuffer.upload(visiblePointLightInstances.data(), (GLsizei)visiblePointLightInstances.size());
+}
+
+
+const DeferredShadingStats &DeferredRenderer::getFrameStats()
+{
+	return frameStats;
+}
+
+
+void DeferredRenderer::resetFrameStats()
+{
+	frameStats = DeferredShadingStats();
+}
+
+
+void DeferredRenderer::createGBuffer(int viewportWidth, int viewportHeight)
+{
+	width = viewportWidth;
+	height = viewportHeight;
+
+	// Normals need more precision than 8 bits to keep highlights smooth, and emission goes above 1 with the emission intensity
+	GlState::global().bindFramebuffer(gBuffer.get());
+	gBufferBytes = 0;
+	gBufferBytes += createTarget(albedoTexture, GL_COLOR_ATTACHMENT0, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height, 4);
+	gBufferBytes += createTarget(normalTexture, GL_COLOR_ATTACHMENT1, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, width, height, 8);
+	gBufferBytes += createTarget(specularTexture, GL_COLOR_ATTACHMENT2, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height, 4);
+	gBufferBytes += createTarget(emissionTexture, GL_COLOR_ATTACHMENT3, GL_R11F_G11F_B10F, GL_RGB, GL_FLOAT, width, height, 4);
+	gBufferBytes += createTarget(depthTexture, GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, width, height, 4);
+
+	const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+	glDrawBuffers(4, drawBuffers);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		cerr << "ERROR::DEFERRED_RENDERER::GBUFFER_INCOMPLETE" << endl;
+	}
+
+	cout << "DeferredRenderer: " << width << "x" << height << " G-buffer, " << gBufferBytes / (1024.0f * 1024.0f) << " MB" << endl;
+}
+
+
+size_t DeferredRenderer::createTarget(GpuResource &texture, GLenum attachment, GLint internalFormat, GLenum format, GLenum type,
+	int viewportWidth, int viewportHeight, size_t bytesPerPixel)
+{
+	// Replacing the texture detaches the old one, which is then deleted
+	texture = GpuResource(GPU_RESOURCE_TEXTURE);
+	GlState::global().bindTexture(GL_TEXTURE_2D, texture.get());
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, viewportWidth, viewportHeight, 0, format, type, NULL);
+
+	// Read with texelFetch, but without mipmaps the default filter would leave the texture incomplete
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	size_t bytes = (size_t)viewportWidth * viewportHeight * bytesPerPixel;
+	texture.setMemory(bytes);
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture.get(), 0);
+	return bytes;
+}
+
+
+Shader DeferredRenderer::buildLightShader(const char *lightVolume, bool shadows) const
+{
+	ShaderDefines defines;
+	defines["LIGHT_VOLUME"] = lightVolume;
+	defines["SHADOWS"] = shadows ? "1" : "0";
+	Shader shader("shaders/vert_lightSceneDeferredLight.vs", "shaders/frag_lightSceneDeferredLight.fs", defines);
+
+	shader.use();
+	shader.setInt("gAlbedo", firstTextureUnit);
+	shader.setInt("gNormal", firstTextureUnit + 1);
+	shader.setInt("gSpecular", firstTextureUnit + 2);
+	shader.setInt("gEmission", firstTextureUnit + 3);
+	shader.setInt("gDepth", firstTextureUnit + 4);
+	shader.bindUniformBlock("Lighting", LIGHTING_BINDING_POINT);
+	return shader;
+}
+
+
+void DeferredRenderer::uploadVolume(GpuResource &vao, GpuResource &vbo, GpuResource &ebo, const vector<vec3> &vertices, const vector<GLuint> &indices)
+{
+	vao = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+	GlState::global().bindVertexArray(vao.get());
+
+	vbo = GpuResource(GPU_RESOURCE_BUFFER);
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, vbo.get());
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vec3), vertices.data(), GL_STATIC_DRAW);
+	vbo.setMemory(vertices.size() * sizeof(vec3));
+
+	// The index buffer binding is part of the vertex array
+	ebo = GpuResource(GPU_RESOURCE_BUFFER);
+	GlState::global().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.get());
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	ebo.setMemory(indices.size() * sizeof(GLuint));
+
+	// aPos
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void*)0);
+	glEnableVertexAttribArray(0);
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "cascaded_shadow_maps.h"
+#include "frustum_culling.h"
+#include "gpu_resource.h"
+#include "instance_buffer.h"
+#include "light_clusters.h"
+#include "shader.h"
+
+
+// First of the five texture units the G-buffer is bound to while shading, above those used by the light clusters
+const GLuint GBUFFER_FIRST_TEXTURE_UNIT = 11;
+
+
+// Work done by all deferred renderers during the current frame
+struct DeferredShadingStats {
+	unsigned shadingPasses = 0;      // Times a G-buffer was shaded
+	unsigned pointLightVolumes = 0;  // Point light spheres drawn
+	unsigned spotLightVolumes = 0;   // Spotlight cones drawn
+	size_t gBufferBytes = 0;         // Memory of the G-buffers shaded
+};
+
+
+// Deferred shading of lit objects: they're drawn once into a G-buffer (albedo, view space normal and shininess, specular color,
+// emission and depth, from which positions are reconstructed), and lights are then drawn as volumes that shade the pixels they cover
+// The directional light and emission are a fullscreen pass, point lights are instanced spheres as large as their reach
+// (see LightClusters::getLightRadius) and the spotlight is a cone, so shading costs grow with the pixels each light covers
+// instead of with every fragment drawn times every light. Only the point lights whose spheres reach into the view frustum are drawn
+// Lit objects write the G-buffer with frag_lightSceneGBuffer.fs (see LitObjectFeatures::getMaterialDefines), the light
+// properties other than the point lights come from the lighting buffer, which has to be updated before shading
+// NOTE: Like OpenGL itself, the deferred renderer may only be used on the main thread
+class DeferredRenderer
+{
+public:
+	// Constructor to build the light shaders and volumes, the G-buffer is bound to five texture units starting at the given one
+	// The G-buffer itself is created by the first geometry pass, at the size of the viewport
+	explicit DeferredRenderer(GLuint firstTextureUnit);
+
+	// Default constructor
+	DeferredRenderer() = default;
+
+	// Replace the point lights, given in world space
+	void setPointLights(const std::vector<ClusteredPointLight> &lights);
+
+	// Set the spotlight volume, in view space like the spotlight in the lighting buffer
+	// Range is how far the light reaches (see LightClusters::getLightRadius) and the outer cut-off is an angle in radians
+	void setSpotLight(bool enabled, glm::vec3 position, glm::vec3 direction, float range, float outerCutOff);
+
+	// Bind the G-buffer for drawing lit objects into it, (re)creating it if the viewport size changed
+	void beginGeometryPass(int viewportWidth, int viewportHeight);
+
+	// Shade the G-buffer into the framebuffer that was bound before the geometry pass, which has to be cleared to the background
+	// Afterwards that framebuffer also holds the depth of the lit objects, so forward rendered objects can follow
+	// The directional light is shadowed if shadow maps are given
+	void shade(const glm::mat4 &view, const glm::mat4 &projection, const CascadedShadowMaps *shadowMaps = nullptr);
+
+	// Work done during the current frame
+	static const DeferredShadingStats &getFrameStats();
+
+	// Reset the work counts, should be called at the start of every frame
+	static void resetFrameStats();
+
+
+private:
+	// G-buffer: albedo, normal and shininess, specular color, emission and depth textures attached to one framebuffer
+	GpuResource gBuffer;
+	GpuResource albedoTexture;
+	GpuResource normalTexture;
+	GpuResource specularTexture;
+	GpuResource emissionTexture;
+	GpuResource depthTexture;
+	int width = 0;
+	int height = 0;
+	size_t gBufferBytes = 0;
+	GLuint firstTextureUnit = 0;
+
+	// Framebuffer bound before the geometry pass, which the G-buffer is shaded into
+	GLuint targetFramebuffer = 0;
+
+	// Shaders of the fullscreen pass (directional light and emission, without and with shadows), the point light spheres and the spotlight cone
+	Shader fullscreenShader;
+	Shader fullscreenShadowShader;
+	Shader pointLightShader;
+	Shader spotLightShader;
+
+	// Light volumes, the sphere and cone meshes enclose the unit sphere and cone they approximate
+	GpuResource fullscreenVAO;
+	GpuResource sphereVAO;
+	GpuResource sphereVBO;
+	GpuResource sphereEBO;
+	GpuResource coneVAO;
+	GpuResource coneVBO;
+	GpuResource coneEBO;
+	GLsizei sphereIndexCount = 0;
+	GLsizei coneIndexCount = 0;
+
+	InstanceBuffer pointLightInstanceBuffer;
+
+	// Point light volumes and their spheres, of which those in the view frustum are uploaded whenever the view changes
+	std::vector<LightVolumeInstance> pointLightInstances;
+	std::vector<LightVolumeInstance> visiblePointLightInstances;
+	std::vector<uint32_t> visiblePointLights;
+	FrustumCuller pointLightCuller;
+	glm::mat4 culledViewProjection = glm::mat4(0.0f);  // View the uploaded lights were culled for, zero to cull again on the next shading pass
+	bool culledWithCulling = false;  // Whether culling was enabled back then
+
+	// Spotlight volume
+	bool spotLightEnabled = false;
+	glm::mat4 spotLightModel = glm::mat4(1.0f);
+
+	// Uniform handles, retrieved once after the shaders are built
+	UniformHandle fullscreenInverseProjectionHandle = -1, fullscreenShadowInverseProjectionHandle = -1;
+	UniformHandle pointLightViewHandle = -1, pointLightProjectionHandle = -1, pointLightInverseProjectionHandle = -1;
+	UniformHandle spotLightModelHandle = -1, spotLightProjectionHandle = -1, spotLightInverseProjectionHandle = -1;
+
+	// Work of the current frame
+	static DeferredShadingStats frameStats;
+
+	// Create the G-buffer textures at the given size and attach them
+	void createGBuffer(int viewportWidth, int viewportHeight);
+
+	// Create a texture of the G-buffer and attach it to the bound framebuffer, returns its size in bytes
+	static size_t createTarget(GpuResource &texture, GLenum attachment, GLint internalFormat, GLenum format, GLenum type,
+		int viewportWidth, int viewportHeight, size_t bytesPerPixel);
+
+	// Upload the point light volumes inside the view frustum, skipped if neither the view nor the lights changed
+	void updateVisiblePointLights(const glm::mat4 &viewProjection);
+
+	// Build a light shader permutation, binding its G-buffer samplers and the lighting block
+	Shader buildLightShader(const char *lightVolume, bool shadows = false) const;
+
+	// Upload an indexed light volume mesh into a new vertex array with positions at location 0
+	static void uploadVolume(GpuResource &vao, GpuResource &vbo, GpuResource &ebo, const std::vector<glm::vec3> &vertices, const std::vector<GLuint> &indices);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include "frustum_culling.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+// AVX has to be enabled explicitly (/arch:AVX, the x64 configurations of the project build with /arch:AVX2), SSE2 is part of every x64 target
+// and enabled by default for 32 bit ones by current compilers
+#if defined(__AVX__)
+#define FRUSTUM_CULLING_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLING_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+
+// Objects the arrays are padded to a multiple of, the widest batch tested at once
+static const size_t CULLING_BATCH_SIZE = 8;
+
+
+FrustumCullingStats FrustumCuller::frameStats;
+bool FrustumCuller::enabled = true;
+
+
+void FrustumCuller::clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+	radius.clear();
+	count = 0;
+}
+
+
+void FrustumCuller::reserve(size_t objectCount)
+{
+	size_t padded = (objectCount + CULLING_BATCH_SIZE - 1) / CULLING_BATCH_SIZE * CULLING_BATCH_SIZE;
+	for (vector<float> *values : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ, &radius })
+	{
+		values->reserve(padded);
+	}
+}
+
+
+void FrustumCuller::add(const Bounds &box, const BoundingSphere &sphere, const mat4 &modelMatrix)
+{
+	// The transformed box is enclosed by a box around its transformed center, whose half extents are those of the original
+	// projected onto the world axes through the absolute values of the matrix
+	vec3 boxCenter = (box.min + box.max) * 0.5f;
+	vec3 halfExtent = (box.max - box.min) * 0.5f;
+	mat3 absoluteMatrix = mat3(abs(vec3(modelMatrix[0])), abs(vec3(modelMatrix[1])), abs(vec3(modelMatrix[2])));
+
+	// The sphere is scaled by the largest scale of the matrix, and grown to be centered on the box if it isn't already
+	float modelScale = sqrt(std::max(dot(vec3(modelMatrix[0]), vec3(modelMatrix[0])),
+		std::max(dot(vec3(modelMatrix[1]), vec3(modelMatrix[1])), dot(vec3(modelMatrix[2]), vec3(modelMatrix[2])))));
+	float sphereRadius = (sphere.radius + length(sphere.center - boxCenter)) * modelScale;
+
+	push(vec3(modelMatrix * vec4(boxCenter, 1.0f)), absoluteMatrix * halfExtent, sphereRadius);
+}
+
+
+void FrustumCuller::addSphere(const vec3 &center, float radius)
+{
+	push(center, vec3(radius), radius);
+}
+
+
+size_t FrustumCuller::size() const
+{
+	return count;
+}
+
+
+void FrustumCuller::cull(const Frustum &frustum, vector<uint32_t> &visible) const
+{
+	visible.clear();
+	frameStats.tested += count;
+	if (!enabled)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			visible.push_back((uint32_t)i);
+		}
+		return;
+	}
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+	// The distance of a box center from a plane is compared against how far the box reaches towards the plane, which is its half
+	// extents projected onto the absolute plane normal, or the sphere radius if that's less
+#if defined(FRUSTUM_CULLING_AVX)
+	__m256 normalX[6], normalY[6], normalZ[6], distance[6], absoluteX[6], absoluteY[6], absoluteZ[6];
+	for (int plane = 0; plane < 6; plane++)
+	{
+		const vec4 &p = frustum.planes[plane];
+		normalX[plane] = _mm256_set1_ps(p.x);
+		normalY[plane] = _mm256_set1_ps(p.y);
+		normalZ[plane] = _mm256_set1_ps(p.z);
+		distance[plane] = _mm256_set1_ps(p.w);
+		absoluteX[plane] = _mm256_set1_ps(fabs(p.x));
+		absoluteY[plane] = _mm256_set1_ps(fabs(p.y));
+		absoluteZ[plane] = _mm256_set1_ps(fabs(p.z));
+	}
+	const __m256 zero = _mm256_setzero_ps();
+
+	// Eight objects at a time, padding has a negative radius so it's always outside
+	for (size_t i = 0; i < count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(&centerX[i]);
+		__m256 y = _mm256_loadu_ps(&centerY[i]);
+		__m256 z = _mm256_loadu_ps(&centerZ[i]);
+		__m256 ex = _mm256_loadu_ps(&extentX[i]);
+		__m256 ey = _mm256_loadu_ps(&extentY[i]);
+		__m256 ez = _mm256_loadu_ps(&extentZ[i]);
+		__m256 r = _mm256_loadu_ps(&radius[i]);
+
+		int outside = 0;
+		for (int plane = 0; plane < 6 && outside != 0xFF; plane++)
+		{
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(normalX[plane], x), _mm256_mul_ps(normalY[plane], y)),
+				_mm256_add_ps(_mm256_mul_ps(normalZ[plane], z), distance[plane]));
+			__m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absoluteX[plane], ex), _mm256_mul_ps(absoluteY[plane], ey)),
+				_mm256_mul_ps(absoluteZ[plane], ez));
+			reach = _mm256_min_ps(reach, r);
+			outside |= _mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(d, reach), zero, _CMP_LT_OQ));
+		}
+
+		for (size_t lane = 0, inside = ~outside & 0xFF; inside != 0; lane++, inside >>= 1)
+		{
+			if (inside & 1)
+			{
+				visible.push_back((uint32_t)(i + lane));
+			}
+		}
+	}
+#elif defined(FRUSTUM_CULLING_SSE2)
+	__m128 normalX[6], normalY[6], normalZ[6], distance[6], absoluteX[6], absoluteY[6], absoluteZ[6];
+	for (int plane = 0; plane < 6; plane++)
+	{
+		const vec4 &p = frustum.planes[plane];
+		normalX[plane] = _mm_set1_ps(p.x);
+		normalY[plane] = _mm_set1_ps(p.y);
+		normalZ[plane] = _mm_set1_ps(p.z);
+		distance[plane] = _mm_set1_ps(p.w);
+		absoluteX[plane] = _mm_set1_ps(fabs(p.x));
+		absoluteY[plane] = _mm_set1_ps(fabs(p.y));
+		absoluteZ[plane] = _mm_set1_ps(fabs(p.z));
+	}
+	const __m128 zero = _mm_setzero_ps();
+
+	// Four objects at a time, padding has a negative radius so it's always outside
+	for (size_t i = 0; i < count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&centerX[i]);
+		__m128 y = _mm_loadu_ps(&centerY[i]);
+		__m128 z = _mm_loadu_ps(&centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&extentX[i]);
+		__m128 ey = _mm_loadu_ps(&extentY[i]);
+		__m128 ez = _mm_loadu_ps(&extentZ[i]);
+		__m128 r = _mm_loadu_ps(&radius[i]);
+
+		int outside = 0;
+		for (int plane = 0; plane < 6 && outside != 0xF; plane++)
+		{
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX[plane], x), _mm_mul_ps(normalY[plane], y)),
+				_mm_add_ps(_mm_mul_ps(normalZ[plane], z), distance[plane]));
+			__m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absoluteX[plane], ex), _mm_mul_ps(absoluteY[plane], ey)),
+				_mm_mul_ps(absoluteZ[plane], ez));
+			reach = _mm_min_ps(reach, r);
+			outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d, reach), zero));
+		}
+
+		for (size_t lane = 0, inside = ~outside & 0xF; inside != 0; lane++, inside >>= 1)
+		{
+			if (inside & 1)
+			{
+				visible.push_back((uint32_t)(i + lane));
+			}
+		}
+	}
+#else
+	for (size_t i = 0; i < count; i++)
+	{
+		bool outside = false;
+		for (int plane = 0; plane < 6 && !outside; plane++)
+		{
+			const vec4 &p = frustum.planes[plane];
+			float d = p.x * centerX[i] + p.y * centerY[i] + p.z * centerZ[i] + p.w;
+			float reach = std::min(fabs(p.x) * extentX[i] + fabs(p.y) * extentY[i] + fabs(p.z) * extentZ[i], radius[i]);
+			outside = d + reach < 0.0f;
+		}
+
+		if (!outside)
+		{
+			visible.push_back((uint32_t)i);
+		}
+	}
+#endif
+
+	frameStats.culled += count - visible.size();
+	frameStats.cullTimeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+}
+
+
+void FrustumCuller::setEnabled(bool enabled)
+{
+	FrustumCuller::enabled = enabled;
+}
+
+
+bool FrustumCuller::isEnabled()
+{
+	return enabled;
+}
+
+
+const FrustumCullingStats &FrustumCuller::getFrameStats()
+{
+	return frameStats;
+}
+
+
+void FrustumCuller::resetFrameStats()
+{
+	frameStats = FrustumCullingStats();
+}
+
+
+void FrustumCuller::push(const vec3 &center, const vec3 &extent, float radius)
+{
+	// Grow the arrays by a whole batch of padding at a time, then overwrite the next padding entry
+	if (count == centerX.size())
+	{
+		size_t padded = count + CULLING_BATCH_SIZE;
+		centerX.resize(padded, 0.0f);
+		centerY.resize(padded, 0.0f);
+		centerZ.resize(padded, 0.0f);
+		extentX.resize(padded, 0.0f);
+		extentY.resize(padded, 0.0f);
+		extentZ.resize(padded, 0.0f);
+		this->radius.resize(padded, -FLT_MAX);
+	}
+
+	centerX[count] = center.x;
+	centerY[count] = center.y;
+	centerZ[count] = center.z;
+	extentX[count] = extent.x;
+	extentY[count] = extent.y;
+	extentZ[count] = extent.z;
+	this->radius[count] = radius;
+	count++;
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "camera.h"
+#include "mesh.h"
+
+
+// Objects tested by all frustum cullers during the current frame
+struct FrustumCullingStats {
+	size_t tested = 0;        // Objects tested against a frustum (all objects given to a culler while culling is disabled)
+	size_t culled = 0;        // Objects found to be outside, which aren't drawn
+	double cullTimeMs = 0.0;  // Time spent testing
+};
+
+
+// Culls objects outside a view frustum in batches: the world space bounds of every object, a box and a sphere around the same center,
+// are stored as separate arrays so eight objects are tested at once with AVX, or four with SSE where AVX isn't enabled
+// An object is culled if its box or its sphere lies entirely behind one of the planes, which is conservative: objects just outside
+// a corner of the frustum may be kept, but nothing visible is ever culled
+class FrustumCuller
+{
+public:
+	// Remove all objects, keeping the memory of the arrays
+	void clear();
+
+	// Reserve memory for an amount of objects
+	void reserve(size_t objectCount);
+
+	// Add an object by its object space bounds and the model matrix placing it in the world, objects are numbered in the order they're added
+	void add(const Bounds &box, const BoundingSphere &sphere, const glm::mat4 &modelMatrix);
+
+	// Add an object by a world space sphere
+	void addSphere(const glm::vec3 &center, float radius);
+
+	// Amount of objects
+	size_t size() const;
+
+	// Fill visible with the numbers of the objects at least partly inside a frustum, in ascending order
+	// While culling is disabled every object is visible
+	void cull(const Frustum &frustum, std::vector<uint32_t> &visible) const;
+
+	// Whether objects are culled at all (on by default), turning it off allows measuring what culling saves
+	static void setEnabled(bool enabled);
+	static bool isEnabled();
+
+	// Objects tested during the current frame
+	static const FrustumCullingStats &getFrameStats();
+
+	// Reset the counts, should be called at the start of every frame
+	static void resetFrameStats();
+
+
+private:
+	// World space box centers and half extents and sphere radii, padded to a multiple of eight with empty bounds
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<float> radius;
+	size_t count = 0;
+
+	// Objects tested during the current frame
+	static FrustumCullingStats frameStats;
+
+	// Whether objects are culled
+	static bool enabled;
+
+	// Append the world space bounds of an object
+	void push(const glm::vec3 &center, const glm::vec3 &extent, float radius);
+};
+
+#endif
\ No newline at end of file
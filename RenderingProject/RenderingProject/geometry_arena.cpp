@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <cstring>
+#include "geometry_arena.h"
+#include "gl_state.h"
+
+using namespace std;
+
+
+// Size of a regular block, meshes that don't fit get a block of their own
+static const GLuint BLOCK_VERTEX_CAPACITY = 1 << 20;
+static const GLuint BLOCK_INDEX_CAPACITY = 1 << 22;
+
+
+// Whether a range allocator has enough free space scattered over multiple ranges to be worth compacting
+static bool isFragmented(const RangeAllocator &ranges)
+{
+	return ranges.getFreeRangeCount() > 1 && ranges.getFreeSize() >= ranges.getSize() / 4;
+}
+
+
+//---------------
+// RangeAllocator
+//---------------
+
+RangeAllocator::RangeAllocator(GLuint size) :
+	size(size),
+	freeSize(0)
+{
+	insertFreeRange(0, size);
+}
+
+
+bool RangeAllocator::allocate(GLuint size, GLuint &offset)
+{
+	if (size == 0)
+	{
+		offset = 0;
+		return true;
+	}
+
+	// Smallest free range that fits, the rest of it stays free
+	multimap<GLuint, GLuint>::iterator bestFit = freeBySize.lower_bound(size);
+	if (bestFit == freeBySize.end())
+	{
+		return false;
+	}
+
+	offset = bestFit->second;
+	GLuint rangeSize = bestFit->first;
+	eraseFreeRange(freeByOffset.find(offset));
+	insertFreeRange(offset + size, rangeSize - size);
+	return true;
+}
+
+
+void RangeAllocator::free(GLuint offset, GLuint size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	// Merge with the free range right after it
+	map<GLuint, GLuint>::iterator next = freeByOffset.find(offset + size);
+	if (next != freeByOffset.end())
+	{
+		size += next->second;
+		eraseFreeRange(next);
+	}
+
+	// Merge with the free range right before it
+	map<GLuint, GLuint>::iterator previous = freeByOffset.lower_bound(offset);
+	if (previous != freeByOffset.begin())
+	{
+		--previous;
+		if (previous->first + previous->second == offset)
+		{
+			offset = previous->first;
+			size += previous->second;
+			eraseFreeRange(previous);
+		}
+	}
+
+	insertFreeRange(offset, size);
+}
+
+
+GLuint RangeAllocator::getSize() const
+{
+	return size;
+}
+
+
+GLuint RangeAllocator::getFreeSize() const
+{
+	return freeSize;
+}
+
+
+size_t RangeAllocator::getFreeRangeCount() const
+{
+	return freeByOffset.size();
+}
+
+
+void RangeAllocator::insertFreeRange(GLuint offset, GLuint size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	freeByOffset[offset] = size;
+	freeBySize.insert(make_pair(size, offset));
+	freeSize += size;
+}
+
+
+void RangeAllocator::eraseFreeRange(map<GLuint, GLuint>::iterator it)
+{
+	pair<multimap<GLuint, GLuint>::iterator, multimap<GLuint, GLuint>::iterator> sameSize = freeBySize.equal_range(it->second);
+	for (multimap<GLuint, GLuint>::iterator bySize = sameSize.first; bySize != sameSize.second; ++bySize)
+	{
+		if (bySize->second == it->first)
+		{
+			freeBySize.erase(bySize);
+			break;
+		}
+	}
+
+	freeSize -= it->second;
+	freeByOffset.erase(it);
+}
+
+
+//-------------------
+// GeometryAllocation
+//-------------------
+
+GeometryAllocation::~GeometryAllocation()
+{
+	reset();
+}
+
+
+GeometryAllocation::GeometryAllocation(GeometryAllocation &&other) noexcept :
+	arena(other.arena),
+	slot(other.slot)
+{
+	other.arena = nullptr;
+}
+
+
+GeometryAllocation &GeometryAllocation::operator=(GeometryAllocation &&other) noexcept
+{
+	if (this != &other)
+	{
+		reset();
+		arena = other.arena;
+		slot = other.slot;
+		other.arena = nullptr;
+	}
+	return *this;
+}
+
+
+GLuint GeometryAllocation::getVertexArray() const
+{
+	return arena ? arena->slots[slot].block->VAO.get() : 0;
+}
+
+
+GLuint GeometryAllocation::getPositionVertexArray() const
+{
+	return arena ? arena->slots[slot].block->positionVAO.get() : 0;
+}
+
+
+GLint GeometryAllocation::getBaseVertex() const
+{
+	return arena ? (GLint)arena->slots[slot].firstVertex : 0;
+}
+
+
+GLuint GeometryAllocation::getFirstIndex() const
+{
+	return arena ? arena->slots[slot].firstIndex : 0;
+}
+
+
+void GeometryAllocation::reset()
+{
+	if (arena)
+	{
+		arena->free(slot);
+		arena = nullptr;
+	}
+}
+
+
+//--------------
+// GeometryArena
+//--------------
+
+GeometryArena::GeometryArena(VertexFormat format) :
+	format(format)
+{
+}
+
+
+GeometryAllocation GeometryArena::allocate(size_t vertexCount, size_t indexCount)
+{
+	Slot slot;
+	slot.block = nullptr;
+	slot.vertexCount = (GLuint)vertexCount;
+	slot.indexCount = (GLuint)indexCount;
+
+	// First block with room for both the vertices and the indices
+	for (size_t i = 0; i < blocks.size() && !slot.block; i++)
+	{
+		Block &block = *blocks[i];
+		if (!block.vertexRanges.allocate(slot.vertexCount, slot.firstVertex))
+		{
+			continue;
+		}
+		if (!block.indexRanges.allocate(slot.indexCount, slot.firstIndex))
+		{
+			block.vertexRanges.free(slot.firstVertex, slot.vertexCount);
+			continue;
+		}
+		slot.block = &block;
+	}
+
+	if (!slot.block)
+	{
+		slot.block = createBlock(std::max(BLOCK_VERTEX_CAPACITY, slot.vertexCount), std::max(BLOCK_INDEX_CAPACITY, slot.indexCount));
+		slot.block->vertexRanges.allocate(slot.vertexCount, slot.firstVertex);
+		slot.block->indexRanges.allocate(slot.indexCount, slot.firstIndex);
+	}
+	slot.block->allocationCount++;
+
+	GeometryAllocation allocation;
+	allocation.arena = this;
+	if (freeSlots.empty())
+	{
+		allocation.slot = (uint32_t)slots.size();
+		slots.push_back(slot);
+	}
+	else
+	{
+		allocation.slot = freeSlots.back();
+		freeSlots.pop_back();
+		slots[allocation.slot] = slot;
+	}
+	return allocation;
+}
+
+
+void GeometryArena::upload(const GeometryAllocation &allocation, const void *vertices, const GLuint *indices)
+{
+	const Slot &slot = slots[allocation.slot];
+	size_t vertexSize = getVertexSize(format);
+
+	// The copy targets leave the element array binding of whatever vertex array is bound alone
+	GlState::global().bindBuffer(GL_COPY_WRITE_BUFFER, slot.block->VBO.get());
+	glBufferSubData(GL_COPY_WRITE_BUFFER, slot.firstVertex * vertexSize, slot.vertexCount * vertexSize, vertices);
+
+	GlState::global().bindBuffer(GL_COPY_WRITE_BUFFER, slot.block->EBO.get());
+	glBufferSubData(GL_COPY_WRITE_BUFFER, slot.firstIndex * sizeof(GLuint), slot.indexCount * sizeof(GLuint), indices);
+
+	// Positions come first in every vertex format, so the position stream is the start of every vertex
+	size_t positionSize = getPositionSize(format);
+	positionScratch.resize(slot.vertexCount * positionSize);
+	for (GLuint i = 0; i < slot.vertexCount; i++)
+	{
+		memcpy(&positionScratch[i * positionSize], (const uint8_t *)vertices + i * vertexSize, positionSize);
+	}
+	GlState::global().bindBuffer(GL_COPY_WRITE_BUFFER, slot.block->positionVBO.get());
+	glBufferSubData(GL_COPY_WRITE_BUFFER, slot.firstVertex * positionSize, slot.vertexCount * positionSize, positionScratch.data());
+}
+
+
+void GeometryArena::compact()
+{
+	if (!freedSinceCompaction)
+	{
+		return;
+	}
+	freedSinceCompaction = false;
+
+	for (size_t i = 0; i < blocks.size();)
+	{
+		Block &block = *blocks[i];
+		if (block.allocationCount == 0)
+		{
+			blocks.erase(blocks.begin() + i);
+			continue;
+		}
+
+		if (isFragmented(block.vertexRanges) || isFragmented(block.indexRanges))
+		{
+			compactBlock(block);
+			compactions++;
+		}
+		i++;
+	}
+}
+
+
+GeometryArenaStats GeometryArena::getStats() const
+{
+	size_t vertexSize = getVertexSize(format);
+	size_t positionSize = getPositionSize(format);
+
+	GeometryArenaStats stats;
+	stats.blockCount = blocks.size();
+	stats.compactions = compactions;
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		const Block &block = *blocks[i];
+		stats.allocationCount += block.allocationCount;
+		stats.vertexBytes += (block.vertexRanges.getSize() - block.vertexRanges.getFreeSize()) * vertexSize;
+		stats.vertexCapacityBytes += block.vertexRanges.getSize() * vertexSize;
+		stats.positionBytes += (block.vertexRanges.getSize() - block.vertexRanges.getFreeSize()) * positionSize;
+		stats.positionCapacityBytes += block.vertexRanges.getSize() * positionSize;
+		stats.indexBytes += (block.indexRanges.getSize() - block.indexRanges.getFreeSize()) * sizeof(GLuint);
+		stats.indexCapacityBytes += block.indexRanges.getSize() * sizeof(GLuint);
+	}
+	return stats;
+}
+
+
+GeometryArena &GeometryArena::global(VertexFormat format)
+{
+	static GeometryArena floatArena(VERTEX_FORMAT_FLOAT);
+	static GeometryArena packedArena(VERTEX_FORMAT_PACKED);
+	return format == VERTEX_FORMAT_PACKED ? packedArena : floatArena;
+}
+
+
+void GeometryArena::compactAll()
+{
+	for (int format = 0; format < VERTEX_FORMAT_COUNT; format++)
+	{
+		global((VertexFormat)format).compact();
+	}
+}
+
+
+GeometryArena::Block *GeometryArena::createBlock(GLuint vertexCapacity, GLuint indexCapacity)
+{
+	unique_ptr<Block> block(new Block());
+	block->vertexRanges = RangeAllocator(vertexCapacity);
+	block->indexRanges = RangeAllocator(indexCapacity);
+	setupBlockBuffers(*block);
+
+	blocks.push_back(std::move(block));
+	return blocks.back().get();
+}
+
+
+void GeometryArena::setupBlockBuffers(Block &block)
+{
+	// Blocks are shared by every model, so they get an owner of their own rather than the scene that happened to create them
+	GpuMemoryScope scope("GeometryArena");
+
+	if (block.VAO.get() == 0)
+	{
+		block.VAO = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+		block.positionVAO = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+	}
+	block.VBO = GpuResource(GPU_RESOURCE_BUFFER);
+	block.EBO = GpuResource(GPU_RESOURCE_BUFFER);
+	block.positionVBO = GpuResource(GPU_RESOURCE_BUFFER);
+
+	size_t vertexBytes = block.vertexRanges.getSize() * getVertexSize(format);
+	size_t indexBytes = block.indexRanges.getSize() * sizeof(GLuint);
+	size_t positionBytes = block.vertexRanges.getSize() * getPositionSize(format);
+
+	GlState::global().bindVertexArray(block.VAO.get());
+
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, block.VBO.get());
+	glBufferData(GL_ARRAY_BUFFER, vertexBytes, NULL, GL_STATIC_DRAW);
+	block.VBO.setMemory(vertexBytes);
+
+	GlState::global().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, block.EBO.get());
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
+	block.EBO.setMemory(indexBytes);
+
+	setupVertexAttributes(format);
+
+	// The position vertex array shares the index buffer
+	GlState::global().bindVertexArray(block.positionVAO.get());
+
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, block.positionVBO.get());
+	glBufferData(GL_ARRAY_BUFFER, positionBytes, NULL, GL_STATIC_DRAW);
+	block.positionVBO.setMemory(positionBytes);
+
+	GlState::global().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, block.EBO.get());
+	setupPositionAttributes(format);
+}
+
+
+void GeometryArena::compactBlock(Block &block)
+{
+	// Copying within a buffer can't handle overlapping ranges, so the allocations are copied into new buffers instead
+	GpuResource oldVBO = std::move(block.VBO);
+	GpuResource oldEBO = std::move(block.EBO);
+	GpuResource oldPositionVBO = std::move(block.positionVBO);
+	block.vertexRanges = RangeAllocator(block.vertexRanges.getSize());
+	block.indexRanges = RangeAllocator(block.indexRanges.getSize());
+	setupBlockBuffers(block);
+
+	// The new allocators have a single free range, so allocating in order packs the ranges together
+	size_t vertexSize = getVertexSize(format);
+	size_t positionSize = getPositionSize(format);
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		Slot &slot = slots[i];
+		if (slot.block != &block)
+		{
+			continue;
+		}
+
+		GLuint firstVertex, firstIndex;
+		block.vertexRanges.allocate(slot.vertexCount, firstVertex);
+		block.indexRanges.allocate(slot.indexCount, firstIndex);
+
+		GlState::global().bindBuffer(GL_COPY_READ_BUFFER, oldVBO.get());
+		GlState::global().bindBuffer(GL_COPY_WRITE_BUFFER, block.VBO.get());
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, slot.firstVertex * vertexSize, firstVertex * vertexSize, slot.vertexCount * vertexSize);
+
+		GlState::global().bindBuffer(GL_COPY_READ_BUFFER, oldEBO.get());
+		GlState::global().bindBuffer(GL_COPY_WRITE_BUFFER, block.EBO.get());
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, slot.firstIndex * sizeof(GLuint), firstIndex * sizeof(GLuint), slot.indexCount * sizeof(GLuint));
+
+		GlState::global().bindBuffer(GL_COPY_READ_BUFFER, oldPositionVBO.get());
+		GlState::global().bindBuffer(GL_COPY_WRITE_BUFFER, block.positionVBO.get());
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, slot.firstVertex * positionSize, firstVertex * positionSize, slot.vertexCount * positionSize);
+
+		slot.firstVertex = firstVertex;
+		slot.firstIndex = firstIndex;
+	}
+}
+
+
+void GeometryArena::free(uint32_t slotIndex)
+{
+	Slot &slot = slots[slotIndex];
+	slot.block->vertexRanges.free(slot.firstVertex, slot.vertexCount);
+	slot.block->indexRanges.free(slot.firstIndex, slot.indexCount);
+	slot.block->allocationCount--;
+	slot.block = nullptr;
+
+	freeSlots.push_back(slotIndex);
+	freedSinceCompaction = true;
+}
\ No newline at end of file
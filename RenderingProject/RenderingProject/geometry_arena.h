@@ -0,0 +1,189 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+#include "gpu_resource.h"
+#include "vertex.h"
+
+
+// Free-list allocator handing out ranges of a fixed size space, e.g. the elements of a buffer
+// Allocations take the smallest free range they fit in, freed ranges are merged with their free neighbours
+class RangeAllocator
+{
+public:
+	// Constructor, the whole space starts out free
+	explicit RangeAllocator(GLuint size = 0);
+
+	// Allocate a range, returns false if no free range is large enough
+	bool allocate(GLuint size, GLuint &offset);
+
+	// Free a range returned by allocate
+	void free(GLuint offset, GLuint size);
+
+	// Size of the whole space
+	GLuint getSize() const;
+
+	// Amount of space not allocated
+	GLuint getFreeSize() const;
+
+	// Amount of separate free ranges, more than one means the space is fragmented
+	size_t getFreeRangeCount() const;
+
+
+private:
+	GLuint size;
+	GLuint freeSize;
+
+	// Free ranges by offset (for merging neighbours) and by size (for finding the best fit), each mapping to the other
+	std::map<GLuint, GLuint> freeByOffset;
+	std::multimap<GLuint, GLuint> freeBySize;
+
+	// Add a free range to both maps
+	void insertFreeRange(GLuint offset, GLuint size);
+
+	// Remove a free range from both maps
+	void eraseFreeRange(std::map<GLuint, GLuint>::iterator it);
+};
+
+
+class GeometryArena;
+
+
+// Range of a geometry arena holding one mesh's vertices and indices, which is freed along with the handle
+// Compacting the arena can move the range, so the offsets should be read again before every draw
+class GeometryAllocation
+{
+public:
+	// Default constructor, holds nothing
+	GeometryAllocation() = default;
+
+	// Destructor frees the range
+	~GeometryAllocation();
+
+	// Every range has a single owner, so handles can be moved but not copied
+	GeometryAllocation(const GeometryAllocation &) = delete;
+	GeometryAllocation &operator=(const GeometryAllocation &) = delete;
+	GeometryAllocation(GeometryAllocation &&other) noexcept;
+	GeometryAllocation &operator=(GeometryAllocation &&other) noexcept;
+
+	// Vertex array to draw the range with, shared by every allocation in the same arena block
+	GLuint getVertexArray() const;
+
+	// Vertex array reading only the positions of the range (from the block's position stream) with the same indices and base vertex
+	GLuint getPositionVertexArray() const;
+
+	// Vertex the indices of the range are relative to, to be passed to glDrawElementsBaseVertex
+	GLint getBaseVertex() const;
+
+	// Offset of the first index of the range in the index buffer, in indices
+	GLuint getFirstIndex() const;
+
+	// Free the range now, leaving the handle empty
+	void reset();
+
+
+private:
+	friend class GeometryArena;
+
+	GeometryArena *arena = nullptr;
+	uint32_t slot = 0;
+};
+
+
+// Memory use of a geometry arena
+struct GeometryArenaStats {
+	size_t blockCount = 0;
+	size_t allocationCount = 0;
+	size_t vertexBytes = 0;          // Vertex buffer memory in use
+	size_t vertexCapacityBytes = 0;  // Vertex buffer memory allocated
+	size_t positionBytes = 0;        // Position stream memory in use
+	size_t positionCapacityBytes = 0;
+	size_t indexBytes = 0;
+	size_t indexCapacityBytes = 0;
+	size_t compactions = 0;          // Blocks compacted since the start of the program
+};
+
+
+// Large shared vertex and index buffers that the meshes of a vertex format are suballocated from, so drawing a mesh
+// doesn't need buffers (and a vertex array) of its own. Geometry lives in blocks of a fixed size, each with one vertex array,
+// new blocks are created as the existing ones fill up and meshes too large for a block get a block of their own
+// Every block also keeps a copy of the vertex positions in a buffer of their own, with a second vertex array reading just those
+// and the same indices, so depth-only passes fetch a fraction of the vertex data
+// NOTE: Like OpenGL itself, arenas may only be used on the main thread
+class GeometryArena
+{
+public:
+	// Constructor, creates no buffers until the first allocation
+	explicit GeometryArena(VertexFormat format);
+
+	// Arenas hand out pointers to themselves, so they can't be copied or moved
+	GeometryArena(const GeometryArena &) = delete;
+	GeometryArena &operator=(const GeometryArena &) = delete;
+
+	// Allocate room for a mesh, vertices are in the arena's vertex format
+	GeometryAllocation allocate(size_t vertexCount, size_t indexCount);
+
+	// Fill an allocation with its vertices and indices, the counts must match the allocation
+	// The positions are copied out of the vertices into the position stream
+	void upload(const GeometryAllocation &allocation, const void *vertices, const GLuint *indices);
+
+	// Move the allocations of fragmented blocks together and delete empty blocks, does nothing if nothing was freed since the last call
+	void compact();
+
+	// Memory use of the arena
+	GeometryArenaStats getStats() const;
+
+	// Arena shared by all meshes of a vertex format
+	static GeometryArena &global(VertexFormat format);
+
+	// Compact the global arenas of all vertex formats, should be called once per frame (e.g. to clean up after models are unloaded)
+	static void compactAll();
+
+
+private:
+	friend class GeometryAllocation;
+
+	// Vertex and index buffers with a vertex array reading from them, and the position stream with a vertex array reading it
+	struct Block {
+		GpuResource VAO, VBO, EBO;
+		GpuResource positionVAO, positionVBO;
+		RangeAllocator vertexRanges;
+		RangeAllocator indexRanges;
+		size_t allocationCount = 0;
+	};
+
+	// Allocated range, addressed through its index so the range can move without invalidating handles
+	struct Slot {
+		Block *block;
+		GLuint firstVertex, vertexCount;
+		GLuint firstIndex, indexCount;
+	};
+
+	VertexFormat format;
+	std::vector<std::unique_ptr<Block>> blocks;
+	std::vector<Slot> slots;
+	std::vector<uint32_t> freeSlots;
+	bool freedSinceCompaction = false;
+	size_t compactions = 0;
+
+	// Positions of the vertices being uploaded, kept to reuse its memory
+	std::vector<uint8_t> positionScratch;
+
+	// Create a block with room for at least the given amounts of vertices and indices
+	Block *createBlock(GLuint vertexCapacity, GLuint indexCapacity);
+
+	// Create the buffers of a block and set up its vertex array to read from them
+	void setupBlockBuffers(Block &block);
+
+	// Copy the allocations of a block into new buffers without gaps between them
+	void compactBlock(Block &block);
+
+	// Return an allocation's range to its block
+	void free(uint32_t slot);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include <cstring>
+#include <iostream>
+#include "gl_extensions.h"
+
+using namespace std;
+
+
+static GlExtensions extensions;
+
+
+// Whether the current context lists an extension
+static bool hasExtension(const char *name)
+{
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (GLint i = 0; i < extensionCount; i++)
+	{
+		if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void loadGlExtensions(GLADloadproc load)
+{
+	extensions = GlExtensions();
+
+	GLint majorVersion = 0, minorVersion = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+	glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
+	bool version41 = majorVersion > 4 || (majorVersion == 4 && minorVersion >= 1);
+	bool version43 = majorVersion > 4 || (majorVersion == 4 && minorVersion >= 3);
+
+	// Without base instances the draws of a multi-draw can't tell which per-draw data is theirs
+	if (version43 || (hasExtension("GL_ARB_multi_draw_indirect") && hasExtension("GL_ARB_base_instance")))
+	{
+		extensions.glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)load("glMultiDrawElementsIndirect");
+		extensions.multiDrawIndirect = extensions.glMultiDrawElementsIndirect != nullptr;
+	}
+
+	// Drivers may support the functions but offer no binary formats, which makes them useless
+	if (version41 || hasExtension("GL_ARB_get_program_binary"))
+	{
+		extensions.glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+		extensions.glProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+		extensions.glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+
+		GLint formatCount = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+		extensions.programBinary = extensions.glGetProgramBinary && extensions.glProgramBinary && extensions.glProgramParameteri && formatCount > 0;
+	}
+
+	cout << "OpenGL " << majorVersion << "." << minorVersion << ", multi-draw indirect " << (extensions.multiDrawIndirect ? "supported" : "not supported")
+		<< ", program binaries " << (extensions.programBinary ? "supported" : "not supported") << endl;
+}
+
+
+const GlExtensions &getGlExtensions()
+{
+	return extensions;
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+
+// Functionality beyond OpenGL 3.3, which glad was generated for, so it's detected and loaded at runtime
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+
+
+// Optional functionality the current context supports, with the entry points to use it
+struct GlExtensions {
+	// glMultiDrawElementsIndirect with base instances (OpenGL 4.3, or ARB_multi_draw_indirect with ARB_base_instance)
+	bool multiDrawIndirect = false;
+	PFNGLMULTIDRAWELEMENTSINDIRECTPROC glMultiDrawElementsIndirect = nullptr;
+
+	// Retrieving and loading linked programs as binaries (OpenGL 4.1 or ARB_get_program_binary), with at least one binary format
+	bool programBinary = false;
+	PFNGLGETPROGRAMBINARYPROC glGetProgramBinary = nullptr;
+	PFNGLPROGRAMBINARYPROC glProgramBinary = nullptr;
+	PFNGLPROGRAMPARAMETERIPROC glProgramParameteri = nullptr;
+};
+
+
+// Detect and load the optional functionality of the current context, should be called once after glad loaded OpenGL
+void loadGlExtensions(GLADloadproc load);
+
+// Optional functionality of the current context, all unsupported until loadGlExtensions is called
+const GlExtensions &getGlExtensions();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,409 @@
+#include "gl_extensions.h"
+#include "gl_state.h"
+
+using namespace std;
+
+
+// Tracked targets and capabilities, in table order
+static const GLenum TEXTURE_TARGETS[] = { GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BUFFER };
+static const GLenum BUFFER_TARGETS[] = { GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GL_TEXTURE_BUFFER, GL_DRAW_INDIRECT_BUFFER };
+static const GLenum CAPABILITIES[] = { GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_STENCIL_TEST, GL_POLYGON_OFFSET_FILL, GL_DEPTH_CLAMP };
+
+
+GlState::GlState() :
+	program(0),
+	vertexArray(0),
+	activeUnit(0),
+	framebuffer(0),
+	polygonModeValue(GL_FILL),
+	clearColorValue(0.0f),
+	depthFuncValue(GL_LESS),
+	depthMaskValue(true),
+	colorMaskValue(true),
+	blendSource(GL_ONE),
+	blendDestination(GL_ZERO),
+	cullFaceValue(GL_BACK),
+	polygonOffsetFactor(0.0f),
+	polygonOffsetUnits(0.0f)
+{
+	for (int unit = 0; unit < TRACKED_UNIT_COUNT; unit++)
+	{
+		for (int target = 0; target < TRACKED_TEXTURE_TARGET_COUNT; target++)
+		{
+			textures[unit][target] = 0;
+		}
+	}
+	for (int target = 0; target < TRACKED_BUFFER_TARGET_COUNT; target++)
+	{
+		buffers[target] = 0;
+	}
+	for (int capability = 0; capability < TRACKED_CAPABILITY_COUNT; capability++)
+	{
+		capabilities[capability] = false;
+	}
+}
+
+
+void GlState::useProgram(GLuint program)
+{
+	if (update(this->program, program))
+	{
+		glUseProgram(program);
+	}
+}
+
+
+void GlState::bindVertexArray(GLuint vertexArray)
+{
+	if (update(this->vertexArray, vertexArray))
+	{
+		glBindVertexArray(vertexArray);
+	}
+}
+
+
+void GlState::activeTexture(GLenum unit)
+{
+	if (update(activeUnit, unit - GL_TEXTURE0))
+	{
+		glActiveTexture(unit);
+	}
+}
+
+
+void GlState::bindTexture(GLenum target, GLuint texture)
+{
+	int targetIndex = getTextureTargetIndex(target);
+	if (targetIndex < 0 || activeUnit >= TRACKED_UNIT_COUNT)
+	{
+		frameStats.issued++;
+		glBindTexture(target, texture);
+		return;
+	}
+
+	if (update(textures[activeUnit][targetIndex], texture))
+	{
+		glBindTexture(target, texture);
+	}
+}
+
+
+void GlState::bindBuffer(GLenum target, GLuint buffer)
+{
+	// The element array binding belongs to the bound vertex array, so it's never cached
+	int targetIndex = getBufferTargetIndex(target);
+	if (targetIndex < 0)
+	{
+		frameStats.issued++;
+		glBindBuffer(target, buffer);
+		return;
+	}
+
+	if (update(buffers[targetIndex], buffer))
+	{
+		glBindBuffer(target, buffer);
+	}
+}
+
+
+void GlState::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	// Indexed bindings are set every time, but they also bind the buffer to the generic target
+	frameStats.issued++;
+	glBindBufferBase(target, index, buffer);
+
+	int targetIndex = getBufferTargetIndex(target);
+	if (targetIndex >= 0)
+	{
+		buffers[targetIndex] = buffer;
+	}
+}
+
+
+void GlState::bindFramebuffer(GLuint framebuffer)
+{
+	if (update(this->framebuffer, framebuffer))
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+}
+
+
+void GlState::enable(GLenum capability)
+{
+	int index = getCapabilityIndex(capability);
+	if (index >= 0 && capabilities[index])
+	{
+		frameStats.filtered++;
+		return;
+	}
+
+	frameStats.issued++;
+	glEnable(capability);
+	if (index >= 0)
+	{
+		capabilities[index] = true;
+	}
+}
+
+
+void GlState::disable(GLenum capability)
+{
+	int index = getCapabilityIndex(capability);
+	if (index >= 0 && !capabilities[index])
+	{
+		frameStats.filtered++;
+		return;
+	}
+
+	frameStats.issued++;
+	glDisable(capability);
+	if (index >= 0)
+	{
+		capabilities[index] = false;
+	}
+}
+
+
+void GlState::polygonMode(GLenum mode)
+{
+	if (update(polygonModeValue, mode))
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, mode);
+	}
+}
+
+
+void GlState::clearColor(const glm::vec4 &color)
+{
+	if (color == clearColorValue)
+	{
+		frameStats.filtered++;
+		return;
+	}
+
+	frameStats.issued++;
+	glClearColor(color.r, color.g, color.b, color.a);
+	clearColorValue = color;
+}
+
+
+void GlState::depthFunc(GLenum function)
+{
+	if (update(depthFuncValue, function))
+	{
+		glDepthFunc(function);
+	}
+}
+
+
+void GlState::depthMask(bool enabled)
+{
+	if (enabled == depthMaskValue)
+	{
+		frameStats.filtered++;
+		return;
+	}
+
+	frameStats.issued++;
+	glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+	depthMaskValue = enabled;
+}
+
+
+void GlState::colorMask(bool enabled)
+{
+	if (enabled == colorMaskValue)
+	{
+		frameStats.filtered++;
+		return;
+	}
+
+	frameStats.issued++;
+	GLboolean value = enabled ? GL_TRUE : GL_FALSE;
+	glColorMask(value, value, value, value);
+	colorMaskValue = enabled;
+}
+
+
+void GlState::blendFunc(GLenum source, GLenum destination)
+{
+	if (source == blendSource && destination == blendDestination)
+	{
+		frameStats.filtered++;
+		return;
+	}
+
+	frameStats.issued++;
+	glBlendFunc(source, destination);
+	blendSource = source;
+	blendDestination = destination;
+}
+
+
+void GlState::cullFace(GLenum face)
+{
+	if (update(cullFaceValue, face))
+	{
+		glCullFace(face);
+	}
+}
+
+
+void GlState::polygonOffset(float factor, float units)
+{
+	if (factor == polygonOffsetFactor && units == polygonOffsetUnits)
+	{
+		frameStats.filtered++;
+		return;
+	}
+
+	frameStats.issued++;
+	glPolygonOffset(factor, units);
+	polygonOffsetFactor = factor;
+	polygonOffsetUnits = units;
+}
+
+
+void GlState::bindTextureUnit(GLuint unit, GLenum target, GLuint texture)
+{
+	int targetIndex = getTextureTargetIndex(target);
+	if (targetIndex >= 0 && unit < TRACKED_UNIT_COUNT && textures[unit][targetIndex] == texture)
+	{
+		frameStats.filtered++;
+		return;
+	}
+
+	activeTexture(GL_TEXTURE0 + unit);
+	bindTexture(target, texture);
+}
+
+
+GLuint GlState::getFramebuffer() const
+{
+	return framebuffer;
+}
+
+
+void GlState::forgetObject(GpuResourceType type, GLuint name)
+{
+	switch (type)
+	{
+	case GPU_RESOURCE_BUFFER:
+		for (int target = 0; target < TRACKED_BUFFER_TARGET_COUNT; target++)
+		{
+			if (buffers[target] == name)
+			{
+				buffers[target] = 0;
+			}
+		}
+		break;
+	case GPU_RESOURCE_VERTEX_ARRAY:
+		if (vertexArray == name)
+		{
+			vertexArray = 0;
+		}
+		break;
+	case GPU_RESOURCE_TEXTURE:
+		for (int unit = 0; unit < TRACKED_UNIT_COUNT; unit++)
+		{
+			for (int target = 0; target < TRACKED_TEXTURE_TARGET_COUNT; target++)
+			{
+				if (textures[unit][target] == name)
+				{
+					textures[unit][target] = 0;
+				}
+			}
+		}
+		break;
+	case GPU_RESOURCE_PROGRAM:
+		// A deleted program stays in use until it's replaced, forgetting it just makes the next useProgram go through
+		if (program == name)
+		{
+			program = 0;
+		}
+		break;
+	case GPU_RESOURCE_FRAMEBUFFER:
+		// Deleting the bound framebuffer reverts to the default one
+		if (framebuffer == name)
+		{
+			framebuffer = 0;
+		}
+		break;
+	case GPU_RESOURCE_QUERY:
+		// Queries aren't bound, there's nothing to forget
+		break;
+	}
+}
+
+
+const GlStateStats &GlState::getFrameStats() const
+{
+	return frameStats;
+}
+
+
+void GlState::resetFrameStats()
+{
+	frameStats = GlStateStats();
+}
+
+
+GlState &GlState::global()
+{
+	static GlState state;
+	return state;
+}
+
+
+bool GlState::update(GLuint &cached, GLuint value)
+{
+	if (cached == value)
+	{
+		frameStats.filtered++;
+		return false;
+	}
+
+	frameStats.issued++;
+	cached = value;
+	return true;
+}
+
+
+int GlState::getTextureTargetIndex(GLenum target)
+{
+	for (int i = 0; i < TRACKED_TEXTURE_TARGET_COUNT; i++)
+	{
+		if (TEXTURE_TARGETS[i] == target)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+int GlState::getBufferTargetIndex(GLenum target)
+{
+	for (int i = 0; i < TRACKED_BUFFER_TARGET_COUNT; i++)
+	{
+		if (BUFFER_TARGETS[i] == target)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+int GlState::getCapabilityIndex(GLenum capability)
+{
+	for (int i = 0; i < TRACKED_CAPABILITY_COUNT; i++)
+	{
+		if (CAPABILITIES[i] == capability)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "gpu_memory.h"
+
+
+// State change counts, reset every frame
+struct GlStateStats {
+	unsigned issued = 0;    // Calls that reached the driver
+	unsigned filtered = 0;  // Calls skipped because the state was already set
+};
+
+
+// Shadow copy of the OpenGL state the renderer changes, so that setting state to what it already is doesn't reach the driver
+// (which on a software driver like llvmpipe costs real CPU time per call). All binds and state changes should go through it,
+// a change made around it leaves the shadow copy stale
+// NOTE: Like OpenGL itself, the state cache may only be used on the main thread
+class GlState
+{
+public:
+	// Default constructor, assumes the default state of a fresh context
+	GlState();
+
+	// The state cache mirrors the single context, so it can't be copied
+	GlState(const GlState &) = delete;
+	GlState &operator=(const GlState &) = delete;
+
+	// Replacements for the OpenGL functions of the same name
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vertexArray);
+	void activeTexture(GLenum unit);
+	void bindTexture(GLenum target, GLuint texture);
+	void bindBuffer(GLenum target, GLuint buffer);
+	void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+	void bindFramebuffer(GLuint framebuffer);  // Binds both the draw and the read framebuffer
+	void enable(GLenum capability);
+	void disable(GLenum capability);
+	void polygonMode(GLenum mode);  // Always sets both faces, core profile has no other option
+	void clearColor(const glm::vec4 &color);
+	void depthFunc(GLenum function);
+	void depthMask(bool enabled);
+	void colorMask(bool enabled);  // Always sets all four channels
+	void blendFunc(GLenum source, GLenum destination);
+	void cullFace(GLenum face);
+	void polygonOffset(float factor, float units);
+
+	// Bind a texture to a unit, only switching the active unit if the binding actually changes
+	void bindTextureUnit(GLuint unit, GLenum target, GLuint texture);
+
+	// Framebuffer currently bound
+	GLuint getFramebuffer() const;
+
+	// Forget bindings of an object that was deleted, OpenGL unbinds it and its name may be reused for a new object
+	void forgetObject(GpuResourceType type, GLuint name);
+
+	// State change counts of the current frame
+	const GlStateStats &getFrameStats() const;
+
+	// Reset state change counts, should be called at the start of every frame
+	void resetFrameStats();
+
+	// State cache of the context
+	static GlState &global();
+
+
+private:
+	// Texture units and targets with tracked bindings, binds outside of them always reach the driver
+	static const int TRACKED_UNIT_COUNT = 32;
+	static const int TRACKED_TEXTURE_TARGET_COUNT = 3;
+	static const int TRACKED_BUFFER_TARGET_COUNT = 6;
+	static const int TRACKED_CAPABILITY_COUNT = 6;
+
+	GLuint program;
+	GLuint vertexArray;
+	GLuint activeUnit;
+	GLuint textures[TRACKED_UNIT_COUNT][TRACKED_TEXTURE_TARGET_COUNT];
+	GLuint buffers[TRACKED_BUFFER_TARGET_COUNT];
+	GLuint framebuffer;
+	bool capabilities[TRACKED_CAPABILITY_COUNT];
+	GLenum polygonModeValue;
+	glm::vec4 clearColorValue;
+	GLenum depthFuncValue;
+	bool depthMaskValue;
+	bool colorMaskValue;
+	GLenum blendSource;
+	GLenum blendDestination;
+	GLenum cullFaceValue;
+	float polygonOffsetFactor;
+	float polygonOffsetUnits;
+
+	GlStateStats frameStats;
+
+	// Count a call and return whether it has to be issued, i.e. whether the value differs from the cached one
+	bool update(GLuint &cached, GLuint value);
+
+	// Index of a target or capability in the tables above, -1 if it isn't tracked
+	static int getTextureTargetIndex(GLenum target);
+	static int getBufferTargetIndex(GLenum target);
+	static int getCapabilityIndex(GLenum capability);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "gpu_memory.h"
+
+using namespace std;
+
+
+void GpuMemoryRegistry::add(GpuResourceType type, GLuint name)
+{
+	Entry entry;
+	entry.type = type;
+	entry.owner = getCurrentOwner();
+	entry.bytes = 0;
+	entries[getKey(type, name)] = entry;
+}
+
+
+void GpuMemoryRegistry::remove(GpuResourceType type, GLuint name)
+{
+	entries.erase(getKey(type, name));
+}
+
+
+void GpuMemoryRegistry::setMemory(GpuResourceType type, GLuint name, size_t bytes)
+{
+	unordered_map<uint64_t, Entry>::iterator it = entries.find(getKey(type, name));
+	if (it != entries.end())
+	{
+		it->second.bytes = bytes;
+	}
+}
+
+
+GpuMemoryStats GpuMemoryRegistry::getStats() const
+{
+	GpuMemoryStats stats;
+	for (unordered_map<uint64_t, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		addToStats(stats, it->second);
+	}
+	return stats;
+}
+
+
+GpuMemoryStats GpuMemoryRegistry::getOwnerStats(const string &owner) const
+{
+	GpuMemoryStats stats;
+	for (unordered_map<uint64_t, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		// The owner itself, or an owner nested in it
+		const string &entryOwner = it->second.owner;
+		if (entryOwner.compare(0, owner.size(), owner) == 0 && (entryOwner.size() == owner.size() || entryOwner[owner.size()] == '/'))
+		{
+			addToStats(stats, it->second);
+		}
+	}
+	return stats;
+}
+
+
+map<string, GpuMemoryStats> GpuMemoryRegistry::getStatsPerOwner() const
+{
+	map<string, GpuMemoryStats> statsPerOwner;
+	for (unordered_map<uint64_t, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		addToStats(statsPerOwner[it->second.owner], it->second);
+	}
+	return statsPerOwner;
+}
+
+
+const string &GpuMemoryRegistry::getCurrentOwner() const
+{
+	static const string noOwner;
+	return owners.empty() ? noOwner : owners.back();
+}
+
+
+GpuMemoryRegistry &GpuMemoryRegistry::global()
+{
+	static GpuMemoryRegistry registry;
+	return registry;
+}
+
+
+uint64_t GpuMemoryRegistry::getKey(GpuResourceType type, GLuint name)
+{
+	return ((uint64_t)type << 32) | name;
+}
+
+
+void GpuMemoryRegistry::addToStats(GpuMemoryStats &stats, const Entry &entry)
+{
+	switch (entry.type)
+	{
+	case GPU_RESOURCE_BUFFER:
+		stats.bufferCount++;
+		stats.bufferBytes += entry.bytes;
+		break;
+	case GPU_RESOURCE_VERTEX_ARRAY:
+		stats.vertexArrayCount++;
+		break;
+	case GPU_RESOURCE_TEXTURE:
+		stats.textureCount++;
+		stats.textureBytes += entry.bytes;
+		break;
+	case GPU_RESOURCE_PROGRAM:
+		stats.programCount++;
+		break;
+	case GPU_RESOURCE_FRAMEBUFFER:
+		stats.framebufferCount++;
+		break;
+	case GPU_RESOURCE_QUERY:
+		stats.queryCount++;
+		break;
+	}
+}
+
+
+GpuMemoryScope::GpuMemoryScope(const string &owner)
+{
+	GpuMemoryRegistry::global().owners.push_back(owner);
+}
+
+
+GpuMemoryScope::~GpuMemoryScope()
+{
+	GpuMemoryRegistry::global().owners.pop_back();
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+#ifndef GPU_MEMORY_H
+#define GPU_MEMORY_H
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Kinds of OpenGL objects tracked by the GPU memory registry
+enum GpuResourceType {
+	GPU_RESOURCE_BUFFER,
+	GPU_RESOURCE_VERTEX_ARRAY,
+	GPU_RESOURCE_TEXTURE,
+	GPU_RESOURCE_PROGRAM,
+	GPU_RESOURCE_FRAMEBUFFER,
+	GPU_RESOURCE_QUERY
+};
+
+
+// Amount of live objects and their memory, per kind of object
+// Programs, vertex arrays, framebuffers and queries are only counted, OpenGL 3.3 has no way to ask how much memory they take up
+struct GpuMemoryStats {
+	unsigned bufferCount = 0;
+	size_t bufferBytes = 0;
+	unsigned vertexArrayCount = 0;
+	unsigned textureCount = 0;
+	size_t textureBytes = 0;
+	unsigned programCount = 0;
+	unsigned framebufferCount = 0;
+	unsigned queryCount = 0;
+};
+
+
+// Registry of every live OpenGL object created through GpuResource, with the memory it takes up and who owns it
+// Owners are set with GpuMemoryScope, so objects created while a scene or model is loading get attributed to it
+// NOTE: Like OpenGL itself, the registry may only be used on the main thread
+class GpuMemoryRegistry
+{
+public:
+	// Default constructor
+	GpuMemoryRegistry() = default;
+
+	// The registry is a single global table, so it can't be copied
+	GpuMemoryRegistry(const GpuMemoryRegistry &) = delete;
+	GpuMemoryRegistry &operator=(const GpuMemoryRegistry &) = delete;
+
+	// Track a newly created object, attributed to the current owner
+	void add(GpuResourceType type, GLuint name);
+
+	// Stop tracking a deleted object
+	void remove(GpuResourceType type, GLuint name);
+
+	// Set the memory an object takes up, e.g. after (re)allocating a buffer's storage
+	void setMemory(GpuResourceType type, GLuint name, size_t bytes);
+
+	// Totals over all objects
+	GpuMemoryStats getStats() const;
+
+	// Totals over the objects of an owner, including those of owners nested in it (e.g. "BackpackScene" includes "BackpackScene/models/...")
+	GpuMemoryStats getOwnerStats(const std::string &owner) const;
+
+	// Totals per owner, sorted by owner name
+	std::map<std::string, GpuMemoryStats> getStatsPerOwner() const;
+
+	// Owner new objects are currently attributed to, empty outside of any scope
+	const std::string &getCurrentOwner() const;
+
+	// Registry shared by the whole program
+	static GpuMemoryRegistry &global();
+
+
+private:
+	friend class GpuMemoryScope;
+
+	// Registered object
+	struct Entry {
+		GpuResourceType type;
+		std::string owner;
+		size_t bytes;
+	};
+
+	// Entries keyed by type and name together, since names are only unique per type
+	std::unordered_map<uint64_t, Entry> entries;
+
+	// Owners of the scopes currently open, innermost last
+	std::vector<std::string> owners;
+
+	// Key of an object in the entry table
+	static uint64_t getKey(GpuResourceType type, GLuint name);
+
+	// Add an entry to a set of totals
+	static void addToStats(GpuMemoryStats &stats, const Entry &entry);
+};
+
+
+// Attributes the OpenGL objects created during its lifetime to an owner, like "BoxScene" or "BackpackScene/models/backpack/backpack.obj"
+// Scopes nest, the innermost one decides the owner
+class GpuMemoryScope
+{
+public:
+	// Constructor opens the scope
+	GpuMemoryScope(const std::string &owner);
+
+	// Destructor closes the scope
+	~GpuMemoryScope();
+
+	// Scopes are tied to where they're opened, so they can't be copied
+	GpuMemoryScope(const GpuMemoryScope &) = delete;
+	GpuMemoryScope &operator=(const GpuMemoryScope &) = delete;
+};
+
+#endif
\ No newline at end of file
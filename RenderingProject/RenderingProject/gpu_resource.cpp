@@ -0,0 +1,118 @@
+#include "gpu_resource.h"
+#include "gl_state.h"
+
+using namespace std;
+
+
+GpuResource::GpuResource(GpuResourceType type) :
+	type(type)
+{
+	switch (type)
+	{
+	case GPU_RESOURCE_BUFFER:
+		glGenBuffers(1, &name);
+		break;
+	case GPU_RESOURCE_VERTEX_ARRAY:
+		glGenVertexArrays(1, &name);
+		break;
+	case GPU_RESOURCE_TEXTURE:
+		glGenTextures(1, &name);
+		break;
+	case GPU_RESOURCE_PROGRAM:
+		name = glCreateProgram();
+		break;
+	case GPU_RESOURCE_FRAMEBUFFER:
+		glGenFramebuffers(1, &name);
+		break;
+	case GPU_RESOURCE_QUERY:
+		glGenQueries(1, &name);
+		break;
+	}
+
+	GpuMemoryRegistry::global().add(type, name);
+}
+
+
+GpuResource::GpuResource(GpuResourceType type, GLuint name) :
+	type(type),
+	name(name)
+{
+	if (name != 0)
+	{
+		GpuMemoryRegistry::global().add(type, name);
+	}
+}
+
+
+GpuResource::~GpuResource()
+{
+	reset();
+}
+
+
+GpuResource::GpuResource(GpuResource &&other) noexcept :
+	type(other.type),
+	name(other.name)
+{
+	other.name = 0;
+}
+
+
+GpuResource &GpuResource::operator=(GpuResource &&other) noexcept
+{
+	if (this != &other)
+	{
+		reset();
+		type = other.type;
+		name = other.name;
+		other.name = 0;
+	}
+	return *this;
+}
+
+
+GLuint GpuResource::get() const
+{
+	return name;
+}
+
+
+void GpuResource::setMemory(size_t bytes) const
+{
+	GpuMemoryRegistry::global().setMemory(type, name, bytes);
+}
+
+
+void GpuResource::reset()
+{
+	if (name == 0)
+	{
+		return;
+	}
+
+	GpuMemoryRegistry::global().remove(type, name);
+	GlState::global().forgetObject(type, name);
+
+	switch (type)
+	{
+	case GPU_RESOURCE_BUFFER:
+		glDeleteBuffers(1, &name);
+		break;
+	case GPU_RESOURCE_VERTEX_ARRAY:
+		glDeleteVertexArrays(1, &name);
+		break;
+	case GPU_RESOURCE_TEXTURE:
+		glDeleteTextures(1, &name);
+		break;
+	case GPU_RESOURCE_PROGRAM:
+		glDeleteProgram(name);
+		break;
+	case GPU_RESOURCE_FRAMEBUFFER:
+		glDeleteFramebuffers(1, &name);
+		break;
+	case GPU_RESOURCE_QUERY:
+		glDeleteQueries(1, &name);
+		break;
+	}
+	name = 0;
+}
\ No newline at end of file
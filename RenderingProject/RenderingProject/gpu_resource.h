@@ -0,0 +1,46 @@
+#ifndef GPU_RESOURCE_H
+#define GPU_RESOURCE_H
+
+#include <glad/glad.h>
+#include "gpu_memory.h"
+
+
+// Owning handle to an OpenGL object (buffer, vertex array, texture, program, framebuffer or query), which is deleted along with the handle
+// Handles are registered in the global GPU memory registry for as long as they own an object
+class GpuResource
+{
+public:
+	// Default constructor, owns nothing
+	GpuResource() = default;
+
+	// Constructor creating a new object of the given type
+	explicit GpuResource(GpuResourceType type);
+
+	// Constructor taking ownership of an existing object
+	GpuResource(GpuResourceType type, GLuint name);
+
+	// Destructor deletes the object
+	~GpuResource();
+
+	// Every object has a single owner, so handles can be moved but not copied
+	GpuResource(const GpuResource &) = delete;
+	GpuResource &operator=(const GpuResource &) = delete;
+	GpuResource(GpuResource &&other) noexcept;
+	GpuResource &operator=(GpuResource &&other) noexcept;
+
+	// OpenGL name of the object, 0 if the handle owns nothing
+	GLuint get() const;
+
+	// Record the memory the object takes up in the registry, should be called whenever its storage is (re)allocated
+	void setMemory(size_t bytes) const;
+
+	// Delete the object now, leaving the handle empty
+	void reset();
+
+
+private:
+	GpuResourceType type = GPU_RESOURCE_BUFFER;
+	GLuint name = 0;
+};
+
+#endif
\ No newline at end of file
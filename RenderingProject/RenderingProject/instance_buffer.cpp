@@ -0,0 +1,88 @@
+#include "instance_buffer.h"
+#include "gl_state.h"
+
+using namespace std;
+using namespace glm;
+
+
+InstanceBuffer::InstanceBuffer(GLsizei stride) :
+	stride(stride),
+	capacity(0),
+	instanceCount(0)
+{
+	VBO = GpuResource(GPU_RESOURCE_BUFFER);
+}
+
+
+void InstanceBuffer::addMat4Attribute(GLuint location, size_t offset) const
+{
+	// A mat4 attribute is passed as 4 vec4 columns in consecutive locations
+	for (GLuint i = 0; i < 4; i++)
+	{
+		addVectorAttribute(location + i, 4, offset + i * sizeof(vec4));
+	}
+}
+
+
+void InstanceBuffer::addMat3Attribute(GLuint location, size_t offset) const
+{
+	for (GLuint i = 0; i < 3; i++)
+	{
+		addVectorAttribute(location + i, 3, offset + i * sizeof(vec3));
+	}
+}
+
+
+void InstanceBuffer::addFloatAttribute(GLuint location, size_t offset) const
+{
+	addVectorAttribute(location, 1, offset);
+}
+
+
+void InstanceBuffer::addVec3Attribute(GLuint location, size_t offset) const
+{
+	addVectorAttribute(location, 3, offset);
+}
+
+
+void InstanceBuffer::addVec4Attribute(GLuint location, size_t offset) const
+{
+	addVectorAttribute(location, 4, offset);
+}
+
+
+void InstanceBuffer::upload(const void *data, GLsizei count)
+{
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, VBO.get());
+
+	// Grow with some headroom so that small increases in instance count don't need a bigger allocation
+	if (count > capacity)
+	{
+		capacity = count + count / 2;
+	}
+
+	// Allocating new storage every upload orphans the old one, so the driver doesn't have to wait for draws still using it
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)capacity * stride, NULL, GL_DYNAMIC_DRAW);
+	VBO.setMemory((size_t)capacity * stride);
+
+	if (count > 0)
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)count * stride, data);
+	}
+	instanceCount = count;
+}
+
+
+GLsizei InstanceBuffer::getInstanceCount() const
+{
+	return instanceCount;
+}
+
+
+void InstanceBuffer::addVectorAttribute(GLuint location, GLint components, size_t offset) const
+{
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, VBO.get());
+	glVertexAttribPointer(location, components, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+	glEnableVertexAttribArray(location);
+	glVertexAttribDivisor(location, 1);
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "gpu_resource.h"
+
+
+// Attribute locations used for per-instance data in the instanced shaders
+const GLuint INSTANCE_MODEL_LOCATION = 3;   // mat4, takes locations 3-6
+const GLuint INSTANCE_EXTRA_LOCATION = 7;   // Whatever follows the model matrix (normal matrix or color)
+
+
+// Per-instance data of lit objects, normal matrix is in world space so it only has to be calculated when the object moves
+struct LitObjectInstance {
+	glm::mat4 model;
+	glm::mat3 normal;
+};
+
+// Per-instance data of objects spinning about their own rotation axis, at a speed in degrees per second (zero for those standing still)
+struct SpinningObjectInstance {
+	glm::mat4 model;
+	float spinSpeed;
+};
+
+// Per-instance data of light source gizmos
+struct LightSourceInstance {
+	glm::mat4 model;
+	glm::vec3 color;
+};
+
+// Per-instance data of the point light volumes of deferred shading, in world space
+struct LightVolumeInstance {
+	glm::vec4 positionRadius;  // Radius of the light's sphere of influence in w
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	glm::vec3 attenuation;     // Constant, linear and quadratic
+};
+
+
+// Vertex buffer holding per-instance attributes for instanced drawing
+class InstanceBuffer
+{
+public:
+	// Buffer
+	GpuResource VBO;
+
+	// Constructor to generate the buffer, stride is the size of the data of one instance
+	InstanceBuffer(GLsizei stride);
+
+	// Default constructor
+	InstanceBuffer() = default;
+
+	// Add per-instance attributes to the currently bound VAO, offset is the position of the attribute inside the instance data
+	void addMat4Attribute(GLuint location, size_t offset) const;
+	void addMat3Attribute(GLuint location, size_t offset) const;
+	void addFloatAttribute(GLuint location, size_t offset) const;
+	void addVec3Attribute(GLuint location, size_t offset) const;
+	void addVec4Attribute(GLuint location, size_t offset) const;
+
+	// Upload data for a given amount of instances, replacing the previous data
+	void upload(const void *data, GLsizei count);
+
+	// Amount of instances in the buffer
+	GLsizei getInstanceCount() const;
+
+
+private:
+	GLsizei stride;
+	GLsizei capacity = 0;  // Amount of instances the buffer has storage for
+	GLsizei instanceCount = 0;
+
+	// Set up a per-instance float vector attribute
+	void addVectorAttribute(GLuint location, GLint components, size_t offset) const;
+};
+
+#endif
\ No newline at end of file
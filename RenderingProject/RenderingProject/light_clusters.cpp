@@ -0,0 +1,542 @@
+#include "light_clusters.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include "gl_state.h"
+#include "thread_pool.h"
+
+// SSE2 is part of every x64 target and enabled by default for 32 bit ones by current compilers
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHT_CLUSTERS_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+
+static_assert(sizeof(PointLightStd140) == 4 * 4 * sizeof(float), "Light data has to be four RGBA32F texels per light");
+
+
+LightClusterStats LightClusters::frameStats;
+
+
+struct LightClusters::Job {
+	LightClusters *clusters;
+	atomic<int> nextSlice;
+	int finishedSlices = 0;
+	mutex finishedMutex;
+	condition_variable allFinished;
+
+	// Assign slices until none are left, returns once this call has nothing more to do
+	void run()
+	{
+		for (int slice = nextSlice++; slice < CLUSTER_COUNT_Z; slice = nextSlice++)
+		{
+			clusters->assignSlice(slice);
+
+			lock_guard<mutex> lock(finishedMutex);
+			if (++finishedSlices == CLUSTER_COUNT_Z)
+			{
+				allFinished.notify_all();
+			}
+		}
+	}
+};
+
+
+// Call visit with the position in the list of every light whose sphere overlaps the box
+// The distance from each sphere center to the box is compared against the radius without taking the square root
+template <typename LightList, typename Box, typename Visit>
+static void forEachOverlap(const LightList &lights, const Box &box, Visit visit)
+{
+#ifdef LIGHT_CLUSTERS_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 minX = _mm_set1_ps(box.min.x), minY = _mm_set1_ps(box.min.y), minZ = _mm_set1_ps(box.min.z);
+	const __m128 maxX = _mm_set1_ps(box.max.x), maxY = _mm_set1_ps(box.max.y), maxZ = _mm_set1_ps(box.max.z);
+
+	// Four lights at a time, padding spheres have a negative squared radius so they never overlap
+	for (size_t i = 0; i < lights.count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&lights.x[i]);
+		__m128 y = _mm_loadu_ps(&lights.y[i]);
+		__m128 z = _mm_loadu_ps(&lights.z[i]);
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), _mm_sub_ps(x, maxX)), zero);
+		__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), _mm_sub_ps(y, maxY)), zero);
+		__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), _mm_sub_ps(z, maxZ)), zero);
+		__m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		int overlaps = _mm_movemask_ps(_mm_cmple_ps(distanceSquared, _mm_loadu_ps(&lights.radiusSquared[i])));
+
+		for (size_t lane = 0; overlaps != 0; lane++, overlaps >>= 1)
+		{
+			if (overlaps & 1)
+			{
+				visit(i + lane);
+			}
+		}
+	}
+#else
+	for (size_t i = 0; i < lights.count; i++)
+	{
+		float dx = std::max(std::max(box.min.x - lights.x[i], lights.x[i] - box.max.x), 0.0f);
+		float dy = std::max(std::max(box.min.y - lights.y[i], lights.y[i] - box.max.y), 0.0f);
+		float dz = std::max(std::max(box.min.z - lights.z[i], lights.z[i] - box.max.z), 0.0f);
+		if (dx * dx + dy * dy + dz * dz <= lights.radiusSquared[i])
+		{
+			visit(i);
+		}
+	}
+#endif
+}
+
+
+LightClusters::LightClusters(GLuint firstTextureUnit) :
+	firstTextureUnit(firstTextureUnit)
+{
+	slices.resize(CLUSTER_COUNT_Z);
+	clusterData.resize(CLUSTER_COUNT * 2);
+
+	lightBuffer = GpuResource(GPU_RESOURCE_BUFFER);
+	lightTexture = GpuResource(GPU_RESOURCE_TEXTURE);
+	clusterBuffer = GpuResource(GPU_RESOURCE_BUFFER);
+	clusterTexture = GpuResource(GPU_RESOURCE_TEXTURE);
+	indexBuffer = GpuResource(GPU_RESOURCE_BUFFER);
+	indexTexture = GpuResource(GPU_RESOURCE_TEXTURE);
+
+	// The cluster grid has a fixed size, the other buffers grow with the lights and start out empty
+	GlState::global().bindBuffer(GL_TEXTURE_BUFFER, clusterBuffer.get());
+	glBufferData(GL_TEXTURE_BUFFER, clusterData.size() * sizeof(uint32_t), NULL, GL_DYNAMIC_DRAW);
+	clusterBuffer.setMemory(clusterData.size() * sizeof(uint32_t));
+	upload();
+
+	// Texture buffers keep referencing their buffer when its storage is reallocated, so each is attached once
+	GlState::global().bindTextureUnit(firstTextureUnit, GL_TEXTURE_BUFFER, lightTexture.get());
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer.get());
+	GlState::global().bindTextureUnit(firstTextureUnit + 1, GL_TEXTURE_BUFFER, clusterTexture.get());
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, clusterBuffer.get());
+	GlState::global().bindTextureUnit(firstTextureUnit + 2, GL_TEXTURE_BUFFER, indexTexture.get());
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indexBuffer.get());
+}
+
+
+void LightClusters::setLights(const vector<ClusteredPointLight> &newLights)
+{
+	lights = newLights;
+
+	radii.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		radii[i] = getLightRadius(lights[i]);
+	}
+	dirty = true;
+}
+
+
+void LightClusters::update(const mat4 &view, const mat4 &projection, float nearPlane, float farPlane, int viewportWidth, int viewportHeight)
+{
+	bool projectionChanged = projection != assignedProjection || viewportWidth != assignedViewportWidth || viewportHeight != assignedViewportHeight;
+	if (!dirty && !projectionChanged && view == assignedView)
+	{
+		return;
+	}
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+	if (projectionChanged)
+	{
+		buildClusterBoxes(projection, nearPlane, farPlane);
+		tileScale = vec2((float)CLUSTER_COUNT_X / viewportWidth, (float)CLUSTER_COUNT_Y / viewportHeight);
+	}
+
+	// Light spheres in view space, binned into the slices their depth range overlaps so each slice only looks at those
+	for (SliceWork &work : slices)
+	{
+		work.depthLights.clear();
+	}
+	viewPositions.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		vec3 position = vec3(view * vec4(lights[i].position, 1.0f));
+		viewPositions[i] = position;
+
+		float nearDepth = -position.z - radii[i];
+		float farDepth = -position.z + radii[i];
+		if (farDepth < nearPlane || nearDepth > farPlane)
+		{
+			continue;
+		}
+		int firstSlice = nearDepth <= nearPlane ? 0 : std::max((int)(log(nearDepth) * depthScale + depthBias), 0);
+		int lastSlice = farDepth >= farPlane ? CLUSTER_COUNT_Z - 1 : std::min((int)(log(farDepth) * depthScale + depthBias), CLUSTER_COUNT_Z - 1);
+		for (int slice = firstSlice; slice <= lastSlice; slice++)
+		{
+			slices[slice].depthLights.add(position.x, position.y, position.z, radii[i] * radii[i], (uint32_t)i);
+		}
+	}
+	for (SliceWork &work : slices)
+	{
+		work.depthLights.pad();
+	}
+
+	// Slices are independent, so workers each take slices until none are left while the main thread does the same
+	// When the pool is busy (e.g. with models loading) the main thread simply ends up doing all of them
+	shared_ptr<Job> job = make_shared<Job>();
+	job->clusters = this;
+	job->nextSlice = 0;
+
+	ThreadPool &pool = ThreadPool::global();
+	unsigned workerCount = std::min(pool.getThreadCount(), (unsigned)CLUSTER_COUNT_Z - 1);
+	for (unsigned i = 0; i < workerCount; i++)
+	{
+		pool.submit([job]() { job->run(); });
+	}
+	job->run();
+	{
+		unique_lock<mutex> lock(job->finishedMutex);
+		job->allFinished.wait(lock, [&job]() { return job->finishedSlices == CLUSTER_COUNT_Z; });
+	}
+
+	gatherResults();
+
+	frameStats.assignTimeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+	frameStats.updates++;
+
+	upload();
+
+	dirty = false;
+	assignedView = view;
+	assignedProjection = projection;
+	assignedViewportWidth = viewportWidth;
+	assignedViewportHeight = viewportHeight;
+}
+
+
+void LightClusters::bind(Shader &shader) const
+{
+	if (handleProgram != shader.ID.get())
+	{
+		lightDataHandle = shader.getUniformHandle("clusterLightData");
+		clusterGridHandle = shader.getUniformHandle("clusterGrid");
+		lightIndicesHandle = shader.getUniformHandle("clusterLightIndices");
+		parametersHandle = shader.getUniformHandle("clusterParameters");
+		handleProgram = shader.ID.get();
+	}
+
+	GlState::global().bindTextureUnit(firstTextureUnit, GL_TEXTURE_BUFFER, lightTexture.get());
+	GlState::global().bindTextureUnit(firstTextureUnit + 1, GL_TEXTURE_BUFFER, clusterTexture.get());
+	GlState::global().bindTextureUnit(firstTextureUnit + 2, GL_TEXTURE_BUFFER, indexTexture.get());
+
+	shader.setInt(lightDataHandle, firstTextureUnit);
+	shader.setInt(clusterGridHandle, firstTextureUnit + 1);
+	shader.setInt(lightIndicesHandle, firstTextureUnit + 2);
+	shader.setVec4f(parametersHandle, vec4(tileScale, depthScale, depthBias));
+}
+
+
+size_t LightClusters::getLightCount() const
+{
+	return lights.size();
+}
+
+
+float LightClusters::getLightRadius(const ClusteredPointLight &light)
+{
+	// Solve constant + linear * d + quadratic * d^2 = brightness / cutoff for the distance d
+	vec3 brightest = glm::max(light.ambient, glm::max(light.diffuse, light.specular));
+	float brightness = std::max(brightest.x, std::max(brightest.y, brightest.z));
+	float c = light.constant - brightness / CLUSTER_LIGHT_CUTOFF;
+	if (c >= 0.0f)
+	{
+		return 0.0f;
+	}
+	if (light.quadratic <= 0.0f)
+	{
+		return light.linear > 0.0f ? -c / light.linear : INFINITY;
+	}
+	return (-light.linear + sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+}
+
+
+const LightClusterStats &LightClusters::getFrameStats()
+{
+	return frameStats;
+}
+
+
+void LightClusters::resetFrameStats()
+{
+	frameStats = LightClusterStats();
+}
+
+
+void LightClusters::buildClusterBoxes(const mat4 &projection, float nearPlane, float farPlane)
+{
+	// Exponential slices, so clusters keep about the same proportions at every depth
+	float depthRatio = log(farPlane / nearPlane);
+	depthScale = CLUSTER_COUNT_Z / depthRatio;
+	depthBias = -CLUSTER_COUNT_Z * log(nearPlane) / depthRatio;
+
+	clusterBoxes.resize(CLUSTER_COUNT);
+	rowBoxes.resize(CLUSTER_COUNT_Y * CLUSTER_COUNT_Z);
+	sliceBoxes.resize(CLUSTER_COUNT_Z);
+
+	for (int z = 0; z < CLUSTER_COUNT_Z; z++)
+	{
+		float sliceNear = nearPlane * pow(farPlane / nearPlane, (float)z / CLUSTER_COUNT_Z);
+		float sliceFar = nearPlane * pow(farPlane / nearPlane, (float)(z + 1) / CLUSTER_COUNT_Z);
+
+		for (int y = 0; y < CLUSTER_COUNT_Y; y++)
+		{
+			for (int x = 0; x < CLUSTER_COUNT_X; x++)
+			{
+				// Corners of the tile at both depths of the slice, unprojected from normalized device coordinates
+				vec2 ndcMin(-1.0f + 2.0f * x / CLUSTER_COUNT_X, -1.0f + 2.0f * y / CLUSTER_COUNT_Y);
+				vec2 ndcMax(-1.0f + 2.0f * (x + 1) / CLUSTER_COUNT_X, -1.0f + 2.0f * (y + 1) / CLUSTER_COUNT_Y);
+
+				Box box;
+				box.min = vec3(INFINITY, INFINITY, -sliceFar);
+				box.max = vec3(-INFINITY, -INFINITY, -sliceNear);
+				for (float depth : { sliceNear, sliceFar })
+				{
+					for (vec2 ndc : { ndcMin, ndcMax })
+					{
+						vec2 corner = depth * (ndc + vec2(projection[2][0], projection[2][1])) / vec2(projection[0][0], projection[1][1]);
+						box.min = vec3(glm::min(vec2(box.min), corner), box.min.z);
+						box.max = vec3(glm::max(vec2(box.max), corner), box.max.z);
+					}
+				}
+				clusterBoxes[x + CLUSTER_COUNT_X * (y + CLUSTER_COUNT_Y * z)] = box;
+
+				Box &row = rowBoxes[y + CLUSTER_COUNT_Y * z];
+				row = x == 0 ? box : Box{ glm::min(row.min, box.min), glm::max(row.max, box.max) };
+			}
+
+			Box &row = rowBoxes[y + CLUSTER_COUNT_Y * z];
+			Box &slice = sliceBoxes[z];
+			slice = y == 0 ? row : Box{ glm::min(slice.min, row.min), glm::max(slice.max, row.max) };
+		}
+	}
+}
+
+
+void LightClusters::assignSlice(int z)
+{
+	// Narrow the lights down slice by slice, then row by row and finally cluster by cluster
+	SliceWork &work = slices[z];
+	work.indices.clear();
+	work.clusterCounts.assign(CLUSTER_COUNT_X * CLUSTER_COUNT_Y, 0);
+
+	work.sliceLights.clear();
+	cullLights(work.depthLights, sliceBoxes[z], work.sliceLights);
+	work.sliceLights.pad();
+
+	for (int y = 0; y < CLUSTER_COUNT_Y; y++)
+	{
+		work.rowLights.clear();
+		cullLights(work.sliceLights, rowBoxes[y + CLUSTER_COUNT_Y * z], work.rowLights);
+		work.rowLights.pad();
+
+		for (int x = 0; x < CLUSTER_COUNT_X; x++)
+		{
+			size_t start = work.indices.size();
+			const Box &box = clusterBoxes[x + CLUSTER_COUNT_X * (y + CLUSTER_COUNT_Y * z)];
+
+			// Only the indices are needed at this level, so the overlapping lights are appended to the slice's index list directly
+			forEachOverlap(work.rowLights, box, [&work](size_t i)
+			{
+				work.indices.push_back(work.rowLights.index[i]);
+			});
+			work.clusterCounts[x + CLUSTER_COUNT_X * y] = (uint32_t)(work.indices.size() - start);
+		}
+	}
+}
+
+
+void LightClusters::gatherResults()
+{
+	// Lights are numbered in the order clusters first reference them, lights no cluster references aren't uploaded at all
+	visibleIndices.assign(lights.size(), -1);
+	lightData.clear();
+	indexData.clear();
+
+	uint32_t maxClusterLights = 0;
+	for (int z = 0; z < CLUSTER_COUNT_Z; z++)
+	{
+		const SliceWork &work = slices[z];
+		size_t next = 0;
+		for (int cluster = 0; cluster < CLUSTER_COUNT_X * CLUSTER_COUNT_Y; cluster++)
+		{
+			uint32_t count = work.clusterCounts[cluster];
+			size_t clusterIndex = cluster + (size_t)CLUSTER_COUNT_X * CLUSTER_COUNT_Y * z;
+			clusterData[clusterIndex * 2] = (uint32_t)indexData.size();
+			clusterData[clusterIndex * 2 + 1] = count;
+			maxClusterLights = std::max(maxClusterLights, count);
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				uint32_t light = work.indices[next++];
+				if (visibleIndices[light] < 0)
+				{
+					visibleIndices[light] = (int32_t)lightData.size();
+
+					const ClusteredPointLight &source = lights[light];
+					PointLightStd140 data;
+					data.position = viewPositions[light];
+					data.constant = source.constant;
+					data.ambient = source.ambient;
+					data.linear = source.linear;
+					data.diffuse = source.diffuse;
+					data.quadratic = source.quadratic;
+					data.specular = source.specular;
+					data.padding0 = 0.0f;
+					lightData.push_back(data);
+				}
+				indexData.push_back((uint32_t)visibleIndices[light]);
+			}
+		}
+	}
+
+	frameStats.lights += lights.size();
+	frameStats.visibleLights += lightData.size();
+	frameStats.lightIndices += indexData.size();
+	frameStats.maxClusterLights = std::max(frameStats.maxClusterLights, (size_t)maxClusterLights);
+}
+
+
+void LightClusters::upload()
+{
+	// Grow with some headroom like instance buffers, but never shrink so moving the camera doesn't keep reallocating
+	GlState &state = GlState::global();
+	if (lightData.size() > lightCapacity || lightCapacity == 0)
+	{
+		lightCapacity = std::max(lightData.size() + lightData.size() / 2, (size_t)1);
+		state.bindBuffer(GL_TEXTURE_BUFFER, lightBuffer.get());
+		glBufferData(GL_TEXTURE_BUFFER, lightCapacity * sizeof(PointLightStd140), NULL, GL_DYNAMIC_DRAW);
+		lightBuffer.setMemory(lightCapacity * sizeof(PointLightStd140));
+	}
+	if (indexData.size() > indexCapacity || indexCapacity == 0)
+	{
+		indexCapacity = std::max(indexData.size() + indexData.size() / 2, (size_t)1);
+		state.bindBuffer(GL_TEXTURE_BUFFER, indexBuffer.get());
+		glBufferData(GL_TEXTURE_BUFFER, indexCapacity * sizeof(uint32_t), NULL, GL_DYNAMIC_DRAW);
+		indexBuffer.setMemory(indexCapacity * sizeof(uint32_t));
+	}
+
+	if (!lightData.empty())
+	{
+		state.bindBuffer(GL_TEXTURE_BUFFER, lightBuffer.get());
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, lightData.size() * sizeof(PointLightStd140), lightData.data());
+	}
+	if (!indexData.empty())
+	{
+		state.bindBuffer(GL_TEXTURE_BUFFER, indexBuffer.get());
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, indexData.size() * sizeof(uint32_t), indexData.data());
+	}
+	state.bindBuffer(GL_TEXTURE_BUFFER, clusterBuffer.get());
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, clusterData.size() * sizeof(uint32_t), clusterData.data());
+}
+
+
+void LightClusters::cullLights(const LightList &lights, const Box &box, LightList &result)
+{
+	forEachOverlap(lights, box, [&lights, &result](size_t i)
+	{
+		result.add(lights.x[i], lights.y[i], lights.z[i], lights.radiusSquared[i], lights.index[i]);
+	});
+}
+
+
+void LightClusters::LightList::clear()
+{
+	x.clear();
+	y.clear();
+	z.clear();
+	radiusSquared.clear();
+	index.clear();
+	count = 0;
+}
+
+
+void LightClusters::LightList::add(float lightX, float lightY, float lightZ, float lightRadiusSquared, uint32_t lightIndex)
+{
+	x.push_back(lightX);
+	y.push_back(lightY);
+	z.push_back(lightZ);
+	radiusSquared.push_back(lightRadiusSquared);
+	index.push_back(lightIndex);
+	count++;
+}
+
+
+void LightClusters::LightList::pad()
+{
+	// Only the arrays grow, count stays the amount of actual lights
+	while (x.size() % 4 != 0)
+	{
+		x.push_back(0.0f);
+		y.push_back(0.0f);
+		z.push_back(0.0f);
+		radiusSquared.push_back(-1.0f);
+		index.push_back(0);
+	}
+}
+
+
+//------------------------------------------
+// Lights of the scenes using the clusters
+//------------------------------------------
+
+void scatterPointLights(const vec3 *positions, const vec3 *colors, const vec3 *speculars, int count, float density, vector<ClusteredPointLight> &lights)
+{
+	// The first lights are the ones of the lighting scheme, the same as in the lighting buffer
+	lights.resize(count);
+	for (int i = 0; i < std::min(count, MAX_POINT_LIGHTS); i++)
+	{
+		lights[i].position = positions[i];
+		lights[i].ambient = colors[i] * 0.1f;
+		lights[i].diffuse = colors[i];
+		lights[i].specular = speculars[i];
+		lights[i].constant = 1.0f;
+		lights[i].linear = 0.09f;
+		lights[i].quadratic = 0.032f;
+	}
+
+	mt19937 random(7);
+	float extent = 0.5f * cbrt(count / density);
+	uniform_real_distribution<float> offset(-extent, extent);
+	uniform_real_distribution<float> hue(0.0f, 1.0f);
+	for (int i = MAX_POINT_LIGHTS; i < count; i++)
+	{
+		vec3 color = clamp(abs(fract(hue(random) + vec3(1.0f, 2.0f / 3.0f, 1.0f / 3.0f)) * 6.0f - 3.0f) - 1.0f, 0.0f, 1.0f) * 0.3f;
+		lights[i].position = vec3(offset(random), offset(random), offset(random) - extent);
+		lights[i].ambient = vec3(0.0f);
+		lights[i].diffuse = color;
+		lights[i].specular = color;
+		lights[i].constant = 1.0f;
+		lights[i].linear = 0.7f;
+		lights[i].quadratic = 1.8f;
+	}
+}
+
+
+float setSceneLights(LightingBuffer &lightingBuffer, const vec3 &directionalDirection, const vec3 &directionalColor, const vec3 &directionalSpecular,
+	const vec3 *pointPositions, const vec3 *pointColors, const vec3 *pointSpeculars,
+	const vec3 &spotColor, const vec3 &spotSpecular, float spotInnerCutOff, float spotOuterCutOff)
+{
+	lightingBuffer.setDirectionalLight(directionalDirection, directionalColor * 0.1f, directionalColor, directionalSpecular);
+
+	for (int i = 0; i < MAX_POINT_LIGHTS; i++)
+	{
+		lightingBuffer.setPointLight(i, pointPositions[i], pointColors[i] * 0.1f, pointColors[i], pointSpeculars[i], 1.0f, 0.09f, 0.032f);
+	}
+
+	lightingBuffer.setSpotLight(vec3(0.0f), vec3(0.0f, 0.0f, -1.0f), spotColor * 0.1f, spotColor, spotSpecular,
+		1.0f, 0.09f, 0.032f, cos(radians(spotInnerCutOff)), cos(radians(spotOuterCutOff)));
+
+	ClusteredPointLight spotReach = { vec3(0.0f), spotColor * 0.1f, spotColor, spotSpecular, 1.0f, 0.09f, 0.032f };
+	return LightClusters::getLightRadius(spotReach);
+}
\ No newline at end of file
@@ -0,0 +1,197 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "gpu_resource.h"
+#include "lighting_buffer.h"
+#include "shader.h"
+
+
+// Dimensions of the cluster grid the view frustum is divided into, must match CLUSTER_COUNT_X/Y/Z in the shaders
+// Clusters are screen tiles in x and y and slices of exponentially growing depth in z
+const int CLUSTER_COUNT_X = 16;
+const int CLUSTER_COUNT_Y = 9;
+const int CLUSTER_COUNT_Z = 24;
+const int CLUSTER_COUNT = CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z;
+
+// First of the three texture units the cluster texture buffers are bound to, above those used by materials
+const GLuint CLUSTER_FIRST_TEXTURE_UNIT = 8;
+
+// Share of its brightest color below which a light is considered to have no influence, decides the light radii
+// At 1/256 a light contributes less than one step of an 8 bit color channel beyond its radius
+const float CLUSTER_LIGHT_CUTOFF = 1.0f / 256.0f;
+
+
+// Point light as given to the light clusters, in world space
+struct ClusteredPointLight {
+	glm::vec3 position;
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float constant;
+	float linear;
+	float quadratic;
+};
+
+
+// Work done by all light clusters during the current frame
+struct LightClusterStats {
+	size_t lights = 0;            // Point lights given to the clusters
+	size_t visibleLights = 0;     // Lights overlapping at least one cluster, the only ones uploaded
+	size_t lightIndices = 0;      // Light references in all clusters together
+	size_t maxClusterLights = 0;  // Most lights referenced by a single cluster
+	double assignTimeMs = 0.0;    // Time spent assigning lights to clusters (on the CPU, including the worker threads)
+	unsigned updates = 0;         // Assignments done, zero if neither the lights nor the view changed
+};
+
+
+// Clustered forward lighting: the view frustum is divided into a 3D grid of clusters, every point light is assigned to the
+// clusters its sphere of influence overlaps, and lit fragments only evaluate the lights of the cluster they're in
+// Assignment runs on the CPU, with the depth slices spread over the global thread pool and lights tested four at a time with SSE.
+// The results go to the shader through texture buffers: the view space lights of visible lights (in the std140 point light layout,
+// four RGBA32F texels each), an (offset, count) pair per cluster and the light index list they point into
+// NOTE: Like OpenGL itself, the light clusters may only be used on the main thread
+class LightClusters
+{
+public:
+	// Constructor to generate the texture buffers, which are bound to three texture units starting at the given one
+	explicit LightClusters(GLuint firstTextureUnit);
+
+	// Default constructor
+	LightClusters() = default;
+
+	// Replace the point lights, they're assigned again on the next update
+	void setLights(const std::vector<ClusteredPointLight> &lights);
+
+	// Assign the lights to the clusters of the view and upload the results, does nothing if neither the lights nor the view changed
+	// Should be called every frame before rendering lit objects, with the projection's near and far planes and the viewport size in pixels
+	void update(const glm::mat4 &view, const glm::mat4 &projection, float nearPlane, float farPlane, int viewportWidth, int viewportHeight);
+
+	// Bind the texture buffers and set the cluster uniforms of a shader, which has to be in use
+	void bind(Shader &shader) const;
+
+	// Amount of point lights
+	size_t getLightCount() const;
+
+	// Distance at which a light's attenuation leaves less than CLUSTER_LIGHT_CUTOFF of its brightest color
+	static float getLightRadius(const ClusteredPointLight &light);
+
+	// Work done during the current frame
+	static const LightClusterStats &getFrameStats();
+
+	// Reset the work counts, should be called at the start of every frame
+	static void resetFrameStats();
+
+
+private:
+	// Axis aligned box in view space
+	struct Box {
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	// Light spheres in view space stored as separate arrays so four can be tested at once, padded to a multiple of four
+	// with spheres that never overlap anything
+	struct LightList {
+		std::vector<float> x, y, z, radiusSquared;
+		std::vector<uint32_t> index;  // Index of the light in the lights given to setLights
+		size_t count = 0;
+
+		void clear();
+		void add(float x, float y, float z, float radiusSquared, uint32_t index);
+		void pad();
+	};
+
+	// Lists a worker fills for one depth slice, kept between frames to reuse their memory
+	struct SliceWork {
+		LightList depthLights;    // Lights overlapping the depth range of the slice, binned on the main thread
+		LightList sliceLights;    // Lights overlapping the slice
+		LightList rowLights;      // Lights overlapping the current row of the slice
+		std::vector<uint32_t> indices;        // Light indices of all clusters of the slice, one cluster after the other
+		std::vector<uint32_t> clusterCounts;  // Amount of indices per cluster of the slice
+	};
+
+	// Assignment in progress, shared with the worker tasks so late ones find no work left instead of a deleted object
+	struct Job;
+
+	std::vector<ClusteredPointLight> lights;
+	std::vector<float> radii;
+
+	// Views of the last assignment, assignment is skipped while they stay the same
+	bool dirty = true;
+	glm::mat4 assignedView = glm::mat4(0.0f);
+	glm::mat4 assignedProjection = glm::mat4(0.0f);
+	int assignedViewportWidth = 0;
+	int assignedViewportHeight = 0;
+
+	// Bounds of every cluster, of every row of clusters in a slice and of every slice, rebuilt when the projection changes
+	std::vector<Box> clusterBoxes;
+	std::vector<Box> rowBoxes;
+	std::vector<Box> sliceBoxes;
+
+	// Slice from view space depth: slice = log(depth) * depthScale + depthBias
+	float depthScale = 0.0f;
+	float depthBias = 0.0f;
+	glm::vec2 tileScale = glm::vec2(0.0f);
+
+	std::vector<glm::vec3> viewPositions;
+	std::vector<SliceWork> slices;
+	std::vector<int32_t> visibleIndices;
+
+	// Data uploaded to the texture buffers
+	std::vector<PointLightStd140> lightData;
+	std::vector<uint32_t> clusterData;
+	std::vector<uint32_t> indexData;
+
+	// Texture buffers: buffer and texture of the light data, the clusters and the light indices
+	GpuResource lightBuffer, lightTexture;
+	GpuResource clusterBuffer, clusterTexture;
+	GpuResource indexBuffer, indexTexture;
+	size_t lightCapacity = 0;
+	size_t indexCapacity = 0;
+	GLuint firstTextureUnit = 0;
+
+	// Uniform handles in the shader program last bound with, looked up again only when the program changes
+	mutable GLuint handleProgram = 0;
+	mutable UniformHandle lightDataHandle = -1, clusterGridHandle = -1, lightIndicesHandle = -1, parametersHandle = -1;
+
+	// Work of the current frame
+	static LightClusterStats frameStats;
+
+	// Compute the bounds of the clusters for a projection
+	void buildClusterBoxes(const glm::mat4 &projection, float nearPlane, float farPlane);
+
+	// Assign the lights to the clusters of one depth slice, runs on the thread pool
+	void assignSlice(int slice);
+
+	// Merge the slices into the uploaded data, keeping only the lights that are referenced
+	void gatherResults();
+
+	// Upload the gathered data to the texture buffers, growing them as needed
+	void upload();
+
+	// Append the lights of a list whose spheres overlap a box to another list
+	static void cullLights(const LightList &lights, const Box &box, LightList &result);
+};
+
+
+//------------------------------------------
+// Lights of the scenes using the clusters
+//------------------------------------------
+
+// Point lights of a scene: the first ones are the MAX_POINT_LIGHTS given ones of its lighting scheme, and the rest are dim, short range
+// lights of random colors, scattered in a volume growing with their amount so that about as many reach any point (density per cubic unit)
+// A fixed seed keeps the layout the same between runs so measurements are comparable
+void scatterPointLights(const glm::vec3 *positions, const glm::vec3 *colors, const glm::vec3 *speculars, int count, float density,
+	std::vector<ClusteredPointLight> &lights);
+
+// Pass the lights of a scene's lighting scheme to the lighting buffer: the directional light, the MAX_POINT_LIGHTS given point lights and
+// the flashlight, which sits at the camera pointing forward so it's given directly in view space. Returns the distance the flashlight reaches
+float setSceneLights(LightingBuffer &lightingBuffer, const glm::vec3 &directionalDirection, const glm::vec3 &directionalColor, const glm::vec3 &directionalSpecular,
+	const glm::vec3 *pointPositions, const glm::vec3 *pointColors, const glm::vec3 *pointSpeculars,
+	const glm::vec3 &spotColor, const glm::vec3 &spotSpecular, float spotInnerCutOff, float spotOuterCutOff);
+
+#endif
\ No newline at end of file
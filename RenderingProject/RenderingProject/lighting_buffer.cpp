@@ -0,0 +1,138 @@
+#include "lighting_buffer.h"
+#include "gl_state.h"
+
+using namespace std;
+using namespace glm;
+
+
+static_assert(sizeof(DirectionalLightStd140) == 64, "DirectionalLightStd140 doesn't match the std140 layout");
+static_assert(sizeof(PointLightStd140) == 64, "PointLightStd140 doesn't match the std140 layout");
+static_assert(sizeof(SpotLightStd140) == 80, "SpotLightStd140 doesn't match the std140 layout");
+
+
+unsigned LightingBuffer::frameUploads = 0;
+
+
+ShaderDefines LitObjectFeatures::getDefines() const
+{
+	ShaderDefines defines;
+	defines["POINT_LIGHT_COUNT"] = to_string(clusteredLights ? 0 : pointLightCount);
+	defines["SPOT_LIGHT"] = spotLight ? "1" : "0";
+	defines["EMISSION"] = emission ? "1" : "0";
+	defines["SPECULAR_MAP"] = specularMap ? "1" : "0";
+	defines["CLUSTERED_LIGHTS"] = clusteredLights ? "1" : "0";
+	defines["SHADOWS"] = shadows ? "1" : "0";
+	return defines;
+}
+
+
+ShaderDefines LitObjectFeatures::getMaterialDefines() const
+{
+	ShaderDefines defines;
+	defines["EMISSION"] = emission ? "1" : "0";
+	defines["SPECULAR_MAP"] = specularMap ? "1" : "0";
+	return defines;
+}
+
+
+LightingBuffer::LightingBuffer(GLuint bindingPoint) :
+	lights(),
+	uploadedView(1.0f),
+	dirty(true),
+	bindingPoint(bindingPoint)
+{
+	UBO = GpuResource(GPU_RESOURCE_BUFFER);
+	GlState::global().bindBuffer(GL_UNIFORM_BUFFER, UBO.get());
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightingBlockStd140), NULL, GL_DYNAMIC_DRAW);
+	UBO.setMemory(sizeof(LightingBlockStd140));
+	GlState::global().bindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+
+void LightingBuffer::setDirectionalLight(vec3 direction, vec3 ambient, vec3 diffuse, vec3 specular)
+{
+	DirectionalLightStd140 &light = lights.directionalLight;
+	assign(light.direction, direction);
+	assign(light.ambient, ambient);
+	assign(light.diffuse, diffuse);
+	assign(light.specular, specular);
+}
+
+
+void LightingBuffer::setPointLight(int index, vec3 position, vec3 ambient, vec3 diffuse, vec3 specular, float constant, float linear, float quadratic)
+{
+	PointLightStd140 &light = lights.pointLights[index];
+	assign(light.position, position);
+	assign(light.ambient, ambient);
+	assign(light.diffuse, diffuse);
+	assign(light.specular, specular);
+	assign(light.constant, constant);
+	assign(light.linear, linear);
+	assign(light.quadratic, quadratic);
+}
+
+
+void LightingBuffer::setSpotLight(vec3 position, vec3 direction, vec3 ambient, vec3 diffuse, vec3 specular, float constant, float linear, float quadratic, float innerCutOff, float outerCutOff)
+{
+	SpotLightStd140 &light = lights.spotLight;
+	assign(light.position, position);
+	assign(light.direction, direction);
+	assign(light.ambient, ambient);
+	assign(light.diffuse, diffuse);
+	assign(light.specular, specular);
+	assign(light.constant, constant);
+	assign(light.linear, linear);
+	assign(light.quadratic, quadratic);
+	assign(light.innerCutOff, innerCutOff);
+	assign(light.outerCutOff, outerCutOff);
+}
+
+
+void LightingBuffer::update(const mat4 &view)
+{
+	GlState::global().bindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, UBO.get());
+
+	if (!dirty && view == uploadedView)
+	{
+		return;
+	}
+
+	// Lighting is calculated in view space, so transform world space positions and directions
+	LightingBlockStd140 block = lights;
+	block.directionalLight.direction = vec3(view * vec4(lights.directionalLight.direction, 0.0f));
+	for (int i = 0; i < MAX_POINT_LIGHTS; i++)
+	{
+		block.pointLights[i].position = vec3(view * vec4(lights.pointLights[i].position, 1.0f));
+	}
+
+	GlState::global().bindBuffer(GL_UNIFORM_BUFFER, UBO.get());
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+	GlState::global().bindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	uploadedView = view;
+	dirty = false;
+	frameUploads++;
+}
+
+
+unsigned LightingBuffer::getFrameUploads()
+{
+	return frameUploads;
+}
+
+
+void LightingBuffer::resetFrameStats()
+{
+	frameUploads = 0;
+}
+
+
+template <typename T>
+void LightingBuffer::assign(T &target, const T &value)
+{
+	if (target != value)
+	{
+		target = value;
+		dirty = true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,130 @@
+#ifndef LIGHTING_BUFFER_H
+#define LIGHTING_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "gpu_resource.h"
+#include "shader.h"
+
+
+// Binding point of the lighting uniform block, shared by every shader that declares it
+const GLuint LIGHTING_BINDING_POINT = 0;
+
+// Amount of point lights in the lighting uniform block, must match NR_POINT_LIGHTS in the shaders
+const int MAX_POINT_LIGHTS = 4;
+
+
+// Features of the lit object shader (frag_lightSceneLitObject.fs) that can be compiled out
+// Scenes use the permutation with only the features they currently need, so disabled ones cost nothing on the GPU
+struct LitObjectFeatures {
+	int pointLightCount = MAX_POINT_LIGHTS;  // Point lights evaluated, the first ones in the lighting buffer
+	bool spotLight = true;     // Flashlight
+	bool emission = true;      // Emission map scaled by material.emissionIntensity
+	bool specularMap = true;   // Specular highlights sampled from material.texture_specular1, none without it
+	bool clusteredLights = false;  // Point lights come from light clusters instead of the lighting buffer (pointLightCount is ignored)
+	bool shadows = false;      // Directional light shadowed by cascaded shadow maps (see CascadedShadowMaps::bind)
+
+	// Definitions selecting the permutation with these features
+	ShaderDefines getDefines() const;
+
+	// Definitions of the material features alone, for the G-buffer shader of deferred shading (frag_lightSceneGBuffer.fs),
+	// which leaves the lights to the deferred renderer
+	ShaderDefines getMaterialDefines() const;
+};
+
+
+// CPU side mirrors of the light structs in the "Lighting" uniform block (std140 layout)
+// Every vec3 is followed by a float to fill the 16 byte alignment std140 gives it
+struct DirectionalLightStd140 {
+	glm::vec3 direction;
+	float padding0;
+	glm::vec3 ambient;
+	float padding1;
+	glm::vec3 diffuse;
+	float padding2;
+	glm::vec3 specular;
+	float padding3;
+};
+
+struct PointLightStd140 {
+	glm::vec3 position;
+	float constant;
+	glm::vec3 ambient;
+	float linear;
+	glm::vec3 diffuse;
+	float quadratic;
+	glm::vec3 specular;
+	float padding0;
+};
+
+struct SpotLightStd140 {
+	glm::vec3 position;
+	float constant;
+	glm::vec3 direction;
+	float linear;
+	glm::vec3 ambient;
+	float quadratic;
+	glm::vec3 diffuse;
+	float innerCutOff;
+	glm::vec3 specular;
+	float outerCutOff;
+};
+
+struct LightingBlockStd140 {
+	DirectionalLightStd140 directionalLight;
+	PointLightStd140 pointLights[MAX_POINT_LIGHTS];
+	SpotLightStd140 spotLight;
+};
+
+
+// Uniform buffer holding the light properties of a scene
+// Lights are given in world space (except for the spotlight, which is attached to the camera and given in view space),
+// and the buffer is transformed to view space and re-uploaded only when the lights or the view matrix change
+class LightingBuffer
+{
+public:
+	// Uniform buffer
+	GpuResource UBO;
+
+	// Constructor to generate the buffer
+	LightingBuffer(GLuint bindingPoint);
+
+	// Default constructor
+	LightingBuffer() = default;
+
+	// Light setters, these only mark the buffer for upload if a value actually changed
+	void setDirectionalLight(glm::vec3 direction, glm::vec3 ambient, glm::vec3 diffuse, glm::vec3 specular);
+	void setPointLight(int index, glm::vec3 position, glm::vec3 ambient, glm::vec3 diffuse, glm::vec3 specular, float constant, float linear, float quadratic);
+	void setSpotLight(glm::vec3 position, glm::vec3 direction, glm::vec3 ambient, glm::vec3 diffuse, glm::vec3 specular, float constant, float linear, float quadratic, float innerCutOff, float outerCutOff);
+
+	// Upload the buffer if needed and bind it to its binding point. Should be called every frame before rendering lit objects
+	void update(const glm::mat4 &view);
+
+	// Amount of buffer uploads done during the current frame, by all lighting buffers
+	static unsigned getFrameUploads();
+
+	// Reset upload counts, should be called at the start of every frame
+	static void resetFrameStats();
+
+
+private:
+	// Light properties as they were set
+	LightingBlockStd140 lights;
+
+	// View matrix used for the data currently in the buffer
+	glm::mat4 uploadedView;
+
+	// Whether lights changed since the last upload
+	bool dirty = true;
+
+	GLuint bindingPoint;
+
+	// Upload count of the current frame
+	static unsigned frameUploads;
+
+	// Copy a value into the light properties, marking the buffer dirty if it differs
+	template <typename T>
+	void assign(T &target, const T &value);
+};
+
+#endif
\ No newline at end of file
@@ -5,6 +5,20 @@
 #include <iostream>
 #include <vector>
 #include "shader.h"
+#include "lighting_buffer.h"
+#include "light_clusters.h"
+#include "deferred_renderer.h"
+#include "cascaded_shadow_maps.h"
+#include "frustum_culling.h"
+#include "occlusion_culling.h"
+#include "render_queue.h"
+#include "texture_cache.h"
+#include "gpu_memory.h"
+#include "geometry_arena.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "program_cache.h"
+#include "model.h"
 #include "camera.h"
 #include "scenes/scene.h"
 #include "scenes/box_scene.h"
@@ -22,6 +36,9 @@ using namespace glm;
 Camera camera;
 vector<Scene *> scenes;
 
+// Names of the scenes, also the owners their GPU resources are attributed to
+const char *sceneNames[] = { "BoxScene", "LightScene", "BackpackScene" };
+
 
 //----------------
 // State variables
@@ -43,7 +60,21 @@ bool prevSceneKeyAlreadyPressed = false;
 bool upKeyAlreadyPressed = false;
 bool downKeyAlreadyPressed = false;
 bool wireframeKeyAlreadyPressed = false;
+bool multiDrawKeyAlreadyPressed = false;
+bool frustumCullingKeyAlreadyPressed = false;
+bool occlusionCullingKeyAlreadyPressed = false;
 bool flashlightKeyAlreadyPressed = false;
+bool lightCountKeyAlreadyPressed = false;
+bool clusteredLightingKeyAlreadyPressed = false;
+bool deferredShadingKeyAlreadyPressed = false;
+bool depthPrepassKeyAlreadyPressed = false;
+bool shadowsKeyAlreadyPressed = false;
+bool statsKeyAlreadyPressed = false;
+bool moreObjectsKeyAlreadyPressed = false;
+bool fewerObjectsKeyAlreadyPressed = false;
+bool reloadKeyAlreadyPressed = false;
+
+bool printStats = false;  // Print statistics of the current frame once it has been rendered
 
 
 // Viewport resizing when the window is resized
@@ -80,13 +111,64 @@ void scrollCallback(GLFWwindow* window, double xOffset, double yOffset)
 }
 
 
+// Create a scene, attributing the GPU resources it creates to its name
+Scene *createScene(GLFWwindow *window, int index)
+{
+	GpuMemoryScope scope(sceneNames[index]);
+	switch (index)
+	{
+	case 0:
+		return new BoxScene(window, &camera);
+	case 1:
+		return new LightScene(window, &camera);
+	default:
+		return new BackpackScene(window, &camera);
+	}
+}
+
+
+// Delete a scene and create it anew, then check that deleting it released all of its GPU resources
+void reloadScene(GLFWwindow *window, int index)
+{
+	delete scenes[index];
+	scenes[index] = NULL;
+	GeometryArena::compactAll();
+
+	// Textures come from the texture cache, so the ones still in use by another scene stay alive
+	GpuMemoryStats remaining = GpuMemoryRegistry::global().getOwnerStats(sceneNames[index]);
+	if (remaining.bufferCount > 0 || remaining.vertexArrayCount > 0 || remaining.programCount > 0)
+	{
+		cerr << "ERROR::GPU_MEMORY::LEAK " << sceneNames[index] << " left " << remaining.bufferCount << " buffers (" << remaining.bufferBytes << " bytes), "
+			<< remaining.vertexArrayCount << " vertex arrays and " << remaining.programCount << " programs behind" << endl;
+	}
+	if (remaining.textureCount > 0)
+	{
+		cout << "GPU memory: " << remaining.textureCount << " textures of " << sceneNames[index] << " are still used elsewhere" << endl;
+	}
+
+	scenes[index] = createScene(window, index);
+	cout << "Reloaded " << sceneNames[index] << endl;
+}
+
+
 // Keyboard handling
 // ESC - exit program
 // Right/Left arrow - previous/next scene
 // Up/Down arrow - cycle variants of scene
 // WASD - move camera
 // M - toggle rendering mode (solid / wireframe)
+// I - toggle multi-draw submission of models (one indirect draw per material instead of one draw per mesh)
+// V - toggle frustum culling of objects outside the view
+// O - toggle occlusion culling of objects hidden behind nearer ones (in scenes that support it)
 // F - toggle flashlight (in scenes that support it)
+// L - cycle the amount of point lights switched on, from none up to 65536 (in scenes that support it)
+// C - toggle clustered lighting, always on with more point lights than the lighting buffer holds (in scenes that support it)
+// G - toggle deferred shading, lighting objects after they're all drawn instead of while drawing them (in scenes that support it)
+// Z - toggle the depth pre-pass, laying down depth first so only visible fragments get shaded (in scenes that support it)
+// H - toggle shadows of the directional light (in scenes that support it)
+// P - print statistics of the current frame
+// R - reload the current scene, reporting any GPU resources it leaked
+// +/- - increase/decrease the amount of objects (in scenes that support it)
 // Page up/down - functionality varies per scene
 void processInput(GLFWwindow *window)
 {
@@ -194,6 +276,52 @@ void processInput(GLFWwindow *window)
 		wireframeKeyAlreadyPressed = false;
 	}
 
+	// I
+	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
+	{
+		if (!multiDrawKeyAlreadyPressed)
+		{
+			Model::setMultiDrawEnabled(!Model::isMultiDrawEnabled());
+			cout << "Multi-draw " << (Model::isMultiDrawEnabled() ? "enabled" : "disabled")
+				<< (MultiDrawBatch::isSupported() ? "" : " (not supported, meshes are drawn one by one)") << endl;
+			multiDrawKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_I) == GLFW_RELEASE)
+	{
+		multiDrawKeyAlreadyPressed = false;
+	}
+
+	// V
+	if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS)
+	{
+		if (!frustumCullingKeyAlreadyPressed)
+		{
+			FrustumCuller::setEnabled(!FrustumCuller::isEnabled());
+			cout << "Frustum culling " << (FrustumCuller::isEnabled() ? "enabled" : "disabled") << endl;
+			frustumCullingKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_V) == GLFW_RELEASE)
+	{
+		frustumCullingKeyAlreadyPressed = false;
+	}
+
+	// O
+	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS)
+	{
+		if (!occlusionCullingKeyAlreadyPressed)
+		{
+			OcclusionCuller::setEnabled(!OcclusionCuller::isEnabled());
+			cout << "Occlusion culling " << (OcclusionCuller::isEnabled() ? "enabled" : "disabled") << endl;
+			occlusionCullingKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_O) == GLFW_RELEASE)
+	{
+		occlusionCullingKeyAlreadyPressed = false;
+	}
+
 	// F
 	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS)
 	{
@@ -208,6 +336,133 @@ void processInput(GLFWwindow *window)
 		flashlightKeyAlreadyPressed = false;
 	}
 
+	// L
+	if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS)
+	{
+		if (!lightCountKeyAlreadyPressed)
+		{
+			scenes[currentScene]->handleKey(GLFW_KEY_L, deltaTime);
+			lightCountKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_L) == GLFW_RELEASE)
+	{
+		lightCountKeyAlreadyPressed = false;
+	}
+
+	// C
+	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS)
+	{
+		if (!clusteredLightingKeyAlreadyPressed)
+		{
+			scenes[currentScene]->handleKey(GLFW_KEY_C, deltaTime);
+			clusteredLightingKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_C) == GLFW_RELEASE)
+	{
+		clusteredLightingKeyAlreadyPressed = false;
+	}
+
+	// G
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS)
+	{
+		if (!deferredShadingKeyAlreadyPressed)
+		{
+			scenes[currentScene]->handleKey(GLFW_KEY_G, deltaTime);
+			deferredShadingKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_G) == GLFW_RELEASE)
+	{
+		deferredShadingKeyAlreadyPressed = false;
+	}
+
+	// H
+	if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS)
+	{
+		if (!shadowsKeyAlreadyPressed)
+		{
+			scenes[currentScene]->handleKey(GLFW_KEY_H, deltaTime);
+			shadowsKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_H) == GLFW_RELEASE)
+	{
+		shadowsKeyAlreadyPressed = false;
+	}
+
+	// Z
+	if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS)
+	{
+		if (!depthPrepassKeyAlreadyPressed)
+		{
+			RenderQueue::setDepthPrepassEnabled(!RenderQueue::isDepthPrepassEnabled());
+			cout << "Depth pre-pass " << (RenderQueue::isDepthPrepassEnabled() ? "enabled" : "disabled") << endl;
+			depthPrepassKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_RELEASE)
+	{
+		depthPrepassKeyAlreadyPressed = false;
+	}
+
+	// P
+	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
+	{
+		if (!statsKeyAlreadyPressed)
+		{
+			printStats = true;
+			statsKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_P) == GLFW_RELEASE)
+	{
+		statsKeyAlreadyPressed = false;
+	}
+
+	// Plus (on the main keyboard, shares the key with equals)
+	if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS)
+	{
+		if (!moreObjectsKeyAlreadyPressed)
+		{
+			scenes[currentScene]->handleKey(GLFW_KEY_EQUAL, deltaTime);
+			moreObjectsKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_RELEASE)
+	{
+		moreObjectsKeyAlreadyPressed = false;
+	}
+
+	// Minus
+	if (glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS)
+	{
+		if (!fewerObjectsKeyAlreadyPressed)
+		{
+			scenes[currentScene]->handleKey(GLFW_KEY_MINUS, deltaTime);
+			fewerObjectsKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_RELEASE)
+	{
+		fewerObjectsKeyAlreadyPressed = false;
+	}
+
+	// R
+	if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS)
+	{
+		if (!reloadKeyAlreadyPressed)
+		{
+			reloadScene(window, currentScene);
+			reloadKeyAlreadyPressed = true;
+		}
+	}
+	else if (glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE)
+	{
+		reloadKeyAlreadyPressed = false;
+	}
+
 	// Page up
 	if (glfwGetKey(window, GLFW_KEY_PAGE_UP) == GLFW_PRESS)
 	{
@@ -222,6 +477,118 @@ void processInput(GLFWwindow *window)
 }
 
 
+// Print statistics collected while rendering the current frame
+void printFrameStats()
+{
+	const UniformStats &uniformStats = Shader::getFrameStats();
+
+	cout << "Frame time: " << deltaTime * 1000.0f << " ms" << endl;
+	cout << "Uniform uploads: " << uniformStats.issued << " issued, " << uniformStats.skipped << " skipped" << endl;
+	cout << "Lighting buffer uploads: " << LightingBuffer::getFrameUploads() << endl;
+
+	const LightClusterStats &clusterStats = LightClusters::getFrameStats();
+	if (clusterStats.updates > 0)
+	{
+		cout << "Light clusters: " << clusterStats.lights << " lights, " << clusterStats.visibleLights << " visible, " << clusterStats.lightIndices << " indices ("
+			<< clusterStats.maxClusterLights << " in the fullest cluster), assigned in " << clusterStats.assignTimeMs << " ms" << endl;
+	}
+
+	const DeferredShadingStats &deferredStats = DeferredRenderer::getFrameStats();
+	if (deferredStats.shadingPasses > 0)
+	{
+		cout << "Deferred shading: " << deferredStats.pointLightVolumes << " point light volumes, " << deferredStats.spotLightVolumes << " spotlight volumes, "
+			<< deferredStats.gBufferBytes / (1024.0f * 1024.0f) << " MB of G-buffer" << endl;
+	}
+
+	const ShadowStats &shadowStats = CascadedShadowMaps::getFrameStats();
+	if (shadowStats.cascadesDrawn + shadowStats.cascadesCached + shadowStats.cascadesSkipped > 0)
+	{
+		cout << "Shadows: " << shadowStats.cascadesDrawn << " cascades drawn, " << shadowStats.cascadesCached << " cached, " << shadowStats.cascadesSkipped
+			<< " waiting for their time slice, " << shadowStats.casters << " casters drawn in " << shadowStats.drawTimeMs << " ms" << endl;
+	}
+
+	const FrustumCullingStats &cullingStats = FrustumCuller::getFrameStats();
+	if (cullingStats.tested > 0)
+	{
+		cout << "Frustum culling: " << cullingStats.tested - cullingStats.culled << " objects drawn, " << cullingStats.culled << " culled"
+			<< (FrustumCuller::isEnabled() ? "" : " (disabled)") << ", tested in " << cullingStats.cullTimeMs << " ms" << endl;
+	}
+
+	const OcclusionCullingStats &occlusionStats = OcclusionCuller::getFrameStats();
+	if (occlusionStats.occludees > 0)
+	{
+		cout << "Occlusion culling: " << occlusionStats.occluderTriangles << " occluder triangles rasterized in " << occlusionStats.occluderTimeMs
+			<< " ms, " << occlusionStats.occluded << " of " << occlusionStats.occludees << " objects hidden, tested in "
+			<< occlusionStats.occludeeTimeMs << " ms" << endl;
+	}
+
+	const TextureCacheStats &textureStats = TextureCache::global().getStats();
+	cout << "Texture cache: " << textureStats.textureCount << " textures, " << textureStats.memoryBytes / (1024.0f * 1024.0f) << " MB, "
+		<< textureStats.hits << " hits, " << textureStats.misses << " misses" << endl;
+
+	const float megabyte = 1024.0f * 1024.0f;
+	GpuMemoryStats gpuStats = GpuMemoryRegistry::global().getStats();
+	cout << "GPU memory: " << (gpuStats.bufferBytes + gpuStats.textureBytes) / megabyte << " MB in " << gpuStats.bufferCount << " buffers and "
+		<< gpuStats.textureCount << " textures, " << gpuStats.vertexArrayCount << " vertex arrays, " << gpuStats.programCount << " programs, "
+		<< gpuStats.framebufferCount << " framebuffers, " << gpuStats.queryCount << " queries" << endl;
+
+	map<string, GpuMemoryStats> ownerStats = GpuMemoryRegistry::global().getStatsPerOwner();
+	for (map<string, GpuMemoryStats>::const_iterator it = ownerStats.begin(); it != ownerStats.end(); ++it)
+	{
+		cout << "  " << (it->first.empty() ? "(no owner)" : it->first) << ": " << it->second.bufferBytes / megabyte << " MB buffers, "
+			<< it->second.textureBytes / megabyte << " MB textures" << endl;
+	}
+
+	const char *formatNames[] = { "float", "packed" };
+	for (int format = 0; format < VERTEX_FORMAT_COUNT; format++)
+	{
+		GeometryArenaStats arenaStats = GeometryArena::global((VertexFormat)format).getStats();
+		cout << "Geometry arena (" << formatNames[format] << " vertices): " << arenaStats.allocationCount << " meshes in " << arenaStats.blockCount << " blocks, "
+			<< (arenaStats.vertexBytes + arenaStats.indexBytes) / megabyte << " of " << (arenaStats.vertexCapacityBytes + arenaStats.indexCapacityBytes) / megabyte << " MB used, "
+			<< arenaStats.compactions << " compactions" << endl;
+	}
+
+	const ProgramCacheStats &programStats = ProgramCache::global().getStats();
+	if (ProgramCache::isSupported())
+	{
+		cout << "Program cache: " << programStats.hits << " hits, " << programStats.misses << " misses (" << programStats.rejected << " rejected), "
+			<< programStats.loadTimeMs << " ms loading, " << programStats.compileTimeMs << " ms compiling" << endl;
+	}
+	else
+	{
+		cout << "Program cache: not supported by the driver, " << programStats.misses << " programs compiled in " << programStats.compileTimeMs << " ms" << endl;
+	}
+
+	const GlStateStats &stateStats = GlState::global().getFrameStats();
+	cout << "GL state changes: " << stateStats.issued << " issued, " << stateStats.filtered << " filtered" << endl;
+
+	const RenderQueueStats &queueStats = RenderQueue::getFrameStats();
+	if (queueStats.items > 0)
+	{
+		cout << "Render queue: " << queueStats.items << " items sorted in " << queueStats.sortTimeMs << " ms, " << queueStats.drawCalls << " draw calls, "
+			<< queueStats.stateChanges << " state changes, " << queueStats.stateSkips << " skipped" << endl;
+	}
+
+	// Fragment counts arrive a frame or two late, averaged over the passes whose results came in this frame
+	if (queueStats.measuredPasses > 0)
+	{
+		uint64_t shadedFragments = queueStats.shadedFragments / queueStats.measuredPasses;
+		cout << "Fragments shaded (" << sceneNames[currentScene] << "): " << shadedFragments << " per pass";
+		if (queueStats.measuredPrepasses > 0)
+		{
+			uint64_t prepassFragments = queueStats.prepassFragments / queueStats.measuredPrepasses;
+			cout << " after a depth pre-pass of " << queueStats.prepassDraws << " draws, " << prepassFragments << " without it ("
+				<< (prepassFragments > 0 ? 100.0 * (1.0 - (double)shadedFragments / prepassFragments) : 0.0) << "% saved)";
+		}
+		cout << endl;
+	}
+
+	const LodStats &lodStats = Model::getFrameStats();
+	cout << "Model triangles: " << lodStats.drawnTriangles << " drawn, " << lodStats.fullDetailTriangles << " at full detail, "
+		<< lodStats.drawCalls << " draw calls" << (Model::isMultiDrawEnabled() && MultiDrawBatch::isSupported() ? " (multi-draw)" : "") << endl;
+}
+
+
 //--------------
 // Main function
 //--------------
@@ -252,15 +619,17 @@ int main()
 		glfwTerminate();
 		return -1;
 	}
+	loadGlExtensions((GLADloadproc)glfwGetProcAddress);
 
 	// Capture cursor
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 	// Initialize camera and scenes
 	camera = Camera(vec3(0.0f, 0.0f, 3.0f));
-	scenes.push_back(new BoxScene(window, &camera));
-	scenes.push_back(new LightScene(window, &camera));
-	scenes.push_back(new BackpackScene(window, &camera));
+	for (int i = 0; i < (int)size(sceneNames); i++)
+	{
+		scenes.push_back(createScene(window, i));
+	}
 
 	// Setup callbacks
 	glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
@@ -268,7 +637,7 @@ int main()
 	glfwSetScrollCallback(window, scrollCallback);
 
 	// Enable depth testing
-	glEnable(GL_DEPTH_TEST);
+	GlState::global().enable(GL_DEPTH_TEST);
 
 
 	//------------
@@ -285,17 +654,8 @@ int main()
 		// Input handling
 		processInput(window);
 
-		// Rendering commands
-		glClearColor(0.05f, 0.05f, 0.1f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		if (drawWireframe) {
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		}
-		else
-		{
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		}
+		// Rendering commands, clearing is up to the scene since it knows its background color
+		GlState::global().polygonMode(drawWireframe ? GL_LINE : GL_FILL);
 
 		// Update camera position
 		camera.updatePosition(deltaTime);
@@ -303,11 +663,39 @@ int main()
 		// Render the currently active scene
 		scenes[currentScene]->render();
 
+		// Report and reset per-frame statistics
+		if (printStats)
+		{
+			printFrameStats();
+			printStats = false;
+		}
+		Shader::resetFrameStats();
+		LightingBuffer::resetFrameStats();
+		LightClusters::resetFrameStats();
+		DeferredRenderer::resetFrameStats();
+		CascadedShadowMaps::resetFrameStats();
+		FrustumCuller::resetFrameStats();
+		OcclusionCuller::resetFrameStats();
+		RenderQueue::resetFrameStats();
+		Model::resetFrameStats();
+		GlState::global().resetFrameStats();
+
+		// Close the gaps left in the geometry arenas by meshes deleted this frame
+		GeometryArena::compactAll();
+
 		// Check and call events and swap buffers
 		glfwPollEvents();
 		glfwSwapBuffers(window);
 	}
 
+	// Scenes release their GPU resources and the geometry arenas their emptied blocks, which needs the context to still be there
+	for (size_t i = 0; i < scenes.size(); i++)
+	{
+		delete scenes[i];
+	}
+	scenes.clear();
+	GeometryArena::compactAll();
+
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	return 0;
@@ -0,0 +1,42 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+
+// Read-only memory mapping of a whole file, unmapped when the object is destroyed
+class MappedFile
+{
+public:
+	// Default constructor, nothing is mapped until open is called
+	MappedFile() = default;
+
+	// Destructor unmaps the file
+	~MappedFile();
+
+	// Mappings own OS handles, so they can't be copied
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	// Map a file, returns false if it doesn't exist or is empty
+	bool open(const std::string &path);
+
+	// Unmap the file, called automatically on destruction
+	void close();
+
+	// Start and size of the mapped file contents
+	const unsigned char *getData() const;
+	size_t getSize() const;
+
+
+private:
+	const unsigned char *data = nullptr;
+	size_t size = 0;
+
+	// Handles kept open for the lifetime of the mapping on Windows
+	void *fileHandle = nullptr;
+	void *mappingHandle = nullptr;
+};
+
+#endif
\ No newline at end of file
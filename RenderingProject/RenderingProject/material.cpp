@@ -0,0 +1,109 @@
+#include "material.h"
+#include <atomic>
+#include "gl_state.h"
+
+using namespace std;
+
+
+TextureType getTextureType(const string &typeName)
+{
+	if (typeName == "texture_diffuse")
+	{
+		return TEXTURE_DIFFUSE;
+	}
+	if (typeName == "texture_specular")
+	{
+		return TEXTURE_SPECULAR;
+	}
+	return TEXTURE_OTHER;
+}
+
+
+Material::Material(vector<Texture> textures)
+{
+	this->textures = std::move(textures);
+
+	// Retrieve texture numbers (the N in diffuse_textureN), which count up per type
+	unsigned diffuseNr = 1;
+	unsigned specularNr = 1;
+	for (size_t i = 0; i < this->textures.size(); i++)
+	{
+		const Texture &texture = this->textures[i];
+
+		Binding binding;
+		binding.texture = texture.ID;
+		binding.type = getTextureType(texture.type);
+		binding.samplerName = "material." + texture.type;
+		if (binding.type == TEXTURE_DIFFUSE)
+		{
+			binding.samplerName += to_string(diffuseNr++);
+		}
+		else if (binding.type == TEXTURE_SPECULAR)
+		{
+			binding.samplerName += to_string(specularNr++);
+		}
+		bindings.push_back(binding);
+	}
+	samplerHandles.resize(bindings.size(), -1);
+}
+
+
+void Material::bind(Shader &shader, const Material *previous) const
+{
+	if (previous == this)
+	{
+		return;
+	}
+
+	if (handleProgram != shader.ID.get())
+	{
+		handleProgram = shader.ID.get();
+		for (size_t i = 0; i < bindings.size(); i++)
+		{
+			samplerHandles[i] = shader.getUniformHandle(bindings[i].samplerName);
+		}
+	}
+
+	for (size_t i = 0; i < bindings.size(); i++)
+	{
+		// Sampler values rarely change between materials, the shader skips setting them again
+		shader.setInt(samplerHandles[i], (int)i);
+		GlState::global().bindTextureUnit((GLuint)i, GL_TEXTURE_2D, bindings[i].texture);
+	}
+}
+
+
+const vector<Texture> &Material::getTextures() const
+{
+	return textures;
+}
+
+
+bool Material::hasTextures(const vector<Texture> &textures) const
+{
+	if (textures.size() != this->textures.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < textures.size(); i++)
+	{
+		if (textures[i].ID != this->textures[i].ID || textures[i].type != this->textures[i].type)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+uint32_t Material::getSortId() const
+{
+	return sortId;
+}
+
+
+uint32_t Material::allocateSortId()
+{
+	static atomic<uint32_t> nextSortId(1);
+	return nextSortId++;
+}
\ No newline at end of file
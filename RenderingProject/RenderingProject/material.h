@@ -0,0 +1,76 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "shader.h"
+#include "texture_cache.h"
+
+
+struct Texture {
+	GLuint ID;
+	TextureRef ref;  // Keeps the texture alive in the texture cache
+	std::string type;
+	std::string path;
+};
+
+
+// Kinds of textures a material can have, the shader samples each kind through numbered samplers (material.texture_diffuse1, ...)
+enum TextureType {
+	TEXTURE_DIFFUSE,
+	TEXTURE_SPECULAR,
+	TEXTURE_OTHER   // Sampled through a single unnumbered sampler named after its type
+};
+
+// Kind of a texture from its type name, as used by Assimp import ("texture_diffuse", ...)
+TextureType getTextureType(const std::string &typeName);
+
+
+// Set of textures a mesh is drawn with, with the texture unit and shader sampler of each one worked out when it's created
+// so that binding it for a draw needs no string work or allocations
+class Material
+{
+public:
+	// Constructor assigns the textures to units in order and names their samplers
+	explicit Material(std::vector<Texture> textures);
+
+	// Default constructor, a material without textures
+	Material() = default;
+
+	// Bind the textures to their units and point the shader's samplers at them
+	// Does nothing if previous is this material, i.e. the previous draw with this shader already bound it
+	void bind(Shader &shader, const Material *previous = nullptr) const;
+
+	// Textures of the material, in the order of their units
+	const std::vector<Texture> &getTextures() const;
+
+	// Whether the material consists of exactly these textures
+	bool hasTextures(const std::vector<Texture> &textures) const;
+
+	// Number of the material, unique among the materials created so far, used to group draws by material when sorting them
+	uint32_t getSortId() const;
+
+
+private:
+	// Texture with its sampler, bound to the unit of its index
+	struct Binding {
+		GLuint texture;
+		TextureType type;
+		std::string samplerName;
+	};
+
+	std::vector<Texture> textures;
+	std::vector<Binding> bindings;
+	uint32_t sortId = allocateSortId();
+
+	// Sampler handles in the shader program last bound with, looked up again only when the program changes
+	mutable GLuint handleProgram = 0;
+	mutable std::vector<UniformHandle> samplerHandles;
+
+	// Hand out the next sort id, starting at 1 (0 is left for draws without a material)
+	static uint32_t allocateSortId();
+};
+
+#endif
\ No newline at end of file
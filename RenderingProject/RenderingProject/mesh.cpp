@@ -1,72 +1,265 @@
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "gl_state.h"
 #include "mesh.h"
 
 using namespace std;
 
 
-Mesh::Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures)
+// Map a unit vector onto the octahedron |x| + |y| + |z| = 1 and unfold that onto the [-1, 1] square
+static glm::vec2 octahedralEncode(glm::vec3 normal)
 {
-	this->vertices = vertices;
-	this->indices = indices;
-	this->textures = textures;
+	float manhattanLength = fabs(normal.x) + fabs(normal.y) + fabs(normal.z);
+	if (manhattanLength == 0.0f)
+	{
+		return glm::vec2(0.0f);
+	}
+	normal /= manhattanLength;
 
-	setupMesh();
+	glm::vec2 encoded(normal.x, normal.y);
+	if (normal.z < 0.0f)
+	{
+		// The lower half gets folded over the diagonals
+		encoded.x = (1.0f - fabs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+		encoded.y = (1.0f - fabs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return encoded;
 }
 
 
-void Mesh::draw(Shader &shader) const
+Bounds computeBounds(const Vertex *vertices, size_t vertexCount)
 {
-	unsigned diffuseNr = 1;
-	unsigned specularNr = 1;
-	for (size_t i = 0; i < textures.size(); i++)
+	Bounds bounds;
+	bounds.min = vertexCount == 0 ? glm::vec3(0.0f) : vertices[0].position;
+	bounds.max = bounds.min;
+	for (size_t i = 1; i < vertexCount; i++)
 	{
-		// Activate proper texture unit before binding
-		glActiveTexture(GL_TEXTURE0 + i);
+		bounds.min = glm::min(bounds.min, vertices[i].position);
+		bounds.max = glm::max(bounds.max, vertices[i].position);
+	}
+	return bounds;
+}
 
-		// Retrieve texture number (the N in diffuse_textureN)
-		string number;
-		string name = textures[i].type;
-		if (name == "texture_diffuse")
-		{
-			number = to_string(diffuseNr++);
-		}
-		else if (name == "texture_specular")
+
+BoundingSphere computeBoundingSphere(const Vertex *vertices, size_t vertexCount, const Bounds &bounds)
+{
+	// Centered on the box rather than fitted more tightly, so culling can test both around the same center
+	BoundingSphere sphere;
+	sphere.center = (bounds.min + bounds.max) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		glm::vec3 offset = vertices[i].position - sphere.center;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	sphere.radius = sqrt(radiusSquared);
+	return sphere;
+}
+
+
+Mesh::Mesh(vector<Vertex> vertices, vector<GLuint> indices, shared_ptr<const Material> material, VertexFormat format, vector<MeshLod> lods)
+{
+	this->vertices = std::move(vertices);
+	this->indices = std::move(indices);
+	this->material = std::move(material);
+	this->format = format;
+	this->lods = std::move(lods);
+	indexCount = (GLsizei)this->indices.size();
+	setupLods();
+	bounds = computeBounds(this->vertices.data(), this->vertices.size());
+	boundingSphere = computeBoundingSphere(this->vertices.data(), this->vertices.size(), bounds);
+	setupOccluder(this->vertices.data(), this->vertices.size(), this->indices.data());
+
+	setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+}
+
+
+Mesh::Mesh(const Vertex *vertices, size_t vertexCount, const GLuint *indices, size_t indexCount, shared_ptr<const Material> material, Bounds bounds,
+	VertexFormat format, vector<MeshLod> lods)
+{
+	this->material = std::move(material);
+	this->bounds = bounds;
+	boundingSphere = computeBoundingSphere(vertices, vertexCount, bounds);
+	this->format = format;
+	this->lods = std::move(lods);
+	this->indexCount = (GLsizei)indexCount;
+	setupLods();
+	setupOccluder(vertices, vertexCount, indices);
+
+	setupMesh(vertices, vertexCount, indices, indexCount);
+}
+
+
+void Mesh::releaseCpuData()
+{
+	// Swapping with empty vectors actually frees the memory, unlike clear
+	vector<Vertex>().swap(vertices);
+	vector<GLuint>().swap(indices);
+}
+
+
+void Mesh::draw(Shader &shader, size_t lod, const Material *previousMaterial) const
+{
+	if (material)
+	{
+		material->bind(shader, previousMaterial);
+	}
+	if (handleProgram != shader.ID.get())
+	{
+		handleProgram = shader.ID.get();
+		octahedralNormalsHandle = shader.getUniformHandle("octahedralNormals");
+	}
+	shader.setBool(octahedralNormalsHandle, format == VERTEX_FORMAT_PACKED);
+
+	// The position transform is an attribute so that multi-draws can vary it per draw, a single draw sets it as a constant
+	glVertexAttrib3fv(3, glm::value_ptr(getPositionOffset()));
+	glVertexAttrib3fv(4, glm::value_ptr(getPositionScale()));
+
+	// Draw mesh, its indices are relative to its first vertex in the arena
+	GlState::global().bindVertexArray(geometry.getVertexArray());
+	glDrawElementsBaseVertex(GL_TRIANGLES, lods[lod].indexCount, GL_UNSIGNED_INT, (void*)((geometry.getFirstIndex() + lods[lod].firstIndex) * sizeof(GLuint)),
+		geometry.getBaseVertex());
+}
+
+
+void Mesh::drawPositions(size_t lod) const
+{
+	glVertexAttrib3fv(3, glm::value_ptr(getPositionOffset()));
+	glVertexAttrib3fv(4, glm::value_ptr(getPositionScale()));
+
+	// Same indices and base vertex as the full vertices, the position stream has a position for every vertex of the arena block
+	GlState::global().bindVertexArray(geometry.getPositionVertexArray());
+	glDrawElementsBaseVertex(GL_TRIANGLES, lods[lod].indexCount, GL_UNSIGNED_INT, (void*)((geometry.getFirstIndex() + lods[lod].firstIndex) * sizeof(GLuint)),
+		geometry.getBaseVertex());
+}
+
+
+const GeometryAllocation &Mesh::getGeometry() const
+{
+	return geometry;
+}
+
+
+glm::vec3 Mesh::getPositionOffset() const
+{
+	return format == VERTEX_FORMAT_PACKED ? bounds.min : glm::vec3(0.0f);
+}
+
+
+glm::vec3 Mesh::getPositionScale() const
+{
+	return format == VERTEX_FORMAT_PACKED ? bounds.max - bounds.min : glm::vec3(1.0f);
+}
+
+
+size_t Mesh::selectLod(const glm::mat4 &modelMatrix, const glm::vec3 &cameraPosition, float pixelsPerUnit, float maxPixelError) const
+{
+	// Bounding sphere in world space, scaled by the largest scale of the model matrix
+	float modelScale = sqrt(std::max(glm::dot(modelMatrix[0], modelMatrix[0]), std::max(glm::dot(modelMatrix[1], modelMatrix[1]), glm::dot(modelMatrix[2], modelMatrix[2]))));
+	glm::vec3 center = glm::vec3(modelMatrix * glm::vec4((bounds.min + bounds.max) * 0.5f, 1.0f));
+	float radius = glm::length(bounds.max - bounds.min) * 0.5f * modelScale;
+
+	// The closest point of the mesh gets the largest projected error, inside the sphere nothing can be dropped
+	float distance = glm::length(center - cameraPosition) - radius;
+	if (distance <= 0.0f)
+	{
+		return 0;
+	}
+
+	for (size_t lod = lods.size() - 1; lod > 0; lod--)
+	{
+		if (lods[lod].error * modelScale * pixelsPerUnit / distance <= maxPixelError)
 		{
-			number = to_string(specularNr++);
+			return lod;
 		}
+	}
+	return 0;
+}
+
 
-		shader.setInt(("material." + name + number).c_str(), i);
-		glBindTexture(GL_TEXTURE_2D, textures[i].ID);
+void Mesh::setupLods()
+{
+	if (lods.empty())
+	{
+		MeshLod fullDetail = { 0, indexCount, 0.0f };
+		lods.push_back(fullDetail);
 	}
+}
 
-	// Draw mesh
-	glBindVertexArray(VAO);
-	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+
+void Mesh::setupOccluder(const Vertex *vertices, size_t vertexCount, const GLuint *indices)
+{
+	size_t lod = lods.size() - 1;
+	while (lod > 0 && lods[lod].error > OCCLUDER_MAX_ERROR * boundingSphere.radius)
+	{
+		lod--;
+	}
+
+	// Only the vertices the level uses are kept, numbered in the order they're first used
+	vector<uint32_t> remap(vertexCount, UINT32_MAX);
+	occluderPositions.clear();
+	occluderIndices.resize(lods[lod].indexCount);
+	for (GLsizei i = 0; i < lods[lod].indexCount; i++)
+	{
+		GLuint index = indices[lods[lod].firstIndex + i];
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = (uint32_t)occluderPositions.size();
+			occluderPositions.push_back(vertices[index].position);
+		}
+		occluderIndices[i] = remap[index];
+	}
 }
 
 
-void Mesh::setupMesh()
+void Mesh::setupMesh(const Vertex *vertices, size_t vertexCount, const GLuint *indices, size_t indexCount)
 {
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
+	GeometryArena &arena = GeometryArena::global(format);
+	geometry = arena.allocate(vertexCount, indexCount);
+
+	if (format == VERTEX_FORMAT_PACKED)
+	{
+		vector<PackedVertex> packed = packVertices(vertices, vertexCount);
+		arena.upload(geometry, packed.data(), indices);
+	}
+	else
+	{
+		arena.upload(geometry, vertices, indices);
+	}
+}
 
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+vector<PackedVertex> Mesh::packVertices(const Vertex *vertices, size_t vertexCount) const
+{
+	// Flat meshes have no extent along some axis, their positions there all quantize to 0
+	glm::vec3 extent = bounds.max - bounds.min;
+	glm::vec3 inverseExtent;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		inverseExtent[axis] = extent[axis] > 0.0f ? 1.0f / extent[axis] : 0.0f;
+	}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+	vector<PackedVertex> packed(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		const Vertex &vertex = vertices[i];
+		PackedVertex &packedVertex = packed[i];
 
-	// Vertex positions
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-	glEnableVertexAttribArray(0);
+		glm::vec3 position = glm::clamp((vertex.position - bounds.min) * inverseExtent, 0.0f, 1.0f);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			packedVertex.position[axis] = (uint16_t)(position[axis] * 65535.0f + 0.5f);
+		}
+		packedVertex.position[3] = 0;
 
-	// Vertex normals
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-	glEnableVertexAttribArray(1);
+		glm::vec2 normal = octahedralEncode(vertex.normal);
+		packedVertex.normal[0] = (int16_t)round(glm::clamp(normal.x, -1.0f, 1.0f) * 32767.0f);
+		packedVertex.normal[1] = (int16_t)round(glm::clamp(normal.y, -1.0f, 1.0f) * 32767.0f);
 
-	// Vertex texture coordinates
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoords));
-	glEnableVertexAttribArray(2);
+		packedVertex.texCoords[0] = glm::packHalf1x16(vertex.texCoords.x);
+		packedVertex.texCoords[1] = glm::packHalf1x16(vertex.texCoords.y);
+	}
+	return packed;
 }
\ No newline at end of file
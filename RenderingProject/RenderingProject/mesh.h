@@ -2,46 +2,127 @@
 #define MESH_H
 
 #include <glad/glad.h>
-#include <string>
+#include <cstdint>
+#include <memory>
 #include <vector>
+#include "geometry_arena.h"
+#include "material.h"
 #include "shader.h"
+#include "vertex.h"
 
 
-struct Vertex {
-	glm::vec3 position;
-	glm::vec3 normal;
-	glm::vec2 texCoords;
+// Level of detail of a mesh, a range of its index buffer indexing the same vertices as the other levels
+struct MeshLod {
+	GLuint firstIndex;
+	GLsizei indexCount;
+	float error;  // Largest distance (in object space) this level deviates from the full detail mesh
 };
 
 
-struct Texture {
-	GLuint ID;
-	std::string type;
-	std::string path;
+// Largest error a level of detail may have to be used as occluder, as a share of the mesh's bounding sphere radius
+// Coarser levels may bulge out of the mesh, which would let occlusion culling hide what's actually visible
+const float OCCLUDER_MAX_ERROR = 0.01f;
+
+
+// Axis aligned bounding box
+struct Bounds {
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// Sphere enclosing an object
+struct BoundingSphere {
+	glm::vec3 center;
+	float radius;
 };
 
+// Bounds of the positions of a set of vertices
+Bounds computeBounds(const Vertex *vertices, size_t vertexCount);
+
+// Sphere around the center of the bounds of a set of vertices, reaching the vertex farthest from it
+BoundingSphere computeBoundingSphere(const Vertex *vertices, size_t vertexCount, const Bounds &bounds);
+
 
 class Mesh
 {
 public:
-	// Mesh data
+	// Mesh data, the vertex and index vectors are empty if the mesh was uploaded from someone else's memory or released its CPU data
 	std::vector<Vertex> vertices;
 	std::vector<GLuint> indices;
-	std::vector<Texture> textures;
+	std::shared_ptr<const Material> material;  // Shared by the meshes of a model that use the same textures, may be null for no textures
+	Bounds bounds;
+	BoundingSphere boundingSphere;
+
+	// Amount of indices in the index buffer (of all levels of detail), also valid when the vertex and index vectors are empty
+	GLsizei indexCount;
+
+	// Levels of detail from full detail to coarsest, a mesh without generated levels has one covering the whole index buffer
+	std::vector<MeshLod> lods;
+
+	// Layout of the vertex data on the GPU, the vertex vector always holds full precision vertices
+	VertexFormat format;
+
+	// Coarse copy of the mesh for occlusion culling (see OcclusionCuller), positions of the coarsest level of detail that stays
+	// within OCCLUDER_MAX_ERROR of the mesh size and indices into them, kept even when the CPU data is released
+	std::vector<glm::vec3> occluderPositions;
+	std::vector<uint32_t> occluderIndices;
+
+	// Constructor, pass the vectors as rvalues to have them moved into the mesh instead of copied
+	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::shared_ptr<const Material> material, VertexFormat format = VERTEX_FORMAT_FLOAT,
+		std::vector<MeshLod> lods = std::vector<MeshLod>());
 
-	// Constructor
-	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	// Constructor uploading data straight from memory owned by someone else (e.g. a mapped cache file),
+	// the vertex and index vectors are left empty
+	Mesh(const Vertex *vertices, size_t vertexCount, const GLuint *indices, size_t indexCount, std::shared_ptr<const Material> material, Bounds bounds,
+		VertexFormat format = VERTEX_FORMAT_FLOAT, std::vector<MeshLod> lods = std::vector<MeshLod>());
 
-	// Draw the mesh
-	void draw(Shader &shader) const;
+	// Meshes own their range of the geometry arena (freed along with the mesh), so they can be moved but not copied
+	Mesh(const Mesh &) = delete;
+	Mesh &operator=(const Mesh &) = delete;
+	Mesh(Mesh &&) = default;
+	Mesh &operator=(Mesh &&) = default;
+
+	// Free the vertex and index vectors, drawing only needs what was uploaded (bounds and LODs are kept)
+	void releaseCpuData();
+
+	// Draw the mesh at a level of detail, the material isn't bound again if it's the one previously drawn with the shader
+	void draw(Shader &shader, size_t lod = 0, const Material *previousMaterial = nullptr) const;
+
+	// Draw only the positions of the mesh at a level of detail from the position stream, for depth-only passes
+	// Binds no material, the shader only gets the position transform (attributes 3 and 4)
+	void drawPositions(size_t lod = 0) const;
+
+	// Range of the geometry arena the mesh was uploaded to
+	const GeometryAllocation &getGeometry() const;
+
+	// Transform the shader applies to the vertex positions, normalizing packed positions back to the bounds (identity for float vertices)
+	glm::vec3 getPositionOffset() const;
+	glm::vec3 getPositionScale() const;
+
+	// Pick the coarsest level of detail whose error stays below maxPixelError pixels when seen from the camera position,
+	// pixelsPerUnit is the size in pixels of a world space unit at a distance of 1 (which depends on projection and viewport)
+	size_t selectLod(const glm::mat4 &modelMatrix, const glm::vec3 &cameraPosition, float pixelsPerUnit, float maxPixelError) const;
 
 
 private:
-	// Render data
-	GLuint VAO, VBO, EBO;
+	// Vertices and indices on the GPU, in the geometry arena of the vertex format
+	GeometryAllocation geometry;
+
+	// Handle of the normal decoding switch in the shader program last drawn with, looked up again only when the program changes
+	mutable GLuint handleProgram = 0;
+	mutable UniformHandle octahedralNormalsHandle = -1;
+
+	// Use a single level covering the whole index buffer if no levels were given
+	void setupLods();
+
+	// Copy the positions and indices of the occluder level of detail
+	void setupOccluder(const Vertex *vertices, size_t vertexCount, const GLuint *indices);
+
+	// Upload the vertices and indices into the geometry arena
+	void setupMesh(const Vertex *vertices, size_t vertexCount, const GLuint *indices, size_t indexCount);
 
-	// Initialize buffers for drawing the mesh
-	void setupMesh();
+	// Convert vertices to the packed layout
+	std::vector<PackedVertex> packVertices(const Vertex *vertices, size_t vertexCount) const;
 };
 
 #endif
\ No newline at end of file
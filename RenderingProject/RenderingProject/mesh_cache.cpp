@@ -0,0 +1,392 @@
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "mesh_cache.h"
+
+using namespace std;
+using namespace glm;
+
+
+static_assert(sizeof(MeshCacheHeader) == 72, "MeshCacheHeader has unexpected padding");
+static_assert(sizeof(MeshCacheEntry) == 72, "MeshCacheEntry has unexpected padding");
+static_assert(sizeof(MeshLod) == 12, "MeshLod has unexpected padding");
+
+
+static const char MESH_CACHE_MAGIC[4] = { 'R', 'P', 'M', 'C' };
+
+
+// Size and modification time of a file, returns false if it doesn't exist
+static bool getFileInfo(const string &path, uint64_t &size, int64_t &modifiedTime)
+{
+#ifdef _WIN32
+	struct _stat64 fileStat;
+	if (_stat64(path.c_str(), &fileStat) != 0)
+#else
+	struct stat fileStat;
+	if (stat(path.c_str(), &fileStat) != 0)
+#endif
+	{
+		return false;
+	}
+
+	size = (uint64_t)fileStat.st_size;
+	modifiedTime = (int64_t)fileStat.st_mtime;
+	return true;
+}
+
+
+// 64-bit FNV-1a hash of the contents of a file
+static bool hashFile(const string &path, uint64_t &hash)
+{
+	MappedFile file;
+	if (!file.open(path))
+	{
+		return false;
+	}
+
+	const unsigned char *data = file.getData();
+	size_t size = file.getSize();
+
+	hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return true;
+}
+
+
+// Check a file against the size, modification time and hash it had when the cache was written. A different modification
+// time doesn't necessarily mean different contents (e.g. after a fresh checkout), so fall back to comparing hashes, and
+// update the time if the contents are still the same so it can be stored
+static bool isUnchanged(const string &path, uint64_t size, int64_t &modifiedTime, uint64_t hash, bool &timeChanged)
+{
+	uint64_t currentSize;
+	int64_t currentModifiedTime;
+	if (!getFileInfo(path, currentSize, currentModifiedTime) || currentSize != size)
+	{
+		return false;
+	}
+
+	if (currentModifiedTime != modifiedTime)
+	{
+		uint64_t currentHash;
+		if (!hashFile(path, currentHash) || currentHash != hash)
+		{
+			return false;
+		}
+
+		modifiedTime = currentModifiedTime;
+		timeChanged = true;
+	}
+	return true;
+}
+
+
+// Name of the material library an .obj model uses, from its first mtllib line, empty if there is none
+static string findMaterialLibrary(const string &sourcePath)
+{
+	size_t extension = sourcePath.find_last_of('.');
+	if (extension == string::npos || sourcePath.compare(extension, string::npos, ".obj") != 0)
+	{
+		return string();
+	}
+
+	MappedFile file;
+	if (!file.open(sourcePath))
+	{
+		return string();
+	}
+
+	const char *data = (const char *)file.getData();
+	size_t size = file.getSize();
+	for (size_t line = 0; line < size; )
+	{
+		size_t end = line;
+		while (end < size && data[end] != '\n')
+		{
+			end++;
+		}
+
+		if (end - line > 7 && memcmp(data + line, "mtllib", 6) == 0 && (data[line + 6] == ' ' || data[line + 6] == '\t'))
+		{
+			size_t first = line + 7;
+			size_t last = end;
+			while (first < last && (data[first] == ' ' || data[first] == '\t'))
+			{
+				first++;
+			}
+			while (last > first && (data[last - 1] == ' ' || data[last - 1] == '\t' || data[last - 1] == '\r'))
+			{
+				last--;
+			}
+			return string(data + first, last - first);
+		}
+
+		line = end + 1;
+	}
+	return string();
+}
+
+
+// Material libraries are referenced relative to the directory of the model
+static string materialLibraryPath(const string &sourcePath, const string &name)
+{
+	return sourcePath.substr(0, sourcePath.find_last_of("/\\") + 1) + name;
+}
+
+
+// Round an offset up to a multiple of 4 bytes
+static uint64_t align4(uint64_t offset)
+{
+	return (offset + 3) & ~(uint64_t)3;
+}
+
+
+// Check that a range lies completely inside a file of the given size
+static bool inFile(uint64_t offset, uint64_t length, size_t fileSize)
+{
+	return offset <= fileSize && length <= fileSize - offset;
+}
+
+
+bool readMeshCache(const string &sourcePath, uint32_t processingKey, MappedFile &file, vector<CachedMesh> &meshes)
+{
+	string cachePath = sourcePath + MESH_CACHE_EXTENSION;
+	meshes.clear();
+
+	//---------------------------------------------------------
+	// Validate the header before mapping anything else
+	//---------------------------------------------------------
+
+	MeshCacheHeader header;
+	string materialLibrary;
+	{
+		ifstream cacheFile(cachePath, ios::binary);
+		if (!cacheFile.read((char *)&header, sizeof(header)))
+		{
+			return false;
+		}
+
+		if (memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0 ||
+			header.version != MESH_CACHE_VERSION ||
+			header.vertexSize != sizeof(Vertex) ||
+			header.processingKey != processingKey)
+		{
+			return false;
+		}
+
+		materialLibrary.resize(header.materialLibraryLength);
+		cacheFile.seekg(sizeof(MeshCacheHeader) + (uint64_t)header.meshCount * sizeof(MeshCacheEntry));
+		if (!cacheFile.read(&materialLibrary[0], materialLibrary.size()))
+		{
+			return false;
+		}
+	}
+
+	// The texture paths come from the material library, so the cache is outdated when either file changed
+	bool timeChanged = false;
+	if (!isUnchanged(sourcePath, header.sourceSize, header.sourceModifiedTime, header.sourceHash, timeChanged) ||
+		(!materialLibrary.empty() && !isUnchanged(materialLibraryPath(sourcePath, materialLibrary), header.materialLibrarySize,
+			header.materialLibraryModifiedTime, header.materialLibraryHash, timeChanged)))
+	{
+		return false;
+	}
+
+	if (timeChanged)
+	{
+		fstream cacheFile(cachePath, ios::in | ios::out | ios::binary);
+		cacheFile.write((const char *)&header, sizeof(header));
+	}
+
+	//-------------------------------------------------
+	// Map the cache and point the meshes into it
+	//-------------------------------------------------
+
+	if (!file.open(cachePath))
+	{
+		return false;
+	}
+
+	const unsigned char *data = file.getData();
+	size_t size = file.getSize();
+
+	if (!inFile(sizeof(MeshCacheHeader), (uint64_t)header.meshCount * sizeof(MeshCacheEntry), size))
+	{
+		cerr << "ERROR::MESH_CACHE::CORRUPT_FILE " << cachePath << endl;
+		file.close();
+		return false;
+	}
+	const MeshCacheEntry *entries = (const MeshCacheEntry *)(data + sizeof(MeshCacheHeader));
+
+	meshes.resize(header.meshCount);
+	for (uint32_t i = 0; i < header.meshCount; i++)
+	{
+		const MeshCacheEntry &entry = entries[i];
+		CachedMesh &mesh = meshes[i];
+
+		bool valid = inFile(entry.vertexOffset, (uint64_t)entry.vertexCount * sizeof(Vertex), size) &&
+			inFile(entry.indexOffset, (uint64_t)entry.indexCount * sizeof(GLuint), size) &&
+			inFile(entry.lodOffset, (uint64_t)entry.lodCount * sizeof(MeshLod), size);
+
+		// Every LOD must stay inside the index range of the mesh
+		const MeshLod *lods = (const MeshLod *)(data + entry.lodOffset);
+		for (uint32_t j = 0; valid && j < entry.lodCount; j++)
+		{
+			valid = lods[j].indexCount >= 0 && (uint64_t)lods[j].firstIndex + (uint64_t)lods[j].indexCount <= entry.indexCount;
+		}
+
+		// Texture records
+		uint64_t offset = entry.textureOffset;
+		for (uint32_t j = 0; valid && j < entry.textureCount; j++)
+		{
+			uint32_t lengths[2];
+			valid = inFile(offset, sizeof(lengths), size);
+			if (valid)
+			{
+				memcpy(lengths, data + offset, sizeof(lengths));
+				offset += sizeof(lengths);
+				valid = inFile(offset, (uint64_t)lengths[0] + lengths[1], size);
+			}
+			if (valid)
+			{
+				CachedTexture texture;
+				texture.type.assign((const char *)data + offset, lengths[0]);
+				texture.path.assign((const char *)data + offset + lengths[0], lengths[1]);
+				mesh.textures.push_back(texture);
+				offset = align4(offset + lengths[0] + lengths[1]);
+			}
+		}
+
+		if (!valid)
+		{
+			cerr << "ERROR::MESH_CACHE::CORRUPT_FILE " << cachePath << endl;
+			meshes.clear();
+			file.close();
+			return false;
+		}
+
+		mesh.vertices = (const Vertex *)(data + entry.vertexOffset);
+		mesh.vertexCount = entry.vertexCount;
+		mesh.indices = (const GLuint *)(data + entry.indexOffset);
+		mesh.indexCount = entry.indexCount;
+		mesh.lods = lods;
+		mesh.lodCount = entry.lodCount;
+		mesh.bounds = entry.bounds;
+	}
+
+	return true;
+}
+
+
+bool writeMeshCache(const string &sourcePath, uint32_t processingKey, const vector<CachedMesh> &meshes)
+{
+	string cachePath = sourcePath + MESH_CACHE_EXTENSION;
+
+	MeshCacheHeader header = {};
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+	header.version = MESH_CACHE_VERSION;
+	header.vertexSize = sizeof(Vertex);
+	header.meshCount = (uint32_t)meshes.size();
+	header.processingKey = processingKey;
+	if (!getFileInfo(sourcePath, header.sourceSize, header.sourceModifiedTime) || !hashFile(sourcePath, header.sourceHash))
+	{
+		cerr << "ERROR::MESH_CACHE::SOURCE_NOT_READABLE " << sourcePath << endl;
+		return false;
+	}
+
+	string materialLibrary = findMaterialLibrary(sourcePath);
+	header.materialLibraryLength = (uint32_t)materialLibrary.size();
+	if (!materialLibrary.empty())
+	{
+		string materialPath = materialLibraryPath(sourcePath, materialLibrary);
+		if (!getFileInfo(materialPath, header.materialLibrarySize, header.materialLibraryModifiedTime) || !hashFile(materialPath, header.materialLibraryHash))
+		{
+			cerr << "ERROR::MESH_CACHE::SOURCE_NOT_READABLE " << materialPath << endl;
+			return false;
+		}
+	}
+
+	// Lay out the data of every mesh after the header, entry table and material library name
+	vector<MeshCacheEntry> entries(meshes.size());
+	uint64_t offset = align4(sizeof(MeshCacheHeader) + meshes.size() * sizeof(MeshCacheEntry) + materialLibrary.size());
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		const CachedMesh &mesh = meshes[i];
+		MeshCacheEntry &entry = entries[i];
+
+		entry = {};
+		entry.vertexCount = (uint32_t)mesh.vertexCount;
+		entry.indexCount = (uint32_t)mesh.indexCount;
+		entry.textureCount = (uint32_t)mesh.textures.size();
+		entry.lodCount = (uint32_t)mesh.lodCount;
+		entry.bounds = mesh.bounds;
+
+		entry.textureOffset = offset;
+		for (size_t j = 0; j < mesh.textures.size(); j++)
+		{
+			offset = align4(offset + 2 * sizeof(uint32_t) + mesh.textures[j].type.size() + mesh.textures[j].path.size());
+		}
+		entry.vertexOffset = offset;
+		offset += mesh.vertexCount * sizeof(Vertex);
+		entry.indexOffset = offset;
+		offset += mesh.indexCount * sizeof(GLuint);
+		entry.lodOffset = offset;
+		offset += mesh.lodCount * sizeof(MeshLod);
+	}
+
+	// Write into a temporary file first, so a crash halfway never leaves a broken cache behind
+	string tempPath = cachePath + ".tmp";
+	{
+		ofstream cacheFile(tempPath, ios::binary | ios::trunc);
+		if (!cacheFile)
+		{
+			cerr << "ERROR::MESH_CACHE::FILE_NOT_WRITABLE " << tempPath << endl;
+			return false;
+		}
+
+		const char padding[4] = {};
+		cacheFile.write((const char *)&header, sizeof(header));
+		cacheFile.write((const char *)entries.data(), entries.size() * sizeof(MeshCacheEntry));
+		cacheFile.write(materialLibrary.data(), materialLibrary.size());
+		cacheFile.write(padding, align4(materialLibrary.size()) - materialLibrary.size());
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			const CachedMesh &mesh = meshes[i];
+			for (size_t j = 0; j < mesh.textures.size(); j++)
+			{
+				const CachedTexture &texture = mesh.textures[j];
+				uint32_t lengths[2] = { (uint32_t)texture.type.size(), (uint32_t)texture.path.size() };
+				cacheFile.write((const char *)lengths, sizeof(lengths));
+				cacheFile.write(texture.type.data(), texture.type.size());
+				cacheFile.write(texture.path.data(), texture.path.size());
+				cacheFile.write(padding, align4(lengths[0] + lengths[1]) - (lengths[0] + lengths[1]));
+			}
+			cacheFile.write((const char *)mesh.vertices, mesh.vertexCount * sizeof(Vertex));
+			cacheFile.write((const char *)mesh.indices, mesh.indexCount * sizeof(GLuint));
+			cacheFile.write((const char *)mesh.lods, mesh.lodCount * sizeof(MeshLod));
+		}
+
+		if (!cacheFile)
+		{
+			cerr << "ERROR::MESH_CACHE::FILE_NOT_WRITABLE " << tempPath << endl;
+			cacheFile.close();
+			remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+	// Rename doesn't replace existing files on every platform
+	remove(cachePath.c_str());
+	if (rename(tempPath.c_str(), cachePath.c_str()) != 0)
+	{
+		cerr << "ERROR::MESH_CACHE::FILE_NOT_WRITABLE " << cachePath << endl;
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mesh.h"
+#include "mapped_file.h"
+
+
+// Binary mesh cache written next to a source model, so that later runs don't have to go through Assimp
+// File layout: MeshCacheHeader, one MeshCacheEntry per mesh, the name of the material library padded to 4 bytes,
+// then the texture paths, vertices, indices and LODs of each mesh at the offsets given by its entry. Vertices are stored exactly as the Vertex struct lays them out,
+// so a cache is only valid for the build that wrote it (the vertex size is checked along with the version)
+
+
+// Appended to the source model path to get the path of its cache
+const char *const MESH_CACHE_EXTENSION = ".meshcache";
+
+// Bump whenever the file layout or the processing done before writing a cache changes
+const uint32_t MESH_CACHE_VERSION = 4;
+
+
+// Fixed size header at the start of a cache file
+struct MeshCacheHeader {
+	char magic[4];                // "RPMC"
+	uint32_t version;
+	uint32_t vertexSize;          // sizeof(Vertex) of the build that wrote the cache
+	uint32_t meshCount;
+	uint32_t processingKey;       // Identifies the processing done on the meshes after importing them
+	uint32_t materialLibraryLength; // Length of the material library name, zero if the source model doesn't use one
+	uint64_t sourceSize;          // Size, modification time and FNV-1a hash of the source model
+	int64_t sourceModifiedTime;
+	uint64_t sourceHash;
+	uint64_t materialLibrarySize; // Same for its material library, which the cached texture paths come from
+	int64_t materialLibraryModifiedTime;
+	uint64_t materialLibraryHash;
+};
+
+// Location and size of the data of one mesh inside a cache file
+struct MeshCacheEntry {
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t textureCount;
+	uint32_t lodCount;
+	Bounds bounds;
+	uint64_t textureOffset;       // Texture records: type length, path length (both uint32_t), type, path, padded to 4 bytes
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t lodOffset;           // MeshLod records, ranges into the indices
+};
+
+
+// Texture reference of a cached mesh, loaded by the model like material textures coming from Assimp
+struct CachedTexture {
+	std::string type;
+	std::string path;
+};
+
+// Mesh read from a cache, vertex, index and LOD pointers point into the mapped file
+// (when writing a cache they point to the processed mesh data instead)
+struct CachedMesh {
+	const Vertex *vertices;
+	size_t vertexCount;
+	const GLuint *indices;
+	size_t indexCount;
+	const MeshLod *lods;
+	size_t lodCount;
+	std::vector<CachedTexture> textures;
+	Bounds bounds;
+};
+
+
+// Map the cache of a source model and read its meshes. Returns false if there is no cache, or if it's outdated
+// (the source model or its material library changed), made with other processing or broken. A cache whose source
+// files only had their modification time changed is still accepted if their hashes match, and the stored times
+// are refreshed so the next run skips hashing again.
+// The mesh pointers stay valid as long as the file stays mapped
+bool readMeshCache(const std::string &sourcePath, uint32_t processingKey, MappedFile &file, std::vector<CachedMesh> &meshes);
+
+// Write the cache of a source model from its processed mesh data, doesn't touch OpenGL so it can run on any thread
+bool writeMeshCache(const std::string &sourcePath, uint32_t processingKey, const std::vector<CachedMesh> &meshes);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,404 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include "mesh_optimizer.h"
+
+using namespace std;
+using namespace glm;
+
+
+//---------------
+// Vertex welding
+//---------------
+
+// Hashes and compares vertices bit by bit, so only exact duplicates get merged
+struct VertexBitsHash {
+	size_t operator()(const Vertex &vertex) const
+	{
+		const unsigned char *bytes = (const unsigned char *)&vertex;
+		size_t hash = 2166136261u;
+		for (size_t i = 0; i < sizeof(Vertex); i++)
+		{
+			hash = (hash ^ bytes[i]) * 16777619u;
+		}
+		return hash;
+	}
+};
+
+struct VertexBitsEqual {
+	bool operator()(const Vertex &a, const Vertex &b) const
+	{
+		return memcmp(&a, &b, sizeof(Vertex)) == 0;
+	}
+};
+
+
+void weldVertices(vector<Vertex> &vertices, vector<GLuint> &indices)
+{
+	unordered_map<Vertex, GLuint, VertexBitsHash, VertexBitsEqual> uniqueVertices;
+	uniqueVertices.reserve(vertices.size());
+
+	vector<Vertex> welded;
+	vector<GLuint> remap(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		pair<unordered_map<Vertex, GLuint, VertexBitsHash, VertexBitsEqual>::iterator, bool> inserted =
+			uniqueVertices.insert(make_pair(vertices[i], (GLuint)welded.size()));
+		if (inserted.second)
+		{
+			welded.push_back(vertices[i]);
+		}
+		remap[i] = inserted.first->second;
+	}
+
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		indices[i] = remap[indices[i]];
+	}
+	vertices.swap(welded);
+}
+
+
+//--------------------------
+// Vertex cache optimization
+//--------------------------
+
+// Parameters of Forsyth's scoring, which models an LRU cache of FORSYTH_CACHE_SIZE entries
+const int FORSYTH_CACHE_SIZE = 32;
+const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+// Valences above this are scored like this one
+const unsigned FORSYTH_MAX_VALENCE = 32;
+
+
+// Score of a vertex from its position in the cache (-1 if not in it) and the amount of triangles still using it
+static float forsythVertexScore(int cachePosition, unsigned remainingValence)
+{
+	if (remainingValence == 0)
+	{
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		// Vertices of the triangle just drawn get a fixed score so that strips aren't favored over fans
+		if (cachePosition < 3)
+		{
+			score = FORSYTH_LAST_TRIANGLE_SCORE;
+		}
+		else
+		{
+			score = pow(1.0f - (float)(cachePosition - 3) / (FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY_POWER);
+		}
+	}
+
+	// Boost vertices with few triangles left, so they get finished instead of staying around as lone triangles
+	score += FORSYTH_VALENCE_BOOST_SCALE * pow((float)std::min(remainingValence, FORSYTH_MAX_VALENCE), -FORSYTH_VALENCE_BOOST_POWER);
+	return score;
+}
+
+
+void optimizeVertexCache(vector<GLuint> &indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Score lookup tables, indexed by cache position + 1 and by remaining valence
+	float scoreTable[FORSYTH_CACHE_SIZE + 1][FORSYTH_MAX_VALENCE + 1];
+	for (int position = -1; position < FORSYTH_CACHE_SIZE; position++)
+	{
+		for (unsigned valence = 0; valence <= FORSYTH_MAX_VALENCE; valence++)
+		{
+			scoreTable[position + 1][valence] = forsythVertexScore(position, valence);
+		}
+	}
+
+	// Triangles using each vertex, the first remainingValence entries of a vertex are the ones not drawn yet
+	vector<unsigned> remainingValence(vertexCount, 0);
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		remainingValence[indices[i]]++;
+	}
+
+	vector<size_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remainingValence[v];
+	}
+
+	vector<unsigned> adjacentTriangles(indices.size());
+	vector<unsigned> fillCounts(vertexCount, 0);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (int corner = 0; corner < 3; corner++)
+		{
+			GLuint v = indices[t * 3 + corner];
+			adjacentTriangles[adjacencyOffsets[v] + fillCounts[v]++] = (unsigned)t;
+		}
+	}
+
+	// Initial scores, with an empty cache
+	vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		vertexScores[v] = scoreTable[0][std::min(remainingValence[v], FORSYTH_MAX_VALENCE)];
+	}
+
+	vector<float> triangleScores(triangleCount);
+	vector<bool> triangleDrawn(triangleCount, false);
+	int bestTriangle = 0;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+		if (triangleScores[t] > triangleScores[bestTriangle])
+		{
+			bestTriangle = (int)t;
+		}
+	}
+
+	// Simulated cache, with room for the vertices pushed out by the triangle being added
+	vector<GLuint> cache;
+	vector<GLuint> newCache;
+	cache.reserve(FORSYTH_CACHE_SIZE + 3);
+	newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+	vector<GLuint> optimized;
+	optimized.reserve(indices.size());
+	size_t nextUndrawn = 0;
+
+	while (optimized.size() < indices.size())
+	{
+		// Nothing in the cache has triangles left, continue with the next triangle not drawn yet
+		if (bestTriangle < 0)
+		{
+			while (triangleDrawn[nextUndrawn])
+			{
+				nextUndrawn++;
+			}
+			bestTriangle = (int)nextUndrawn;
+		}
+
+		// Draw the best triangle, removing it from the triangles left for its vertices
+		const GLuint *triangle = &indices[bestTriangle * 3];
+		triangleDrawn[bestTriangle] = true;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			GLuint v = triangle[corner];
+			optimized.push_back(v);
+
+			unsigned *adjacent = &adjacentTriangles[adjacencyOffsets[v]];
+			unsigned *last = adjacent + remainingValence[v] - 1;
+			*find(adjacent, last, (unsigned)bestTriangle) = *last;
+			remainingValence[v]--;
+		}
+
+		// The triangle's vertices move to the front of the cache
+		newCache.assign(triangle, triangle + 3);
+		for (size_t i = 0; i < cache.size(); i++)
+		{
+			if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+			{
+				newCache.push_back(cache[i]);
+			}
+		}
+		cache.swap(newCache);
+
+		// Rescore the vertices whose cache position changed, including the ones just pushed out, and their triangles
+		for (size_t i = 0; i < cache.size(); i++)
+		{
+			GLuint v = cache[i];
+			int position = i < (size_t)FORSYTH_CACHE_SIZE ? (int)i : -1;
+
+			float score = scoreTable[position + 1][std::min(remainingValence[v], FORSYTH_MAX_VALENCE)];
+			float scoreChange = score - vertexScores[v];
+			vertexScores[v] = score;
+
+			const unsigned *adjacent = &adjacentTriangles[adjacencyOffsets[v]];
+			for (unsigned j = 0; j < remainingValence[v]; j++)
+			{
+				triangleScores[adjacent[j]] += scoreChange;
+			}
+		}
+
+		if (cache.size() > (size_t)FORSYTH_CACHE_SIZE)
+		{
+			cache.resize(FORSYTH_CACHE_SIZE);
+		}
+
+		// Only triangles of cached vertices can have gained, so the next triangle is searched among those
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < cache.size(); i++)
+		{
+			GLuint v = cache[i];
+			const unsigned *adjacent = &adjacentTriangles[adjacencyOffsets[v]];
+			for (unsigned j = 0; j < remainingValence[v]; j++)
+			{
+				if (triangleScores[adjacent[j]] > bestScore)
+				{
+					bestScore = triangleScores[adjacent[j]];
+					bestTriangle = (int)adjacent[j];
+				}
+			}
+		}
+	}
+
+	indices.swap(optimized);
+}
+
+
+//----------------------
+// Overdraw optimization
+//----------------------
+
+void optimizeOverdraw(vector<GLuint> &indices, const vector<Vertex> &vertices)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Split the triangles into clusters wherever the cache starts over, i.e. at triangles missing the cache with
+	// every vertex, reordering whole clusters then loses next to nothing in vertex cache efficiency
+	vector<size_t> clusterStarts;
+	vector<size_t> cacheTimestamps(vertices.size(), 0);
+	size_t timestamp = MEASURED_VERTEX_CACHE_SIZE + 1;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		int misses = 0;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			GLuint v = indices[t * 3 + corner];
+			if (timestamp - cacheTimestamps[v] > MEASURED_VERTEX_CACHE_SIZE)
+			{
+				cacheTimestamps[v] = timestamp++;
+				misses++;
+			}
+		}
+
+		if (t == 0 || misses == 3)
+		{
+			clusterStarts.push_back(t);
+		}
+	}
+	clusterStarts.push_back(triangleCount);
+
+	// Area weighted centroid of the mesh, and of every cluster along with its average normal
+	size_t clusterCount = clusterStarts.size() - 1;
+	vector<vec3> clusterCentroids(clusterCount, vec3(0.0f));
+	vector<vec3> clusterNormals(clusterCount, vec3(0.0f));
+	vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		float clusterArea = 0.0f;
+		for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+		{
+			vec3 p0 = vertices[indices[t * 3]].position;
+			vec3 p1 = vertices[indices[t * 3 + 1]].position;
+			vec3 p2 = vertices[indices[t * 3 + 2]].position;
+
+			// The cross product's length is twice the triangle area, so summing it weights normals by area
+			vec3 areaNormal = cross(p1 - p0, p2 - p0);
+			float area = length(areaNormal);
+
+			clusterNormals[c] += areaNormal;
+			clusterCentroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+			clusterArea += area;
+		}
+
+		meshCentroid += clusterCentroids[c];
+		meshArea += clusterArea;
+		clusterCentroids[c] = clusterArea > 0.0f ? clusterCentroids[c] / clusterArea : vertices[indices[clusterStarts[c] * 3]].position;
+	}
+	meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : vec3(0.0f);
+
+	// Clusters far out and facing away from the center are likely to hide the rest, so they get drawn first
+	vector<float> clusterSortKeys(clusterCount);
+	vector<size_t> clusterOrder(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		float normalLength = length(clusterNormals[c]);
+		vec3 normal = normalLength > 0.0f ? clusterNormals[c] / normalLength : vec3(0.0f);
+		clusterSortKeys[c] = dot(clusterCentroids[c] - meshCentroid, normal);
+		clusterOrder[c] = c;
+	}
+	stable_sort(clusterOrder.begin(), clusterOrder.end(), [&clusterSortKeys](size_t a, size_t b)
+	{
+		return clusterSortKeys[a] > clusterSortKeys[b];
+	});
+
+	vector<GLuint> sorted;
+	sorted.reserve(indices.size());
+	for (size_t i = 0; i < clusterCount; i++)
+	{
+		size_t c = clusterOrder[i];
+		sorted.insert(sorted.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+	}
+	indices.swap(sorted);
+}
+
+
+//--------------------------
+// Vertex fetch optimization
+//--------------------------
+
+void optimizeVertexFetch(vector<Vertex> &vertices, vector<GLuint> &indices)
+{
+	const GLuint unused = ~(GLuint)0;
+	vector<GLuint> remap(vertices.size(), unused);
+
+	vector<Vertex> reordered;
+	reordered.reserve(vertices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		GLuint &newIndex = remap[indices[i]];
+		if (newIndex == unused)
+		{
+			newIndex = (GLuint)reordered.size();
+			reordered.push_back(vertices[indices[i]]);
+		}
+		indices[i] = newIndex;
+	}
+	vertices.swap(reordered);
+}
+
+
+//------------
+// Measurement
+//------------
+
+VertexCacheStats analyzeVertexCache(const vector<GLuint> &indices, size_t vertexCount)
+{
+	VertexCacheStats stats = { 0.0f, 0.0f };
+	if (indices.empty() || vertexCount == 0)
+	{
+		return stats;
+	}
+
+	// A vertex is in the FIFO cache if fewer than MEASURED_VERTEX_CACHE_SIZE misses happened since it was added
+	vector<size_t> cacheTimestamps(vertexCount, 0);
+	size_t timestamp = MEASURED_VERTEX_CACHE_SIZE + 1;
+	size_t misses = 0;
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		if (timestamp - cacheTimestamps[indices[i]] > MEASURED_VERTEX_CACHE_SIZE)
+		{
+			cacheTimestamps[indices[i]] = timestamp++;
+			misses++;
+		}
+	}
+
+	stats.acmr = (float)misses / (indices.size() / 3);
+	stats.atvr = (float)misses / vertexCount;
+	return stats;
+}
\ No newline at end of file
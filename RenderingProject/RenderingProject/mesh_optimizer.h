@@ -0,0 +1,36 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glad/glad.h>
+#include <vector>
+#include "mesh.h"
+
+
+// Size of the FIFO post-transform cache simulated when measuring meshes
+const unsigned MEASURED_VERTEX_CACHE_SIZE = 16;
+
+
+// Vertex cache efficiency of an indexed triangle list
+struct VertexCacheStats {
+	float acmr;  // Average cache miss ratio: vertex shader invocations per triangle, 0.5 at best and 3 at worst
+	float atvr;  // Average transformed vertex ratio: vertex shader invocations per vertex, 1 at best
+};
+
+
+// Merge vertices that are exactly identical and remap the indices to them
+void weldVertices(std::vector<Vertex> &vertices, std::vector<GLuint> &indices);
+
+// Reorder triangles so that they reuse recently transformed vertices (Forsyth's linear-speed vertex cache optimization)
+void optimizeVertexCache(std::vector<GLuint> &indices, size_t vertexCount);
+
+// Reorder runs of cache-optimized triangles so that outward facing parts of the mesh are drawn first and hide the rest,
+// the triangle order inside each run is kept, so the vertex cache efficiency barely changes
+void optimizeOverdraw(std::vector<GLuint> &indices, const std::vector<Vertex> &vertices);
+
+// Reorder vertices in the order the indices first use them, so vertex fetching walks memory linearly, and drop unused vertices
+void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<GLuint> &indices);
+
+// Simulate a FIFO post-transform cache of MEASURED_VERTEX_CACHE_SIZE entries over the indices
+VertexCacheStats analyzeVertexCache(const std::vector<GLuint> &indices, size_t vertexCount);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include "mesh_simplifier.h"
+
+using namespace std;
+using namespace glm;
+
+
+// Collapses are rejected if they turn a triangle by more than this (cosine of the angle between old and new normal)
+const double SIMPLIFIER_MIN_NORMAL_COSINE = 0.25;
+
+
+// Symmetric 4x4 matrix summing the squared distances to a set of planes
+struct Quadric {
+	double a2, ab, ac, ad;
+	double b2, bc, bd;
+	double c2, cd;
+	double d2;
+};
+
+
+// Quadric of the plane through a triangle
+static Quadric planeQuadric(const dvec3 &p0, const dvec3 &p1, const dvec3 &p2)
+{
+	Quadric quadric = {};
+	dvec3 normal = cross(p1 - p0, p2 - p0);
+	double normalLength = length(normal);
+	if (normalLength == 0.0)
+	{
+		return quadric;
+	}
+	normal /= normalLength;
+	double d = -dot(normal, p0);
+
+	quadric.a2 = normal.x * normal.x;
+	quadric.ab = normal.x * normal.y;
+	quadric.ac = normal.x * normal.z;
+	quadric.ad = normal.x * d;
+	quadric.b2 = normal.y * normal.y;
+	quadric.bc = normal.y * normal.z;
+	quadric.bd = normal.y * d;
+	quadric.c2 = normal.z * normal.z;
+	quadric.cd = normal.z * d;
+	quadric.d2 = d * d;
+	return quadric;
+}
+
+
+static void addQuadric(Quadric &target, const Quadric &quadric)
+{
+	target.a2 += quadric.a2;
+	target.ab += quadric.ab;
+	target.ac += quadric.ac;
+	target.ad += quadric.ad;
+	target.b2 += quadric.b2;
+	target.bc += quadric.bc;
+	target.bd += quadric.bd;
+	target.c2 += quadric.c2;
+	target.cd += quadric.cd;
+	target.d2 += quadric.d2;
+}
+
+
+// Sum of squared distances from a point to the planes of the quadric
+static double evaluateQuadric(const Quadric &q, const dvec3 &p)
+{
+	double error = q.a2 * p.x * p.x + 2.0 * q.ab * p.x * p.y + 2.0 * q.ac * p.x * p.z + 2.0 * q.ad * p.x +
+		q.b2 * p.y * p.y + 2.0 * q.bc * p.y * p.z + 2.0 * q.bd * p.y +
+		q.c2 * p.z * p.z + 2.0 * q.cd * p.z +
+		q.d2;
+	return error > 0.0 ? error : 0.0;
+}
+
+
+// Candidate collapse of vertex "from" onto vertex "to", valid as long as neither vertex changed since it was queued
+struct Collapse {
+	double cost;
+	GLuint from;
+	GLuint to;
+	unsigned fromVersion;
+	unsigned toVersion;
+
+	bool operator>(const Collapse &other) const
+	{
+		return cost > other.cost;
+	}
+};
+
+
+// Vertices that must not be removed: the ones on edges not shared by exactly two triangles (borders, seams,
+// non-manifold edges), and the ones sharing their position with another vertex (the other side of a seam)
+static vector<bool> findLockedVertices(const vector<Vertex> &vertices, const vector<GLuint> &indices)
+{
+	vector<bool> locked(vertices.size(), false);
+
+	unordered_map<uint64_t, unsigned> edgeUses;
+	edgeUses.reserve(indices.size());
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		for (int corner = 0; corner < 3; corner++)
+		{
+			GLuint a = indices[i + corner];
+			GLuint b = indices[i + (corner + 1) % 3];
+			edgeUses[((uint64_t)std::min(a, b) << 32) | std::max(a, b)]++;
+		}
+	}
+	for (unordered_map<uint64_t, unsigned>::const_iterator it = edgeUses.begin(); it != edgeUses.end(); ++it)
+	{
+		if (it->second != 2)
+		{
+			locked[(GLuint)(it->first >> 32)] = true;
+			locked[(GLuint)(it->first & 0xffffffffu)] = true;
+		}
+	}
+
+	// Group vertices by the exact bits of their position
+	unordered_map<string, GLuint> firstWithPosition;
+	firstWithPosition.reserve(vertices.size());
+	for (size_t v = 0; v < vertices.size(); v++)
+	{
+		string key((const char *)&vertices[v].position, sizeof(vec3));
+		pair<unordered_map<string, GLuint>::iterator, bool> inserted = firstWithPosition.insert(make_pair(key, (GLuint)v));
+		if (!inserted.second)
+		{
+			locked[v] = true;
+			locked[inserted.first->second] = true;
+		}
+	}
+
+	return locked;
+}
+
+
+vector<GLuint> simplifyMesh(const vector<Vertex> &vertices, const vector<GLuint> &indices, size_t targetIndexCount, float &resultError)
+{
+	resultError = 0.0f;
+	size_t vertexCount = vertices.size();
+	size_t triangleCount = indices.size() / 3;
+
+	vector<dvec3> positions(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		positions[v] = dvec3(vertices[v].position);
+	}
+
+	vector<bool> locked = findLockedVertices(vertices, indices);
+
+	// Triangles that are still alive, with the vertices they currently use
+	vector<GLuint> triangles(indices.begin(), indices.begin() + triangleCount * 3);
+	vector<bool> triangleAlive(triangleCount, true);
+	size_t aliveTriangles = triangleCount;
+
+	// Quadrics and triangle lists per vertex, the lists may still hold triangles that died since
+	vector<Quadric> quadrics(vertexCount, Quadric());
+	vector<vector<unsigned>> vertexTriangles(vertexCount);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const GLuint *triangle = &triangles[t * 3];
+		Quadric quadric = planeQuadric(positions[triangle[0]], positions[triangle[1]], positions[triangle[2]]);
+		for (int corner = 0; corner < 3; corner++)
+		{
+			addQuadric(quadrics[triangle[corner]], quadric);
+			vertexTriangles[triangle[corner]].push_back((unsigned)t);
+		}
+	}
+
+	vector<bool> vertexAlive(vertexCount, true);
+	vector<unsigned> versions(vertexCount, 0);
+
+	priority_queue<Collapse, vector<Collapse>, greater<Collapse>> collapses;
+
+	// Queue the collapse of one vertex onto another, if the first one may be removed at all
+	auto queueCollapse = [&](GLuint from, GLuint to)
+	{
+		if (locked[from] || from == to)
+		{
+			return;
+		}
+
+		Quadric combined = quadrics[from];
+		addQuadric(combined, quadrics[to]);
+
+		Collapse collapse;
+		collapse.cost = evaluateQuadric(combined, positions[to]);
+		collapse.from = from;
+		collapse.to = to;
+		collapse.fromVersion = versions[from];
+		collapse.toVersion = versions[to];
+		collapses.push(collapse);
+	};
+
+	// Check that moving a vertex onto another doesn't flip or squash any of the triangles that stay
+	auto collapseKeepsTriangles = [&](GLuint from, GLuint to)
+	{
+		const vector<unsigned> &adjacent = vertexTriangles[from];
+		for (size_t i = 0; i < adjacent.size(); i++)
+		{
+			unsigned t = adjacent[i];
+			const GLuint *triangle = &triangles[t * 3];
+			if (!triangleAlive[t] || triangle[0] == to || triangle[1] == to || triangle[2] == to)
+			{
+				continue;
+			}
+
+			dvec3 corners[3];
+			dvec3 movedCorners[3];
+			for (int corner = 0; corner < 3; corner++)
+			{
+				corners[corner] = positions[triangle[corner]];
+				movedCorners[corner] = triangle[corner] == from ? positions[to] : corners[corner];
+			}
+
+			dvec3 normal = cross(corners[1] - corners[0], corners[2] - corners[0]);
+			dvec3 movedNormal = cross(movedCorners[1] - movedCorners[0], movedCorners[2] - movedCorners[0]);
+			double lengths = length(normal) * length(movedNormal);
+			if (lengths == 0.0 || dot(normal, movedNormal) < SIMPLIFIER_MIN_NORMAL_COSINE * lengths)
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (int corner = 0; corner < 3; corner++)
+		{
+			GLuint a = triangles[t * 3 + corner];
+			GLuint b = triangles[t * 3 + (corner + 1) % 3];
+			queueCollapse(a, b);
+			queueCollapse(b, a);
+		}
+	}
+
+	//--------------------------------------
+	// Collapse the cheapest edges in order
+	//--------------------------------------
+
+	double maxCost = 0.0;
+	vector<GLuint> neighbors;
+	while (aliveTriangles * 3 > targetIndexCount && !collapses.empty())
+	{
+		Collapse collapse = collapses.top();
+		collapses.pop();
+
+		GLuint from = collapse.from;
+		GLuint to = collapse.to;
+		if (!vertexAlive[from] || !vertexAlive[to] || versions[from] != collapse.fromVersion || versions[to] != collapse.toVersion)
+		{
+			continue;
+		}
+		if (!collapseKeepsTriangles(from, to))
+		{
+			continue;
+		}
+
+		// Move every triangle of the removed vertex over to the kept one, the ones using both become degenerate
+		const vector<unsigned> &adjacent = vertexTriangles[from];
+		for (size_t i = 0; i < adjacent.size(); i++)
+		{
+			unsigned t = adjacent[i];
+			if (!triangleAlive[t])
+			{
+				continue;
+			}
+
+			GLuint *triangle = &triangles[t * 3];
+			if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+			{
+				triangleAlive[t] = false;
+				aliveTriangles--;
+				continue;
+			}
+
+			for (int corner = 0; corner < 3; corner++)
+			{
+				if (triangle[corner] == from)
+				{
+					triangle[corner] = to;
+				}
+			}
+			vertexTriangles[to].push_back(t);
+		}
+
+		vertexAlive[from] = false;
+		vertexTriangles[from].clear();
+		addQuadric(quadrics[to], quadrics[from]);
+		versions[to]++;
+		maxCost = std::max(maxCost, collapse.cost);
+
+		// Drop dead triangles from the kept vertex and requeue the edges around it, whose costs changed
+		vector<unsigned> &kept = vertexTriangles[to];
+		kept.erase(remove_if(kept.begin(), kept.end(), [&triangleAlive](unsigned t) { return !triangleAlive[t]; }), kept.end());
+
+		neighbors.clear();
+		for (size_t i = 0; i < kept.size(); i++)
+		{
+			for (int corner = 0; corner < 3; corner++)
+			{
+				GLuint v = triangles[kept[i] * 3 + corner];
+				if (v != to)
+				{
+					neighbors.push_back(v);
+				}
+			}
+		}
+		sort(neighbors.begin(), neighbors.end());
+		neighbors.erase(unique(neighbors.begin(), neighbors.end()), neighbors.end());
+
+		for (size_t i = 0; i < neighbors.size(); i++)
+		{
+			queueCollapse(neighbors[i], to);
+			queueCollapse(to, neighbors[i]);
+		}
+	}
+
+	vector<GLuint> simplified;
+	simplified.reserve(aliveTriangles * 3);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		if (triangleAlive[t])
+		{
+			simplified.insert(simplified.end(), triangles.begin() + t * 3, triangles.begin() + t * 3 + 3);
+		}
+	}
+
+	resultError = (float)sqrt(maxCost);
+	return simplified;
+}
\ No newline at end of file
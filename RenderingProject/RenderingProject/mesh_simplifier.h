@@ -0,0 +1,16 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glad/glad.h>
+#include <vector>
+#include "mesh.h"
+
+
+// Simplify an indexed triangle list down to at most targetIndexCount indices using quadric error metric edge collapses
+// Edges are collapsed onto one of their vertices instead of a new position, so the result indexes the same vertices
+// and LODs can share one vertex buffer. Vertices on borders and on UV or normal seams (vertices sharing a position
+// with another vertex) are never removed, which keeps seams closed. Simplification stops early if nothing can be
+// collapsed anymore. resultError is set to the largest object space error of the collapses done
+std::vector<GLuint> simplifyMesh(const std::vector<Vertex> &vertices, const std::vector<GLuint> &indices, size_t targetIndexCount, float &resultError);
+
+#endif
\ No newline at end of file
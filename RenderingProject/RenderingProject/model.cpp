@@ -1,60 +1,544 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
 #include "model.h"
+#include "thread_pool.h"
 
 using namespace std;
 
 
-Model::Model(const char *path)
+// A level is dropped if simplifying couldn't remove more than this share of the triangles of the previous one
+const float LOD_MIN_REDUCTION = 0.1f;
+
+LodStats Model::frameStats;
+bool Model::multiDrawEnabled = true;
+
+
+struct Model::StagedMesh {
+	std::vector<Vertex> vertices;  // Processed data of imported meshes, meshes read from the mesh cache point into the mapped file instead
+	std::vector<GLuint> indices;
+	std::vector<MeshLod> lods;
+	CachedMesh data = CachedMesh();  // Pointers to the vertices, indices and LODs, along with the texture paths and bounds
+	bool processed = false;
+};
+
+
+struct Model::LoadState {
+	std::string path;
+	ModelOptions options;
+	std::chrono::steady_clock::time_point startTime;
+
+	// Source of the meshes, kept alive until they're all processed and uploaded
+	MappedFile cacheFile;
+	Assimp::Importer importer;
+	std::vector<aiMesh *> sceneMeshes;
+	bool cached = false;
+
+	// Shared with the worker threads, guarded by the mutex (staged meshes may only be read once they're processed)
+	std::mutex mutex;
+	std::condition_variable meshProcessed;
+	std::vector<StagedMesh> stagedMeshes;  // One per mesh, filled in once the model is imported
+	bool imported = false;
+	bool failed = false;
+	bool cacheWritten = false;  // Set once the mesh cache no longer reads the staged data
+	size_t processedCount = 0;
+
+	// Only used by the main thread
+	size_t uploadedCount = 0;
+	std::vector<GLuint> textureIDs;  // Textures of all meshes, requested as soon as the model is imported
+};
+
+
+Model::Model(const char *path, ModelOptions options)
+{
+	loadAsync(path, options);
+	shared_ptr<LoadState> state = loadState;
+
+	// Start loading the textures as soon as they are known, then upload the meshes once they're all processed
+	{
+		unique_lock<mutex> lock(state->mutex);
+		state->meshProcessed.wait(lock, [&state] { return state->imported || state->failed; });
+	}
+	update(numeric_limits<double>::infinity());
+
+	{
+		unique_lock<mutex> lock(state->mutex);
+		state->meshProcessed.wait(lock, [&state] { return state->processedCount == state->stagedMeshes.size() || state->failed; });
+	}
+	update(numeric_limits<double>::infinity());
+
+	TextureLoader::global().finish();
+	update(numeric_limits<double>::infinity());
+}
+
+
+void Model::loadAsync(const char *path, ModelOptions options)
+{
+	this->options = options;
+	meshes.clear();
+	stagedTextures.clear();
+	updateBounds();
+
+	string pathString = path;
+	directory = pathString.substr(0, pathString.find_last_of('/'));
+
+	const string &currentOwner = GpuMemoryRegistry::global().getCurrentOwner();
+	owner = currentOwner.empty() ? pathString : currentOwner + "/" + pathString;
+
+	loadState = make_shared<LoadState>();
+	loadState->path = pathString;
+	loadState->options = options;
+	loadState->startTime = chrono::steady_clock::now();
+
+	shared_ptr<LoadState> state = loadState;
+	ThreadPool::global().submit([state] { importModel(state); });
+}
+
+
+void Model::update(double timeBudgetMs)
+{
+	if (!loadState)
+	{
+		return;
+	}
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+	LoadState &state = *loadState;
+	GpuMemoryScope scope(owner);
+
+	// Created while loading rather than on the first draw, so the buffers are attributed to the model
+	if (MultiDrawBatch::isSupported())
+	{
+		batch.createBuffers();
+	}
+
+	// Meshes are uploaded in order, so only the ones processed without a gap after the last upload are taken
+	size_t uploadableCount;
+	bool cacheWritten;
+	{
+		lock_guard<mutex> lock(state.mutex);
+		if (state.failed)
+		{
+			loadState.reset();
+			return;
+		}
+		if (!state.imported)
+		{
+			return;
+		}
+
+		cacheWritten = state.cacheWritten;
+		uploadableCount = state.uploadedCount;
+		while (uploadableCount < state.stagedMeshes.size() && state.stagedMeshes[uploadableCount].processed)
+		{
+			uploadableCount++;
+		}
+	}
+
+	// Request the textures of every mesh right after importing, so they decode while the meshes are being processed
+	if (stagedTextures.size() != state.stagedMeshes.size())
+	{
+		stagedTextures.resize(state.stagedMeshes.size());
+		meshes.reserve(state.stagedMeshes.size());
+		for (size_t i = 0; i < state.stagedMeshes.size(); i++)
+		{
+			const vector<CachedTexture> &textures = state.stagedMeshes[i].data.textures;
+			for (size_t j = 0; j < textures.size(); j++)
+			{
+				stagedTextures[i].push_back(loadTexture(textures[j].path.c_str(), textures[j].type));
+				state.textureIDs.push_back(stagedTextures[i].back().ID);
+			}
+		}
+	}
+
+	// At least one mesh is uploaded per call, so loading always makes progress however small the budget
+	chrono::duration<double, milli> elapsed(0.0);
+	size_t previousMeshCount = meshes.size();
+	while (state.uploadedCount < uploadableCount)
+	{
+		StagedMesh &staged = state.stagedMeshes[state.uploadedCount];
+		shared_ptr<const Material> material = getMaterial(std::move(stagedTextures[state.uploadedCount]));
+		vector<MeshLod> lods(staged.data.lods, staged.data.lods + staged.data.lodCount);
+		if (state.cached || options.releaseCpuData)
+		{
+			// Uploaded straight from the mapped cache file or the staged data, without keeping a copy
+			meshes.emplace_back(staged.data.vertices, staged.data.vertexCount, staged.data.indices, staged.data.indexCount, std::move(material),
+				staged.data.bounds, options.vertexFormat, std::move(lods));
+		}
+		else if (cacheWritten)
+		{
+			meshes.emplace_back(std::move(staged.vertices), std::move(staged.indices), std::move(material), options.vertexFormat, std::move(lods));
+		}
+		else
+		{
+			// The mesh cache is still being written from the staged data, so it has to stay where it is
+			meshes.emplace_back(staged.vertices, staged.indices, std::move(material), options.vertexFormat, std::move(lods));
+		}
+		state.uploadedCount++;
+
+		elapsed = chrono::steady_clock::now() - startTime;
+		if (elapsed.count() >= timeBudgetMs)
+		{
+			break;
+		}
+	}
+	if (meshes.size() != previousMeshCount)
+	{
+		updateBounds();
+	}
+
+	// Decoded textures (of any model) get the rest of the time, again with at least one upload
+	TextureLoader::global().processUploads(std::max(timeBudgetMs - elapsed.count(), 0.0));
+
+	if (state.uploadedCount < state.stagedMeshes.size())
+	{
+		return;
+	}
+	for (size_t i = 0; i < state.textureIDs.size(); i++)
+	{
+		if (TextureLoader::global().isPending(state.textureIDs[i]))
+		{
+			return;
+		}
+	}
+
+	chrono::duration<double, milli> loadTime = chrono::steady_clock::now() - state.startTime;
+	cout << "Model: loaded " << state.path << (state.cached ? " from mesh cache" : " through Assimp") << " in " << loadTime.count() << " ms" << endl;
+
+	// Workers still writing the mesh cache keep their own reference to the state
+	stagedTextures.clear();
+	loadState.reset();
+}
+
+
+bool Model::isReady() const
 {
-	loadModel(path);
+	return !loadState;
+}
+
+
+float Model::getProgress() const
+{
+	if (!loadState)
+	{
+		return 1.0f;
+	}
+
+	// Processing and uploading a mesh and uploading a texture count as one step each
+	size_t totalSteps;
+	size_t doneSteps;
+	{
+		lock_guard<mutex> lock(loadState->mutex);
+		if (!loadState->imported)
+		{
+			return 0.0f;
+		}
+		totalSteps = 2 * loadState->stagedMeshes.size() + loadState->textureIDs.size();
+		doneSteps = loadState->processedCount + loadState->uploadedCount;
+	}
+	for (size_t i = 0; i < loadState->textureIDs.size(); i++)
+	{
+		if (!TextureLoader::global().isPending(loadState->textureIDs[i]))
+		{
+			doneSteps++;
+		}
+	}
+
+	return totalSteps == 0 ? 1.0f : (float)doneSteps / (float)totalSteps;
 }
 
 
+bool Model::hasTexture(TextureType type) const
+{
+	for (const Mesh &mesh : meshes)
+	{
+		if (!mesh.material)
+		{
+			continue;
+		}
+		for (const Texture &texture : mesh.material->getTextures())
+		{
+			if (getTextureType(texture.type) == type)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
 
 void Model::draw(Shader &shader) const
 {
+	const Material *previousMaterial = nullptr;
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		drawMesh(shader, meshes[i], 0, previousMaterial);
+	}
+	flushDraws(shader);
+}
+
+
+void Model::draw(Shader &shader, const glm::mat4 &modelMatrix, const Camera &camera, const glm::mat4 &projection, float viewportHeight,
+	const OcclusionCuller *occlusionCuller) const
+{
+	// Pixels covered by one world space unit at a distance of 1 along the view direction
+	float pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;
+
+	cullMeshes(modelMatrix, camera, projection, occlusionCuller);
+
+	const Material *previousMaterial = nullptr;
+	for (size_t i = 0; i < visibleMeshes.size(); i++)
+	{
+		const Mesh &mesh = meshes[visibleMeshes[i]];
+		size_t lod = mesh.selectLod(modelMatrix, camera.position, pixelsPerUnit, options.lodPixelError);
+		drawMesh(shader, mesh, lod, previousMaterial);
+	}
+	flushDraws(shader);
+}
+
+
+void Model::drawPositions(const glm::mat4 &modelMatrix, const Camera &camera, const glm::mat4 &projection, float viewportHeight) const
+{
+	float pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;
+
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		size_t lod = meshes[i].selectLod(modelMatrix, camera.position, pixelsPerUnit, options.lodPixelError);
+		meshes[i].drawPositions(lod);
+	}
+}
+
+
+void Model::submit(RenderQueue &queue, RenderPass pass, Shader &shader, uint32_t uniformBlock, const glm::mat4 &modelMatrix, const Camera &camera,
+	const glm::mat4 &projection, float viewportHeight, const OcclusionCuller *occlusionCuller, const DepthOnlyDraw &depthOnly) const
+{
+	float pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;
+
+	cullMeshes(modelMatrix, camera, projection, occlusionCuller);
+
+	for (size_t i = 0; i < visibleMeshes.size(); i++)
+	{
+		const Mesh &mesh = meshes[visibleMeshes[i]];
+		size_t lod = mesh.selectLod(modelMatrix, camera.position, pixelsPerUnit, options.lodPixelError);
+		frameStats.drawnTriangles += mesh.lods[lod].indexCount / 3;
+		frameStats.fullDetailTriangles += mesh.lods[0].indexCount / 3;
+
+		glm::vec3 center = glm::vec3(modelMatrix * glm::vec4((mesh.bounds.min + mesh.bounds.max) * 0.5f, 1.0f));
+		queue.submitMesh(pass, shader, mesh, lod, center, uniformBlock, depthOnly);
+	}
+}
+
+
+void Model::addOccluders(OcclusionCuller &occlusionCuller, const glm::mat4 &modelMatrix) const
+{
+	for (const Mesh &mesh : meshes)
+	{
+		occlusionCuller.addOccluder(mesh.occluderPositions.data(), mesh.occluderPositions.size(), mesh.occluderIndices.data(), mesh.occluderIndices.size(), modelMatrix);
+	}
+}
+
+
+Bounds Model::getBounds() const
+{
+	return bounds;
+}
+
+
+BoundingSphere Model::getBoundingSphere() const
+{
+	return boundingSphere;
+}
+
+
+const LodStats &Model::getFrameStats()
+{
+	return frameStats;
+}
+
+
+void Model::resetFrameStats()
+{
+	frameStats = LodStats();
+}
+
+
+void Model::setMultiDrawEnabled(bool enabled)
+{
+	multiDrawEnabled = enabled;
+}
+
+
+bool Model::isMultiDrawEnabled()
+{
+	return multiDrawEnabled;
+}
+
+
+bool Model::useMultiDraw()
+{
+	return multiDrawEnabled && MultiDrawBatch::isSupported();
+}
+
+
+void Model::cullMeshes(const glm::mat4 &modelMatrix, const Camera &camera, const glm::mat4 &projection, const OcclusionCuller *occlusionCuller) const
+{
+	meshCuller.clear();
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		meshCuller.add(meshes[i].bounds, meshes[i].boundingSphere, modelMatrix);
+	}
+	meshCuller.cull(camera.getFrustum(projection), visibleMeshes);
+
+	if (occlusionCuller)
+	{
+		visibleMeshes.erase(remove_if(visibleMeshes.begin(), visibleMeshes.end(), [this, occlusionCuller, &modelMatrix](uint32_t mesh)
+		{
+			return occlusionCuller->isOccluded(meshes[mesh].bounds, modelMatrix);
+		}), visibleMeshes.end());
+	}
+}
+
+
+void Model::drawMesh(Shader &shader, const Mesh &mesh, size_t lod, const Material *&previousMaterial) const
+{
+	frameStats.drawnTriangles += mesh.lods[lod].indexCount / 3;
+	frameStats.fullDetailTriangles += mesh.lods[0].indexCount / 3;
+
+	if (useMultiDraw())
+	{
+		batch.add(mesh, lod);
+	}
+	else
+	{
+		mesh.draw(shader, lod, previousMaterial);
+		previousMaterial = mesh.material.get();
+		frameStats.drawCalls++;
+	}
+}
+
+
+void Model::flushDraws(Shader &shader) const
+{
+	frameStats.drawCalls += batch.submit(shader);
+}
+
+
+void Model::updateBounds()
+{
+	bounds = meshes.empty() ? Bounds{ glm::vec3(0.0f), glm::vec3(0.0f) } : meshes[0].bounds;
+	for (size_t i = 1; i < meshes.size(); i++)
+	{
+		bounds.min = glm::min(bounds.min, meshes[i].bounds.min);
+		bounds.max = glm::max(bounds.max, meshes[i].bounds.max);
+	}
+
+	// Reaches as far as the farthest mesh sphere from the center of the box
+	boundingSphere = { (bounds.min + bounds.max) * 0.5f, 0.0f };
 	for (size_t i = 0; i < meshes.size(); i++)
-		meshes[i].draw(shader);
+	{
+		boundingSphere.radius = std::max(boundingSphere.radius, glm::length(meshes[i].boundingSphere.center - boundingSphere.center) + meshes[i].boundingSphere.radius);
+	}
 }
 
 
-void Model::loadModel(string path)
+void Model::importModel(shared_ptr<LoadState> state)
 {
-	Assimp::Importer import;
-	const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+	// Warm start, the meshes are ready as soon as the cache is mapped
+	vector<CachedMesh> cachedMeshes;
+	if (readMeshCache(state->path, getProcessingKey(state->options), state->cacheFile, cachedMeshes))
+	{
+		{
+			lock_guard<mutex> lock(state->mutex);
+			state->cached = true;
+			state->stagedMeshes.resize(cachedMeshes.size());
+			for (size_t i = 0; i < cachedMeshes.size(); i++)
+			{
+				state->stagedMeshes[i].data = cachedMeshes[i];
+				state->stagedMeshes[i].processed = true;
+			}
+			state->processedCount = cachedMeshes.size();
+			state->imported = true;
+		}
+		state->meshProcessed.notify_all();
+		return;
+	}
+
+	const aiScene *scene = state->importer.ReadFile(state->path, aiProcess_Triangulate | aiProcess_FlipUVs);
 
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 	{
-		cerr << "ERROR::ASSIMP::" << import.GetErrorString() << endl;
+		cerr << "ERROR::ASSIMP::" << state->importer.GetErrorString() << endl;
+		{
+			lock_guard<mutex> lock(state->mutex);
+			state->failed = true;
+		}
+		state->meshProcessed.notify_all();
+		return;
+	}
+
+	collectMeshes(scene->mRootNode, scene, state->sceneMeshes);
+
+	// Texture paths are known right away, so the main thread can start loading them before the meshes are processed
+	vector<StagedMesh> stagedMeshes(state->sceneMeshes.size());
+	for (size_t i = 0; i < state->sceneMeshes.size(); i++)
+	{
+		aiMesh *mesh = state->sceneMeshes[i];
+		if (mesh->mMaterialIndex < scene->mNumMaterials)
+		{
+			aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+			collectMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", stagedMeshes[i].data.textures);
+			collectMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", stagedMeshes[i].data.textures);
+		}
+	}
+
+	{
+		lock_guard<mutex> lock(state->mutex);
+		state->stagedMeshes.swap(stagedMeshes);
+		state->imported = true;
+	}
+	state->meshProcessed.notify_all();
+
+	if (state->sceneMeshes.empty())
+	{
+		writeMeshCache(state->path, getProcessingKey(state->options), cachedMeshes);
 		return;
 	}
-	directory = path.substr(0, path.find_last_of('/'));
 
-	processNode(scene->mRootNode, scene);
+	// Meshes don't depend on each other, so they're processed in parallel
+	for (size_t i = 0; i < state->sceneMeshes.size(); i++)
+	{
+		ThreadPool::global().submit([state, i] { processMesh(state, i); });
+	}
 }
 
 
-void Model::processNode(aiNode *node, const aiScene *scene)
+void Model::collectMeshes(aiNode *node, const aiScene *scene, vector<aiMesh *> &sceneMeshes)
 {
-	// Process all the node's meshes (if any)
+	// Collect all the node's meshes (if any)
 	for (size_t i = 0; i < node->mNumMeshes; i++)
 	{
-		aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-		meshes.push_back(processMesh(mesh, scene));
+		sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
 	}
 
 	// Then do the same for each of its children
 	for (size_t i = 0; i < node->mNumChildren; i++)
 	{
-		processNode(node->mChildren[i], scene);
+		collectMeshes(node->mChildren[i], scene, sceneMeshes);
 	}
 }
 
 
-Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene)
+void Model::processMesh(shared_ptr<LoadState> state, size_t meshIndex)
 {
-	vector<Vertex> vertices;
-	vector<GLuint> indices;
-	vector<Texture> textures;
+	aiMesh *mesh = state->sceneMeshes[meshIndex];
+	StagedMesh &staged = state->stagedMeshes[meshIndex];
+	vector<Vertex> &vertices = staged.vertices;
+	vector<GLuint> &indices = staged.indices;
+	vertices.reserve(mesh->mNumVertices);
+	indices.reserve(mesh->mNumFaces * 3);
 
 	// Process vertices
 	for (size_t i = 0; i < mesh->mNumVertices; i++)
@@ -102,97 +586,167 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene)
 		}
 	}
 
-	// Process material
-	if (mesh->mMaterialIndex >= 0)
-	{
-		aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-
-		vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+	optimizeMesh(state->options, vertices, indices);
+	staged.lods = generateLods(state->options, vertices, indices);
 
-		vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-	}
+	staged.data.vertices = vertices.data();
+	staged.data.vertexCount = vertices.size();
+	staged.data.indices = indices.data();
+	staged.data.indexCount = indices.size();
+	staged.data.lods = staged.lods.data();
+	staged.data.lodCount = staged.lods.size();
+	staged.data.bounds = computeBounds(vertices.data(), vertices.size());
 
-	return Mesh(vertices, indices, textures);
+	finishMesh(state, meshIndex);
 }
 
 
-vector<Texture> Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+void Model::finishMesh(const shared_ptr<LoadState> &state, size_t meshIndex)
 {
-	vector<Texture> textures;
-	for (size_t i = 0; i < mat->GetTextureCount(type); i++)
+	bool allProcessed;
 	{
-		aiString str;
-		mat->GetTexture(type, i, &str);
-		bool skip = false;
-		for (size_t j = 0; j < textures_loaded.size(); j++)
+		lock_guard<mutex> lock(state->mutex);
+		state->stagedMeshes[meshIndex].processed = true;
+		state->processedCount++;
+		allProcessed = state->processedCount == state->stagedMeshes.size();
+	}
+	state->meshProcessed.notify_all();
+
+	// The last mesh writes the cache, the staged data stays alive meanwhile since this task still holds the state
+	if (allProcessed)
+	{
+		vector<CachedMesh> cachedMeshes;
+		for (size_t i = 0; i < state->stagedMeshes.size(); i++)
 		{
-			if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-			{
-				textures.push_back(textures_loaded[j]);
-				skip = true;
-				break;
-			}
-		}
-		if (!skip)
-		{   // If texture hasn't been loaded already, load it
-			Texture texture;
-			texture.ID = textureFromFile(str.C_Str(), directory);
-			texture.type = typeName;
-			texture.path = str.C_Str();
-			textures.push_back(texture);
-			textures_loaded.push_back(texture); // Add to loaded textures
+			cachedMeshes.push_back(state->stagedMeshes[i].data);
 		}
+		writeMeshCache(state->path, getProcessingKey(state->options), cachedMeshes);
+
+		lock_guard<mutex> lock(state->mutex);
+		state->cacheWritten = true;
 	}
-	return textures;
 }
 
 
-GLuint Model::textureFromFile(const char *path, const string &directory)
+void Model::optimizeMesh(const ModelOptions &options, vector<Vertex> &vertices, vector<GLuint> &indices)
 {
-	stbi_set_flip_vertically_on_load(true);
+	VertexCacheStats before = analyzeVertexCache(indices, vertices.size());
+	size_t verticesBefore = vertices.size();
+
+	if (options.weldVertices)
+	{
+		weldVertices(vertices, indices);
+	}
+	if (options.optimizeVertexCache)
+	{
+		optimizeVertexCache(indices, vertices.size());
+	}
+	if (options.optimizeOverdraw)
+	{
+		optimizeOverdraw(indices, vertices);
+	}
+	if (options.optimizeVertexFetch)
+	{
+		optimizeVertexFetch(vertices, indices);
+	}
 
-	string filename = string(path);
-	filename = directory + '/' + filename;
+	// Meshes are processed in parallel, so every line is written at once to keep them from interleaving
+	VertexCacheStats after = analyzeVertexCache(indices, vertices.size());
+	ostringstream log;
+	log << "Mesh optimizer: " << indices.size() / 3 << " triangles, " << verticesBefore << " -> " << vertices.size() << " vertices, "
+		<< "ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << endl;
+	cout << log.str();
+}
 
-	GLuint textureID;
-	glGenTextures(1, &textureID);
 
-	int width, height, nrChannels;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrChannels, 0);
-	if (data)
+vector<MeshLod> Model::generateLods(const ModelOptions &options, const vector<Vertex> &vertices, vector<GLuint> &indices)
+{
+	vector<MeshLod> lods;
+	MeshLod fullDetail = { 0, (GLsizei)indices.size(), 0.0f };
+	lods.push_back(fullDetail);
+
+	// Every level is simplified from the previous one, so its error adds up on top of the previous error
+	vector<GLuint> previous = indices;
+	for (int level = 1; level < options.lodCount; level++)
 	{
-		GLenum format;
-		if (nrChannels == 1)
+		size_t targetIndexCount = previous.size() / 6 * 3;
+		float error;
+		vector<GLuint> simplified = simplifyMesh(vertices, previous, targetIndexCount, error);
+		if (simplified.empty() || simplified.size() > previous.size() * (1.0f - LOD_MIN_REDUCTION))
 		{
-			format = GL_RED;
+			break;
 		}
-		else if (nrChannels == 3)
-		{
-			format = GL_RGB;
-		}
-		else if (nrChannels == 4)
+
+		if (options.optimizeVertexCache)
 		{
-			format = GL_RGBA;
+			optimizeVertexCache(simplified, vertices.size());
 		}
 
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		MeshLod lod = { (GLuint)indices.size(), (GLsizei)simplified.size(), lods.back().error + error };
+		lods.push_back(lod);
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+		previous.swap(simplified);
+	}
 
-		stbi_image_free(data);
+	ostringstream log;
+	log << "Mesh LODs:";
+	for (size_t i = 0; i < lods.size(); i++)
+	{
+		log << " " << lods[i].indexCount / 3 << " (error " << lods[i].error << ")";
 	}
-	else
+	log << endl;
+	cout << log.str();
+
+	return lods;
+}
+
+
+uint32_t Model::getProcessingKey(const ModelOptions &options)
+{
+	return (options.weldVertices ? 1u : 0u) |
+		(options.optimizeVertexCache ? 2u : 0u) |
+		(options.optimizeOverdraw ? 4u : 0u) |
+		(options.optimizeVertexFetch ? 8u : 0u) |
+		((uint32_t)options.lodCount << 4);
+}
+
+
+void Model::collectMaterialTextures(aiMaterial *mat, aiTextureType type, const string &typeName, vector<CachedTexture> &textures)
+{
+	for (size_t i = 0; i < mat->GetTextureCount(type); i++)
 	{
-		cerr << "Texture failed to load at path: " << path << endl;
-		stbi_image_free(data);
+		aiString str;
+		mat->GetTexture(type, i, &str);
+
+		CachedTexture texture;
+		texture.type = typeName;
+		texture.path = str.C_Str();
+		textures.push_back(texture);
 	}
+}
+
+
+Texture Model::loadTexture(const char *path, const string &typeName)
+{
+	// Decoded on the thread pool if it isn't cached, and uploaded by update (or whoever else processes the loader's uploads)
+	Texture texture;
+	texture.ref = TextureCache::global().acquire(directory + '/' + path, true, GL_REPEAT);
+	texture.ID = texture.ref->get();
+	texture.type = typeName;
+	texture.path = path;
+	return texture;
+}
+
 
-	return textureID;
+shared_ptr<const Material> Model::getMaterial(vector<Texture> textures) const
+{
+	// Models have few distinct materials, so a linear search over the meshes is enough
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		if (meshes[i].material && meshes[i].material->hasTextures(textures))
+		{
+			return meshes[i].material;
+		}
+	}
+	return make_shared<const Material>(std::move(textures));
 }
\ No newline at end of file
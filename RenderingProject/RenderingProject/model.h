@@ -7,47 +7,201 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
+#include "frustum_culling.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "multi_draw.h"
+#include "occlusion_culling.h"
+#include "render_queue.h"
+#include "camera.h"
 #include "shader.h"
+#include "texture_cache.h"
+#include "texture_loader.h"
+
+
+// Processing applied to the meshes of a model when importing it, meshes loaded from the mesh cache already had it done
+// (except for packing vertices, which happens on upload so the cache always holds full precision vertices)
+struct ModelOptions {
+	bool weldVertices = true;          // Merge identical vertices, which Assimp leaves duplicated per face
+	bool optimizeVertexCache = true;   // Reorder triangles for post-transform cache reuse
+	bool optimizeOverdraw = false;     // Reorder triangle clusters so that outer parts are drawn first
+	bool optimizeVertexFetch = true;   // Reorder vertices in the order they are first used
+
+	VertexFormat vertexFormat = VERTEX_FORMAT_FLOAT;  // Layout the vertices are uploaded with, packed halves their size
+	bool releaseCpuData = false;   // Don't keep vertices and indices in memory once uploaded (meshes from the mesh cache never keep them)
+
+	int lodCount = 4;              // Levels of detail generated per mesh (including full detail), each with about half the triangles of the previous one
+	float lodPixelError = 1.0f;    // Largest error in pixels allowed on screen when picking a level of detail
+};
+
+
+// Triangle counts of the models drawn, collected over all models and reset every frame
+struct LodStats {
+	size_t drawnTriangles = 0;       // Triangles drawn at the levels of detail picked
+	size_t fullDetailTriangles = 0;  // Triangles that would have been drawn at full detail
+	size_t drawCalls = 0;            // Draw calls issued by draw, a multi-draw counts once (those of submitted models are counted by the render queue)
+};
 
 
 class Model
 {
 public:
-	// Constructor
-	Model(const char *path);
+	// Constructor, loads the model synchronously
+	Model(const char *path, ModelOptions options = ModelOptions());
 
 	// Default constructor
 	Model() = default;
 
-	// Draw the model
+	// Models own their meshes, so they can be moved but not copied
+	Model(const Model &) = delete;
+	Model &operator=(const Model &) = delete;
+	Model(Model &&) = default;
+	Model &operator=(Model &&) = default;
+
+	// Start loading a model in the background: importing and processing the meshes runs on the global thread pool,
+	// while update uploads the results. The model draws nothing until its first meshes are uploaded
+	void loadAsync(const char *path, ModelOptions options = ModelOptions());
+
+	// Upload processed meshes and decoded textures until the time budget is spent, must be called every frame
+	// on the main thread while the model is loading (at least one mesh is uploaded per call if one is ready)
+	void update(double timeBudgetMs);
+
+	// Whether every mesh and texture of the model is uploaded, also true if loading failed
+	bool isReady() const;
+
+	// Share of the loading work done so far, from 0 to 1
+	float getProgress() const;
+
+	// Whether any mesh of the model has a texture of this kind, only complete once the model is ready
+	bool hasTexture(TextureType type) const;
+
+	// Draw the model at full detail
 	void draw(Shader &shader) const;
 
+	// Draw the model with every mesh at the coarsest level of detail that stays within the pixel error of the options,
+	// as seen by the camera through a projection onto a viewport of the given height in pixels
+	// Meshes outside the camera's view frustum aren't drawn, nor are those hidden behind the occluders of an occlusion culler if one is given
+	void draw(Shader &shader, const glm::mat4 &modelMatrix, const Camera &camera, const glm::mat4 &projection, float viewportHeight,
+		const OcclusionCuller *occlusionCuller = nullptr) const;
+
+	// Submit the meshes to a render queue instead of drawing them right away, culled and at the level of detail picked like draw does
+	// Every mesh gets the depth of its own center, so meshes with the same state are drawn front to back (and still go in a multi-draw when they can)
+	// Meshes are drawn in the depth pre-pass with the depth-only shader and uniforms if one is given
+	void submit(RenderQueue &queue, RenderPass pass, Shader &shader, uint32_t uniformBlock, const glm::mat4 &modelMatrix, const Camera &camera,
+		const glm::mat4 &projection, float viewportHeight, const OcclusionCuller *occlusionCuller = nullptr, const DepthOnlyDraw &depthOnly = DepthOnlyDraw()) const;
+
+	// Draw only the position streams of all meshes, without culling, at the level of detail draw picks for the camera
+	// For depth-only passes seen from elsewhere (like shadow maps), where the shader in use already has its uniforms set
+	void drawPositions(const glm::mat4 &modelMatrix, const Camera &camera, const glm::mat4 &projection, float viewportHeight) const;
+
+	// Add the coarse occluder versions of all meshes uploaded so far to an occlusion culler
+	void addOccluders(OcclusionCuller &occlusionCuller, const glm::mat4 &modelMatrix) const;
+
+	// Object space bounds of all meshes uploaded so far, the sphere is centered on the box
+	Bounds getBounds() const;
+	BoundingSphere getBoundingSphere() const;
+
+	// Triangle counts of the current frame
+	static const LodStats &getFrameStats();
+
+	// Reset triangle counts, should be called at the start of every frame
+	static void resetFrameStats();
+
+	// Whether models submit their meshes with multi-draws, only has an effect if the context supports them (on by default)
+	static void setMultiDrawEnabled(bool enabled);
+	static bool isMultiDrawEnabled();
+
 
 private:
+	// Mesh processed on the thread pool, waiting to be uploaded
+	struct StagedMesh;
+
+	// Loading progress, shared with the worker threads so the model can go away while they're still running
+	struct LoadState;
+
 	// Model data
 	std::vector<Mesh> meshes;
 	std::string directory;
+	ModelOptions options;
+
+	// Object space bounds of the meshes uploaded so far, updated whenever meshes are uploaded
+	Bounds bounds = { glm::vec3(0.0f), glm::vec3(0.0f) };
+	BoundingSphere boundingSphere = { glm::vec3(0.0f), 0.0f };
+
+	// Owner the model's GPU resources are attributed to in the GPU memory registry, the current owner when loading started
+	// with the model path appended
+	std::string owner;
+
+	// Load in progress, released once the model is ready
+	std::shared_ptr<LoadState> loadState;
+
+	// Textures of the meshes that aren't uploaded yet, kept here rather than in the load state
+	// since the last reference to a texture has to be dropped on the main thread
+	std::vector<std::vector<Texture>> stagedTextures;
+
+	// Draws of the meshes, collected by draw and submitted at once when multi-draw is enabled
+	mutable MultiDrawBatch batch;
+
+	// World space bounds of the meshes and the ones inside the view frustum, filled by draw and kept to reuse their memory
+	mutable FrustumCuller meshCuller;
+	mutable std::vector<uint32_t> visibleMeshes;
+
+	// Triangle counts of the current frame
+	static LodStats frameStats;
+
+	// Whether draws go through the batch
+	static bool multiDrawEnabled;
+
+	// Whether the current draws go through the batch, i.e. multi-draw is enabled and supported
+	static bool useMultiDraw();
+
+	// Fill visibleMeshes with the meshes inside the camera's view frustum that aren't hidden behind the occluders of an occlusion culler
+	void cullMeshes(const glm::mat4 &modelMatrix, const Camera &camera, const glm::mat4 &projection, const OcclusionCuller *occlusionCuller) const;
+
+	// Draw a mesh at a level of detail, or add it to the batch when using multi-draw
+	// previousMaterial tracks the material bound by the previous draw of the model, so it isn't bound again
+	void drawMesh(Shader &shader, const Mesh &mesh, size_t lod, const Material *&previousMaterial) const;
+
+	// Submit the batched draws, if any
+	void flushDraws(Shader &shader) const;
+
+	// Compute the bounds of all meshes, called whenever meshes are uploaded
+	void updateBounds();
+
+	// Read the mesh cache if it's up to date and otherwise import the model through Assimp, runs on the thread pool
+	static void importModel(std::shared_ptr<LoadState> state);
+
+	// Collect the meshes of a node from the model, then recurively collect those of all its child nodes
+	static void collectMeshes(aiNode *node, const aiScene *scene, std::vector<aiMesh *> &sceneMeshes);
+
+	// Convert, optimize and simplify one imported mesh, runs on the thread pool
+	static void processMesh(std::shared_ptr<LoadState> state, size_t meshIndex);
+
+	// Mark a mesh as processed, the last one writes the mesh cache if the model was imported through Assimp
+	static void finishMesh(const std::shared_ptr<LoadState> &state, size_t meshIndex);
 
-	// Vector of all loaded textures so duplicates don't have to be loaded
-	std::vector<Texture> textures_loaded;
+	// Run the mesh optimizations enabled in the options and log their effect on vertex cache efficiency
+	static void optimizeMesh(const ModelOptions &options, std::vector<Vertex> &vertices, std::vector<GLuint> &indices);
 
-	// Load model data
-	void loadModel(std::string path);
+	// Simplify the mesh into coarser levels of detail appended to its indices, returns the levels including full detail
+	static std::vector<MeshLod> generateLods(const ModelOptions &options, const std::vector<Vertex> &vertices, std::vector<GLuint> &indices);
 
-	// Process a node from the model, then recurively process all its child nodes
-	void processNode(aiNode *node, const aiScene *scene);
+	// Key identifying the processing done by the options, stored in the mesh cache so that caches made with other options are rejected
+	static uint32_t getProcessingKey(const ModelOptions &options);
 
-	// Process a mesh from the model into an instance of our own mesh class
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene);
+	// Helper function to collect the texture paths of a given material
+	static void collectMaterialTextures(aiMaterial *mat, aiTextureType type, const std::string &typeName, std::vector<CachedTexture> &textures);
 
-	// Helper function to retrieve, load, and initialize the textures from a given material
-	std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName);
+	// Helper function to retrieve a texture through the texture cache, so it's only loaded if no other model uses it yet
+	Texture loadTexture(const char *path, const std::string &typeName);
 
-	// Helper function to load texture images from file
-	GLuint textureFromFile(const char *path, const std::string &directory);
+	// Material with the given textures, shared with the meshes already uploaded that have the same textures
+	std::shared_ptr<const Material> getMaterial(std::vector<Texture> textures) const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "multi_draw.h"
+
+using namespace std;
+
+
+// Attribute locations the shaders read the per-draw data from
+static const GLuint POSITION_OFFSET_LOCATION = 3;
+static const GLuint POSITION_SCALE_LOCATION = 4;
+
+
+void MultiDrawBatch::createBuffers()
+{
+	if (commandBuffer.get() == 0)
+	{
+		commandBuffer = GpuResource(GPU_RESOURCE_BUFFER);
+		drawDataBuffer = GpuResource(GPU_RESOURCE_BUFFER);
+	}
+}
+
+
+void MultiDrawBatch::add(const Mesh &mesh, size_t lod)
+{
+	Draw draw = { mesh.getGeometry().getVertexArray(), mesh.material.get(), &mesh, lod };
+	draws.push_back(draw);
+}
+
+
+size_t MultiDrawBatch::submit(Shader &shader)
+{
+	if (draws.empty())
+	{
+		return 0;
+	}
+	createBuffers();
+
+	stable_sort(draws.begin(), draws.end(), compareDraws);
+
+	commands.resize(draws.size());
+	drawData.resize(draws.size());
+	for (size_t i = 0; i < draws.size(); i++)
+	{
+		const Mesh &mesh = *draws[i].mesh;
+		const MeshLod &lod = mesh.lods[draws[i].lod];
+
+		DrawElementsIndirectCommand &command = commands[i];
+		command.count = lod.indexCount;
+		command.instanceCount = 1;
+		command.firstIndex = mesh.getGeometry().getFirstIndex() + lod.firstIndex;
+		command.baseVertex = mesh.getGeometry().getBaseVertex();
+		command.baseInstance = (GLuint)i;
+
+		drawData[i].positionOffset = mesh.getPositionOffset();
+		drawData[i].positionScale = mesh.getPositionScale();
+	}
+
+	// Buffers are respecified every submit, so the driver can hand out fresh memory while earlier draws still read the old contents
+	GlState::global().bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer.get());
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+	commandBuffer.setMemory(commands.size() * sizeof(DrawElementsIndirectCommand));
+
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, drawDataBuffer.get());
+	glBufferData(GL_ARRAY_BUFFER, drawData.size() * sizeof(DrawData), drawData.data(), GL_STREAM_DRAW);
+	drawDataBuffer.setMemory(drawData.size() * sizeof(DrawData));
+
+	if (handleProgram != shader.ID.get())
+	{
+		handleProgram = shader.ID.get();
+		octahedralNormalsHandle = shader.getUniformHandle("octahedralNormals");
+	}
+
+	size_t drawCalls = 0;
+	const Material *previousMaterial = nullptr;
+	for (size_t begin = 0, end; begin < draws.size(); begin = end)
+	{
+		const Draw &first = draws[begin];
+		for (end = begin + 1; end < draws.size() && draws[end].vertexArray == first.vertexArray && draws[end].material == first.material; end++)
+		{
+		}
+
+		// Point the vertex array's per-draw attributes at the draw data, stepping once per instance (the base instance selects the draw)
+		GlState::global().bindVertexArray(first.vertexArray);
+		glVertexAttribPointer(POSITION_OFFSET_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void*)offsetof(DrawData, positionOffset));
+		glVertexAttribDivisor(POSITION_OFFSET_LOCATION, 1);
+		glEnableVertexAttribArray(POSITION_OFFSET_LOCATION);
+		glVertexAttribPointer(POSITION_SCALE_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void*)offsetof(DrawData, positionScale));
+		glVertexAttribDivisor(POSITION_SCALE_LOCATION, 1);
+		glEnableVertexAttribArray(POSITION_SCALE_LOCATION);
+
+		if (first.material)
+		{
+			first.material->bind(shader, previousMaterial);
+			previousMaterial = first.material;
+		}
+		shader.setBool(octahedralNormalsHandle, first.mesh->format == VERTEX_FORMAT_PACKED);
+		getGlExtensions().glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(begin * sizeof(DrawElementsIndirectCommand)), (GLsizei)(end - begin), 0);
+		drawCalls++;
+
+		// Vertex arrays are shared with meshes drawn one by one, which set the attributes as constants instead
+		glDisableVertexAttribArray(POSITION_OFFSET_LOCATION);
+		glDisableVertexAttribArray(POSITION_SCALE_LOCATION);
+	}
+
+	draws.clear();
+	return drawCalls;
+}
+
+
+bool MultiDrawBatch::isSupported()
+{
+	return getGlExtensions().multiDrawIndirect;
+}
+
+
+bool MultiDrawBatch::compareDraws(const Draw &a, const Draw &b)
+{
+	if (a.vertexArray != b.vertexArray)
+	{
+		return a.vertexArray < b.vertexArray;
+	}
+	return less<const Material *>()(a.material, b.material);
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef MULTI_DRAW_H
+#define MULTI_DRAW_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "gpu_resource.h"
+#include "mesh.h"
+#include "shader.h"
+
+
+// Command record read by glMultiDrawElementsIndirect, the layout is fixed by OpenGL
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;  // Index of the draw's per-draw data
+};
+
+
+// Data that differs between the draws of a multi-draw, read as instanced vertex attributes (see Mesh::draw for the single draw equivalent)
+struct DrawData {
+	glm::vec3 positionOffset;
+	glm::vec3 positionScale;
+};
+
+
+// Collects mesh draws and submits them with one glMultiDrawElementsIndirect per vertex array and material,
+// instead of a draw call (and texture binds) per mesh. Each draw's base instance points at its per-draw data
+// NOTE: Needs multi-draw indirect support (see GlExtensions), without it meshes have to be drawn one by one
+class MultiDrawBatch
+{
+public:
+	// Default constructor, buffers are created by createBuffers
+	MultiDrawBatch() = default;
+
+	// Create the command and per-draw data buffers, does nothing if they already exist
+	void createBuffers();
+
+	// Add a mesh at a level of detail to the batch
+	void add(const Mesh &mesh, size_t lod);
+
+	// Draw everything added since the last submit and empty the batch, returns the amount of draw calls issued
+	size_t submit(Shader &shader);
+
+	// Whether the current context supports multi-draw indirect
+	static bool isSupported();
+
+
+private:
+	// Mesh added to the batch
+	struct Draw {
+		GLuint vertexArray;
+		const Material *material;
+		const Mesh *mesh;
+		size_t lod;
+	};
+
+	std::vector<Draw> draws;
+
+	// Contents of the buffers, kept to reuse their memory
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<DrawData> drawData;
+
+	GpuResource commandBuffer;
+	GpuResource drawDataBuffer;
+
+	// Handle of the normal decoding switch in the shader program last submitted with, looked up again only when the program changes
+	GLuint handleProgram = 0;
+	UniformHandle octahedralNormalsHandle = -1;
+
+	// Order draws by vertex array and then material, so draws that can share a multi-draw end up next to each other
+	static bool compareDraws(const Draw &a, const Draw &b);
+};
+
+#endif
\ No newline at end of file
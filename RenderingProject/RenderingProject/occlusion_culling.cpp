@@ -0,0 +1,472 @@
+#include "occlusion_culling.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include "thread_pool.h"
+
+// AVX has to be enabled explicitly (/arch:AVX or /arch:AVX2, which the x64 configurations of the project build with), SSE2 is part of every x64 target
+// and enabled by default for 32 bit ones by current compilers
+#if defined(__AVX__)
+#define OCCLUSION_CULLING_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_CULLING_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+
+static const int OCCLUSION_TILE_COUNT_X = OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_SIZE;
+static const int OCCLUSION_TILE_COUNT_Y = OCCLUSION_BUFFER_HEIGHT / OCCLUSION_TILE_SIZE;
+static const int OCCLUSION_BAND_COUNT = OCCLUSION_BUFFER_HEIGHT / OCCLUSION_BAND_HEIGHT;
+
+static_assert(OCCLUSION_BUFFER_WIDTH % 8 == 0, "Rows have to hold whole groups of pixels rasterized at once");
+static_assert(OCCLUSION_BUFFER_WIDTH % OCCLUSION_TILE_SIZE == 0 && OCCLUSION_BUFFER_HEIGHT % OCCLUSION_BAND_HEIGHT == 0
+	&& OCCLUSION_BAND_HEIGHT % OCCLUSION_TILE_SIZE == 0, "The depth buffer has to split evenly into bands and tiles");
+
+// Clip space planes triangles are clipped against, as (a, b, c, d) with a * x + b * y + c * z + d * w >= 0 inside: the near plane
+// and a guard band twice the size of the screen, which keeps screen coordinates small enough for precise edge functions
+static const vec4 CLIP_PLANES[] = {
+	vec4(0.0f, 0.0f, 1.0f, 1.0f),
+	vec4(1.0f, 0.0f, 0.0f, 2.0f),
+	vec4(-1.0f, 0.0f, 0.0f, 2.0f),
+	vec4(0.0f, 1.0f, 0.0f, 2.0f),
+	vec4(0.0f, -1.0f, 0.0f, 2.0f)
+};
+
+
+//-----------------
+// Rasterizer lanes
+//-----------------
+
+// Pixels rasterized at once and the operations on them, so the same rasterizer runs with AVX, SSE or plain floats
+#if defined(OCCLUSION_CULLING_AVX)
+typedef __m256 Lanes;
+static const int LANE_COUNT = 8;
+
+static inline Lanes lanesSet(float value) { return _mm256_set1_ps(value); }
+static inline Lanes lanesIndices() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+static inline Lanes lanesLoad(const float *values) { return _mm256_loadu_ps(values); }
+static inline void lanesStore(float *values, Lanes lanes) { _mm256_storeu_ps(values, lanes); }
+static inline Lanes lanesAdd(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+static inline Lanes lanesMul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+static inline Lanes lanesMin(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+
+// Lanes of inside where all three edge functions are at least zero, and lanes of outside elsewhere
+static inline Lanes lanesSelectInside(Lanes edge0, Lanes edge1, Lanes edge2, Lanes inside, Lanes outside)
+{
+	Lanes mask = _mm256_cmp_ps(_mm256_min_ps(_mm256_min_ps(edge0, edge1), edge2), _mm256_setzero_ps(), _CMP_GE_OQ);
+	return _mm256_blendv_ps(outside, inside, mask);
+}
+#elif defined(OCCLUSION_CULLING_SSE2)
+typedef __m128 Lanes;
+static const int LANE_COUNT = 4;
+
+static inline Lanes lanesSet(float value) { return _mm_set1_ps(value); }
+static inline Lanes lanesIndices() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+static inline Lanes lanesLoad(const float *values) { return _mm_loadu_ps(values); }
+static inline void lanesStore(float *values, Lanes lanes) { _mm_storeu_ps(values, lanes); }
+static inline Lanes lanesAdd(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes lanesMul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes lanesMin(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+
+// Lanes of inside where all three edge functions are at least zero, and lanes of outside elsewhere
+static inline Lanes lanesSelectInside(Lanes edge0, Lanes edge1, Lanes edge2, Lanes inside, Lanes outside)
+{
+	Lanes mask = _mm_cmpge_ps(_mm_min_ps(_mm_min_ps(edge0, edge1), edge2), _mm_setzero_ps());
+	return _mm_or_ps(_mm_and_ps(mask, inside), _mm_andnot_ps(mask, outside));
+}
+#else
+typedef float Lanes;
+static const int LANE_COUNT = 1;
+
+static inline Lanes lanesSet(float value) { return value; }
+static inline Lanes lanesIndices() { return 0.0f; }
+static inline Lanes lanesLoad(const float *values) { return *values; }
+static inline void lanesStore(float *values, Lanes lanes) { *values = lanes; }
+static inline Lanes lanesAdd(Lanes a, Lanes b) { return a + b; }
+static inline Lanes lanesMul(Lanes a, Lanes b) { return a * b; }
+static inline Lanes lanesMin(Lanes a, Lanes b) { return std::min(a, b); }
+
+// Inside where all three edge functions are at least zero, and outside elsewhere
+static inline Lanes lanesSelectInside(Lanes edge0, Lanes edge1, Lanes edge2, Lanes inside, Lanes outside)
+{
+	return std::min(std::min(edge0, edge1), edge2) >= 0.0f ? inside : outside;
+}
+#endif
+
+
+//------------------
+// Occlusion culling
+//------------------
+
+OcclusionCullingStats OcclusionCuller::frameStats;
+bool OcclusionCuller::enabled = true;
+
+
+struct OcclusionCuller::Job {
+	OcclusionCuller *culler;
+	atomic<int> nextBand;
+	int finishedBands = 0;
+	mutex finishedMutex;
+	condition_variable allFinished;
+
+	// Rasterize bands until none are left, returns once this call has nothing more to do
+	void run()
+	{
+		for (int band = nextBand++; band < OCCLUSION_BAND_COUNT; band = nextBand++)
+		{
+			culler->rasterizeBand(band);
+
+			lock_guard<mutex> lock(finishedMutex);
+			if (++finishedBands == OCCLUSION_BAND_COUNT)
+			{
+				allFinished.notify_all();
+			}
+		}
+	}
+};
+
+
+OcclusionCuller::OcclusionCuller()
+{
+	depth.resize(OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT, 1.0f);
+	tileMaxDepth.resize(OCCLUSION_TILE_COUNT_X * OCCLUSION_TILE_COUNT_Y, 1.0f);
+	bandTriangles.resize(OCCLUSION_BAND_COUNT);
+}
+
+
+void OcclusionCuller::begin(const mat4 &viewProjection)
+{
+	this->viewProjection = viewProjection;
+	active = enabled;
+
+	triangles.clear();
+	for (vector<uint32_t> &band : bandTriangles)
+	{
+		band.clear();
+	}
+}
+
+
+void OcclusionCuller::addOccluder(const vec3 *positions, size_t vertexCount, const uint32_t *indices, size_t indexCount, const mat4 &modelMatrix)
+{
+	if (!active)
+	{
+		return;
+	}
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+	mat4 transform = viewProjection * modelMatrix;
+	clipPositions.resize(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		clipPositions[i] = transform * vec4(positions[i], 1.0f);
+	}
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		addClipTriangle(clipPositions[indices[i]], clipPositions[indices[i + 1]], clipPositions[indices[i + 2]]);
+	}
+
+	frameStats.occluderTimeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+}
+
+
+void OcclusionCuller::rasterize()
+{
+	if (!active)
+	{
+		return;
+	}
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+	// Bands are independent, so workers each take bands until none are left while the main thread does the same
+	shared_ptr<Job> job = make_shared<Job>();
+	job->culler = this;
+	job->nextBand = 0;
+
+	ThreadPool &pool = ThreadPool::global();
+	unsigned workerCount = std::min(pool.getThreadCount(), (unsigned)OCCLUSION_BAND_COUNT - 1);
+	for (unsigned i = 0; i < workerCount; i++)
+	{
+		pool.submit([job]() { job->run(); });
+	}
+	job->run();
+	{
+		unique_lock<mutex> lock(job->finishedMutex);
+		job->allFinished.wait(lock, [&job]() { return job->finishedBands == OCCLUSION_BAND_COUNT; });
+	}
+
+	frameStats.occluderTriangles += triangles.size();
+	frameStats.occluderTimeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+}
+
+
+bool OcclusionCuller::isOccluded(const Bounds &box, const mat4 &modelMatrix) const
+{
+	if (!active)
+	{
+		return false;
+	}
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+	frameStats.occludees++;
+
+	// Screen rectangle and nearest depth of the box corners, boxes reaching in front of the near plane are never occluded
+	mat4 transform = viewProjection * modelMatrix;
+	vec2 screenMin = vec2(FLT_MAX);
+	vec2 screenMax = vec2(-FLT_MAX);
+	float nearestDepth = FLT_MAX;
+	bool inFront = true;
+	for (int corner = 0; corner < 8 && inFront; corner++)
+	{
+		vec3 position = vec3(corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y, corner & 4 ? box.max.z : box.min.z);
+		vec4 clip = transform * vec4(position, 1.0f);
+		inFront = clip.z >= -clip.w;
+
+		vec3 ndc = vec3(clip) / clip.w;
+		vec2 screen = (vec2(ndc) * 0.5f + 0.5f) * vec2(OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+		screenMin = glm::min(screenMin, screen);
+		screenMax = glm::max(screenMax, screen);
+		nearestDepth = std::min(nearestDepth, ndc.z * 0.5f + 0.5f);
+	}
+
+	// Every pixel the rectangle touches has to hold something nearer than the box
+	int firstX = std::max((int)floor(screenMin.x), 0);
+	int firstY = std::max((int)floor(screenMin.y), 0);
+	int lastX = std::min((int)floor(screenMax.x), OCCLUSION_BUFFER_WIDTH - 1);
+	int lastY = std::min((int)floor(screenMax.y), OCCLUSION_BUFFER_HEIGHT - 1);
+	bool occluded = inFront && firstX <= lastX && firstY <= lastY;
+	for (int tileY = firstY / OCCLUSION_TILE_SIZE; tileY <= lastY / OCCLUSION_TILE_SIZE && occluded; tileY++)
+	{
+		for (int tileX = firstX / OCCLUSION_TILE_SIZE; tileX <= lastX / OCCLUSION_TILE_SIZE && occluded; tileX++)
+		{
+			if (tileMaxDepth[tileY * OCCLUSION_TILE_COUNT_X + tileX] < nearestDepth)
+			{
+				continue;
+			}
+
+			// Part of the tile is farther than the box, which only matters if that part is within the rectangle
+			int tileLastY = std::min(tileY * OCCLUSION_TILE_SIZE + OCCLUSION_TILE_SIZE - 1, lastY);
+			int tileLastX = std::min(tileX * OCCLUSION_TILE_SIZE + OCCLUSION_TILE_SIZE - 1, lastX);
+			for (int y = std::max(tileY * OCCLUSION_TILE_SIZE, firstY); y <= tileLastY && occluded; y++)
+			{
+				for (int x = std::max(tileX * OCCLUSION_TILE_SIZE, firstX); x <= tileLastX && occluded; x++)
+				{
+					occluded = depth[y * OCCLUSION_BUFFER_WIDTH + x] < nearestDepth;
+				}
+			}
+		}
+	}
+
+	frameStats.occluded += occluded ? 1 : 0;
+	frameStats.occludeeTimeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+	return occluded;
+}
+
+
+void OcclusionCuller::setEnabled(bool enabled)
+{
+	OcclusionCuller::enabled = enabled;
+}
+
+
+bool OcclusionCuller::isEnabled()
+{
+	return enabled;
+}
+
+
+const OcclusionCullingStats &OcclusionCuller::getFrameStats()
+{
+	return frameStats;
+}
+
+
+void OcclusionCuller::resetFrameStats()
+{
+	frameStats = OcclusionCullingStats();
+}
+
+
+void OcclusionCuller::addClipTriangle(const vec4 &a, const vec4 &b, const vec4 &c)
+{
+	// Sutherland-Hodgman, every plane adds at most one vertex to the polygon
+	const int maxVertices = 3 + (int)size(CLIP_PLANES);
+	vec4 polygon[maxVertices] = { a, b, c };
+	vec4 clipped[maxVertices];
+	int vertexCount = 3;
+
+	for (const vec4 &plane : CLIP_PLANES)
+	{
+		float distances[maxVertices];
+		bool allInside = true;
+		bool allOutside = true;
+		for (int i = 0; i < vertexCount; i++)
+		{
+			distances[i] = dot(plane, polygon[i]);
+			allInside = allInside && distances[i] >= 0.0f;
+			allOutside = allOutside && distances[i] < 0.0f;
+		}
+		if (allOutside)
+		{
+			return;
+		}
+		if (allInside)
+		{
+			continue;
+		}
+
+		int clippedCount = 0;
+		for (int i = 0; i < vertexCount; i++)
+		{
+			int next = (i + 1) % vertexCount;
+			if (distances[i] >= 0.0f)
+			{
+				clipped[clippedCount++] = polygon[i];
+			}
+			if ((distances[i] >= 0.0f) != (distances[next] >= 0.0f))
+			{
+				clipped[clippedCount++] = mix(polygon[i], polygon[next], distances[i] / (distances[i] - distances[next]));
+			}
+		}
+		copy(clipped, clipped + clippedCount, polygon);
+		vertexCount = clippedCount;
+	}
+
+	// Depth buffer pixels with depth from 0 to 1 like the window coordinates OpenGL produces, as a triangle fan
+	vec3 screen[maxVertices];
+	for (int i = 0; i < vertexCount; i++)
+	{
+		vec3 ndc = vec3(polygon[i]) / polygon[i].w;
+		screen[i] = vec3((ndc.x * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH, (ndc.y * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT, ndc.z * 0.5f + 0.5f);
+	}
+	for (int i = 1; i + 1 < vertexCount; i++)
+	{
+		addScreenTriangle(screen[0], screen[i], screen[i + 1]);
+	}
+}
+
+
+void OcclusionCuller::addScreenTriangle(const vec3 &a, const vec3 &b, const vec3 &c)
+{
+	// Twice the signed area, positive for counter-clockwise triangles since rows go up like normalized device coordinates
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (area <= 0.0f)
+	{
+		return;
+	}
+
+	Triangle triangle;
+	triangle.minX = std::max((int)floor(std::min(std::min(a.x, b.x), c.x)), 0);
+	triangle.minY = std::max((int)floor(std::min(std::min(a.y, b.y), c.y)), 0);
+	triangle.maxX = std::min((int)floor(std::max(std::max(a.x, b.x), c.x)), OCCLUSION_BUFFER_WIDTH - 1);
+	triangle.maxY = std::min((int)floor(std::max(std::max(a.y, b.y), c.y)), OCCLUSION_BUFFER_HEIGHT - 1);
+	if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+	{
+		return;
+	}
+
+	// Edge functions are positive left of each edge, moving them inwards by how far a pixel reaches from its center towards
+	// the edge leaves them positive only for pixels entirely inside
+	const vec3 *vertices[3] = { &a, &b, &c };
+	for (int edge = 0; edge < 3; edge++)
+	{
+		const vec3 &from = *vertices[edge];
+		const vec3 &to = *vertices[(edge + 1) % 3];
+		triangle.edgeA[edge] = from.y - to.y;
+		triangle.edgeB[edge] = to.x - from.x;
+		triangle.edgeC[edge] = -triangle.edgeA[edge] * from.x - triangle.edgeB[edge] * from.y - 0.5f * (fabs(triangle.edgeA[edge]) + fabs(triangle.edgeB[edge]));
+	}
+
+	// Depth is linear in screen space, the farthest depth over a pixel is at one of its corners but never beyond the farthest vertex
+	triangle.depthA = ((b.z - a.z) * (c.y - a.y) - (b.y - a.y) * (c.z - a.z)) / area;
+	triangle.depthB = ((b.x - a.x) * (c.z - a.z) - (b.z - a.z) * (c.x - a.x)) / area;
+	triangle.depthC = a.z - triangle.depthA * a.x - triangle.depthB * a.y + 0.5f * (fabs(triangle.depthA) + fabs(triangle.depthB));
+	triangle.maxDepth = std::max(std::max(a.z, b.z), c.z);
+
+	uint32_t index = (uint32_t)triangles.size();
+	triangles.push_back(triangle);
+	for (int band = triangle.minY / OCCLUSION_BAND_HEIGHT; band <= triangle.maxY / OCCLUSION_BAND_HEIGHT; band++)
+	{
+		bandTriangles[band].push_back(index);
+	}
+}
+
+
+void OcclusionCuller::rasterizeBand(int band)
+{
+	int firstRow = band * OCCLUSION_BAND_HEIGHT;
+	int lastRow = firstRow + OCCLUSION_BAND_HEIGHT - 1;
+	fill(depth.begin() + firstRow * OCCLUSION_BUFFER_WIDTH, depth.begin() + (lastRow + 1) * OCCLUSION_BUFFER_WIDTH, 1.0f);
+
+	const Lanes laneIndices = lanesIndices();
+	for (uint32_t index : bandTriangles[band])
+	{
+		const Triangle &triangle = triangles[index];
+
+		// Functions at the pixel centers of the first group of every row, rows start at a whole group so stores stay within the row
+		int firstX = triangle.minX / LANE_COUNT * LANE_COUNT;
+		Lanes x = lanesAdd(laneIndices, lanesSet(firstX + 0.5f));
+		Lanes edgeStart[3], edgeStep[3];
+		for (int edge = 0; edge < 3; edge++)
+		{
+			edgeStart[edge] = lanesAdd(lanesMul(lanesSet(triangle.edgeA[edge]), x), lanesSet(triangle.edgeC[edge]));
+			edgeStep[edge] = lanesSet(triangle.edgeA[edge] * LANE_COUNT);
+		}
+		Lanes depthStart = lanesAdd(lanesMul(lanesSet(triangle.depthA), x), lanesSet(triangle.depthC));
+		Lanes depthStep = lanesSet(triangle.depthA * LANE_COUNT);
+		Lanes maxDepth = lanesSet(triangle.maxDepth);
+
+		int lastY = std::min(triangle.maxY, lastRow);
+		for (int y = std::max(triangle.minY, firstRow); y <= lastY; y++)
+		{
+			float rowY = y + 0.5f;
+			Lanes edge0 = lanesAdd(edgeStart[0], lanesSet(triangle.edgeB[0] * rowY));
+			Lanes edge1 = lanesAdd(edgeStart[1], lanesSet(triangle.edgeB[1] * rowY));
+			Lanes edge2 = lanesAdd(edgeStart[2], lanesSet(triangle.edgeB[2] * rowY));
+			Lanes pixelDepth = lanesAdd(depthStart, lanesSet(triangle.depthB * rowY));
+
+			float *row = &depth[y * OCCLUSION_BUFFER_WIDTH];
+			for (int pixel = firstX; pixel <= triangle.maxX; pixel += LANE_COUNT)
+			{
+				Lanes previous = lanesLoad(row + pixel);
+				Lanes nearest = lanesMin(previous, lanesMin(pixelDepth, maxDepth));
+				lanesStore(row + pixel, lanesSelectInside(edge0, edge1, edge2, nearest, previous));
+
+				edge0 = lanesAdd(edge0, edgeStep[0]);
+				edge1 = lanesAdd(edge1, edgeStep[1]);
+				edge2 = lanesAdd(edge2, edgeStep[2]);
+				pixelDepth = lanesAdd(pixelDepth, depthStep);
+			}
+		}
+	}
+
+	// Farthest depth of the tiles in the band
+	for (int tileY = firstRow / OCCLUSION_TILE_SIZE; tileY <= lastRow / OCCLUSION_TILE_SIZE; tileY++)
+	{
+		for (int tileX = 0; tileX < OCCLUSION_TILE_COUNT_X; tileX++)
+		{
+			float farthest = 0.0f;
+			for (int y = tileY * OCCLUSION_TILE_SIZE; y < (tileY + 1) * OCCLUSION_TILE_SIZE; y++)
+			{
+				const float *row = &depth[y * OCCLUSION_BUFFER_WIDTH + tileX * OCCLUSION_TILE_SIZE];
+				for (int x = 0; x < OCCLUSION_TILE_SIZE; x++)
+				{
+					farthest = std::max(farthest, row[x]);
+				}
+			}
+			tileMaxDepth[tileY * OCCLUSION_TILE_COUNT_X + tileX] = farthest;
+		}
+	}
+}
\ No newline at end of file
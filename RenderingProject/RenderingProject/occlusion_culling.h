@@ -0,0 +1,113 @@
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "mesh.h"
+
+
+// Size in pixels of the depth buffer occluders are rasterized into, whatever the size of the viewport
+const int OCCLUSION_BUFFER_WIDTH = 320;
+const int OCCLUSION_BUFFER_HEIGHT = 192;
+
+// Side of the square tiles of the depth buffer that keep the farthest depth of their pixels, so most tests compare once per tile
+const int OCCLUSION_TILE_SIZE = 8;
+
+// Rows of the depth buffer rasterized by one task, a multiple of the tile size
+const int OCCLUSION_BAND_HEIGHT = 16;
+
+
+// Work done by all occlusion cullers during the current frame
+struct OcclusionCullingStats {
+	size_t occluderTriangles = 0;  // Triangles rasterized into the depth buffers, after back faces were dropped and clipping
+	size_t occludees = 0;          // Bounding boxes tested
+	size_t occluded = 0;           // Boxes found hidden behind the occluders, which aren't drawn
+	double occluderTimeMs = 0.0;   // Time spent transforming and rasterizing occluders
+	double occludeeTimeMs = 0.0;   // Time spent testing boxes
+};
+
+
+// Software occlusion culling: a few large objects close to the camera are rasterized on the CPU into a small depth buffer,
+// and objects whose bounding boxes are behind that depth everywhere they cover can be skipped
+// Rasterization is conservative, a pixel only takes the depth of a triangle it lies entirely inside of, and then the farthest depth
+// the triangle has over it, so occluders may hide less than they do on screen but never more. The buffer is split into bands of
+// rows that are rasterized in parallel on the global thread pool, eight pixels at a time with AVX or four with SSE where AVX isn't enabled
+// Usage every frame: begin with the view, add occluders, rasterize them and then test objects
+// NOTE: Runs entirely on the CPU, but occluders and tests may only be added from one thread at a time
+class OcclusionCuller
+{
+public:
+	// Constructor to allocate the depth buffer
+	OcclusionCuller();
+
+	// Clear the depth buffer and start collecting occluders seen through a combined projection * view matrix
+	void begin(const glm::mat4 &viewProjection);
+
+	// Add an indexed triangle mesh as occluder, given in object space along with the model matrix placing it in the world
+	// Only front faces (counter-clockwise on screen) are rasterized, so occluders should be closed meshes or at least face the camera
+	void addOccluder(const glm::vec3 *positions, size_t vertexCount, const uint32_t *indices, size_t indexCount, const glm::mat4 &modelMatrix);
+
+	// Rasterize the occluders added since begin, must be called before testing objects
+	void rasterize();
+
+	// Whether an object is entirely hidden behind the occluders, given by its object space box and the model matrix placing it
+	// Always false while occlusion culling is disabled
+	bool isOccluded(const Bounds &box, const glm::mat4 &modelMatrix) const;
+
+	// Whether objects are culled at all (on by default), turning it off allows measuring what culling saves
+	static void setEnabled(bool enabled);
+	static bool isEnabled();
+
+	// Work done during the current frame
+	static const OcclusionCullingStats &getFrameStats();
+
+	// Reset the work counts, should be called at the start of every frame
+	static void resetFrameStats();
+
+
+private:
+	// Triangle in depth buffer pixels prepared for rasterization, every function is evaluated at pixel centers as a * x + b * y + c
+	// The edge functions are positive inside and offset so that they're only positive for pixels entirely inside the triangle,
+	// the depth function is offset to give the farthest depth over the pixel
+	struct Triangle {
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthA, depthB, depthC;
+		float maxDepth;
+		int minX, minY, maxX, maxY;
+	};
+
+	// Rasterization in progress, shared with the worker tasks so late ones find no work left instead of a deleted object
+	struct Job;
+
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+	bool active = false;  // Whether culling was enabled at begin, stays the same until the next begin
+
+	// Depth of every pixel from 0 (near plane) to 1 (far plane), rows from the bottom of the screen up
+	std::vector<float> depth;
+
+	// Farthest depth of every tile, filled along with the depth buffer
+	std::vector<float> tileMaxDepth;
+
+	// Triangles of the occluders and the ones overlapping every band, kept between frames to reuse their memory
+	std::vector<Triangle> triangles;
+	std::vector<std::vector<uint32_t>> bandTriangles;
+	std::vector<glm::vec4> clipPositions;
+
+	// Work of the current frame
+	static OcclusionCullingStats frameStats;
+
+	// Whether objects are culled
+	static bool enabled;
+
+	// Clip a triangle against the near plane and a guard band around the screen, then set up the triangles the result is made of
+	void addClipTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c);
+
+	// Set up a triangle in depth buffer pixels for rasterization and add it to the bands it overlaps, dropping back faces
+	void addScreenTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c);
+
+	// Rasterize the triangles overlapping a band of rows and update the farthest depths of its tiles, runs on the thread pool
+	void rasterizeBand(int band);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#include "gl_extensions.h"
+#include "program_cache.h"
+
+using namespace std;
+
+
+static_assert(sizeof(ProgramCacheHeader) == 24, "ProgramCacheHeader has unexpected padding");
+
+
+static const char PROGRAM_CACHE_MAGIC[4] = { 'R', 'P', 'P', 'B' };
+
+
+// Continue a 64-bit FNV-1a hash with a string, including its terminating zero so that consecutive strings can't run into each other
+static void hashString(uint64_t &hash, const char *text)
+{
+	size_t length = strlen(text);
+	for (size_t i = 0; i <= length; i++)
+	{
+		hash ^= (unsigned char)text[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+
+// Create a directory if it doesn't exist yet
+static void createDirectory(const char *path)
+{
+#ifdef _WIN32
+	_mkdir(path);
+#else
+	mkdir(path, 0755);
+#endif
+}
+
+
+bool ProgramCache::load(const string &vertexSource, const string &fragmentSource, GpuResource &program)
+{
+	if (!isSupported())
+	{
+		return false;
+	}
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+	uint64_t key = getKey(vertexSource, fragmentSource);
+
+	ifstream cacheFile(getPath(key), ios::binary);
+	if (!cacheFile)
+	{
+		return false;
+	}
+
+	ProgramCacheHeader header;
+	if (!cacheFile.read((char *)&header, sizeof(header)) || memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != PROGRAM_CACHE_VERSION || header.key != key)
+	{
+		return false;
+	}
+
+	vector<char> binary(header.binaryLength);
+	if (!cacheFile.read(binary.data(), binary.size()))
+	{
+		cerr << "ERROR::PROGRAM_CACHE::CORRUPT_FILE " << getPath(key) << endl;
+		return false;
+	}
+
+	GpuResource loaded(GPU_RESOURCE_PROGRAM);
+	getGlExtensions().glProgramBinary(loaded.get(), header.binaryFormat, binary.data(), (GLsizei)binary.size());
+	GLint success = 0;
+	glGetProgramiv(loaded.get(), GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		stats.rejected++;
+		return false;
+	}
+
+	program = std::move(loaded);
+	stats.hits++;
+	stats.loadTimeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+	return true;
+}
+
+
+void ProgramCache::store(const string &vertexSource, const string &fragmentSource, const GpuResource &program)
+{
+	if (!isSupported())
+	{
+		return;
+	}
+
+	GLint length = 0;
+	glGetProgramiv(program.get(), GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+	{
+		return;
+	}
+
+	vector<char> binary(length);
+	GLenum binaryFormat = 0;
+	getGlExtensions().glGetProgramBinary(program.get(), length, &length, &binaryFormat, binary.data());
+
+	ProgramCacheHeader header;
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = getKey(vertexSource, fragmentSource);
+	header.binaryFormat = binaryFormat;
+	header.binaryLength = (uint32_t)length;
+
+	// Write into a temporary file first, so a crash halfway never leaves a broken binary behind
+	createDirectory(PROGRAM_CACHE_DIRECTORY);
+	string cachePath = getPath(header.key);
+	string tempPath = cachePath + ".tmp";
+	{
+		ofstream cacheFile(tempPath, ios::binary | ios::trunc);
+		cacheFile.write((const char *)&header, sizeof(header));
+		cacheFile.write(binary.data(), length);
+		if (!cacheFile)
+		{
+			cerr << "ERROR::PROGRAM_CACHE::FILE_NOT_WRITABLE " << tempPath << endl;
+			cacheFile.close();
+			remove(tempPath.c_str());
+			return;
+		}
+	}
+
+	// Rename doesn't replace existing files on every platform
+	remove(cachePath.c_str());
+	if (rename(tempPath.c_str(), cachePath.c_str()) != 0)
+	{
+		cerr << "ERROR::PROGRAM_CACHE::FILE_NOT_WRITABLE " << cachePath << endl;
+		remove(tempPath.c_str());
+	}
+}
+
+
+void ProgramCache::addCompile(double timeMs)
+{
+	stats.misses++;
+	stats.compileTimeMs += timeMs;
+}
+
+
+const ProgramCacheStats &ProgramCache::getStats() const
+{
+	return stats;
+}
+
+
+bool ProgramCache::isSupported()
+{
+	return getGlExtensions().programBinary;
+}
+
+
+void ProgramCache::prepareForStore(GLuint program)
+{
+	if (isSupported())
+	{
+		getGlExtensions().glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+}
+
+
+ProgramCache &ProgramCache::global()
+{
+	static ProgramCache cache;
+	return cache;
+}
+
+
+uint64_t ProgramCache::getKey(const string &vertexSource, const string &fragmentSource)
+{
+	// Binaries only work with the driver that produced them, so the driver is part of the key
+	uint64_t hash = 14695981039346656037ULL;
+	hashString(hash, vertexSource.c_str());
+	hashString(hash, fragmentSource.c_str());
+	hashString(hash, (const char *)glGetString(GL_VENDOR));
+	hashString(hash, (const char *)glGetString(GL_RENDERER));
+	hashString(hash, (const char *)glGetString(GL_VERSION));
+	return hash;
+}
+
+
+string ProgramCache::getPath(uint64_t key)
+{
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "%016llx.bin", (unsigned long long)key);
+	return string(PROGRAM_CACHE_DIRECTORY) + "/" + fileName;
+}
\ No newline at end of file
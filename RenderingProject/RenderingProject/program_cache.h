@@ -0,0 +1,86 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+#include "gpu_resource.h"
+
+
+// On-disk cache of linked shader programs as driver specific binaries, so later runs can skip compiling and linking
+// Each program is a file in the cache directory named after a hash of its sources and the driver's vendor, renderer and version
+// strings, holding a ProgramCacheHeader followed by the binary. Binaries the driver rejects are simply compiled again and replaced
+
+
+// Directory the program binaries are written to, relative to the working directory
+const char *const PROGRAM_CACHE_DIRECTORY = "shadercache";
+
+// Bump whenever the file layout changes
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+
+// Fixed size header at the start of a cache file
+struct ProgramCacheHeader {
+	char magic[4];         // "RPPB"
+	uint32_t version;
+	uint64_t key;          // Hash the file is named after, guards against collisions in the file name
+	uint32_t binaryFormat;
+	uint32_t binaryLength;
+};
+
+
+// Cache hits and time spent building programs since the start of the program
+struct ProgramCacheStats {
+	unsigned hits = 0;
+	unsigned misses = 0;       // Programs compiled from source, including rejected binaries
+	unsigned rejected = 0;     // Binaries found in the cache but refused by the driver (e.g. after a driver update)
+	double loadTimeMs = 0.0;
+	double compileTimeMs = 0.0;
+};
+
+
+// NOTE: Like OpenGL itself, the program cache may only be used on the main thread
+class ProgramCache
+{
+public:
+	// Default constructor
+	ProgramCache() = default;
+
+	// The cache is a single global directory, so it can't be copied
+	ProgramCache(const ProgramCache &) = delete;
+	ProgramCache &operator=(const ProgramCache &) = delete;
+
+	// Create a program from the cached binary of these sources, returns false (leaving program empty) if there is none,
+	// the driver rejects it or the driver doesn't support program binaries
+	bool load(const std::string &vertexSource, const std::string &fragmentSource, GpuResource &program);
+
+	// Write the binary of a program linked from these sources to the cache, does nothing without program binary support
+	void store(const std::string &vertexSource, const std::string &fragmentSource, const GpuResource &program);
+
+	// Count a program compiled from source because load failed
+	void addCompile(double timeMs);
+
+	// Hits and build times so far
+	const ProgramCacheStats &getStats() const;
+
+	// Whether the driver supports program binaries, i.e. whether the cache does anything
+	static bool isSupported();
+
+	// Ask the driver to keep a program's binary retrievable, must be called before linking a program that will be stored
+	static void prepareForStore(GLuint program);
+
+	// Cache shared by all shaders
+	static ProgramCache &global();
+
+
+private:
+	ProgramCacheStats stats;
+
+	// Hash of the sources and the driver strings
+	static uint64_t getKey(const std::string &vertexSource, const std::string &fragmentSource);
+
+	// Path of the cache file of a key
+	static std::string getPath(uint64_t key);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,565 @@
+#include "render_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <glm/gtc/type_ptr.hpp>
+#include "gl_state.h"
+#include "model.h"
+#include "thread_pool.h"
+
+using namespace std;
+using namespace glm;
+
+
+// Layout of the sort key, from the most significant bits down (pass, program, material, vertex array, depth)
+// Program and vertex array names and material ids are cut to their bits, which at worst puts unrelated items next to each other
+static const int KEY_PASS_SHIFT = 60;
+static const int KEY_PROGRAM_SHIFT = 48;
+static const int KEY_MATERIAL_SHIFT = 32;
+static const int KEY_VERTEX_ARRAY_SHIFT = 20;
+static const uint64_t KEY_PROGRAM_MASK = 0xFFF;
+static const uint64_t KEY_MATERIAL_MASK = 0xFFFF;
+static const uint64_t KEY_VERTEX_ARRAY_MASK = 0xFFF;
+static const uint64_t KEY_DEPTH_MASK = 0xFFFFF;
+
+// Queues shorter than this are sorted on the main thread alone, handing the work out would cost more than it saves
+static const size_t PARALLEL_SORT_MIN_ENTRIES = 16384;
+
+// Fewest entries per chunk when sorting in parallel
+static const size_t SORT_CHUNK_MIN_ENTRIES = 4096;
+
+
+RenderQueueStats RenderQueue::frameStats;
+bool RenderQueue::depthPrepassEnabled = false;
+
+
+struct RenderQueue::SortJob {
+	RenderQueue *queue;
+	int chunkCount;  // Copied so late tasks never read the queue, which may have moved on to another sort or be gone
+	int shift;
+	bool scatter;
+	atomic<int> nextChunk;
+	int finishedChunks = 0;
+	mutex finishedMutex;
+	condition_variable allFinished;
+
+	// Process chunks until none are left, returns once this call has nothing more to do
+	void run()
+	{
+		for (int chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++)
+		{
+			if (scatter)
+			{
+				queue->scatterChunk(chunk, shift);
+			}
+			else
+			{
+				queue->countChunk(chunk, shift);
+			}
+
+			lock_guard<mutex> lock(finishedMutex);
+			if (++finishedChunks == chunkCount)
+			{
+				allFinished.notify_all();
+			}
+		}
+	}
+};
+
+
+void RenderQueue::begin(const mat4 &view, float nearPlane, float farPlane)
+{
+	items.clear();
+	entries.clear();
+	uniformBlocks.clear();
+	uniforms.clear();
+	uniformValues.clear();
+	sorted = true;
+	fill(passBegin, passBegin + RENDER_PASS_COUNT + 1, 0);
+	fill(depthOnlyItems, depthOnlyItems + RENDER_PASS_COUNT, 0);
+
+	// The view space z axis points out of the screen, so depth is the negated third row of the view matrix
+	depthAxis = -vec3(view[0][2], view[1][2], view[2][2]);
+	depthOffset = -view[3][2] - nearPlane;
+	depthScale = (float)KEY_DEPTH_MASK / (farPlane - nearPlane);
+}
+
+
+uint32_t RenderQueue::beginUniformBlock()
+{
+	UniformBlock block = { (uint32_t)uniforms.size(), 0 };
+	uniformBlocks.push_back(block);
+	return (uint32_t)(uniformBlocks.size() - 1);
+}
+
+
+void RenderQueue::addUniform(UniformHandle handle, const mat3 &value)
+{
+	Uniform uniform = { handle, false, (uint32_t)uniformValues.size() };
+	uniforms.push_back(uniform);
+	uniformValues.insert(uniformValues.end(), value_ptr(value), value_ptr(value) + 9);
+	uniformBlocks.back().uniformCount++;
+}
+
+
+void RenderQueue::addUniform(UniformHandle handle, const mat4 &value)
+{
+	Uniform uniform = { handle, true, (uint32_t)uniformValues.size() };
+	uniforms.push_back(uniform);
+	uniformValues.insert(uniformValues.end(), value_ptr(value), value_ptr(value) + 16);
+	uniformBlocks.back().uniformCount++;
+}
+
+
+void RenderQueue::submitMesh(RenderPass pass, Shader &shader, const Mesh &mesh, size_t lod, const vec3 &position, uint32_t uniformBlock,
+	const DepthOnlyDraw &depthOnly)
+{
+	Item item = {};
+	item.shader = &shader;
+	item.material = mesh.material.get();
+	item.vertexArray = mesh.getGeometry().getVertexArray();
+	item.mesh = &mesh;
+	item.lod = lod;
+	item.uniformBlock = uniformBlock;
+	item.depthOnly = depthOnly;
+	submit(pass, item, position);
+}
+
+
+void RenderQueue::submitArrays(RenderPass pass, Shader &shader, GLuint vertexArray, GLint firstVertex, GLsizei vertexCount, GLsizei instanceCount,
+	const vec3 &position, const Material *material, uint32_t uniformBlock, const DepthOnlyDraw &depthOnly)
+{
+	Item item = {};
+	item.shader = &shader;
+	item.material = material;
+	item.vertexArray = vertexArray;
+	item.firstVertex = firstVertex;
+	item.vertexCount = vertexCount;
+	item.instanceCount = instanceCount;
+	item.uniformBlock = uniformBlock;
+	item.depthOnly = depthOnly;
+	submit(pass, item, position);
+}
+
+
+void RenderQueue::execute(RenderPass pass)
+{
+	if (!sorted)
+	{
+		sort();
+	}
+
+	collectFragmentQueries();
+
+	// Passes with depth-only items are measured whether the pre-pass is enabled or not
+	FragmentQuery *query = depthOnlyItems[pass] > 0 ? startFragmentQuery() : nullptr;
+	bool prepass = depthPrepassEnabled && depthOnlyItems[pass] > 0;
+	if (prepass)
+	{
+		if (query)
+		{
+			query->measuredPrepass = true;
+			glBeginQuery(GL_SAMPLES_PASSED, query->prepass.get());
+		}
+		executeDepthPrepass(pass);
+		if (query)
+		{
+			glEndQuery(GL_SAMPLES_PASSED);
+		}
+	}
+	if (query)
+	{
+		glBeginQuery(GL_SAMPLES_PASSED, query->shaded.get());
+	}
+
+	bool multiDraw = Model::isMultiDrawEnabled() && MultiDrawBatch::isSupported();
+	const Item *previous = nullptr;
+	const Material *boundMaterial = nullptr;
+	for (size_t i = passBegin[pass]; i < passBegin[pass + 1]; i++)
+	{
+		const Item &item = items[entries[i].item];
+
+		// Uniforms are program state, so a block is set again whenever the program changes
+		bool sameProgram = previous && previous->shader == item.shader;
+		bool sameMaterial = previous && previous->material == item.material;
+		bool sameVertexArray = previous && previous->vertexArray == item.vertexArray;
+		bool sameUniforms = sameProgram && previous->uniformBlock == item.uniformBlock;
+		int skips = (int)sameProgram + (int)sameMaterial + (int)sameVertexArray + (int)sameUniforms;
+		frameStats.stateSkips += skips;
+		frameStats.stateChanges += 4 - skips;
+
+		// Items drawn in the pre-pass only shade the fragments that ended up visible, without writing depth again
+		bool prepassed = prepass && item.depthOnly.shader;
+		bool samePrepassed = previous && prepassed == (prepass && previous->depthOnly.shader);
+
+		// Batched meshes keep collecting as long as nothing but the mesh changes
+		bool batched = multiDraw && item.mesh;
+		if (!(batched && skips == 4 && samePrepassed))
+		{
+			flushBatch(previous ? previous->shader : nullptr);
+		}
+
+		if (prepass && !samePrepassed)
+		{
+			GlState::global().depthFunc(prepassed ? GL_EQUAL : GL_LESS);
+			GlState::global().depthMask(!prepassed);
+		}
+
+		if (!sameProgram)
+		{
+			item.shader->use();
+			boundMaterial = nullptr;
+		}
+		if (!sameUniforms && item.uniformBlock != NO_UNIFORM_BLOCK)
+		{
+			applyUniformBlock(*item.shader, item.uniformBlock);
+		}
+
+		if (batched)
+		{
+			batch.add(*item.mesh, item.lod);
+		}
+		else if (item.mesh)
+		{
+			item.mesh->draw(*item.shader, item.lod, boundMaterial);
+			frameStats.drawCalls++;
+		}
+		else
+		{
+			if (item.material)
+			{
+				item.material->bind(*item.shader, boundMaterial);
+			}
+			GlState::global().bindVertexArray(item.vertexArray);
+			glDrawArraysInstanced(GL_TRIANGLES, item.firstVertex, item.vertexCount, item.instanceCount);
+			frameStats.drawCalls++;
+		}
+
+		// Items without a material leave the textures of the previous one bound
+		if (item.material)
+		{
+			boundMaterial = item.material;
+		}
+		previous = &item;
+	}
+	flushBatch(previous ? previous->shader : nullptr);
+
+	if (query)
+	{
+		glEndQuery(GL_SAMPLES_PASSED);
+	}
+	if (prepass)
+	{
+		GlState::global().depthFunc(GL_LESS);
+		GlState::global().depthMask(true);
+	}
+}
+
+
+void RenderQueue::setDepthPrepassEnabled(bool enabled)
+{
+	depthPrepassEnabled = enabled;
+}
+
+
+bool RenderQueue::isDepthPrepassEnabled()
+{
+	return depthPrepassEnabled;
+}
+
+
+const RenderQueueStats &RenderQueue::getFrameStats()
+{
+	return frameStats;
+}
+
+
+void RenderQueue::resetFrameStats()
+{
+	frameStats = RenderQueueStats();
+}
+
+
+void RenderQueue::submit(RenderPass pass, const Item &item, const vec3 &position)
+{
+	float depth = (dot(depthAxis, position) + depthOffset) * depthScale;
+	uint64_t depthBits = (uint64_t)std::min(std::max(depth, 0.0f), (float)KEY_DEPTH_MASK);
+	uint64_t material = item.material ? item.material->getSortId() : 0;
+
+	SortEntry entry;
+	entry.key = (uint64_t)pass << KEY_PASS_SHIFT
+		| (item.shader->ID.get() & KEY_PROGRAM_MASK) << KEY_PROGRAM_SHIFT
+		| (material & KEY_MATERIAL_MASK) << KEY_MATERIAL_SHIFT
+		| (item.vertexArray & KEY_VERTEX_ARRAY_MASK) << KEY_VERTEX_ARRAY_SHIFT
+		| depthBits;
+	entry.item = (uint32_t)items.size();
+
+	if (item.depthOnly.shader)
+	{
+		depthOnlyItems[pass]++;
+	}
+	items.push_back(item);
+	entries.push_back(entry);
+	sorted = false;
+	frameStats.items++;
+}
+
+
+void RenderQueue::sort()
+{
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+	size_t count = entries.size();
+	sortBuffer.resize(count);
+
+	size_t chunks = 1;
+	if (count >= PARALLEL_SORT_MIN_ENTRIES)
+	{
+		chunks = std::min((size_t)ThreadPool::global().getThreadCount() + 1, count / SORT_CHUNK_MIN_ENTRIES);
+	}
+	chunkCount = (int)std::max(chunks, (size_t)1);
+	chunkDigits.resize(chunkCount);
+
+	// Bytes that are the same in every key don't change the order, so their passes are skipped
+	// (in a typical frame that's most of the program, material and vertex array bytes)
+	uint64_t differingBits = 0;
+	for (size_t i = 1; i < count; i++)
+	{
+		differingBits |= entries[i].key ^ entries[0].key;
+	}
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		if (((differingBits >> shift) & 0xFF) == 0)
+		{
+			continue;
+		}
+
+		runChunks(shift, false);
+
+		// Every chunk scatters its entries of a digit after those of the earlier chunks, which keeps the sort stable
+		uint32_t offset = 0;
+		for (int digit = 0; digit < 256; digit++)
+		{
+			for (int chunk = 0; chunk < chunkCount; chunk++)
+			{
+				uint32_t digitCount = chunkDigits[chunk][digit];
+				chunkDigits[chunk][digit] = offset;
+				offset += digitCount;
+			}
+		}
+
+		runChunks(shift, true);
+		entries.swap(sortBuffer);
+	}
+
+	// Passes are the top bits of the key, so they're now in order
+	size_t entry = 0;
+	for (int pass = 0; pass <= RENDER_PASS_COUNT; pass++)
+	{
+		while (entry < count && (int)(entries[entry].key >> KEY_PASS_SHIFT) < pass)
+		{
+			entry++;
+		}
+		passBegin[pass] = entry;
+	}
+	passBegin[RENDER_PASS_COUNT] = count;
+
+	sorted = true;
+	frameStats.sortTimeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+}
+
+
+void RenderQueue::countChunk(int chunk, int shift)
+{
+	array<uint32_t, 256> &digits = chunkDigits[chunk];
+	digits.fill(0);
+
+	size_t chunkBegin = entries.size() * chunk / chunkCount;
+	size_t chunkEnd = entries.size() * (chunk + 1) / chunkCount;
+	for (size_t i = chunkBegin; i < chunkEnd; i++)
+	{
+		digits[(entries[i].key >> shift) & 0xFF]++;
+	}
+}
+
+
+void RenderQueue::scatterChunk(int chunk, int shift)
+{
+	array<uint32_t, 256> &offsets = chunkDigits[chunk];
+
+	size_t chunkBegin = entries.size() * chunk / chunkCount;
+	size_t chunkEnd = entries.size() * (chunk + 1) / chunkCount;
+	for (size_t i = chunkBegin; i < chunkEnd; i++)
+	{
+		sortBuffer[offsets[(entries[i].key >> shift) & 0xFF]++] = entries[i];
+	}
+}
+
+
+void RenderQueue::runChunks(int shift, bool scatter)
+{
+	if (chunkCount == 1)
+	{
+		if (scatter)
+		{
+			scatterChunk(0, shift);
+		}
+		else
+		{
+			countChunk(0, shift);
+		}
+		return;
+	}
+
+	// Chunks are independent, so workers each take chunks until none are left while the main thread does the same
+	shared_ptr<SortJob> job = make_shared<SortJob>();
+	job->queue = this;
+	job->chunkCount = chunkCount;
+	job->shift = shift;
+	job->scatter = scatter;
+	job->nextChunk = 0;
+
+	ThreadPool &pool = ThreadPool::global();
+	unsigned workerCount = std::min(pool.getThreadCount(), (unsigned)chunkCount - 1);
+	for (unsigned i = 0; i < workerCount; i++)
+	{
+		pool.submit([job]() { job->run(); });
+	}
+	job->run();
+	{
+		unique_lock<mutex> lock(job->finishedMutex);
+		job->allFinished.wait(lock, [&job]() { return job->finishedChunks == job->chunkCount; });
+	}
+}
+
+
+void RenderQueue::executeDepthPrepass(RenderPass pass)
+{
+	GlState &state = GlState::global();
+	state.colorMask(false);
+	state.depthFunc(GL_LESS);
+	state.depthMask(true);
+
+	// Same order as the pass itself, so depth-only items go front to back within the same state as well
+	const Item *previous = nullptr;
+	for (size_t i = passBegin[pass]; i < passBegin[pass + 1]; i++)
+	{
+		const Item &item = items[entries[i].item];
+		const DepthOnlyDraw &depthOnly = item.depthOnly;
+		if (!depthOnly.shader)
+		{
+			continue;
+		}
+
+		bool sameProgram = previous && previous->depthOnly.shader == depthOnly.shader;
+		if (!sameProgram)
+		{
+			depthOnly.shader->use();
+		}
+		if (!(sameProgram && previous->depthOnly.uniformBlock == depthOnly.uniformBlock) && depthOnly.uniformBlock != NO_UNIFORM_BLOCK)
+		{
+			applyUniformBlock(*depthOnly.shader, depthOnly.uniformBlock);
+		}
+
+		if (item.mesh)
+		{
+			item.mesh->drawPositions(item.lod);
+		}
+		else
+		{
+			state.bindVertexArray(depthOnly.vertexArray);
+			glDrawArraysInstanced(GL_TRIANGLES, item.firstVertex, item.vertexCount, item.instanceCount);
+		}
+		frameStats.prepassDraws++;
+		previous = &item;
+	}
+
+	state.colorMask(true);
+}
+
+
+void RenderQueue::collectFragmentQueries()
+{
+	for (int i = 0; i < FRAGMENT_QUERY_COUNT; i++)
+	{
+		FragmentQuery &query = fragmentQueries[i];
+		if (!query.pending)
+		{
+			continue;
+		}
+
+		// Queries finish in order, so once the last one of a pass is ready the pre-pass one is as well
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(query.shaded.get(), GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			continue;
+		}
+
+		GLuint samples = 0;
+		glGetQueryObjectuiv(query.shaded.get(), GL_QUERY_RESULT, &samples);
+		frameStats.shadedFragments += samples;
+		frameStats.measuredPasses++;
+		if (query.measuredPrepass)
+		{
+			glGetQueryObjectuiv(query.prepass.get(), GL_QUERY_RESULT, &samples);
+			frameStats.prepassFragments += samples;
+			frameStats.measuredPrepasses++;
+		}
+		query.pending = false;
+	}
+}
+
+
+RenderQueue::FragmentQuery *RenderQueue::startFragmentQuery()
+{
+	for (int i = 0; i < FRAGMENT_QUERY_COUNT; i++)
+	{
+		FragmentQuery &query = fragmentQueries[i];
+		if (query.pending)
+		{
+			continue;
+		}
+
+		if (query.shaded.get() == 0)
+		{
+			query.prepass = GpuResource(GPU_RESOURCE_QUERY);
+			query.shaded = GpuResource(GPU_RESOURCE_QUERY);
+		}
+		query.pending = true;
+		query.measuredPrepass = false;
+		return &query;
+	}
+	return nullptr;
+}
+
+
+void RenderQueue::applyUniformBlock(Shader &shader, uint32_t block) const
+{
+	const UniformBlock &uniformBlock = uniformBlocks[block];
+	for (uint32_t i = uniformBlock.firstUniform; i < uniformBlock.firstUniform + uniformBlock.uniformCount; i++)
+	{
+		const Uniform &uniform = uniforms[i];
+		if (uniform.isMat4)
+		{
+			shader.setMat4f(uniform.handle, make_mat4(&uniformValues[uniform.offset]));
+		}
+		else
+		{
+			shader.setMat3f(uniform.handle, make_mat3(&uniformValues[uniform.offset]));
+		}
+	}
+}
+
+
+void RenderQueue::flushBatch(Shader *shader)
+{
+	if (shader)
+	{
+		frameStats.drawCalls += batch.submit(*shader);
+	}
+}
\ No newline at end of file
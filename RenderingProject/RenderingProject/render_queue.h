@@ -0,0 +1,213 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "gpu_resource.h"
+#include "material.h"
+#include "mesh.h"
+#include "multi_draw.h"
+#include "shader.h"
+
+
+// Passes the items of a render queue are drawn in, each executed separately so other work (like deferred lighting) can happen in between
+enum RenderPass {
+	RENDER_PASS_OPAQUE,  // Lit objects, into the G-buffer with deferred shading
+	RENDER_PASS_UNLIT,   // Objects that aren't lit, such as light source gizmos, drawn once the lit ones are shaded
+	RENDER_PASS_COUNT
+};
+
+
+// Uniform block for items that set no uniforms of their own
+const uint32_t NO_UNIFORM_BLOCK = UINT32_MAX;
+
+
+// Depth-only version of an item, drawn in the depth pre-pass
+// Meshes are drawn from their position stream, other items from a vertex array of their own that should read only positions
+struct DepthOnlyDraw {
+	Shader *shader = nullptr;                  // Null for items left out of the pre-pass
+	GLuint vertexArray = 0;                    // Unused for meshes
+	uint32_t uniformBlock = NO_UNIFORM_BLOCK;  // Uniforms of the depth-only shader
+};
+
+
+// Work done by all render queues during the current frame
+// Fragment counts come from occlusion queries, which are read once their results are ready, so they belong to a frame or two earlier
+struct RenderQueueStats {
+	size_t items = 0;               // Items submitted
+	size_t drawCalls = 0;           // Draw calls issued executing them, a multi-draw counts once
+	size_t stateChanges = 0;        // Program, material, vertex array and uniform changes made between consecutive items
+	size_t stateSkips = 0;          // Changes skipped because consecutive items had the same state
+	double sortTimeMs = 0.0;        // Time spent sorting
+	size_t prepassDraws = 0;        // Draw calls of the depth pre-pass
+	uint64_t prepassFragments = 0;  // Fragments passing the depth test in the pre-pass, the ones the lit pass would shade without it
+	uint64_t shadedFragments = 0;   // Fragments shaded by passes with depth-only items
+	size_t measuredPasses = 0;      // Passes the shaded fragments were counted for
+	size_t measuredPrepasses = 0;   // Pre-passes the pre-pass fragments were counted for
+};
+
+
+// Collects the draws of a frame and issues them sorted by a 64 bit key, instead of in the order the scene happens to make them
+// The key holds, from the most significant bits down, the pass, the program, the material, the vertex array and the depth
+// of the item, so draws sharing state end up next to each other and those with the same state go front to back for early depth rejection
+// Items are sorted with a least significant digit radix sort (parallel on the global thread pool for large queues), and while executing
+// only the state that differs from the previous item is changed. Consecutive meshes with the same state are merged into a multi-draw
+// when models use multi-draw
+// With the depth pre-pass enabled, items submitted with a depth-only draw first fill the depth buffer with a trivial shader,
+// after which the pass is drawn testing for equal depth without writing it, so every pixel is shaded once whatever the draw order
+// Usage every frame: begin with the view, submit items, then execute every pass. The items are sorted by the first execute after them
+// NOTE: Items point at the shaders, materials and meshes they draw, which have to stay alive until the frame is executed
+class RenderQueue
+{
+public:
+	// Remove all items and uniform blocks, keeping their memory, and start collecting those of a frame seen through a view
+	// The depth of items is measured along the view direction and spread over the sort key between the clip planes
+	void begin(const glm::mat4 &view, float nearPlane, float farPlane);
+
+	// Start a block of uniform values to submit items with, values are added to the block started last
+	// The values are set on the shader of every item submitted with the block right before it's drawn (unless the previous item set them)
+	uint32_t beginUniformBlock();
+	void addUniform(UniformHandle handle, const glm::mat3 &value);
+	void addUniform(UniformHandle handle, const glm::mat4 &value);
+
+	// Submit a mesh drawn at a level of detail, its depth is that of a world space position (usually the center of the object)
+	void submitMesh(RenderPass pass, Shader &shader, const Mesh &mesh, size_t lod, const glm::vec3 &position, uint32_t uniformBlock = NO_UNIFORM_BLOCK,
+		const DepthOnlyDraw &depthOnly = DepthOnlyDraw());
+
+	// Submit an instanced draw of non-indexed vertices from a vertex array, drawn with the textures that are bound unless a material is given
+	void submitArrays(RenderPass pass, Shader &shader, GLuint vertexArray, GLint firstVertex, GLsizei vertexCount, GLsizei instanceCount,
+		const glm::vec3 &position, const Material *material = nullptr, uint32_t uniformBlock = NO_UNIFORM_BLOCK, const DepthOnlyDraw &depthOnly = DepthOnlyDraw());
+
+	// Draw the items of a pass in sorted order, preceded by the depth pre-pass if it's enabled and the pass has depth-only items
+	// The fragments shaded by passes with depth-only items are counted either way, to compare them with the pre-pass on and off
+	void execute(RenderPass pass);
+
+	// Whether items with a depth-only draw get a depth pre-pass (off by default)
+	static void setDepthPrepassEnabled(bool enabled);
+	static bool isDepthPrepassEnabled();
+
+	// Work done during the current frame
+	static const RenderQueueStats &getFrameStats();
+
+	// Reset the work counts, should be called at the start of every frame
+	static void resetFrameStats();
+
+
+private:
+	// Draw submitted to the queue
+	struct Item {
+		Shader *shader;
+		const Material *material;  // Null to keep the textures that are bound
+		GLuint vertexArray;
+		const Mesh *mesh;          // Mesh drawn, null for other vertices
+		size_t lod;
+		GLint firstVertex;
+		GLsizei vertexCount;
+		GLsizei instanceCount;
+		uint32_t uniformBlock;
+		DepthOnlyDraw depthOnly;
+	};
+
+	// Item number with its sort key, the array sorted in place of the items themselves
+	struct SortEntry {
+		uint64_t key;
+		uint32_t item;
+	};
+
+	// Uniform value of a block, the value itself lives in the value arena
+	struct Uniform {
+		UniformHandle handle;
+		bool isMat4;
+		uint32_t offset;
+	};
+
+	// Range of uniforms making up a block
+	struct UniformBlock {
+		uint32_t firstUniform;
+		uint32_t uniformCount;
+	};
+
+	// Sort in progress, shared with the worker tasks so late ones find no work left instead of a deleted object
+	struct SortJob;
+
+	// Fragment counts of one executed pass, in flight until the GPU has the results
+	struct FragmentQuery {
+		GpuResource prepass;
+		GpuResource shaded;
+		bool pending = false;
+		bool measuredPrepass = false;
+	};
+
+	// Passes that can be measured at once, passes executed while all queries are still pending aren't counted
+	static const int FRAGMENT_QUERY_COUNT = 8;
+
+	// View depth of a world space position is dot(depthAxis, position) + depthOffset, scaled to the depth bits of the key
+	glm::vec3 depthAxis = glm::vec3(0.0f, 0.0f, -1.0f);
+	float depthOffset = 0.0f;
+	float depthScale = 1.0f;
+
+	// Items of the frame and their keys, sorted by the first execute after they were submitted
+	std::vector<Item> items;
+	std::vector<SortEntry> entries;
+	std::vector<SortEntry> sortBuffer;
+	bool sorted = true;
+
+	// First sorted entry of every pass, the last one is the amount of entries
+	size_t passBegin[RENDER_PASS_COUNT + 1] = {};
+
+	// Items with a depth-only draw in every pass
+	size_t depthOnlyItems[RENDER_PASS_COUNT] = {};
+
+	FragmentQuery fragmentQueries[FRAGMENT_QUERY_COUNT];
+
+	// Per-frame arena of uniform blocks, their uniforms and the floats of their values
+	std::vector<UniformBlock> uniformBlocks;
+	std::vector<Uniform> uniforms;
+	std::vector<float> uniformValues;
+
+	// Count of every digit in every chunk of the entries for the current pass of the sort, turned into the chunk's scatter offsets
+	std::vector<std::array<uint32_t, 256>> chunkDigits;
+	int chunkCount = 1;
+
+	// Draws of consecutive meshes with the same state, submitted at once when models use multi-draw
+	MultiDrawBatch batch;
+
+	// Work of the current frame
+	static RenderQueueStats frameStats;
+
+	// Whether items with a depth-only draw get a depth pre-pass
+	static bool depthPrepassEnabled;
+
+	// Add an item along with its sort key
+	void submit(RenderPass pass, const Item &item, const glm::vec3 &position);
+
+	// Radix sort the entries by key, a byte at a time, and find where every pass begins
+	void sort();
+
+	// Count the digits of a chunk of entries, or move the chunk's entries to their place in the sort buffer, runs on the thread pool
+	void countChunk(int chunk, int shift);
+	void scatterChunk(int chunk, int shift);
+
+	// Run one of the chunk functions on every chunk, in parallel if there's more than one
+	void runChunks(int shift, bool scatter);
+
+	// Draw the depth-only versions of the items of a pass, with color writes masked off
+	void executeDepthPrepass(RenderPass pass);
+
+	// Add the results of the fragment queries that are ready to the frame stats
+	void collectFragmentQueries();
+
+	// Query that isn't in flight to measure a pass with, null if all of them are
+	FragmentQuery *startFragmentQuery();
+
+	// Set the values of a uniform block on a shader
+	void applyUniformBlock(Shader &shader, uint32_t block) const;
+
+	// Submit the batched meshes, if any
+	void flushBatch(Shader *shader);
+};
+
+#endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "backpack_scene.h"
+#include <algorithm>
 
 using namespace std;
 using namespace glm;
@@ -14,7 +15,14 @@ BackpackScene::BackpackScene(GLFWwindow *w, Camera *c)
 	// Load models
 	//------------
 
-	backpackModel = Model("models/backpack/backpack.obj");
+	// Vertices are uploaded packed, at half the size of the full precision ones, and not kept in memory afterwards
+	// The model loads in the background, placeholders are drawn until it's ready
+	ModelOptions backpackOptions;
+	backpackOptions.vertexFormat = VERTEX_FORMAT_PACKED;
+	backpackOptions.releaseCpuData = true;
+	backpackModel.loadAsync("models/backpack/backpack.obj", backpackOptions);
+	shadowMaps = CascadedShadowMaps(2048, SHADOW_MAP_TEXTURE_UNIT);
+	generateBackpacks();
 
 
 	//-----------------------------------------------
@@ -22,8 +30,16 @@ BackpackScene::BackpackScene(GLFWwindow *w, Camera *c)
 	//-----------------------------------------------
 
 	// Samplers for textures are set by the model itself so no need to set any here now
-	backpackShader = Shader("shaders/vert_lightSceneLitObject.vs", "shaders/frag_lightSceneLitObject.fs");
+	// The backpack shader permutation is picked once the model is ready
+	backpackShaders = ShaderPermutations("shaders/vert_lightSceneLitObject.vs", "shaders/frag_lightSceneLitObject.fs", [](Shader &shader)
+	{
+		shader.bindUniformBlock("Lighting", LIGHTING_BINDING_POINT);
+	});
+	backpackGBufferShaders = ShaderPermutations("shaders/vert_lightSceneLitObject.vs", "shaders/frag_lightSceneGBuffer.fs");
 	lightSourceShader = Shader("shaders/vert_lightSceneLightSource.vs", "shaders/frag_lightSceneLightSource.fs");
+	depthPrepassShader = Shader("shaders/vert_depthPrepass.vs", "shaders/frag_depthPrepass.fs");
+
+	getUniformHandles();
 
 
 	//--------------
@@ -35,23 +51,64 @@ BackpackScene::BackpackScene(GLFWwindow *w, Camera *c)
 
 	// --Light--
 
-	glGenVertexArrays(1, &lightVAO);
-	glBindVertexArray(lightVAO);
+	lightVAO = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+	GlState::global().bindVertexArray(lightVAO.get());
 
-	glGenBuffers(1, &lightVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, lightVBO);
+	lightVBO = GpuResource(GPU_RESOURCE_BUFFER);
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, lightVBO.get());
 	glBufferData(GL_ARRAY_BUFFER, sizeof(lightVertices), lightVertices, GL_STATIC_DRAW);
+	lightVBO.setMemory(sizeof(lightVertices));
 
 	// aPos
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (void*)0);
 	glEnableVertexAttribArray(0);
+
+	// aModel and aColor (per instance)
+	lightInstanceBuffer = InstanceBuffer(sizeof(LightSourceInstance));
+	lightInstanceBuffer.addMat4Attribute(INSTANCE_MODEL_LOCATION, offsetof(LightSourceInstance, model));
+	lightInstanceBuffer.addVec3Attribute(INSTANCE_EXTRA_LOCATION, offsetof(LightSourceInstance, color));
+
+	// Filled along with the point lights below
+
+	//----------
+
+
+	// --Placeholder--
+
+	placeholderVAO = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+	GlState::global().bindVertexArray(placeholderVAO.get());
+
+	// aPos, same cube as the light sources
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, lightVBO.get());
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	// aModel and aColor (per instance)
+	placeholderInstanceBuffer = InstanceBuffer(sizeof(LightSourceInstance));
+	placeholderInstanceBuffer.addMat4Attribute(INSTANCE_MODEL_LOCATION, offsetof(LightSourceInstance, model));
+	placeholderInstanceBuffer.addVec3Attribute(INSTANCE_EXTRA_LOCATION, offsetof(LightSourceInstance, color));
+
+	//----------
+
+
+	// --Lighting--
+
+	deferredRenderer = DeferredRenderer(GBUFFER_FIRST_TEXTURE_UNIT);
+
+	lightingBuffer = LightingBuffer(LIGHTING_BINDING_POINT);
+	updateLightingBuffer();
+
+	// --Light clusters--
+
+	lightClusters = LightClusters(CLUSTER_FIRST_TEXTURE_UNIT);
+	generatePointLights();
 }
 
 
 void BackpackScene::render()
 {
-	glClearColor(skyColor.x, skyColor.y, skyColor.z, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
+	GlState::global().clearColor(vec4(skyColor, 1.0f));
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	// View matrix
 	mat4 view(1.0f);
@@ -61,74 +118,150 @@ void BackpackScene::render()
 	mat4 projection(1.0f);
 	int viewportW, viewportH;
 	glfwGetFramebufferSize(window, &viewportW, &viewportH);
-	projection = perspective(camera->fov, (float)viewportW / (float)viewportH, 0.1f, 100.0f);
+	projection = perspective(camera->fov, (float)viewportW / (float)viewportH, nearPlane, farPlane);
+
+	// Upload a bit more of the backpack if it's still loading
+	backpackModel.update(modelUploadBudget);
+
+	// Draws are collected first and issued sorted by state and depth once everything is submitted
+	renderQueue.begin(view, nearPlane, farPlane);
 
 	//--------------------
 	// Render the backpack
 	//--------------------
 
-	backpackShader.use();
+	if (backpackModel.isReady())
+	{
+		// The model just finished loading, so its shadows are drawn from scratch
+		if (!backpackShader)
+		{
+			selectBackpackShader();
+			shadowMaps.invalidate();
+		}
+
+		// Bounds of the backpacks, for the view and the cascades of the shadow maps alike
+		Bounds backpackBounds = backpackModel.getBounds();
+		BoundingSphere backpackSphere = backpackModel.getBoundingSphere();
+		backpackCuller.clear();
+		for (size_t i = 0; i < backpackModelMats.size(); i++)
+		{
+			backpackCuller.add(backpackBounds, backpackSphere, backpackModelMats[i]);
+		}
+
+		// Shadow maps are drawn right away, before anything of the frame, only the cascades that are due this frame
+		if (shadows)
+		{
+			shadowMaps.update(view, projection, nearPlane, shadowDistance, directionalLightDirection);
+			shadowMaps.draw([this, &projection, viewportH](const mat4 &lightView, const mat4 &lightProjection, const Frustum &casterFrustum)
+			{
+				return drawShadowCasters(lightView, lightProjection, casterFrustum, projection, (float)viewportH);
+			}, viewportW, viewportH);
+		}
 
-	backpackShader.setFloat("material.shininess", 32.0f);
-	backpackShader.setFloat("material.emissionIntensity", 0.0f);
+		backpackShader->use();
 
-	// Directional light properties
-	backpackShader.setVec3f("directionalLight.direction", vec3(view * vec4(directionalLightDirection, 0.0f)));
-	backpackShader.setVec3f("directionalLight.ambient", directionalLightColor * 0.1f);
-	backpackShader.setVec3f("directionalLight.diffuse", directionalLightColor);
-	backpackShader.setVec3f("directionalLight.specular", directionalLightSpecular);
+		backpackShader->setFloat(shininessHandle, 32.0f);
 
-	// Point light properties
-	for (size_t i = 0; i < size(pointLightPositions); i++)
-	{
-		backpackShader.setVec3f("pointLights[" + to_string(i) + "].position", vec3(view * vec4(pointLightPositions[i], 1.0f)));
-		backpackShader.setVec3f("pointLights[" + to_string(i) + "].ambient", pointLightColors[i] * 0.1f);
-		backpackShader.setVec3f("pointLights[" + to_string(i) + "].diffuse", pointLightColors[i]);
-		backpackShader.setVec3f("pointLights[" + to_string(i) + "].specular", pointLightSpeculars[i]);
-		backpackShader.setFloat("pointLights[" + to_string(i) + "].constant", 1.0f);
-		backpackShader.setFloat("pointLights[" + to_string(i) + "].linear", 0.09f);
-		backpackShader.setFloat("pointLights[" + to_string(i) + "].quadratic", 0.032f);
-	}
+		// Light properties, uploaded only if they or the view matrix changed
+		lightingBuffer.update(view);
 
-	// Spotlight properties
-	backpackShader.setVec3f("spotLight.position", vec3(0.0f));
-	backpackShader.setVec3f("spotLight.direction", vec3(0.0f, 0.0f, -1.0f));
-	if (flashlight)
-	{
-		backpackShader.setVec3f("spotLight.ambient", spotLightColor * 0.1f);
-		backpackShader.setVec3f("spotLight.diffuse", spotLightColor);
-		backpackShader.setVec3f("spotLight.specular", spotLightSpecular);
+		// Point lights assigned to clusters, again only if they or the view changed
+		if (usesLightClusters())
+		{
+			lightClusters.update(view, projection, nearPlane, farPlane, viewportW, viewportH);
+			lightClusters.bind(*backpackShader);
+		}
+
+		// With deferred shading the shadows are applied while shading instead
+		if (shadows && !deferredShading)
+		{
+			shadowMaps.bind(*backpackShader, view);
+		}
+
+		backpackShader->setMat4f(viewHandle, view);
+		backpackShader->setMat4f(projectionHandle, projection);
+
+		depthPrepassShader.use();
+		depthPrepassShader.setMat4f(depthPrepassViewHandle, view);
+		depthPrepassShader.setMat4f(depthPrepassProjectionHandle, projection);
+
+		// Skip the backpacks outside the view, those left cull their meshes once more while drawing
+		backpackCuller.cull(camera->getFrustum(projection), visibleBackpacks);
+
+		// The backpacks in view nearest to the camera hide those behind them, and the meshes of other backpacks
+		OcclusionCuller *occlusion = OcclusionCuller::isEnabled() ? &occlusionCuller : nullptr;
+		if (occlusion)
+		{
+			occlusionCuller.begin(projection * view);
+			vec3 cameraPosition = camera->position;
+			occluderBackpacks = visibleBackpacks;
+			size_t occluderCount = std::min(occluderBackpacks.size(), (size_t)occluderBackpackCount);
+			nth_element(occluderBackpacks.begin(), occluderBackpacks.begin() + occluderCount, occluderBackpacks.end(), [this, cameraPosition](uint32_t a, uint32_t b)
+			{
+				vec3 toA = vec3(backpackModelMats[a][3]) - cameraPosition;
+				vec3 toB = vec3(backpackModelMats[b][3]) - cameraPosition;
+				return dot(toA, toA) < dot(toB, toB);
+			});
+			for (size_t i = 0; i < occluderCount; i++)
+			{
+				backpackModel.addOccluders(occlusionCuller, backpackModelMats[occluderBackpacks[i]]);
+			}
+			occlusionCuller.rasterize();
+		}
+
+		for (size_t i = 0; i < visibleBackpacks.size(); i++)
+		{
+			const mat4 &backpackModelMat = backpackModelMats[visibleBackpacks[i]];
+			if (occlusion && occlusion->isOccluded(backpackBounds, backpackModelMat))
+			{
+				continue;
+			}
+
+			// Normal matrix for backpack
+			mat3 backpackNormal(1.0f);
+			backpackNormal = mat3(transpose(inverse(view * backpackModelMat)));
+
+			uint32_t backpackUniforms = renderQueue.beginUniformBlock();
+			renderQueue.addUniform(modelHandle, backpackModelMat);
+			renderQueue.addUniform(normalMatViewHandle, backpackNormal);
+
+			// Only positions are drawn in the depth pre-pass, so its shader just needs the model matrix
+			DepthOnlyDraw depthOnly;
+			depthOnly.shader = &depthPrepassShader;
+			depthOnly.uniformBlock = renderQueue.beginUniformBlock();
+			renderQueue.addUniform(depthPrepassModelHandle, backpackModelMat);
+
+			// Submit the model at the level of detail its distance allows, with the shader properties we set above
+			backpackModel.submit(renderQueue, RENDER_PASS_OPAQUE, *backpackShader, backpackUniforms, backpackModelMat, *camera, projection,
+				(float)viewportH, occlusion, depthOnly);
+		}
+
+		// With deferred shading the backpacks go into the G-buffer first and are lit as a whole afterwards
+		if (deferredShading)
+		{
+			deferredRenderer.beginGeometryPass(viewportW, viewportH);
+		}
+
+		renderQueue.execute(RENDER_PASS_OPAQUE);
+
+		if (deferredShading)
+		{
+			deferredRenderer.shade(view, projection, shadows ? &shadowMaps : nullptr);
+		}
 	}
 	else
 	{
-		backpackShader.setVec3f("spotLight.ambient", vec3(0.0f));
-		backpackShader.setVec3f("spotLight.diffuse", vec3(0.0f));
-		backpackShader.setVec3f("spotLight.specular", vec3(0.0f));
-	}
-	backpackShader.setFloat("spotLight.constant", 1.0f);
-	backpackShader.setFloat("spotLight.linear", 0.09f);
-	backpackShader.setFloat("spotLight.quadratic", 0.032f);
-	backpackShader.setFloat("spotLight.innerCutOff", cos(radians(spotLightInnerCutOff)));
-	backpackShader.setFloat("spotLight.outerCutOff", cos(radians(spotLightOuterCutOff)));
-
-	backpackShader.setVec3f("viewPos", camera->position);
+		// Placeholder boxes where the backpacks will be, drawn at once like the light sources
+		updatePlaceholderInstances();
 
-	// Model matrix for the backpack
-	mat4 backpackModelMat = mat4(1.0f);
-	backpackModelMat = translate(backpackModelMat, vec3(0.0f, 0.0f, 0.0f));
-	backpackModelMat = scale(backpackModelMat, vec3(1.0f, 1.0f, 1.0f));
+		lightSourceShader.use();
 
-	// Normal matrix for backpack
-	mat3 backpackNormal(1.0f);
-	backpackNormal = mat3(transpose(inverse(view * backpackModelMat)));
+		lightSourceShader.setMat4f(lightSourceViewHandle, view);
+		lightSourceShader.setMat4f(lightSourceProjectionHandle, projection);
 
-	backpackShader.setMat4f("model", backpackModelMat);
-	backpackShader.setMat4f("view", view);
-	backpackShader.setMat4f("projection", projection);
-	backpackShader.setMat3f("normalMatView", backpackNormal);
-
-	// Draw the model, with the shader properties we set above
-	backpackModel.draw(backpackShader);
+		renderQueue.submitArrays(RENDER_PASS_UNLIT, lightSourceShader, placeholderVAO.get(), 0, 36, placeholderInstanceBuffer.getInstanceCount(),
+			camera->position);
+	}
 
 
 	//---------------------
@@ -137,24 +270,13 @@ void BackpackScene::render()
 
 	lightSourceShader.use();
 
-	lightSourceShader.setMat4f("view", view);
-	lightSourceShader.setMat4f("projection", projection);
+	lightSourceShader.setMat4f(lightSourceViewHandle, view);
+	lightSourceShader.setMat4f(lightSourceProjectionHandle, projection);
 
-	glBindVertexArray(lightVAO);
+	// Draw all light sources at once
+	renderQueue.submitArrays(RENDER_PASS_UNLIT, lightSourceShader, lightVAO.get(), 0, 36, lightInstanceBuffer.getInstanceCount(), camera->position);
 
-	// Draw light sources
-	for (size_t i = 0; i < size(pointLightPositions); i++)
-	{
-		lightSourceShader.setVec3f("lightColor", pointLightColors[i]);
-
-		// Model matrix for light source
-		mat4 lightModelMat(1.0f);
-		lightModelMat = translate(lightModelMat, pointLightPositions[i]);
-		lightModelMat = scale(lightModelMat, vec3(0.2f));
-		lightSourceShader.setMat4f("model", lightModelMat);
-
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-	}
+	renderQueue.execute(RENDER_PASS_UNLIT);
 }
 
 
@@ -182,6 +304,61 @@ void BackpackScene::handleKey(int key, float deltaTime)
 	if (key == GLFW_KEY_F)
 	{
 		flashlight = !flashlight;
+		updateLightingBuffer();
+		selectBackpackShader();
+	}
+
+	// L
+	if (key == GLFW_KEY_L)
+	{
+		int next = 0;
+		while (next < (int)size(lightCounts) && lightCounts[next] <= pointLightCount)
+		{
+			next++;
+		}
+		pointLightCount = next < (int)size(lightCounts) ? lightCounts[next] : lightCounts[0];
+		cout << "BackpackScene: " << pointLightCount << " point lights" << endl;
+
+		generatePointLights();
+		selectBackpackShader();
+	}
+
+	// C
+	if (key == GLFW_KEY_C)
+	{
+		clusteredLighting = !clusteredLighting;
+		cout << "BackpackScene: clustered lighting " << (clusteredLighting ? "on" : "off") << endl;
+		selectBackpackShader();
+	}
+
+	// G
+	if (key == GLFW_KEY_G)
+	{
+		deferredShading = !deferredShading;
+		cout << "BackpackScene: deferred shading " << (deferredShading ? "on" : "off") << endl;
+		selectBackpackShader();
+	}
+
+	// H
+	if (key == GLFW_KEY_H)
+	{
+		shadows = !shadows;
+		cout << "BackpackScene: shadows " << (shadows ? "on" : "off") << endl;
+		selectBackpackShader();
+	}
+
+	// Plus
+	if (key == GLFW_KEY_EQUAL && backpackCount < maxBackpackCount)
+	{
+		backpackCount *= 10;
+		generateBackpacks();
+	}
+
+	// Minus
+	if (key == GLFW_KEY_MINUS && backpackCount > 1)
+	{
+		backpackCount /= 10;
+		generateBackpacks();
 	}
 
 	// Page up
@@ -288,4 +465,154 @@ void BackpackScene::adjustLights()
 		pointLightSpeculars[3] = vec3(1.0f);
 		break;
 	}
+
+	updateLightingBuffer();
+	generatePointLights();
+}
+
+
+void BackpackScene::getUniformHandles()
+{
+	// Lit object, once its permutation is picked
+	if (backpackShader)
+	{
+		shininessHandle = backpackShader->getUniformHandle("material.shininess");
+
+		modelHandle = backpackShader->getUniformHandle("model");
+		viewHandle = backpackShader->getUniformHandle("view");
+		projectionHandle = backpackShader->getUniformHandle("projection");
+		normalMatViewHandle = backpackShader->getUniformHandle("normalMatView");
+	}
+
+	// Light source
+	lightSourceViewHandle = lightSourceShader.getUniformHandle("view");
+	lightSourceProjectionHandle = lightSourceShader.getUniformHandle("projection");
+
+	// Depth pre-pass
+	depthPrepassModelHandle = depthPrepassShader.getUniformHandle("model");
+	depthPrepassViewHandle = depthPrepassShader.getUniformHandle("view");
+	depthPrepassProjectionHandle = depthPrepassShader.getUniformHandle("projection");
+}
+
+
+void BackpackScene::selectBackpackShader()
+{
+	// Which textures the backpack has is only known once it's loaded, until then rendering doesn't need the shader
+	if (!backpackModel.isReady())
+	{
+		return;
+	}
+
+	// The backpack has no emission map, and the specular term is dropped if it has no specular map either
+	LitObjectFeatures features;
+	features.pointLightCount = std::min(pointLightCount, MAX_POINT_LIGHTS);
+	features.spotLight = flashlight;
+	features.clusteredLights = usesLightClusters();
+	features.emission = false;
+	features.specularMap = backpackModel.hasTexture(TEXTURE_SPECULAR);
+	features.shadows = shadows;
+
+	// With deferred shading the backpack only writes its material to the G-buffer
+	Shader *shader = deferredShading ? &backpackGBufferShaders.get(features.getMaterialDefines()) : &backpackShaders.get(features.getDefines());
+	if (shader != backpackShader)
+	{
+		backpackShader = shader;
+		getUniformHandles();
+	}
+}
+
+
+void BackpackScene::generateBackpacks()
+{
+	// Square grid stretching away from the camera, with the first backpack at the origin
+	const float spacing = 4.0f;
+	int columns = (int)ceil(sqrt((float)backpackCount));
+
+	backpackModelMats.resize(backpackCount);
+	for (int i = 0; i < backpackCount; i++)
+	{
+		vec3 position(((i % columns) - (columns - 1) / 2) * spacing, 0.0f, -(i / columns) * spacing);
+		backpackModelMats[i] = translate(mat4(1.0f), position);
+	}
+
+	// The shadows they cast are drawn again on the next frame
+	shadowMaps.invalidate();
+}
+
+
+size_t BackpackScene::drawShadowCasters(const mat4 &lightView, const mat4 &lightProjection, const Frustum &casterFrustum, const mat4 &projection,
+	float viewportHeight)
+{
+	backpackCuller.cull(casterFrustum, shadowBackpacks);
+
+	depthPrepassShader.use();
+	depthPrepassShader.setMat4f(depthPrepassViewHandle, lightView);
+	depthPrepassShader.setMat4f(depthPrepassProjectionHandle, lightProjection);
+
+	// At the level of detail the backpacks have on screen, as that's where their shadows are seen
+	for (size_t i = 0; i < shadowBackpacks.size(); i++)
+	{
+		const mat4 &backpackModelMat = backpackModelMats[shadowBackpacks[i]];
+		depthPrepassShader.setMat4f(depthPrepassModelHandle, backpackModelMat);
+		backpackModel.drawPositions(backpackModelMat, *camera, projection, viewportHeight);
+	}
+	return shadowBackpacks.size();
+}
+
+
+void BackpackScene::updatePlaceholderInstances()
+{
+	vec3 color = mix(vec3(0.1f), vec3(0.8f), backpackModel.getProgress());
+
+	vector<LightSourceInstance> instances(backpackModelMats.size());
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		// Roughly the size of the backpack
+		instances[i].model = scale(backpackModelMats[i], vec3(2.0f, 3.0f, 1.5f));
+		instances[i].color = color;
+	}
+	placeholderInstanceBuffer.upload(instances.data(), (GLsizei)instances.size());
+}
+
+
+void BackpackScene::updateLightingBuffer()
+{
+	// Switching the flashlight off selects a shader permutation without it, so it's always set here
+	float flashlightReach = setSceneLights(lightingBuffer, directionalLightDirection, directionalLightColor, directionalLightSpecular,
+		pointLightPositions, pointLightColors, pointLightSpeculars, spotLightColor, spotLightSpecular, spotLightInnerCutOff, spotLightOuterCutOff);
+
+	// Deferred shading draws the flashlight as a cone reaching as far as its light does
+	deferredRenderer.setSpotLight(flashlight, vec3(0.0f), vec3(0.0f, 0.0f, -1.0f), flashlightReach, radians(spotLightOuterCutOff));
+}
+
+
+void BackpackScene::updateLightInstances()
+{
+	// Only the point lights switched on get a gizmo
+	vector<LightSourceInstance> instances(pointLights.size());
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		// Model matrix for light source
+		instances[i].model = mat4(1.0f);
+		instances[i].model = translate(instances[i].model, pointLights[i].position);
+		instances[i].model = scale(instances[i].model, vec3(0.2f));
+		instances[i].color = pointLights[i].diffuse;
+	}
+	lightInstanceBuffer.upload(instances.data(), (GLsizei)instances.size());
+}
+
+
+void BackpackScene::generatePointLights()
+{
+	scatterPointLights(pointLightPositions, pointLightColors, pointLightSpeculars, pointLightCount, lightDensity, pointLights);
+
+	lightClusters.setLights(pointLights);
+	deferredRenderer.setPointLights(pointLights);
+	updateLightInstances();
+}
+
+
+bool BackpackScene::usesLightClusters() const
+{
+	return !deferredShading && (clusteredLighting || pointLightCount > MAX_POINT_LIGHTS);
 }
\ No newline at end of file
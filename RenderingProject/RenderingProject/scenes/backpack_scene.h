@@ -64,21 +64,88 @@ public:
 
 	Model backpackModel;
 
+	int backpackCount = 1;  // Amount of backpacks drawn, changed in steps of 10x to see how levels of detail scale
+	int maxBackpackCount = 1000;
+	std::vector<glm::mat4> backpackModelMats;
+
+	// Bounds of the backpacks, tested against the view frustum every frame so only those in view are drawn
+	FrustumCuller backpackCuller;
+	std::vector<uint32_t> visibleBackpacks;
+
+	// Hides the backpacks and meshes behind the backpacks nearest to the camera, which are rasterized as occluders
+	OcclusionCuller occlusionCuller;
+	std::vector<uint32_t> occluderBackpacks;
+	int occluderBackpackCount = 4;
+
+	// Backpacks casting shadows into the cascade being drawn, culled with the same bounds against the cascade's frustum
+	std::vector<uint32_t> shadowBackpacks;
+
+	double modelUploadBudget = 2.0;  // Milliseconds per frame spent uploading the backpack while it loads
+
 
 	//--------
 	// Shaders
 	//--------
 
-	Shader backpackShader;
+	// Permutations of the backpack shader, backpackShader is the one matching the features currently in use
+	// (null until the model is ready, as which textures it has decides the permutation)
+	ShaderPermutations backpackShaders;
+	Shader *backpackShader = nullptr;
+
+	// Permutations of the backpack shader writing the G-buffer instead, picked as backpackShader with deferred shading
+	ShaderPermutations backpackGBufferShaders;
 	Shader lightSourceShader;
 
+	// Draws the positions of the backpacks in the depth pre-pass, and into the shadow maps with the light's view and projection
+	Shader depthPrepassShader;
+
 
 	//---------------
 	// Buffer objects
 	//---------------
 
-	GLuint lightVAO;
-	GLuint lightVBO;
+	GpuResource lightVAO;
+	GpuResource lightVBO;
+
+	InstanceBuffer lightInstanceBuffer;
+
+	// Boxes standing in for the backpacks until the model is loaded, drawn like the light sources
+	GpuResource placeholderVAO;
+	InstanceBuffer placeholderInstanceBuffer;
+
+	LightingBuffer lightingBuffer;
+
+	// Point lights assigned to clusters, used instead of the lighting buffer's point lights when there are more than it holds
+	LightClusters lightClusters;
+
+	// Shades the backpacks after they're drawn with deferred shading, instead of every fragment being lit as it's drawn
+	DeferredRenderer deferredRenderer;
+
+	// Draws of the current frame, issued sorted by state and depth
+	RenderQueue renderQueue;
+
+	// Shadows of the directional light
+	CascadedShadowMaps shadowMaps;
+
+
+	//----------------
+	// Uniform handles
+	//----------------
+
+	// Handles of the uniforms set every frame, retrieved once after the shaders are built
+	// Light properties aren't among them, they live in the lighting buffer
+	UniformHandle shininessHandle;
+	UniformHandle modelHandle;
+	UniformHandle viewHandle;
+	UniformHandle projectionHandle;
+	UniformHandle normalMatViewHandle;
+
+	UniformHandle lightSourceViewHandle;
+	UniformHandle lightSourceProjectionHandle;
+
+	UniformHandle depthPrepassModelHandle;
+	UniformHandle depthPrepassViewHandle;
+	UniformHandle depthPrepassProjectionHandle;
 
 
 	//-----------------
@@ -110,6 +177,9 @@ public:
 		glm::vec3(1.0f)
 	};
 
+	// All point lights switched on, the first ones are the ones above and the rest are scattered randomly
+	std::vector<ClusteredPointLight> pointLights;
+
 	// Spot
 	glm::vec3 spotLightColor = glm::vec3(1.0f);
 	glm::vec3 spotLightSpecular = glm::vec3(1.0f);
@@ -126,6 +196,15 @@ public:
 	int lightingScheme = 0;
 	int amountSchemes = 5;
 	bool flashlight = true;
+	int pointLightCount = MAX_POINT_LIGHTS;  // Point lights switched on, cycled through lightCounts
+	int lightCounts[8] = { 0, 1, 2, 3, 4, 256, 4096, 65536 };
+	float lightDensity = 0.02f;  // Point lights per cubic unit of the volume the lights beyond the first ones are scattered in
+	bool clusteredLighting = false;  // Use light clusters even when the lighting buffer has room for all point lights
+	bool deferredShading = false;  // Draw the backpacks into a G-buffer and light them with light volumes afterwards
+	bool shadows = true;  // Shadow the directional light with the cascaded shadow maps
+	float shadowDistance = 50.0f;  // View distance up to which shadows are drawn
+	float nearPlane = 0.1f;  // Clip planes of the projection, the light clusters are spread between them
+	float farPlane = 100.0f;
 	glm::vec3 skyColor = glm::vec3(0.05f, 0.05f, 0.1f);
 
 
@@ -144,6 +223,35 @@ public:
 
 	// Adjust light settings, called when lighting scheme is changed
 	void adjustLights();
+
+	// Pass light settings to the lighting buffer, called whenever they change
+	void updateLightingBuffer();
+
+	// Update the per-instance data of the light source gizmos, called whenever lights change
+	void updateLightInstances();
+
+	// Collect the point lights switched on and pass them to the light clusters, called whenever they change
+	void generatePointLights();
+
+	// Whether point lights come from the light clusters, either because they're enabled or because there are too many lights for the lighting buffer
+	// Deferred shading has its own way of handling many lights, so it never uses them
+	bool usesLightClusters() const;
+
+	// Retrieve the handles of the uniforms set every frame
+	void getUniformHandles();
+
+	// Pick the backpack shader permutation with only the features in use and retrieve its uniform handles, called whenever they change
+	void selectBackpackShader();
+
+	// Lay out the backpacks on a grid, called whenever their amount changes
+	void generateBackpacks();
+
+	// Draw the backpacks inside a cascade's frustum into its shadow map, returns the amount drawn
+	size_t drawShadowCasters(const glm::mat4 &lightView, const glm::mat4 &lightProjection, const Frustum &casterFrustum, const glm::mat4 &projection,
+		float viewportHeight);
+
+	// Update the per-instance data of the placeholder boxes, brightening them as loading progresses
+	void updatePlaceholderInstances();
 };
 
 #endif
\ No newline at end of file
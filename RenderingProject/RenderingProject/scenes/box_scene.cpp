@@ -1,9 +1,35 @@
 #include "box_scene.h"
+#include <algorithm>
 
 using namespace std;
 using namespace glm;
 
 
+// Radius of the sphere around a box reaching its corners, which contains the box however it's rotated
+static const float BOX_RADIUS = 0.8660254f;
+
+// Object space bounds of a box, and bounds containing it however it's rotated for the boxes that spin
+static const Bounds BOX_BOUNDS = { vec3(-0.5f), vec3(0.5f) };
+static const Bounds SPINNING_BOX_BOUNDS = { vec3(-BOX_RADIUS), vec3(BOX_RADIUS) };
+
+// Speed every 3rd box spins at, in degrees per second
+static const float BOX_SPIN_SPEED = 50.0f;
+
+// Corners of a box and its triangles, counter-clockwise seen from outside, for rasterizing it as occluder
+static const vec3 BOX_CORNERS[8] = {
+	vec3(-0.5f, -0.5f, -0.5f), vec3(0.5f, -0.5f, -0.5f), vec3(-0.5f, 0.5f, -0.5f), vec3(0.5f, 0.5f, -0.5f),
+	vec3(-0.5f, -0.5f, 0.5f), vec3(0.5f, -0.5f, 0.5f), vec3(-0.5f, 0.5f, 0.5f), vec3(0.5f, 0.5f, 0.5f)
+};
+static const uint32_t BOX_INDICES[36] = {
+	4, 6, 2, 4, 2, 0,
+	1, 3, 7, 1, 7, 5,
+	0, 1, 5, 0, 5, 4,
+	6, 7, 3, 6, 3, 2,
+	2, 3, 1, 2, 1, 0,
+	4, 5, 7, 4, 7, 6
+};
+
+
 BoxScene::BoxScene(GLFWwindow *w, Camera *c)
 {
 	window = w;
@@ -27,17 +53,23 @@ BoxScene::BoxScene(GLFWwindow *w, Camera *c)
 	boxShader.setInt("tex0", 0);
 	boxShader.setInt("tex1", 1);
 
+	mixWeightHandle = boxShader.getUniformHandle("mixWeight");
+	timeHandle = boxShader.getUniformHandle("time");
+	viewHandle = boxShader.getUniformHandle("view");
+	projectionHandle = boxShader.getUniformHandle("projection");
+
 
 	//--------------
 	// Setup buffers
 	//--------------
 
-	glGenVertexArrays(1, &boxVAO);
-	glBindVertexArray(boxVAO);
+	boxVAO = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+	GlState::global().bindVertexArray(boxVAO.get());
 
-	glGenBuffers(1, &boxVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+	boxVBO = GpuResource(GPU_RESOURCE_BUFFER);
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, boxVBO.get());
 	glBufferData(GL_ARRAY_BUFFER, sizeof(boxVertices), boxVertices, GL_STATIC_DRAW);
+	boxVBO.setMemory(sizeof(boxVertices));
 
 	// aPos
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)0);
@@ -46,49 +78,48 @@ BoxScene::BoxScene(GLFWwindow *w, Camera *c)
 	// aTexCoord
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
 	glEnableVertexAttribArray(2);
+
+	// aModel and aSpinSpeed (per instance)
+	boxInstanceBuffer = InstanceBuffer(sizeof(SpinningObjectInstance));
+	boxInstanceBuffer.addMat4Attribute(INSTANCE_MODEL_LOCATION, offsetof(SpinningObjectInstance, model));
+	boxInstanceBuffer.addFloatAttribute(INSTANCE_EXTRA_LOCATION, offsetof(SpinningObjectInstance, spinSpeed));
+
+	generateBoxes();
 }
 
 
 void BoxScene::render()
 {
+	GlState::global().clearColor(vec4(0.05f, 0.05f, 0.1f, 1.0f));
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
 	boxShader.use();
-	boxShader.setFloat("mixWeight", textureMix);
+	boxShader.setFloat(mixWeightHandle, textureMix);
+	boxShader.setFloat(timeHandle, (float)glfwGetTime());
 	
 	// View matrix
 	mat4 view(1.0f);
 	view = camera->getViewMatrix();
-	boxShader.setMat4f("view", view);
+	boxShader.setMat4f(viewHandle, view);
 
 	// Projection matrix
 	mat4 projection(1.0f);
 	int viewportW, viewportH;
 	glfwGetFramebufferSize(window, &viewportW, &viewportH);
 	projection = perspective(camera->fov, (float)viewportW / (float)viewportH, 0.1f, 100.0f);
-	boxShader.setMat4f("projection", projection);
+	boxShader.setMat4f(projectionHandle, projection);
 	
-	glActiveTexture(GL_TEXTURE0);
+	GlState::global().activeTexture(GL_TEXTURE0);
 	containerTexture.bind();
-	glActiveTexture(GL_TEXTURE1);
+	GlState::global().activeTexture(GL_TEXTURE1);
 	faceTexture.bind();
-	glBindVertexArray(boxVAO);
+	GlState::global().bindVertexArray(boxVAO.get());
 
-	for (size_t i = 0; i < size(boxPositions); i++)
-	{
-		// Model matrix, different for each box to move them in world space
-		mat4 model(1.0f);
-		model = translate(model, boxPositions[i]);
-		float angle = 20.0f * i;
-		if (i % 3 == 0)
-		{
-			// Make every 3rd box spin
-			angle += (float)glfwGetTime() * 50.0f;
-		}
-		model = rotate(model, radians(angle), vec3(1.0f, 0.3f, 0.5f));
-		boxShader.setMat4f("model", model);
+	// Only the boxes in view are uploaded, and only when the view changed
+	updateVisibleBoxes(projection * view);
 
-		// Draw a box
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-	}
+	// Draw all boxes in view at once
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 36, boxInstanceBuffer.getInstanceCount());
 }
 
 
@@ -115,4 +146,107 @@ void BoxScene::handleKey(int key, float deltaTime)
 			textureMix = 0.0f;
 		}
 	}
+
+	// Plus
+	if (key == GLFW_KEY_EQUAL && boxCount < maxBoxCount)
+	{
+		boxCount *= 10;
+		generateBoxes();
+	}
+
+	// Minus
+	if (key == GLFW_KEY_MINUS && boxCount > 10)
+	{
+		boxCount /= 10;
+		generateBoxes();
+	}
+}
+
+
+void BoxScene::generateBoxes()
+{
+	// Boxes past the first 10 are scattered randomly
+	boxInstancePositions = scatterPositions(boxPositions, size(boxPositions), boxCount);
+
+	boxInstances.resize(boxCount);
+	boxCuller.clear();
+	boxCuller.reserve(boxCount);
+	for (size_t i = 0; i < boxInstances.size(); i++)
+	{
+		// Model matrix, different for each box to move them in world space
+		mat4 model(1.0f);
+		model = translate(model, boxInstancePositions[i]);
+		float angle = 20.0f * i;
+		boxInstances[i].model = rotate(model, radians(angle), vec3(1.0f, 0.3f, 0.5f));
+
+		// Make every 3rd box spin, about the same axis so the shader just adds to the angle
+		boxInstances[i].spinSpeed = i % 3 == 0 ? BOX_SPIN_SPEED : 0.0f;
+
+		boxCuller.addSphere(boxInstancePositions[i], BOX_RADIUS);
+	}
+
+	// The boxes in view are uploaded on the next frame
+	culledViewProjection = mat4(0.0f);
+
+	cout << "BoxScene: " << boxCount << " boxes" << endl;
+}
+
+
+void BoxScene::updateVisibleBoxes(const mat4 &viewProjection)
+{
+	// Culling only depends on the boxes' spheres and the spinning ones are rotated by the shader, so the boxes in view only change along with the view
+	if (viewProjection == culledViewProjection && culledWithCulling == FrustumCuller::isEnabled() && culledWithOcclusion == OcclusionCuller::isEnabled())
+	{
+		return;
+	}
+	culledViewProjection = viewProjection;
+	culledWithCulling = FrustumCuller::isEnabled();
+	culledWithOcclusion = OcclusionCuller::isEnabled();
+
+	boxCuller.cull(Frustum(viewProjection), visibleBoxes);
+
+	// The boxes in view nearest to the camera hide those behind them, farther ones are too small on screen to be worth rasterizing
+	// Spinning boxes aren't occluders since their orientation on screen isn't known here, and are tested with bounds covering every orientation
+	if (OcclusionCuller::isEnabled())
+	{
+		occluderBoxes.clear();
+		for (size_t i = 0; i < visibleBoxes.size(); i++)
+		{
+			if (boxInstances[visibleBoxes[i]].spinSpeed == 0.0f)
+			{
+				occluderBoxes.push_back(visibleBoxes[i]);
+			}
+		}
+		size_t occluderCount = std::min(occluderBoxes.size(), (size_t)occluderBoxCount);
+		vec3 cameraPosition = camera->position;
+		nth_element(occluderBoxes.begin(), occluderBoxes.begin() + occluderCount, occluderBoxes.end(), [this, cameraPosition](uint32_t a, uint32_t b)
+		{
+			vec3 toA = boxInstancePositions[a] - cameraPosition;
+			vec3 toB = boxInstancePositions[b] - cameraPosition;
+			return dot(toA, toA) < dot(toB, toB);
+		});
+
+		occlusionCuller.begin(viewProjection);
+		for (size_t i = 0; i < occluderCount; i++)
+		{
+			occlusionCuller.addOccluder(BOX_CORNERS, size(BOX_CORNERS), BOX_INDICES, size(BOX_INDICES), boxInstances[occluderBoxes[i]].model);
+		}
+		occlusionCuller.rasterize();
+
+		visibleBoxes.erase(remove_if(visibleBoxes.begin(), visibleBoxes.end(), [this](uint32_t box)
+		{
+			if (boxInstances[box].spinSpeed != 0.0f)
+			{
+				return occlusionCuller.isOccluded(SPINNING_BOX_BOUNDS, translate(mat4(1.0f), boxInstancePositions[box]));
+			}
+			return occlusionCuller.isOccluded(BOX_BOUNDS, boxInstances[box].model);
+		}), visibleBoxes.end());
+	}
+
+	visibleBoxInstances.resize(visibleBoxes.size());
+	for (size_t i = 0; i < visibleBoxes.size(); i++)
+	{
+		visibleBoxInstances[i] = boxInstances[visibleBoxes[i]];
+	}
+	boxInstanceBuffer.upload(visibleBoxInstances.data(), (GLsizei)visibleBoxInstances.size());
 }
\ No newline at end of file
@@ -4,7 +4,7 @@
 #include "scene.h"
 
 
-// A scene with 10 textured boxes floating in a void
+// A scene with textured boxes floating in a void, 10 of them by default
 class BoxScene : public Scene
 {
 public:
@@ -70,6 +70,24 @@ public:
 		glm::vec3(-1.3f,  1.0f, -1.5f)
 	};
 
+	// Positions of all drawn boxes, the first ones come from boxPositions and the rest are scattered randomly
+	std::vector<glm::vec3> boxInstancePositions;
+
+	// Per-instance data of the boxes, every 3rd box spins in the vertex shader so the data never changes
+	std::vector<SpinningObjectInstance> boxInstances;
+
+	// Bounds of the boxes, spheres around their positions since some spin, tested whenever the view changes so only the boxes in view are uploaded
+	FrustumCuller boxCuller;
+	std::vector<uint32_t> visibleBoxes;
+	std::vector<SpinningObjectInstance> visibleBoxInstances;
+	glm::mat4 culledViewProjection = glm::mat4(0.0f);  // View the uploaded boxes were culled for, zero to cull again on the next frame
+	bool culledWithCulling = false;  // Whether frustum and occlusion culling were enabled back then
+	bool culledWithOcclusion = false;
+
+	// Hides the boxes behind the ones nearest to the camera, which are rasterized as occluders
+	OcclusionCuller occlusionCuller;
+	std::vector<uint32_t> occluderBoxes;
+
 
 	//---------
 	// Textures
@@ -86,12 +104,25 @@ public:
 	Shader boxShader;
 
 
+	//----------------
+	// Uniform handles
+	//----------------
+
+	// Handles of the uniforms set every frame, retrieved once after the shader is built
+	UniformHandle mixWeightHandle;
+	UniformHandle timeHandle;
+	UniformHandle viewHandle;
+	UniformHandle projectionHandle;
+
+
 	//---------------
 	// Buffer objects
 	//---------------
 
-	GLuint boxVAO;
-	GLuint boxVBO;
+	GpuResource boxVAO;
+	GpuResource boxVBO;
+
+	InstanceBuffer boxInstanceBuffer;
 
 
 	//------
@@ -101,6 +132,9 @@ public:
 	GLFWwindow *window;  // Window that's rendered into
 	Camera *camera;  // Current active camera
 	float textureMix = 0.2f;  // Mixing weight for the two textures on the boxes
+	int boxCount = 10;  // Amount of boxes drawn, changed in steps of 10x to see how rendering scales
+	int maxBoxCount = 1000000;
+	int occluderBoxCount = 64;  // Boxes nearest to the camera rasterized as occluders
 
 
 	//--------
@@ -115,6 +149,12 @@ public:
 
 	// Handle scene specific keyboard commands
 	void handleKey(int key, float deltaTime) override;
+
+	// Place boxes and calculate their per-instance data and bounds, called when the box count changes
+	void generateBoxes();
+
+	// Upload the per-instance data of the boxes inside the view frustum and not hidden by others, skipped if neither the view nor the boxes changed
+	void updateVisibleBoxes(const glm::mat4 &viewProjection);
 };
 
 #endif
\ No newline at end of file
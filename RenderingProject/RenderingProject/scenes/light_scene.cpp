@@ -1,9 +1,29 @@
 #include "light_scene.h"
+#include <algorithm>
 
 using namespace std;
 using namespace glm;
 
 
+// Object space bounds of a box, the sphere reaches its corners
+static const Bounds BOX_BOUNDS = { vec3(-0.5f), vec3(0.5f) };
+static const BoundingSphere BOX_SPHERE = { vec3(0.0f), 0.8660254f };
+
+// Corners of a box and its triangles, counter-clockwise seen from outside, for rasterizing it as occluder
+static const vec3 BOX_CORNERS[8] = {
+	vec3(-0.5f, -0.5f, -0.5f), vec3(0.5f, -0.5f, -0.5f), vec3(-0.5f, 0.5f, -0.5f), vec3(0.5f, 0.5f, -0.5f),
+	vec3(-0.5f, -0.5f, 0.5f), vec3(0.5f, -0.5f, 0.5f), vec3(-0.5f, 0.5f, 0.5f), vec3(0.5f, 0.5f, 0.5f)
+};
+static const uint32_t BOX_INDICES[36] = {
+	4, 6, 2, 4, 2, 0,
+	1, 3, 7, 1, 7, 5,
+	0, 1, 5, 0, 5, 4,
+	6, 7, 3, 6, 3, 2,
+	2, 3, 1, 2, 1, 0,
+	4, 5, 7, 4, 7, 6
+};
+
+
 LightScene::LightScene(GLFWwindow *w, Camera *c)
 {
 	window = w;
@@ -23,13 +43,29 @@ LightScene::LightScene(GLFWwindow *w, Camera *c)
 	// Generate shaders and set samplers for textures
 	//-----------------------------------------------
 
-	boxShader = Shader("shaders/vert_lightSceneLitObject.vs", "shaders/frag_lightSceneLitObject.fs");
-	boxShader.use();
-	boxShader.setInt("material.texture_diffuse1", 0);
-	boxShader.setInt("material.texture_specular1", 1);
-	boxShader.setInt("material.texture_emission1", 2);
+	// Box shader permutations are built as the features in use change, each set up the same way
+	boxShaders = ShaderPermutations("shaders/vert_lightSceneLitObjectInstanced.vs", "shaders/frag_lightSceneLitObject.fs", [](Shader &shader)
+	{
+		shader.use();
+		shader.setInt("material.texture_diffuse1", 0);
+		shader.setInt("material.texture_specular1", 1);
+		shader.setInt("material.texture_emission1", 2);
+		shader.bindUniformBlock("Lighting", LIGHTING_BINDING_POINT);
+	});
+
+	// The G-buffer permutations only sample the material, lights are applied by the deferred renderer afterwards
+	boxGBufferShaders = ShaderPermutations("shaders/vert_lightSceneLitObjectInstanced.vs", "shaders/frag_lightSceneGBuffer.fs", [](Shader &shader)
+	{
+		shader.use();
+		shader.setInt("material.texture_diffuse1", 0);
+		shader.setInt("material.texture_specular1", 1);
+		shader.setInt("material.texture_emission1", 2);
+	});
 
 	lightSourceShader = Shader("shaders/vert_lightSceneLightSource.vs", "shaders/frag_lightSceneLightSource.fs");
+	depthPrepassShader = Shader("shaders/vert_depthPrepassInstanced.vs", "shaders/frag_depthPrepass.fs");
+
+	selectBoxShader();
 
 
 	//--------------
@@ -38,12 +74,13 @@ LightScene::LightScene(GLFWwindow *w, Camera *c)
 
 	// --Box--
 
-	glGenVertexArrays(1, &boxVAO);
-	glBindVertexArray(boxVAO);
+	boxVAO = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+	GlState::global().bindVertexArray(boxVAO.get());
 
-	glGenBuffers(1, &boxVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+	boxVBO = GpuResource(GPU_RESOURCE_BUFFER);
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, boxVBO.get());
 	glBufferData(GL_ARRAY_BUFFER, sizeof(boxVertices), boxVertices, GL_STATIC_DRAW);
+	boxVBO.setMemory(sizeof(boxVertices));
 
 	// aPos
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)0);
@@ -57,27 +94,96 @@ LightScene::LightScene(GLFWwindow *w, Camera *c)
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(6 * sizeof(GLfloat)));
 	glEnableVertexAttribArray(2);
 
+	// aModel and aNormalMat (per instance)
+	boxInstanceBuffer = InstanceBuffer(sizeof(LitObjectInstance));
+	boxInstanceBuffer.addMat4Attribute(INSTANCE_MODEL_LOCATION, offsetof(LitObjectInstance, model));
+	boxInstanceBuffer.addMat3Attribute(INSTANCE_EXTRA_LOCATION, offsetof(LitObjectInstance, normal));
+
+	// Position stream for the depth pre-pass, 12 bytes per vertex instead of the 32 of the full vertices
+	float boxPositions[36 * 3];
+	for (int i = 0; i < 36; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			boxPositions[i * 3 + j] = boxVertices[i * 8 + j];
+		}
+	}
+
+	boxPositionVAO = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+	GlState::global().bindVertexArray(boxPositionVAO.get());
+
+	boxPositionVBO = GpuResource(GPU_RESOURCE_BUFFER);
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, boxPositionVBO.get());
+	glBufferData(GL_ARRAY_BUFFER, sizeof(boxPositions), boxPositions, GL_STATIC_DRAW);
+	boxPositionVBO.setMemory(sizeof(boxPositions));
+
+	// aPos
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	// aModel (per instance)
+	boxInstanceBuffer.addMat4Attribute(INSTANCE_MODEL_LOCATION, offsetof(LitObjectInstance, model));
+
+	// The same positions for the shadow maps, with only the model matrices of the casters per instance
+	shadowBoxVAO = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+	GlState::global().bindVertexArray(shadowBoxVAO.get());
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, boxPositionVBO.get());
+
+	// aPos
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	// aModel (per instance)
+	shadowInstanceBuffer = InstanceBuffer(sizeof(mat4));
+	shadowInstanceBuffer.addMat4Attribute(INSTANCE_MODEL_LOCATION, 0);
+
+	shadowMaps = CascadedShadowMaps(2048, SHADOW_MAP_TEXTURE_UNIT);
+
+	generateBoxes();
+
 	//----------
 
 
 	// --Light--
 
-	glGenVertexArrays(1, &lightVAO);
-	glBindVertexArray(lightVAO);
+	lightVAO = GpuResource(GPU_RESOURCE_VERTEX_ARRAY);
+	GlState::global().bindVertexArray(lightVAO.get());
 
 	// Same as box
-	glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+	GlState::global().bindBuffer(GL_ARRAY_BUFFER, boxVBO.get());
 
 	// aPos
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)0);
 	glEnableVertexAttribArray(0);
+
+	// aModel and aColor (per instance)
+	lightInstanceBuffer = InstanceBuffer(sizeof(LightSourceInstance));
+	lightInstanceBuffer.addMat4Attribute(INSTANCE_MODEL_LOCATION, offsetof(LightSourceInstance, model));
+	lightInstanceBuffer.addVec3Attribute(INSTANCE_EXTRA_LOCATION, offsetof(LightSourceInstance, color));
+
+	// Filled along with the point lights below
+
+	//----------
+
+
+	// --Lighting--
+
+	deferredRenderer = DeferredRenderer(GBUFFER_FIRST_TEXTURE_UNIT);
+
+	lightingBuffer = LightingBuffer(LIGHTING_BINDING_POINT);
+	updateLightingBuffer();
+
+	// --Light clusters--
+
+	lightClusters = LightClusters(CLUSTER_FIRST_TEXTURE_UNIT);
+	generatePointLights();
 }
 
 
 void LightScene::render()
 {
-	glClearColor(skyColor.x, skyColor.y, skyColor.z, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
+	GlState::global().clearColor(vec4(skyColor, 1.0f));
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	// View matrix
 	mat4 view(1.0f);
@@ -87,86 +193,71 @@ void LightScene::render()
 	mat4 projection(1.0f);
 	int viewportW, viewportH;
 	glfwGetFramebufferSize(window, &viewportW, &viewportH);
-	projection = perspective(camera->fov, (float)viewportW / (float)viewportH, 0.1f, 100.0f);
+	projection = perspective(camera->fov, (float)viewportW / (float)viewportH, nearPlane, farPlane);
+
+	// Draws are collected first and issued sorted by state and depth once everything is submitted
+	renderQueue.begin(view, nearPlane, farPlane);
+
+	//-------------------
+	// Render shadow maps
+	//-------------------
+
+	// Drawn right away, before anything of the frame, only the cascades that are due this frame
+	if (shadows)
+	{
+		shadowMaps.update(view, projection, nearPlane, shadowDistance, directionalLightDirection);
+		shadowMaps.draw([this](const mat4 &lightView, const mat4 &lightProjection, const Frustum &casterFrustum)
+		{
+			return drawShadowCasters(lightView, lightProjection, casterFrustum);
+		}, viewportW, viewportH);
+	}
 
 	//-----------------
 	// Render lit boxes
 	//-----------------
 
-	boxShader.use();
+	boxShader->use();
 
-	boxShader.setFloat("material.shininess", 32.0f);
-	boxShader.setFloat("material.emissionIntensity", emissionIntensity);
+	boxShader->setFloat(shininessHandle, 32.0f);
+	boxShader->setFloat(emissionIntensityHandle, emissionIntensity);
 
-	// Directional light properties
-	boxShader.setVec3f("directionalLight.direction", vec3(view * vec4(directionalLightDirection, 0.0f)));
-	boxShader.setVec3f("directionalLight.ambient", directionalLightColor * 0.1f);
-	boxShader.setVec3f("directionalLight.diffuse", directionalLightColor);
-	boxShader.setVec3f("directionalLight.specular", directionalLightSpecular);
+	// Light properties, uploaded only if they or the view matrix changed
+	lightingBuffer.update(view);
 
-	// Point light properties
-	for (size_t i = 0; i < size(pointLightPositions); i++)
+	// Point lights assigned to clusters, again only if they or the view changed
+	if (usesLightClusters())
 	{
-		boxShader.setVec3f("pointLights[" + to_string(i) + "].position", vec3(view * vec4(pointLightPositions[i], 1.0f)));
-		boxShader.setVec3f("pointLights[" + to_string(i) + "].ambient", pointLightColors[i] * 0.1f);
-		boxShader.setVec3f("pointLights[" + to_string(i) + "].diffuse", pointLightColors[i]);
-		boxShader.setVec3f("pointLights[" + to_string(i) + "].specular", pointLightSpeculars[i]);
-		boxShader.setFloat("pointLights[" + to_string(i) + "].constant", 1.0f);
-		boxShader.setFloat("pointLights[" + to_string(i) + "].linear", 0.09f);
-		boxShader.setFloat("pointLights[" + to_string(i) + "].quadratic", 0.032f);
+		lightClusters.update(view, projection, nearPlane, farPlane, viewportW, viewportH);
+		lightClusters.bind(*boxShader);
 	}
 
-	// Spotlight properties
-	boxShader.setVec3f("spotLight.position", vec3(0.0f));
-	boxShader.setVec3f("spotLight.direction", vec3(0.0f, 0.0f, -1.0f));
-	if (flashlight)
-	{
-		boxShader.setVec3f("spotLight.ambient", spotLightColor * 0.1f);
-		boxShader.setVec3f("spotLight.diffuse", spotLightColor);
-		boxShader.setVec3f("spotLight.specular", spotLightSpecular);
-	}
-	else
+	// With deferred shading the shadows are applied while shading instead
+	if (shadows && !deferredShading)
 	{
-		boxShader.setVec3f("spotLight.ambient", vec3(0.0f));
-		boxShader.setVec3f("spotLight.diffuse", vec3(0.0f));
-		boxShader.setVec3f("spotLight.specular", vec3(0.0f));
+		shadowMaps.bind(*boxShader, view);
 	}
-	boxShader.setFloat("spotLight.constant", 1.0f);
-	boxShader.setFloat("spotLight.linear", 0.09f);
-	boxShader.setFloat("spotLight.quadratic", 0.032f);
-	boxShader.setFloat("spotLight.innerCutOff", cos(radians(spotLightInnerCutOff)));
-	boxShader.setFloat("spotLight.outerCutOff", cos(radians(spotLightOuterCutOff)));
 
-	boxShader.setVec3f("viewPos", camera->position);
+	boxShader->setMat4f(viewHandle, view);
+	boxShader->setMat4f(projectionHandle, projection);
 
-	boxShader.setMat4f("view", view);
-	boxShader.setMat4f("projection", projection);
+	depthPrepassShader.use();
+	depthPrepassShader.setMat4f(depthPrepassViewHandle, view);
+	depthPrepassShader.setMat4f(depthPrepassProjectionHandle, projection);
 
-	glActiveTexture(GL_TEXTURE0);
+	GlState::global().activeTexture(GL_TEXTURE0);
 	containerDiffuseMap.bind();
-	glActiveTexture(GL_TEXTURE1);
+	GlState::global().activeTexture(GL_TEXTURE1);
 	containerSpecularMap.bind();
-	glActiveTexture(GL_TEXTURE2);
+	GlState::global().activeTexture(GL_TEXTURE2);
 	containerEmissionMap.bind();
-	glBindVertexArray(boxVAO);
-
-	// Draw boxes
-	for (size_t i = 0; i < size(boxPositions); i++)
-	{
-		// Model matrix for box
-		mat4 boxModel(1.0f);
-		boxModel = translate(boxModel, boxPositions[i]);
-		float angle = 20.0f * i;
-		boxModel = rotate(boxModel, radians(angle), vec3(1.0f, 0.3f, 0.5f));
-		boxShader.setMat4f("model", boxModel);
-
-		// Normal matrix for box
-		mat3 boxNormal(1.0f);
-		boxNormal = mat3(transpose(inverse(view * boxModel)));
-		boxShader.setMat3f("normalMatView", boxNormal);
 
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-	}
+	// Draw all boxes in view at once, with the textures bound above, and their positions in the depth pre-pass
+	updateVisibleBoxes(projection);
+	DepthOnlyDraw depthOnly;
+	depthOnly.shader = &depthPrepassShader;
+	depthOnly.vertexArray = boxPositionVAO.get();
+	renderQueue.submitArrays(RENDER_PASS_OPAQUE, *boxShader, boxVAO.get(), 0, 36, boxInstanceBuffer.getInstanceCount(), camera->position, nullptr,
+		NO_UNIFORM_BLOCK, depthOnly);
 
 	
 	//---------------------
@@ -175,24 +266,31 @@ void LightScene::render()
 
 	lightSourceShader.use();
 
-	lightSourceShader.setMat4f("view", view);
-	lightSourceShader.setMat4f("projection", projection);
+	lightSourceShader.setMat4f(lightSourceViewHandle, view);
+	lightSourceShader.setMat4f(lightSourceProjectionHandle, projection);
+
+	// Draw all light sources at once
+	renderQueue.submitArrays(RENDER_PASS_UNLIT, lightSourceShader, lightVAO.get(), 0, 36, lightInstanceBuffer.getInstanceCount(), camera->position);
+
 
-	glBindVertexArray(lightVAO);
+	//------------
+	// Issue draws
+	//------------
 
-	// Draw light sources
-	for (size_t i = 0; i < size(pointLightPositions); i++)
+	// With deferred shading the boxes go into the G-buffer first and are lit as a whole afterwards
+	if (deferredShading)
 	{
-		lightSourceShader.setVec3f("lightColor", pointLightColors[i]);
+		deferredRenderer.beginGeometryPass(viewportW, viewportH);
+	}
 
-		// Model matrix for light source
-		mat4 lightModel(1.0f);
-		lightModel = translate(lightModel, pointLightPositions[i]);
-		lightModel = scale(lightModel, vec3(0.2f));
-		lightSourceShader.setMat4f("model", lightModel);
+	renderQueue.execute(RENDER_PASS_OPAQUE);
 
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+	if (deferredShading)
+	{
+		deferredRenderer.shade(view, projection, shadows ? &shadowMaps : nullptr);
 	}
+
+	renderQueue.execute(RENDER_PASS_UNLIT);
 }
 
 
@@ -220,6 +318,47 @@ void LightScene::handleKey(int key, float deltaTime)
 	if (key == GLFW_KEY_F)
 	{
 		flashlight = !flashlight;
+		updateLightingBuffer();
+		selectBoxShader();
+	}
+
+	// L
+	if (key == GLFW_KEY_L)
+	{
+		int next = 0;
+		while (next < (int)size(lightCounts) && lightCounts[next] <= pointLightCount)
+		{
+			next++;
+		}
+		pointLightCount = next < (int)size(lightCounts) ? lightCounts[next] : lightCounts[0];
+		cout << "LightScene: " << pointLightCount << " point lights" << endl;
+
+		generatePointLights();
+		selectBoxShader();
+	}
+
+	// C
+	if (key == GLFW_KEY_C)
+	{
+		clusteredLighting = !clusteredLighting;
+		cout << "LightScene: clustered lighting " << (clusteredLighting ? "on" : "off") << endl;
+		selectBoxShader();
+	}
+
+	// G
+	if (key == GLFW_KEY_G)
+	{
+		deferredShading = !deferredShading;
+		cout << "LightScene: deferred shading " << (deferredShading ? "on" : "off") << endl;
+		selectBoxShader();
+	}
+
+	// H
+	if (key == GLFW_KEY_H)
+	{
+		shadows = !shadows;
+		cout << "LightScene: shadows " << (shadows ? "on" : "off") << endl;
+		selectBoxShader();
 	}
 
 	// Page up
@@ -231,6 +370,7 @@ void LightScene::handleKey(int key, float deltaTime)
 		{
 			emissionIntensity = 2.0f;
 		}
+		selectBoxShader();
 	}
 
 	// Page down
@@ -242,6 +382,21 @@ void LightScene::handleKey(int key, float deltaTime)
 		{
 			emissionIntensity = 0.0f;
 		}
+		selectBoxShader();
+	}
+
+	// Plus
+	if (key == GLFW_KEY_EQUAL && boxCount < maxBoxCount)
+	{
+		boxCount *= 10;
+		generateBoxes();
+	}
+
+	// Minus
+	if (key == GLFW_KEY_MINUS && boxCount > 10)
+	{
+		boxCount /= 10;
+		generateBoxes();
 	}
 }
 
@@ -336,4 +491,192 @@ void LightScene::adjustLights()
 		pointLightSpeculars[3] = vec3(1.0f);
 		break;
 	}
+
+	updateLightingBuffer();
+	generatePointLights();
+}
+
+
+void LightScene::getUniformHandles()
+{
+	// Lit object
+	shininessHandle = boxShader->getUniformHandle("material.shininess");
+	emissionIntensityHandle = boxShader->getUniformHandle("material.emissionIntensity");
+
+	viewHandle = boxShader->getUniformHandle("view");
+	projectionHandle = boxShader->getUniformHandle("projection");
+
+	// Light source
+	lightSourceViewHandle = lightSourceShader.getUniformHandle("view");
+	lightSourceProjectionHandle = lightSourceShader.getUniformHandle("projection");
+
+	// Depth pre-pass
+	depthPrepassViewHandle = depthPrepassShader.getUniformHandle("view");
+	depthPrepassProjectionHandle = depthPrepassShader.getUniformHandle("projection");
+}
+
+
+void LightScene::selectBoxShader()
+{
+	LitObjectFeatures features;
+	features.pointLightCount = std::min(pointLightCount, MAX_POINT_LIGHTS);
+	features.spotLight = flashlight;
+	features.clusteredLights = usesLightClusters();
+	features.emission = emissionIntensity > 0.0f;
+	features.shadows = shadows;
+
+	// With deferred shading the boxes only write their material to the G-buffer
+	Shader *shader = deferredShading ? &boxGBufferShaders.get(features.getMaterialDefines()) : &boxShaders.get(features.getDefines());
+	if (shader != boxShader)
+	{
+		boxShader = shader;
+		getUniformHandles();
+	}
+}
+
+
+void LightScene::updateLightingBuffer()
+{
+	// Switching the flashlight off selects a shader permutation without it, so it's always set here
+	float flashlightReach = setSceneLights(lightingBuffer, directionalLightDirection, directionalLightColor, directionalLightSpecular,
+		pointLightPositions, pointLightColors, pointLightSpeculars, spotLightColor, spotLightSpecular, spotLightInnerCutOff, spotLightOuterCutOff);
+
+	// Deferred shading draws the flashlight as a cone reaching as far as its light does
+	deferredRenderer.setSpotLight(flashlight, vec3(0.0f), vec3(0.0f, 0.0f, -1.0f), flashlightReach, radians(spotLightOuterCutOff));
+}
+
+
+void LightScene::updateLightInstances()
+{
+	// Only the point lights switched on get a gizmo
+	vector<LightSourceInstance> instances(pointLights.size());
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		// Model matrix for light source
+		instances[i].model = mat4(1.0f);
+		instances[i].model = translate(instances[i].model, pointLights[i].position);
+		instances[i].model = scale(instances[i].model, vec3(0.2f));
+		instances[i].color = pointLights[i].diffuse;
+	}
+	lightInstanceBuffer.upload(instances.data(), (GLsizei)instances.size());
+}
+
+
+void LightScene::generateBoxes()
+{
+	// Boxes past the first 10 are scattered randomly
+	vector<vec3> positions = scatterPositions(boxPositions, size(boxPositions), boxCount);
+
+	boxInstances.resize(boxCount);
+	boxCuller.clear();
+	boxCuller.reserve(boxCount);
+	for (size_t i = 0; i < boxInstances.size(); i++)
+	{
+		// Model matrix for box
+		mat4 boxModel(1.0f);
+		boxModel = translate(boxModel, positions[i]);
+		float angle = 20.0f * i;
+		boxModel = rotate(boxModel, radians(angle), vec3(1.0f, 0.3f, 0.5f));
+		boxInstances[i].model = boxModel;
+
+		// Normal matrix for box, in world space since the boxes don't move
+		boxInstances[i].normal = mat3(transpose(inverse(boxModel)));
+
+		boxCuller.add(BOX_BOUNDS, BOX_SPHERE, boxModel);
+	}
+
+	// The boxes in view are uploaded on the next frame, and the shadows they cast are drawn again
+	culledViewProjection = mat4(0.0f);
+	shadowMaps.invalidate();
+
+	cout << "LightScene: " << boxCount << " boxes" << endl;
+}
+
+
+void LightScene::updateVisibleBoxes(const mat4 &projection)
+{
+	// The boxes don't move, so the ones in view only change along with the view
+	mat4 viewProjection = projection * camera->getViewMatrix();
+	if (viewProjection == culledViewProjection && culledWithCulling == FrustumCuller::isEnabled() && culledWithOcclusion == OcclusionCuller::isEnabled())
+	{
+		return;
+	}
+	culledViewProjection = viewProjection;
+	culledWithCulling = FrustumCuller::isEnabled();
+	culledWithOcclusion = OcclusionCuller::isEnabled();
+
+	boxCuller.cull(Frustum(viewProjection), visibleBoxes);
+
+	// The boxes in view nearest to the camera hide those behind them, farther ones are too small on screen to be worth rasterizing
+	if (OcclusionCuller::isEnabled())
+	{
+		occluderBoxes = visibleBoxes;
+		size_t occluderCount = std::min(occluderBoxes.size(), (size_t)occluderBoxCount);
+		vec3 cameraPosition = camera->position;
+		nth_element(occluderBoxes.begin(), occluderBoxes.begin() + occluderCount, occluderBoxes.end(), [this, cameraPosition](uint32_t a, uint32_t b)
+		{
+			vec3 toA = vec3(boxInstances[a].model[3]) - cameraPosition;
+			vec3 toB = vec3(boxInstances[b].model[3]) - cameraPosition;
+			return dot(toA, toA) < dot(toB, toB);
+		});
+
+		occlusionCuller.begin(viewProjection);
+		for (size_t i = 0; i < occluderCount; i++)
+		{
+			occlusionCuller.addOccluder(BOX_CORNERS, size(BOX_CORNERS), BOX_INDICES, size(BOX_INDICES), boxInstances[occluderBoxes[i]].model);
+		}
+		occlusionCuller.rasterize();
+
+		visibleBoxes.erase(remove_if(visibleBoxes.begin(), visibleBoxes.end(), [this](uint32_t box)
+		{
+			return occlusionCuller.isOccluded(BOX_BOUNDS, boxInstances[box].model);
+		}), visibleBoxes.end());
+	}
+	visibleBoxInstances.resize(visibleBoxes.size());
+	for (size_t i = 0; i < visibleBoxes.size(); i++)
+	{
+		visibleBoxInstances[i] = boxInstances[visibleBoxes[i]];
+	}
+	boxInstanceBuffer.upload(visibleBoxInstances.data(), (GLsizei)visibleBoxInstances.size());
+}
+
+
+size_t LightScene::drawShadowCasters(const mat4 &lightView, const mat4 &lightProjection, const Frustum &casterFrustum)
+{
+	boxCuller.cull(casterFrustum, shadowBoxes);
+	if (shadowBoxes.empty())
+	{
+		return 0;
+	}
+
+	shadowBoxModels.resize(shadowBoxes.size());
+	for (size_t i = 0; i < shadowBoxes.size(); i++)
+	{
+		shadowBoxModels[i] = boxInstances[shadowBoxes[i]].model;
+	}
+	shadowInstanceBuffer.upload(shadowBoxModels.data(), (GLsizei)shadowBoxModels.size());
+
+	depthPrepassShader.use();
+	depthPrepassShader.setMat4f(depthPrepassViewHandle, lightView);
+	depthPrepassShader.setMat4f(depthPrepassProjectionHandle, lightProjection);
+
+	GlState::global().bindVertexArray(shadowBoxVAO.get());
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 36, (GLsizei)shadowBoxModels.size());
+	return shadowBoxModels.size();
+}
+
+
+void LightScene::generatePointLights()
+{
+	scatterPointLights(pointLightPositions, pointLightColors, pointLightSpeculars, pointLightCount, lightDensity, pointLights);
+
+	lightClusters.setLights(pointLights);
+	deferredRenderer.setPointLights(pointLights);
+	updateLightInstances();
+}
+
+
+bool LightScene::usesLightClusters() const
+{
+	return !deferredShading && (clusteredLighting || pointLightCount > MAX_POINT_LIGHTS);
 }
\ No newline at end of file
@@ -70,6 +70,25 @@ public:
 		glm::vec3(-1.3f,  1.0f, -1.5f)
 	};
 
+	// Per-instance data of all drawn boxes, the first ones are placed at boxPositions and the rest are scattered randomly
+	std::vector<LitObjectInstance> boxInstances;
+
+	// Bounds of the boxes, tested against the view frustum whenever the view changes so only the boxes in view are uploaded and drawn
+	FrustumCuller boxCuller;
+	std::vector<uint32_t> visibleBoxes;
+	std::vector<LitObjectInstance> visibleBoxInstances;
+	glm::mat4 culledViewProjection = glm::mat4(0.0f);  // View the uploaded boxes were culled for, zero to cull again on the next frame
+	bool culledWithCulling = false;  // Whether frustum and occlusion culling were enabled back then
+	bool culledWithOcclusion = false;
+
+	// Hides the boxes behind the ones nearest to the camera, which are rasterized as occluders
+	OcclusionCuller occlusionCuller;
+	std::vector<uint32_t> occluderBoxes;
+
+	// Boxes casting shadows into the cascade being drawn, culled with the same bounds against the cascade's frustum
+	std::vector<uint32_t> shadowBoxes;
+	std::vector<glm::mat4> shadowBoxModels;
+
 
 	//---------
 	// Textures
@@ -84,17 +103,68 @@ public:
 	// Shaders
 	//--------
 
-	Shader boxShader;
+	// Permutations of the box shader, boxShader is the one matching the features currently in use
+	ShaderPermutations boxShaders;
+	Shader *boxShader = nullptr;
+
+	// Permutations of the box shader writing the G-buffer instead, picked as boxShader with deferred shading
+	ShaderPermutations boxGBufferShaders;
 	Shader lightSourceShader;
 
+	// Draws the positions of the boxes in the depth pre-pass, and into the shadow maps with the light's view and projection
+	Shader depthPrepassShader;
+
 
 	//---------------
 	// Buffer objects
 	//---------------
 
-	GLuint lightVAO;
-	GLuint boxVAO;
-	GLuint boxVBO;
+	GpuResource lightVAO;
+	GpuResource boxVAO;
+	GpuResource boxVBO;
+
+	// Positions of the box vertices alone, read by the depth pre-pass along with the box instances
+	GpuResource boxPositionVAO;
+	GpuResource boxPositionVBO;
+
+	InstanceBuffer boxInstanceBuffer;
+	InstanceBuffer lightInstanceBuffer;
+
+	// Box positions along with the model matrices of the shadow casters of a cascade
+	GpuResource shadowBoxVAO;
+	InstanceBuffer shadowInstanceBuffer;
+
+	// Shadows of the directional light
+	CascadedShadowMaps shadowMaps;
+
+	LightingBuffer lightingBuffer;
+
+	// Point lights assigned to clusters, used instead of the lighting buffer's point lights when there are more than it holds
+	LightClusters lightClusters;
+
+	// Shades the boxes after they're drawn with deferred shading, instead of every fragment being lit as it's drawn
+	DeferredRenderer deferredRenderer;
+
+	// Draws of the current frame, issued sorted by state and depth
+	RenderQueue renderQueue;
+
+
+	//----------------
+	// Uniform handles
+	//----------------
+
+	// Handles of the uniforms set every frame, retrieved once after the shaders are built
+	// Light properties aren't among them, they live in the lighting buffer
+	UniformHandle shininessHandle;
+	UniformHandle emissionIntensityHandle;
+	UniformHandle viewHandle;
+	UniformHandle projectionHandle;
+
+	UniformHandle lightSourceViewHandle;
+	UniformHandle lightSourceProjectionHandle;
+
+	UniformHandle depthPrepassViewHandle;
+	UniformHandle depthPrepassProjectionHandle;
 
 
 	//-----------------
@@ -126,6 +196,9 @@ public:
 		glm::vec3(1.0f)
 	};
 
+	// All point lights switched on, the first ones are the ones above and the rest are scattered randomly
+	std::vector<ClusteredPointLight> pointLights;
+
 	// Spot
 	glm::vec3 spotLightColor = glm::vec3(1.0f);
 	glm::vec3 spotLightSpecular = glm::vec3(1.0f);
@@ -143,6 +216,18 @@ public:
 	int amountSchemes = 5;
 	bool flashlight = true;
 	float emissionIntensity = 1.0f;
+	int pointLightCount = MAX_POINT_LIGHTS;  // Point lights switched on, cycled through lightCounts
+	int lightCounts[8] = { 0, 1, 2, 3, 4, 256, 4096, 65536 };
+	float lightDensity = 0.02f;  // Point lights per cubic unit of the volume the lights beyond the first ones are scattered in
+	bool clusteredLighting = false;  // Use light clusters even when the lighting buffer has room for all point lights
+	bool deferredShading = false;  // Draw the boxes into a G-buffer and light them with light volumes afterwards
+	bool shadows = true;  // Shadow the directional light with the cascaded shadow maps
+	float shadowDistance = 50.0f;  // View distance up to which shadows are drawn
+	float nearPlane = 0.1f;  // Clip planes of the projection, the light clusters are spread between them
+	float farPlane = 100.0f;
+	int boxCount = 10;  // Amount of boxes drawn, changed in steps of 10x to see how rendering scales
+	int maxBoxCount = 1000000;
+	int occluderBoxCount = 64;  // Boxes nearest to the camera rasterized as occluders
 	glm::vec3 skyColor = glm::vec3(0.05f, 0.05f, 0.1f);
 
 
@@ -161,6 +246,34 @@ public:
 
 	// Adjust light settings, called when lighting scheme is changed
 	void adjustLights();
+
+	// Pass light settings to the lighting buffer, called whenever they change
+	void updateLightingBuffer();
+
+	// Update the per-instance data of the light source gizmos, called whenever lights change
+	void updateLightInstances();
+
+	// Collect the point lights switched on and pass them to the light clusters, called whenever they change
+	void generatePointLights();
+
+	// Whether point lights come from the light clusters, either because they're enabled or because there are too many lights for the lighting buffer
+	// Deferred shading has its own way of handling many lights, so it never uses them
+	bool usesLightClusters() const;
+
+	// Place boxes and compute their per-instance data and bounds, called when the box count changes
+	void generateBoxes();
+
+	// Upload the per-instance data of the boxes inside the view frustum and not hidden by others, skipped if neither the view nor the boxes changed
+	void updateVisibleBoxes(const glm::mat4 &projection);
+
+	// Draw the boxes inside a cascade's frustum into its shadow map, returns the amount drawn
+	size_t drawShadowCasters(const glm::mat4 &lightView, const glm::mat4 &lightProjection, const Frustum &casterFrustum);
+
+	// Retrieve the handles of the uniforms set every frame
+	void getUniformHandles();
+
+	// Pick the box shader permutation with only the features in use and retrieve its uniform handles, called whenever they change
+	void selectBoxShader();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+#include "scene.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace std;
+using namespace glm;
+
+
+vector<vec3> Scene::scatterPositions(const vec3 *fixedPositions, size_t fixedCount, size_t count)
+{
+	vector<vec3> positions(fixedPositions, fixedPositions + std::min(fixedCount, count));
+	positions.resize(count);
+
+	mt19937 random(42);
+	float extent = 3.0f * cbrt((float)count);
+	uniform_real_distribution<float> offset(-extent, extent);
+	for (size_t i = fixedCount; i < count; i++)
+	{
+		positions[i] = vec3(offset(random), offset(random), offset(random) - extent);
+	}
+	return positions;
+}
\ No newline at end of file
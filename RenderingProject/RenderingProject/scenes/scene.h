@@ -5,24 +5,46 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <vector>
 #include "../shader.h"
+#include "../shader_permutations.h"
 #include "../camera.h"
+#include "../gl_state.h"
 #include "../texture_legacy.h"
 #include "../model.h"
+#include "../lighting_buffer.h"
+#include "../light_clusters.h"
+#include "../deferred_renderer.h"
+#include "../cascaded_shadow_maps.h"
+#include "../frustum_culling.h"
+#include "../occlusion_culling.h"
+#include "../render_queue.h"
+#include "../instance_buffer.h"
 
 
 // Base class for scenes
 // NOTE: I made the design choice that every scene should be self contained,
 //       and as such they shall not share resources to keep things clear, meaning
 //       data may and will be duplicated, but that's a sacrifice I'm willing to make here
+//       (code generating the same layouts in several scenes lives here though)
 class Scene
 {
 public:
+	// Scenes are deleted through this base class when they're reloaded, which has to release all their GPU resources
+	virtual ~Scene() = default;
+
 	// Render the scene into the window
 	virtual void render() = 0;
 
 	// Handle scene specific keyboard commands
 	virtual void handleKey(int key, float deltaTime) = 0;
+
+
+protected:
+	// Positions of an amount of objects, the first ones are the given fixed positions and the rest are scattered randomly in front of
+	// the origin, with the volume they're in growing so that density stays about the same
+	// A fixed seed keeps the layout the same between runs so measurements are comparable
+	static std::vector<glm::vec3> scatterPositions(const glm::vec3 *fixedPositions, size_t fixedCount, size_t count);
 };
 
 #endif
\ No newline at end of file
@@ -1,13 +1,20 @@
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include "gl_state.h"
+#include "program_cache.h"
 #include "shader.h"
 
 using namespace std;
 using namespace glm;
 
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath)
+UniformStats Shader::frameStats;
+
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines &defines)
 {
 	//----------------------------------------------------------
 	// 1. Retrieve the vertex/fragment source code from filePath
@@ -39,12 +46,99 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath)
 	{
 		cerr << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
 	}
+
+	// Specialize the sources for the permutation, the definitions are part of the program cache key this way
+	vertexCode = insertDefines(vertexCode, defines);
+	fragmentCode = insertDefines(fragmentCode, defines);
+	string permutation = describeDefines(defines);
+
+	//---------------------------------------------------------------------------
+	// 2. Load the linked program from the program cache, or build it from source
+	//---------------------------------------------------------------------------
+	ProgramCache &programCache = ProgramCache::global();
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+	if (programCache.load(vertexCode, fragmentCode, ID))
+	{
+		cout << "Shader: loaded " << vertexPath << " + " << fragmentPath << permutation << " from program cache in "
+			<< chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count() << " ms" << endl;
+	}
+	else
+	{
+		bool compiled = compile(vertexCode, fragmentCode);
+		double compileTimeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+		programCache.addCompile(compileTimeMs);
+		cout << "Shader: compiled " << vertexPath << " + " << fragmentPath << permutation << " in " << compileTimeMs << " ms" << endl;
+
+		if (compiled)
+		{
+			programCache.store(vertexCode, fragmentCode, ID);
+		}
+	}
+
+	//-------------------------------------------
+	// 3. Read uniform locations into a table once
+	//-------------------------------------------
+	readActiveUniforms();
+}
+
+
+string Shader::insertDefines(const string &source, const ShaderDefines &defines)
+{
+	if (defines.empty())
+	{
+		return source;
+	}
+
+	string defineLines;
+	for (const auto &define : defines)
+	{
+		defineLines += "#define " + define.first + " " + define.second + "\n";
+	}
+
+	// Directly after the #version line, or at the start if there is none
+	size_t position = 0;
+	size_t versionStart = source.find("#version");
+	if (versionStart != string::npos)
+	{
+		size_t lineEnd = source.find('\n', versionStart);
+		position = lineEnd == string::npos ? source.size() : lineEnd + 1;
+	}
+
+	string result = source;
+	if (position == result.size() && (result.empty() || result.back() != '\n'))
+	{
+		result += '\n';
+		position = result.size();
+	}
+	result.insert(position, defineLines);
+	return result;
+}
+
+
+string Shader::describeDefines(const ShaderDefines &defines)
+{
+	if (defines.empty())
+	{
+		return "";
+	}
+
+	string description = " [";
+	for (auto it = defines.begin(); it != defines.end(); ++it)
+	{
+		if (it != defines.begin())
+		{
+			description += ", ";
+		}
+		description += it->first + "=" + it->second;
+	}
+	return description + "]";
+}
+
+
+bool Shader::compile(const string &vertexCode, const string &fragmentCode)
+{
 	const char* vShaderCode = vertexCode.c_str();
 	const char* fShaderCode = fragmentCode.c_str();
-
-	//-------------------
-	// 2. Compile shaders
-	//-------------------
 	unsigned int vertex, fragment;
 	int success;
 	char infoLog[512];
@@ -73,75 +167,243 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath)
 		cerr << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << endl;
 	};
 
-	// Shader Program
-	ID = glCreateProgram();
-	glAttachShader(ID, vertex);
-	glAttachShader(ID, fragment);
-	glLinkProgram(ID);
+	// Shader Program, kept retrievable as a binary for the program cache
+	ID = GpuResource(GPU_RESOURCE_PROGRAM);
+	ProgramCache::prepareForStore(ID.get());
+	glAttachShader(ID.get(), vertex);
+	glAttachShader(ID.get(), fragment);
+	glLinkProgram(ID.get());
 	// Print linking errors if any
-	glGetProgramiv(ID, GL_LINK_STATUS, &success);
+	glGetProgramiv(ID.get(), GL_LINK_STATUS, &success);
 	if (!success)
 	{
-		glGetProgramInfoLog(ID, 512, NULL, infoLog);
+		glGetProgramInfoLog(ID.get(), 512, NULL, infoLog);
 		cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << endl;
 	}
 
 	// Delete the shaders as they're linked into our program now and no longer necessary
 	glDeleteShader(vertex);
 	glDeleteShader(fragment);
+	return success != 0;
 }
 
 
 void Shader::use() const
 {
-	glUseProgram(ID);
+	GlState::global().useProgram(ID.get());
+}
+
+
+void Shader::bindUniformBlock(const string &blockName, GLuint bindingPoint) const
+{
+	GLuint blockIndex = glGetUniformBlockIndex(ID.get(), blockName.c_str());
+	if (blockIndex == GL_INVALID_INDEX)
+	{
+		cerr << "ERROR::SHADER::UNIFORM_BLOCK_NOT_FOUND " << blockName << endl;
+		return;
+	}
+	glUniformBlockBinding(ID.get(), blockIndex, bindingPoint);
+}
+
+
+UniformHandle Shader::getUniformHandle(const string &name) const
+{
+	auto it = uniformHandles.find(name);
+	if (it == uniformHandles.end())
+	{
+		return -1;
+	}
+	return it->second;
 }
 
 
 // Uniform setter for bools
-void Shader::setBool(const string &name, bool value) const
+void Shader::setBool(const string &name, bool value)
 {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+	setBool(getUniformHandle(name), value);
 }
 
 
 // Uniform setter for ints
-void Shader::setInt(const string &name, int value) const
+void Shader::setInt(const string &name, int value)
 {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+	setInt(getUniformHandle(name), value);
 }
 
 
 // Uniform setter for floats
-void Shader::setFloat(const string &name, float value) const
+void Shader::setFloat(const string &name, float value)
 {
-	glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+	setFloat(getUniformHandle(name), value);
 }
 
 
 // Uniform setter for vec3 (with floats)
-void Shader::setVec3f(const string &name, vec3 value) const
+void Shader::setVec3f(const string &name, vec3 value)
 {
-	glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, value_ptr(value));
+	setVec3f(getUniformHandle(name), value);
 }
 
 
 // Uniform setter for vec4 (with floats)
-void Shader::setVec4f(const string &name, vec4 value) const
+void Shader::setVec4f(const string &name, vec4 value)
 {
-	glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, value_ptr(value));
+	setVec4f(getUniformHandle(name), value);
 }
 
 
 // Uniform setter for mat3 (with floats)
-void Shader::setMat3f(const string &name, mat3 value) const
+void Shader::setMat3f(const string &name, mat3 value)
 {
-	glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, value_ptr(value));
+	setMat3f(getUniformHandle(name), value);
 }
 
 
 // Uniform setter for mat4 (with floats)
-void Shader::setMat4f(const string &name, mat4 value) const
+void Shader::setMat4f(const string &name, mat4 value)
 {
-	glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, value_ptr(value));
+	setMat4f(getUniformHandle(name), value);
+}
+
+
+void Shader::setBool(UniformHandle handle, bool value)
+{
+	setInt(handle, (int)value);
+}
+
+
+void Shader::setInt(UniformHandle handle, int value)
+{
+	if (updateShadowValue(handle, &value, sizeof(value)))
+	{
+		glUniform1i(uniforms[handle].location, value);
+	}
+}
+
+
+void Shader::setFloat(UniformHandle handle, float value)
+{
+	if (updateShadowValue(handle, &value, sizeof(value)))
+	{
+		glUniform1f(uniforms[handle].location, value);
+	}
+}
+
+
+void Shader::setVec3f(UniformHandle handle, vec3 value)
+{
+	if (updateShadowValue(handle, value_ptr(value), sizeof(value)))
+	{
+		glUniform3fv(uniforms[handle].location, 1, value_ptr(value));
+	}
+}
+
+
+void Shader::setVec4f(UniformHandle handle, vec4 value)
+{
+	if (updateShadowValue(handle, value_ptr(value), sizeof(value)))
+	{
+		glUniform4fv(uniforms[handle].location, 1, value_ptr(value));
+	}
+}
+
+
+void Shader::setMat3f(UniformHandle handle, mat3 value)
+{
+	if (updateShadowValue(handle, value_ptr(value), sizeof(value)))
+	{
+		glUniformMatrix3fv(uniforms[handle].location, 1, GL_FALSE, value_ptr(value));
+	}
+}
+
+
+void Shader::setMat4f(UniformHandle handle, mat4 value)
+{
+	if (updateShadowValue(handle, value_ptr(value), sizeof(value)))
+	{
+		glUniformMatrix4fv(uniforms[handle].location, 1, GL_FALSE, value_ptr(value));
+	}
+}
+
+
+const UniformStats &Shader::getFrameStats()
+{
+	return frameStats;
+}
+
+
+void Shader::resetFrameStats()
+{
+	frameStats = UniformStats();
+}
+
+
+void Shader::readActiveUniforms()
+{
+	GLint uniformCount = 0;
+	GLint maxNameLength = 0;
+	glGetProgramiv(ID.get(), GL_ACTIVE_UNIFORMS, &uniformCount);
+	glGetProgramiv(ID.get(), GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+	vector<char> nameBuffer(maxNameLength + 1);
+	for (GLint i = 0; i < uniformCount; i++)
+	{
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(ID.get(), i, (GLsizei)nameBuffer.size(), NULL, &size, &type, nameBuffer.data());
+		string name = nameBuffer.data();
+
+		// Arrays of basic types are reported once as "name[0]", so register every element separately
+		string baseName = name;
+		if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+		{
+			baseName = name.substr(0, name.size() - 3);
+		}
+
+		for (GLint element = 0; element < size; element++)
+		{
+			string elementName = size > 1 ? baseName + "[" + to_string(element) + "]" : name;
+
+			// Uniforms inside uniform blocks have no location and can't be set this way
+			GLint location = glGetUniformLocation(ID.get(), elementName.c_str());
+			if (location == -1)
+			{
+				continue;
+			}
+
+			Uniform uniform;
+			uniform.location = location;
+			uniform.valueSet = false;
+			uniforms.push_back(uniform);
+
+			UniformHandle handle = (UniformHandle)uniforms.size() - 1;
+			uniformHandles[elementName] = handle;
+			if (element == 0 && size > 1)
+			{
+				uniformHandles[baseName] = handle;
+			}
+		}
+	}
+}
+
+
+bool Shader::updateShadowValue(UniformHandle handle, const void *value, size_t size)
+{
+	// Setting a uniform that isn't active is a no-op, same as with location -1 in OpenGL
+	if (handle < 0 || handle >= (UniformHandle)uniforms.size())
+	{
+		return false;
+	}
+
+	Uniform &uniform = uniforms[handle];
+	if (uniform.valueSet && memcmp(uniform.value, value, size) == 0)
+	{
+		frameStats.skipped++;
+		return false;
+	}
+
+	memcpy(uniform.value, value, size);
+	uniform.valueSet = true;
+	frameStats.issued++;
+	return true;
 }
\ No newline at end of file
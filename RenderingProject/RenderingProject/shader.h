@@ -2,20 +2,40 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <map>
 #include <string>
+#include <vector>
+#include <unordered_map>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "gpu_resource.h"
+
+
+// Handle to a uniform in a shader's location table, -1 if the shader has no such active uniform
+typedef GLint UniformHandle;
+
+
+// Preprocessor definitions (name to value) selecting a permutation of a shader, inserted into both sources after the #version line
+// Kept sorted by name, so the same definitions always give the same sources and thus the same program cache entry
+typedef std::map<std::string, std::string> ShaderDefines;
+
+
+// Uniform upload counts, collected over all shaders and reset every frame
+struct UniformStats {
+	unsigned issued = 0;   // Uploads that reached the driver
+	unsigned skipped = 0;  // Uploads skipped because the value was already set
+};
 
 
 class Shader
 {
 public:
-    // The shader program ID
-    GLuint ID;
+    // The shader program, deleted along with the shader
+    GpuResource ID;
 
-    // Constructor reads and builds the shader
-    Shader(const char* vertexPath, const char* fragmentPath);
+    // Constructor reads and builds the shader, with the definitions inserted into its sources
+    Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines &defines = ShaderDefines());
 
 	// Default constructor
 	Shader() = default;
@@ -23,14 +43,66 @@ public:
     // Activate the shader
     void use() const;
 
+	// Bind a uniform block of the shader to a uniform buffer binding point
+	void bindUniformBlock(const std::string &blockName, GLuint bindingPoint) const;
+
+	// Retrieve the handle of a uniform, meant to be done once and the handle stored for the per-frame setters below
+	UniformHandle getUniformHandle(const std::string &name) const;
+
     // Utility uniform functions
-    void setBool(const std::string &name, bool value) const;  
-    void setInt(const std::string &name, int value) const;   
-    void setFloat(const std::string &name, float value) const;
-	void setVec3f(const std::string &name, glm::vec3 value) const;
-    void setVec4f(const std::string &name, glm::vec4 value) const;
-	void setMat3f(const std::string &name, glm::mat3 value) const;
-    void setMat4f(const std::string &name, glm::mat4 value) const;
+    void setBool(const std::string &name, bool value);
+    void setInt(const std::string &name, int value);
+    void setFloat(const std::string &name, float value);
+	void setVec3f(const std::string &name, glm::vec3 value);
+    void setVec4f(const std::string &name, glm::vec4 value);
+	void setMat3f(const std::string &name, glm::mat3 value);
+    void setMat4f(const std::string &name, glm::mat4 value);
+
+	// Utility uniform functions taking a handle, these don't allocate and skip values that are already set
+	void setBool(UniformHandle handle, bool value);
+	void setInt(UniformHandle handle, int value);
+	void setFloat(UniformHandle handle, float value);
+	void setVec3f(UniformHandle handle, glm::vec3 value);
+	void setVec4f(UniformHandle handle, glm::vec4 value);
+	void setMat3f(UniformHandle handle, glm::mat3 value);
+	void setMat4f(UniformHandle handle, glm::mat4 value);
+
+	// Uniform upload counts of the current frame
+	static const UniformStats &getFrameStats();
+
+	// Reset uniform upload counts, should be called at the start of every frame
+	static void resetFrameStats();
+
+
+private:
+	// Entry in the location table, with a shadow copy of the last value uploaded to the uniform
+	struct Uniform {
+		GLint location;
+		bool valueSet;
+		GLfloat value[16];  // Large enough for a mat4, other types use the start of it
+	};
+
+	// Location table, filled once after linking
+	std::vector<Uniform> uniforms;
+	std::unordered_map<std::string, UniformHandle> uniformHandles;
+
+	// Upload counts of the current frame
+	static UniformStats frameStats;
+
+	// Insert definitions into a shader source after its #version line (which has to stay first)
+	static std::string insertDefines(const std::string &source, const ShaderDefines &defines);
+
+	// Definitions as a readable list for the log, e.g. " [FLASHLIGHT=1, POINT_LIGHT_COUNT=4]"
+	static std::string describeDefines(const ShaderDefines &defines);
+
+	// Compile and link the program from source, returns false (after printing the errors) if that failed
+	bool compile(const std::string &vertexCode, const std::string &fragmentCode);
+
+	// Read the active uniforms of the linked program into the location table
+	void readActiveUniforms();
+
+	// Compare a value to the shadow copy of the uniform and update the copy, returns true if the value needs uploading
+	bool updateShadowValue(UniformHandle handle, const void *value, size_t size);
 };
-  
+
 #endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include "shader_permutations.h"
+
+using namespace std;
+
+
+ShaderPermutations::ShaderPermutations(const char *vertexPath, const char *fragmentPath, SetupFunction setup) :
+	vertexPath(vertexPath),
+	fragmentPath(fragmentPath),
+	setup(setup)
+{
+}
+
+
+Shader &ShaderPermutations::get(const ShaderDefines &defines)
+{
+	auto it = shaders.find(defines);
+	if (it != shaders.end())
+	{
+		return *it->second;
+	}
+
+	unique_ptr<Shader> shader = make_unique<Shader>(vertexPath.c_str(), fragmentPath.c_str(), defines);
+	if (setup)
+	{
+		setup(*shader);
+	}
+	return *shaders.emplace(defines, std::move(shader)).first->second;
+}
+
+
+size_t ShaderPermutations::getCount() const
+{
+	return shaders.size();
+}
\ No newline at end of file
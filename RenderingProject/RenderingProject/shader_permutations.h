@@ -0,0 +1,43 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include "shader.h"
+
+
+// Permutations of one shader, each built from the same sources with its own definitions the first time it's asked for
+// Shaders compile the features their definitions disable out entirely, so instead of one shader doing everything and
+// branching on (or zeroing out) unused features, scenes use the permutation matching what they currently need
+class ShaderPermutations
+{
+public:
+	// Function preparing a newly built permutation, e.g. setting sampler units and binding uniform blocks
+	typedef std::function<void(Shader &)> SetupFunction;
+
+	// Constructor, builds no permutations yet
+	ShaderPermutations(const char *vertexPath, const char *fragmentPath, SetupFunction setup = nullptr);
+
+	// Default constructor
+	ShaderPermutations() = default;
+
+	// Permutation with these definitions, built and set up on the first request
+	// The reference stays valid for the lifetime of the permutations, but uniform handles differ between permutations
+	Shader &get(const ShaderDefines &defines);
+
+	// Amount of permutations built so far
+	size_t getCount() const;
+
+
+private:
+	std::string vertexPath;
+	std::string fragmentPath;
+	SetupFunction setup;
+
+	// Built permutations by their definitions, the shaders are held by pointer so they don't move as more are added
+	std::map<ShaderDefines, std::unique_ptr<Shader>> shaders;
+};
+
+#endif
\ No newline at end of file
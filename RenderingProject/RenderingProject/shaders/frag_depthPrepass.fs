@@ -0,0 +1,8 @@
+#version 330 core
+
+// Only depth is written, with color writes masked off
+
+
+void main()
+{
+}
\ No newline at end of file
@@ -0,0 +1,267 @@
+#version 330 core
+
+// Light volume drawn, defined by the application (see DeferredRenderer)
+#define LIGHT_VOLUME_FULLSCREEN 0 // Directional light and emission, one triangle covering the screen
+#define LIGHT_VOLUME_POINT 1      // Point light spheres, one instance per light
+#define LIGHT_VOLUME_SPOT 2       // Spotlight cone
+#ifndef LIGHT_VOLUME
+#define LIGHT_VOLUME LIGHT_VOLUME_FULLSCREEN
+#endif
+
+// Whether the directional light of the fullscreen pass is shadowed, defined by the application
+#ifndef SHADOWS
+#define SHADOWS 0
+#endif
+
+// Shadow cascades, must match SHADOW_CASCADE_COUNT in cascaded_shadow_maps.h
+#define SHADOW_CASCADE_COUNT 4
+
+#define NR_POINT_LIGHTS 4
+
+// Light structs are laid out for the std140 "Lighting" uniform block, the same as in frag_lightSceneLitObject.fs
+struct DirectionalLight {
+    vec3 direction; // should be in view space
+    
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position; // should be in view space
+    float constant;
+    
+    vec3 ambient;
+    float linear;
+    vec3 diffuse;
+    float quadratic;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position; // should be in view space
+    float constant;
+    vec3 direction; // should be in view space
+    float linear;
+    
+    vec3 ambient;
+    float quadratic;
+    vec3 diffuse;
+    float innerCutOff;
+    vec3 specular;
+    float outerCutOff;
+};
+
+#if LIGHT_VOLUME == LIGHT_VOLUME_POINT
+flat in vec3 lightPosition; // in view space
+flat in float lightRadius;
+flat in vec3 lightAmbient;
+flat in vec3 lightDiffuse;
+flat in vec3 lightSpecular;
+flat in vec3 lightAttenuation;
+#endif
+
+out vec4 fragColor;
+
+// G-buffer, see DeferredRenderer
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;    // View space normal in xyz, shininess in w
+uniform sampler2D gSpecular;
+uniform sampler2D gEmission;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseProjection;
+
+layout (std140) uniform Lighting
+{
+    DirectionalLight directionalLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+    SpotLight spotLight;
+};
+
+#if SHADOWS
+// Cascaded shadow maps of the directional light, sampled the same as in frag_lightSceneLitObject.fs
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 shadowMatrices[SHADOW_CASCADE_COUNT];  // From view space to the texture coordinates and depth of every cascade
+
+float calcShadow(vec3 fragPos);
+#endif
+
+// Surface properties of the pixel, read from the G-buffer
+vec3 albedo;
+vec3 specularColor;
+float shininess;
+
+vec3 calcDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir, float shadow);
+vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    
+    // Nothing was drawn here, the background stays
+    if (depth == 1.0)
+    {
+        discard;
+    }
+    
+    // View space position from the depth
+    vec2 screenPos = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+    vec4 viewPos = inverseProjection * vec4(vec3(screenPos, depth) * 2.0 - 1.0, 1.0);
+    vec3 fragPos = viewPos.xyz / viewPos.w;
+    
+#if LIGHT_VOLUME == LIGHT_VOLUME_POINT
+    // The sphere covers pixels in front of and behind the light's reach too
+    if (length(lightPosition - fragPos) > lightRadius)
+    {
+        discard;
+    }
+#endif
+    
+    // Properties
+    vec4 normalShininess = texelFetch(gNormal, pixel, 0);
+    vec3 normal = normalShininess.xyz;
+    vec3 viewDir = normalize(-fragPos);
+    albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+    specularColor = texelFetch(gSpecular, pixel, 0).rgb;
+    shininess = normalShininess.w;
+    
+    vec3 result;
+#if LIGHT_VOLUME == LIGHT_VOLUME_FULLSCREEN
+    // Directional light influence and emission, written along with the depth so forward rendered objects can follow
+#if SHADOWS
+    float shadow = calcShadow(fragPos);
+#else
+    float shadow = 1.0;
+#endif
+    result = calcDirectionalLight(directionalLight, normal, viewDir, shadow);
+    result += texelFetch(gEmission, pixel, 0).rgb;
+    gl_FragDepth = depth;
+#elif LIGHT_VOLUME == LIGHT_VOLUME_POINT
+    // Point light influence
+    PointLight light;
+    light.position = lightPosition;
+    light.constant = lightAttenuation.x;
+    light.ambient = lightAmbient;
+    light.linear = lightAttenuation.y;
+    light.diffuse = lightDiffuse;
+    light.quadratic = lightAttenuation.z;
+    light.specular = lightSpecular;
+    result = calcPointLight(light, normal, fragPos, viewDir);
+#else
+    // Spotlight influence
+    result = calcSpotLight(spotLight, normal, fragPos, viewDir);
+#endif
+    
+    // Final result, added to the other lights by blending
+    fragColor = vec4(result, 1.0);
+}
+
+
+vec3 calcDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir, float shadow)
+{
+    // Ambient
+    vec3 ambient =  light.ambient * albedo;
+    
+    // Diffuse
+    vec3 lightDir = normalize(-light.direction);
+    float diffuseMultiplier = max(dot(normal, lightDir), 0.0);
+    vec3 diffuse = light.diffuse * diffuseMultiplier * albedo;
+    
+    // Specular
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float specularMultiplier = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    vec3 specular = light.specular * specularMultiplier * specularColor;
+    
+    return (ambient + (diffuse + specular) * shadow);
+}
+
+
+vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    // Ambient
+    vec3 ambient =  light.ambient * albedo;
+    
+    // Diffuse
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diffuseMultiplier = max(dot(normal, lightDir), 0.0);
+    vec3 diffuse = light.diffuse * diffuseMultiplier * albedo;
+    
+    // Specular
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float specularMultiplier = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    vec3 specular = light.specular * specularMultiplier * specularColor;
+    
+    // Attenuation
+    float lightDist = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + (light.linear * lightDist) + (light.quadratic * lightDist * lightDist));
+    
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+    
+    return (ambient + diffuse + specular);
+}
+
+
+vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    // Ambient
+    vec3 ambient =  light.ambient * albedo;
+    
+    // Diffuse
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diffuseMultiplier = max(dot(normal, lightDir), 0.0);
+    vec3 diffuse = light.diffuse * diffuseMultiplier * albedo;
+    
+    // Specular
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float specularMultiplier = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    vec3 specular = light.specular * specularMultiplier * specularColor;
+    
+    // Attenuation
+    float lightDist = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + (light.linear * lightDist) + (light.quadratic * lightDist * lightDist));
+    
+    // Intensity
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.innerCutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0); 
+    
+    ambient *= attenuation * intensity;
+    diffuse *= attenuation * intensity;
+    specular *= attenuation * intensity;
+    
+    return (ambient + diffuse + specular);
+}
+
+#if SHADOWS
+float calcShadow(vec3 fragPos)
+{
+    // Cascades overlap and the nearer ones have smaller texels, so the first one covering the fragment (with room for the filter) is used
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+    {
+        vec3 coords = (shadowMatrices[i] * vec4(fragPos, 1.0)).xyz;
+        if (all(greaterThan(coords.xy, texelSize * 2.0)) && all(lessThan(coords.xy, 1.0 - texelSize * 2.0)) && coords.z <= 1.0)
+        {
+            // 3x3 percentage closer filtering, every tap is itself a bilinear blend of four depth tests
+            float lit = 0.0;
+            for (int x = -1; x <= 1; x++)
+            {
+                for (int y = -1; y <= 1; y++)
+                {
+                    lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texelSize, float(i), coords.z));
+                }
+            }
+            return lit / 9.0;
+        }
+    }
+    
+    // Beyond the shadow distance
+    return 1.0;
+}
+#endif
\ No newline at end of file
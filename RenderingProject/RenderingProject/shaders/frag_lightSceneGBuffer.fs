@@ -0,0 +1,51 @@
+#version 330 core
+
+// Features that can be compiled out, defined by the application to select a permutation (see LitObjectFeatures)
+// Without definitions everything is enabled
+#ifndef EMISSION
+#define EMISSION 1
+#endif
+#ifndef SPECULAR_MAP
+#define SPECULAR_MAP 1
+#endif
+
+struct Material {
+    sampler2D texture_diffuse1;
+    sampler2D texture_specular1;
+    sampler2D texture_emission1;
+    float shininess;
+    float emissionIntensity;
+};
+
+in vec3 fragPos;
+in vec3 normalVecView;
+in vec2 texCoords;
+
+// G-buffer of deferred shading, see DeferredRenderer
+layout (location = 0) out vec4 gAlbedo;
+layout (location = 1) out vec4 gNormal;    // View space normal in xyz, shininess in w
+layout (location = 2) out vec4 gSpecular;
+layout (location = 3) out vec4 gEmission;
+
+uniform Material material;
+
+
+void main()
+{
+    // Surface properties of the fragment, lights are applied to them later
+    // The normal is stored as the lit object shader uses it
+    gAlbedo = vec4(vec3(texture(material.texture_diffuse1, texCoords)), 1.0);
+    gNormal = vec4(normalVecView, material.shininess);
+    
+#if SPECULAR_MAP
+    gSpecular = vec4(vec3(texture(material.texture_specular1, texCoords)), 1.0);
+#else
+    gSpecular = vec4(0.0);
+#endif
+    
+#if EMISSION
+    gEmission = vec4(vec3(texture(material.texture_emission1, texCoords)) * material.emissionIntensity, 1.0);
+#else
+    gEmission = vec4(0.0);
+#endif
+}
\ No newline at end of file
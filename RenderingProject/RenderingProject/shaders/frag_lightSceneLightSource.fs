@@ -1,8 +1,8 @@
 #version 330 core
 
-out vec4 fragColor;
+in vec3 lightColor;
 
-uniform vec3 lightColor;
+out vec4 fragColor;
 
 
 void main()
@@ -1,6 +1,35 @@
 #version 330 core
 #define NR_POINT_LIGHTS 4  
 
+// Features that can be compiled out, defined by the application to select a permutation (see LitObjectFeatures)
+// Without definitions everything is enabled
+#ifndef POINT_LIGHT_COUNT
+#define POINT_LIGHT_COUNT NR_POINT_LIGHTS
+#endif
+#ifndef SPOT_LIGHT
+#define SPOT_LIGHT 1
+#endif
+#ifndef EMISSION
+#define EMISSION 1
+#endif
+#ifndef SPECULAR_MAP
+#define SPECULAR_MAP 1
+#endif
+#ifndef CLUSTERED_LIGHTS
+#define CLUSTERED_LIGHTS 0
+#endif
+#ifndef SHADOWS
+#define SHADOWS 0
+#endif
+
+// Cluster grid, must match CLUSTER_COUNT_X/Y/Z in light_clusters.h
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+
+// Shadow cascades, must match SHADOW_CASCADE_COUNT in cascaded_shadow_maps.h
+#define SHADOW_CASCADE_COUNT 4
+
 struct Material {
     sampler2D texture_diffuse1;
     sampler2D texture_specular1;
@@ -9,6 +38,8 @@ struct Material {
     float emissionIntensity;
 };
 
+// Light structs are laid out for the std140 "Lighting" uniform block, members are ordered
+// so that every vec3 is followed by a float (see lighting_buffer.h for the CPU side)
 struct DirectionalLight {
     vec3 direction; // should be in view space
     
@@ -19,29 +50,26 @@ struct DirectionalLight {
 
 struct PointLight {
     vec3 position; // should be in view space
+    float constant;
     
     vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-    
-    float constant;
     float linear;
+    vec3 diffuse;
     float quadratic;
+    vec3 specular;
 };
 
 struct SpotLight {
     vec3 position; // should be in view space
+    float constant;
     vec3 direction; // should be in view space
+    float linear;
     
     vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-    
-    float constant;
-    float linear;
     float quadratic;
-    
+    vec3 diffuse;
     float innerCutOff;
+    vec3 specular;
     float outerCutOff;
 };
 
@@ -52,11 +80,33 @@ in vec2 texCoords;
 out vec4 fragColor;
 
 uniform Material material;
-uniform DirectionalLight directionalLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-uniform SpotLight spotLight;
 
-vec3 calcDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir);
+layout (std140) uniform Lighting
+{
+    DirectionalLight directionalLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+    SpotLight spotLight;
+};
+
+#if CLUSTERED_LIGHTS
+// Point lights assigned to clusters on the CPU (see LightClusters), replacing those of the lighting block
+uniform samplerBuffer clusterLightData;      // Four texels per light, laid out like PointLight
+uniform usamplerBuffer clusterGrid;          // Offset into clusterLightIndices and light count per cluster
+uniform usamplerBuffer clusterLightIndices;
+uniform vec4 clusterParameters;              // Tiles per pixel in x and y, depth slice scale and bias
+
+PointLight fetchClusterLight(int index);
+#endif
+
+#if SHADOWS
+// Cascaded shadow maps of the directional light (see CascadedShadowMaps)
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 shadowMatrices[SHADOW_CASCADE_COUNT];  // From view space to the texture coordinates and depth of every cascade
+
+float calcShadow(vec3 fragPos);
+#endif
+
+vec3 calcDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir, float shadow);
 vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 
@@ -68,27 +118,48 @@ void main()
     vec3 normal = normalVecView;
     vec3 viewDir = normalize(-fragPos);
     
-    // Directional light influence
-    result = calcDirectionalLight(directionalLight, normal, viewDir);
+    // Directional light influence, only ambient where the light is blocked
+#if SHADOWS
+    float shadow = calcShadow(fragPos);
+#else
+    float shadow = 1.0;
+#endif
+    result = calcDirectionalLight(directionalLight, normal, viewDir, shadow);
     
-    // Point light influences
-    for (int i = 0; i < NR_POINT_LIGHTS; i++)
+#if CLUSTERED_LIGHTS
+    // Point light influences of the lights in the fragment's cluster
+    ivec3 cluster = ivec3(gl_FragCoord.xy * clusterParameters.xy, log(-fragPos.z) * clusterParameters.z + clusterParameters.w);
+    cluster = clamp(cluster, ivec3(0), ivec3(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1, CLUSTER_COUNT_Z - 1));
+    uvec2 clusterLights = texelFetch(clusterGrid, cluster.x + CLUSTER_COUNT_X * (cluster.y + CLUSTER_COUNT_Y * cluster.z)).xy;
+    for (uint i = 0u; i < clusterLights.y; i++)
+    {
+        int lightIndex = int(texelFetch(clusterLightIndices, int(clusterLights.x + i)).r);
+        result += calcPointLight(fetchClusterLight(lightIndex), normal, fragPos, viewDir);
+    }
+#else
+    // Point light influences, the block always holds NR_POINT_LIGHTS but only the first POINT_LIGHT_COUNT are used
+    for (int i = 0; i < POINT_LIGHT_COUNT; i++)
     {
         result += calcPointLight(pointLights[i], normal, fragPos, viewDir);
     }
+#endif
     
+#if SPOT_LIGHT
     // Spotlight influence
     result += calcSpotLight(spotLight, normal, fragPos, viewDir);
+#endif
     
+#if EMISSION
     // Emission
     result += vec3(texture(material.texture_emission1, texCoords)) * material.emissionIntensity;
+#endif
     
     // Final result
     fragColor = vec4(result, 1.0);
 }
 
 
-vec3 calcDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir)
+vec3 calcDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir, float shadow)
 {
     // Ambient
     vec3 ambient =  light.ambient * vec3(texture(material.texture_diffuse1, texCoords));
@@ -99,11 +170,15 @@ vec3 calcDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir)
     vec3 diffuse = light.diffuse * diffuseMultiplier * vec3(texture(material.texture_diffuse1, texCoords));
     
     // Specular
+#if SPECULAR_MAP
     vec3 reflectDir = reflect(-lightDir, normal);
     float specularMultiplier = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     vec3 specular = light.specular * specularMultiplier * vec3(texture(material.texture_specular1, texCoords));
+#else
+    vec3 specular = vec3(0.0);
+#endif
     
-    return (ambient + diffuse + specular);
+    return (ambient + (diffuse + specular) * shadow);
 }
 
 
@@ -118,9 +193,13 @@ vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     vec3 diffuse = light.diffuse * diffuseMultiplier * vec3(texture(material.texture_diffuse1, texCoords));
     
     // Specular
+#if SPECULAR_MAP
     vec3 reflectDir = reflect(-lightDir, normal);
     float specularMultiplier = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     vec3 specular = light.specular * specularMultiplier * vec3(texture(material.texture_specular1, texCoords));
+#else
+    vec3 specular = vec3(0.0);
+#endif
     
     // Attenuation
     float lightDist = length(light.position - fragPos);
@@ -145,9 +224,13 @@ vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     vec3 diffuse = light.diffuse * diffuseMultiplier * vec3(texture(material.texture_diffuse1, texCoords));
     
     // Specular
+#if SPECULAR_MAP
     vec3 reflectDir = reflect(-lightDir, normal);
     float specularMultiplier = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     vec3 specular = light.specular * specularMultiplier * vec3(texture(material.texture_specular1, texCoords));
+#else
+    vec3 specular = vec3(0.0);
+#endif
     
     // Attenuation
     float lightDist = length(light.position - fragPos);
@@ -163,4 +246,53 @@ vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     specular *= attenuation * intensity;
     
     return (ambient + diffuse + specular);
-}
\ No newline at end of file
+}
+
+
+#if CLUSTERED_LIGHTS
+PointLight fetchClusterLight(int index)
+{
+    vec4 positionConstant = texelFetch(clusterLightData, index * 4);
+    vec4 ambientLinear = texelFetch(clusterLightData, index * 4 + 1);
+    vec4 diffuseQuadratic = texelFetch(clusterLightData, index * 4 + 2);
+    vec4 specular = texelFetch(clusterLightData, index * 4 + 3);
+    
+    PointLight light;
+    light.position = positionConstant.xyz;
+    light.constant = positionConstant.w;
+    light.ambient = ambientLinear.xyz;
+    light.linear = ambientLinear.w;
+    light.diffuse = diffuseQuadratic.xyz;
+    light.quadratic = diffuseQuadratic.w;
+    light.specular = specular.xyz;
+    return light;
+}
+#endif
+
+#if SHADOWS
+float calcShadow(vec3 fragPos)
+{
+    // Cascades overlap and the nearer ones have smaller texels, so the first one covering the fragment (with room for the filter) is used
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+    {
+        vec3 coords = (shadowMatrices[i] * vec4(fragPos, 1.0)).xyz;
+        if (all(greaterThan(coords.xy, texelSize * 2.0)) && all(lessThan(coords.xy, 1.0 - texelSize * 2.0)) && coords.z <= 1.0)
+        {
+            // 3x3 percentage closer filtering, every tap is itself a bilinear blend of four depth tests
+            float lit = 0.0;
+            for (int x = -1; x <= 1; x++)
+            {
+                for (int y = -1; y <= 1; y++)
+                {
+                    lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texelSize, float(i), coords.z));
+                }
+            }
+            return lit / 9.0;
+        }
+    }
+    
+    // Beyond the shadow distance
+    return 1.0;
+}
+#endif
\ No newline at end of file
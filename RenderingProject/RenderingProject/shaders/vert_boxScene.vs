@@ -3,18 +3,36 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
 layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in mat4 aModel; // per instance
+layout (location = 7) in float aSpinSpeed; // per instance, in degrees per second
 
 out vec3 ourColor;
 out vec2 texCoord;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform float time;
+
+// Axis the boxes are rotated about (in BoxScene::generateBoxes), spinning about it adds to that rotation
+const vec3 SPIN_AXIS = vec3(0.8638684, 0.2591605, 0.4319342);
+
+
+// Rotation about an axis of unit length
+mat3 rotation(vec3 axis, float angle)
+{
+    float c = cos(angle);
+    float s = sin(angle);
+    vec3 t = (1.0 - c) * axis;
+    return mat3(t.x * axis + vec3(c, s * axis.z, -s * axis.y),
+                t.y * axis + vec3(-s * axis.z, c, s * axis.x),
+                t.z * axis + vec3(s * axis.y, -s * axis.x, c));
+}
 
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    vec3 position = rotation(SPIN_AXIS, radians(mod(aSpinSpeed * time, 360.0))) * aPos;
+    gl_Position = projection * view * aModel * vec4(position, 1.0);
     ourColor = aColor;
     texCoord = aTexCoord;
 }
\ No newline at end of file
@@ -0,0 +1,21 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+
+// Position transform of packed vertices, see vert_lightSceneLitObject.vs
+layout (location = 3) in vec3 aPositionOffset;
+layout (location = 4) in vec3 aPositionScale;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// The lit pass tests against this depth with GL_EQUAL, so the position has to be computed exactly the same way as in the lit shader
+invariant gl_Position;
+
+
+void main()
+{
+    vec3 position = aPositionOffset + aPos * aPositionScale;
+    gl_Position = projection * view * model * vec4(position, 1.0);
+}
\ No newline at end of file
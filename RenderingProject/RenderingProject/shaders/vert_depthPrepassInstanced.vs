@@ -0,0 +1,17 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in mat4 aModel; // per instance
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// The lit pass tests against this depth with GL_EQUAL, so the position has to be computed exactly the same way as in the lit shader
+invariant gl_Position;
+
+
+void main()
+{
+    vec4 viewPos = view * aModel * vec4(aPos, 1.0);
+    gl_Position = projection * viewPos;
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#version 330 core
+
+// Light volume drawn, defined by the application (see DeferredRenderer)
+#define LIGHT_VOLUME_FULLSCREEN 0 // Directional light and emission, one triangle covering the screen
+#define LIGHT_VOLUME_POINT 1      // Point light spheres, one instance per light
+#define LIGHT_VOLUME_SPOT 2       // Spotlight cone
+#ifndef LIGHT_VOLUME
+#define LIGHT_VOLUME LIGHT_VOLUME_FULLSCREEN
+#endif
+
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in vec4 aPositionRadius; // per instance, in world space
+layout (location = 4) in vec3 aAmbient; // per instance
+layout (location = 5) in vec3 aDiffuse; // per instance
+layout (location = 6) in vec3 aSpecular; // per instance
+layout (location = 7) in vec3 aAttenuation; // per instance
+
+#if LIGHT_VOLUME == LIGHT_VOLUME_POINT
+flat out vec3 lightPosition; // in view space
+flat out float lightRadius;
+flat out vec3 lightAmbient;
+flat out vec3 lightDiffuse;
+flat out vec3 lightSpecular;
+flat out vec3 lightAttenuation;
+#endif
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat4 volumeModel; // spotlight cone, to view space
+
+
+void main()
+{
+#if LIGHT_VOLUME == LIGHT_VOLUME_FULLSCREEN
+    // Vertices 0, 1 and 2 at (-1, -1), (3, -1) and (-1, 3), no vertex buffer needed
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(position, 0.0, 1.0);
+#elif LIGHT_VOLUME == LIGHT_VOLUME_POINT
+    // Unit sphere scaled to the light's reach
+    gl_Position = projection * view * vec4(aPositionRadius.xyz + aPos * aPositionRadius.w, 1.0);
+    lightPosition = vec3(view * vec4(aPositionRadius.xyz, 1.0));
+    lightRadius = aPositionRadius.w;
+    lightAmbient = aAmbient;
+    lightDiffuse = aDiffuse;
+    lightSpecular = aSpecular;
+    lightAttenuation = aAttenuation;
+#else
+    gl_Position = projection * volumeModel * vec4(aPos, 1.0);
+#endif
+}
\ No newline at end of file
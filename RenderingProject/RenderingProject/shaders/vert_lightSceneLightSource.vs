@@ -1,13 +1,17 @@
 #version 330 core
 
 layout (location = 0) in vec3 aPos;
+layout (location = 3) in mat4 aModel; // per instance
+layout (location = 7) in vec3 aColor; // per instance
+
+out vec3 lightColor;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-} 
\ No newline at end of file
+    gl_Position = projection * view * aModel * vec4(aPos, 1.0);
+    lightColor = aColor;
+}
\ No newline at end of file
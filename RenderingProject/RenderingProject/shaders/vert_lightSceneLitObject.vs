@@ -4,6 +4,12 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
+// Vertex decoding, meshes with packed vertices have positions normalized against their bounds
+// and octahedral encoded normals (only the xy of aNormal are set then), see Mesh::draw
+// The position transform is per draw, a constant attribute for single draws and instanced data for multi-draws (see MultiDrawBatch)
+layout (location = 3) in vec3 aPositionOffset;
+layout (location = 4) in vec3 aPositionScale;
+
 out vec3 fragPos;
 out vec3 normalVecView;
 out vec2 texCoords;
@@ -13,11 +19,29 @@ uniform mat4 view;
 uniform mat4 projection;
 uniform mat3 normalMatView;
 
+uniform bool octahedralNormals = false;
+
+// Has to match the depth pre-pass exactly, see vert_depthPrepass.vs
+invariant gl_Position;
+
+
+vec3 octahedralDecode(vec2 encoded)
+{
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-normal.z, 0.0);
+    normal.x += normal.x >= 0.0 ? -fold : fold;
+    normal.y += normal.y >= 0.0 ? -fold : fold;
+    return normalize(normal);
+}
+
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-    fragPos = vec3(view * model * vec4(aPos, 1.0));
-    normalVecView = normalMatView * aNormal;
+    vec3 position = aPositionOffset + aPos * aPositionScale;
+    vec3 normal = octahedralNormals ? octahedralDecode(aNormal.xy) : aNormal;
+
+    gl_Position = projection * view * model * vec4(position, 1.0);
+    fragPos = vec3(view * model * vec4(position, 1.0));
+    normalVecView = normalMatView * normal;
     texCoords = aTexCoords;
 } 
\ No newline at end of file
@@ -0,0 +1,28 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aModel; // per instance
+layout (location = 7) in mat3 aNormalMat; // per instance, in world space
+
+out vec3 fragPos;
+out vec3 normalVecView;
+out vec2 texCoords;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// Has to match the depth pre-pass exactly, see vert_depthPrepass.vs
+invariant gl_Position;
+
+
+void main()
+{
+    vec4 viewPos = view * aModel * vec4(aPos, 1.0);
+    gl_Position = projection * viewPos;
+    fragPos = vec3(viewPos);
+    // View matrix is only rotation and translation, so its upper 3x3 part works for normals as is
+    normalVecView = mat3(view) * aNormalMat * aNormal;
+    texCoords = aTexCoords;
+}
\ No newline at end of file
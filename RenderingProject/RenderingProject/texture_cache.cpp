@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
+#include "texture_cache.h"
+#include "texture_loader.h"
+
+using namespace std;
+
+
+TextureRef TextureCache::acquire(const string &path, bool flipVertically, GLint wrapMode)
+{
+	// Flipping and wrapping are baked into the texture, so they are part of the key
+	string key = canonicalizePath(path) + (flipVertically ? "|flip|" : "|noflip|") + to_string(wrapMode);
+
+	unordered_map<string, Entry>::iterator it = entries.find(key);
+	if (it != entries.end())
+	{
+		TextureRef texture = it->second.texture.lock();
+		if (texture)
+		{
+			stats.hits++;
+			return texture;
+		}
+	}
+
+	stats.misses++;
+	stats.textureCount++;
+
+	GLuint textureID = TextureLoader::global().load(path, flipVertically, wrapMode, [this, key](GLuint, size_t memoryBytes)
+	{
+		setTextureMemory(key, memoryBytes);
+	});
+
+	TextureRef texture(new GpuResource(GPU_RESOURCE_TEXTURE, textureID), [this, key](const GpuResource *texture)
+	{
+		release(key, texture);
+	});
+
+	Entry &entry = entries[key];
+	entry.texture = texture;
+	entry.memoryBytes = 0;
+	return texture;
+}
+
+
+const TextureCacheStats &TextureCache::getStats() const
+{
+	return stats;
+}
+
+
+TextureCache &TextureCache::global()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+
+string TextureCache::canonicalizePath(const string &path)
+{
+	string canonical = path;
+
+#ifdef _WIN32
+	// Paths are case insensitive on Windows
+	char fullPath[_MAX_PATH];
+	if (_fullpath(fullPath, path.c_str(), _MAX_PATH))
+	{
+		canonical = fullPath;
+	}
+	transform(canonical.begin(), canonical.end(), canonical.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+#else
+	char *fullPath = realpath(path.c_str(), NULL);
+	if (fullPath)
+	{
+		canonical = fullPath;
+		free(fullPath);
+	}
+#endif
+
+	replace(canonical.begin(), canonical.end(), '\\', '/');
+	return canonical;
+}
+
+
+void TextureCache::release(const string &key, const GpuResource *texture)
+{
+	// The texture may still be waiting for its image, which mustn't be uploaded once the name is free again
+	TextureLoader::global().cancel(texture->get());
+	delete texture;
+
+	unordered_map<string, Entry>::iterator it = entries.find(key);
+	if (it != entries.end())
+	{
+		stats.memoryBytes -= it->second.memoryBytes;
+		entries.erase(it);
+	}
+	stats.textureCount--;
+}
+
+
+void TextureCache::setTextureMemory(const string &key, size_t memoryBytes)
+{
+	unordered_map<string, Entry>::iterator it = entries.find(key);
+	if (it == entries.end())
+	{
+		return;
+	}
+
+	TextureRef texture = it->second.texture.lock();
+	if (texture)
+	{
+		it->second.memoryBytes = memoryBytes;
+		stats.memoryBytes += memoryBytes;
+		texture->setMemory(memoryBytes);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "gpu_resource.h"
+
+
+// Shared reference to a texture owned by the texture cache, the texture is deleted once the last reference is gone
+typedef std::shared_ptr<const GpuResource> TextureRef;
+
+
+// Texture cache statistics, collected since the start of the program
+struct TextureCacheStats {
+	unsigned hits = 0;          // Requests served by a texture that was already loaded
+	unsigned misses = 0;        // Requests that had to load a file
+	unsigned textureCount = 0;  // Textures currently alive
+	size_t memoryBytes = 0;     // Estimated GPU memory of the live textures, mipmaps included
+};
+
+
+// Process-wide cache of textures loaded from files, so every file is decoded and uploaded only once
+// Textures are keyed by their canonical path together with their load settings
+class TextureCache
+{
+public:
+	// Default constructor
+	TextureCache() = default;
+
+	// References hold a pointer back to the cache, so it can't be copied
+	TextureCache(const TextureCache &) = delete;
+	TextureCache &operator=(const TextureCache &) = delete;
+
+	// Get a texture for an image file, queueing it on the global texture loader if it isn't loaded yet
+	// Newly loaded textures stay empty until the loader has uploaded them
+	TextureRef acquire(const std::string &path, bool flipVertically, GLint wrapMode);
+
+	// Cache statistics
+	const TextureCacheStats &getStats() const;
+
+	// Cache shared by the whole program
+	static TextureCache &global();
+
+	// Absolute path with forward slashes, so different spellings of the same file give the same key
+	static std::string canonicalizePath(const std::string &path);
+
+
+private:
+	// Cache entry, holding only a weak reference so the cache itself doesn't keep textures alive
+	struct Entry {
+		std::weak_ptr<const GpuResource> texture;
+		size_t memoryBytes;
+	};
+
+	std::unordered_map<std::string, Entry> entries;
+	TextureCacheStats stats;
+
+	// Delete a texture whose last reference is gone
+	void release(const std::string &key, const GpuResource *texture);
+
+	// Record the memory of a texture once it has been uploaded
+	void setTextureMemory(const std::string &key, size_t memoryBytes);
+};
+
+#endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <glad/glad.h>
 #include <stb_image.h>
 #include <iostream>
+#include "texture_cache.h"
 
 
 class TextureLegacy
@@ -12,7 +13,10 @@ public:
 	// Texture ID
 	GLuint ID;
 
-	// Constructor to generate texture from image
+	// Reference keeping the texture alive in the texture cache
+	TextureRef ref;
+
+	// Constructor to get the texture of an image from the texture cache, loading the image if needed
 	TextureLegacy(const char* imagePath, GLint wrapMode);
 
 	// Default constructor
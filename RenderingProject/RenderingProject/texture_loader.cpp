@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stb_image.h>
+#include "gl_state.h"
+#include "texture_loader.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+
+GLuint TextureLoader::load(const string &path, bool flipVertically, GLint wrapMode, UploadCallback onUploaded)
+{
+	// Textures are created here since only the main thread may call OpenGL, binding makes the name an actual texture object
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	GlState::global().bindTexture(GL_TEXTURE_2D, textureID);
+
+	uint64_t ticket;
+	{
+		lock_guard<mutex> lock(queueMutex);
+		ticket = nextTicket++;
+		pendingTextures[textureID] = ticket;
+	}
+
+	ThreadPool::global().submit([this, textureID, ticket, path, flipVertically, wrapMode, onUploaded]
+	{
+		DecodedImage image;
+		image.textureID = textureID;
+		image.ticket = ticket;
+		image.path = path;
+		image.wrapMode = wrapMode;
+		image.onUploaded = onUploaded;
+
+		stbi_set_flip_vertically_on_load_thread(flipVertically);
+		image.pixels = stbi_load(path.c_str(), &image.width, &image.height, &image.channels, 0);
+
+		{
+			lock_guard<mutex> lock(queueMutex);
+			decodedImages.push_back(image);
+		}
+		imageDecoded.notify_one();
+	});
+
+	return textureID;
+}
+
+
+void TextureLoader::processUploads(double timeBudgetMs)
+{
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+	while (true)
+	{
+		DecodedImage image;
+		{
+			lock_guard<mutex> lock(queueMutex);
+			if (decodedImages.empty())
+			{
+				return;
+			}
+			image = decodedImages.front();
+			decodedImages.pop_front();
+
+			// The texture was cancelled while its image was decoding, its name may already belong to another texture
+			unordered_map<GLuint, uint64_t>::iterator it = pendingTextures.find(image.textureID);
+			if (it == pendingTextures.end() || it->second != image.ticket)
+			{
+				stbi_image_free(image.pixels);
+				continue;
+			}
+		}
+
+		// Upload outside of the lock so workers can keep queueing images meanwhile
+		// Textures are only cancelled on the main thread, so it's still pending afterwards
+		upload(image);
+
+		{
+			lock_guard<mutex> lock(queueMutex);
+			pendingTextures.erase(image.textureID);
+		}
+
+		chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - startTime;
+		if (elapsed.count() >= timeBudgetMs)
+		{
+			return;
+		}
+	}
+}
+
+
+void TextureLoader::finish()
+{
+	while (true)
+	{
+		{
+			unique_lock<mutex> lock(queueMutex);
+			imageDecoded.wait(lock, [this] { return !decodedImages.empty() || pendingTextures.empty(); });
+			if (pendingTextures.empty())
+			{
+				return;
+			}
+		}
+
+		processUploads();
+	}
+}
+
+
+void TextureLoader::finish(GLuint textureID)
+{
+	DecodedImage image;
+	{
+		unique_lock<mutex> lock(queueMutex);
+		deque<DecodedImage>::iterator decoded;
+		imageDecoded.wait(lock, [this, textureID, &decoded]
+		{
+			unordered_map<GLuint, uint64_t>::iterator it = pendingTextures.find(textureID);
+			if (it == pendingTextures.end())
+			{
+				return true;
+			}
+
+			// Images of earlier loads of a cancelled texture with the same name are left for processUploads to drop
+			uint64_t ticket = it->second;
+			decoded = find_if(decodedImages.begin(), decodedImages.end(), [textureID, ticket](const DecodedImage &image)
+			{
+				return image.textureID == textureID && image.ticket == ticket;
+			});
+			return decoded != decodedImages.end();
+		});
+
+		// Already uploaded (or never queued)
+		if (pendingTextures.count(textureID) == 0)
+		{
+			return;
+		}
+		image = *decoded;
+		decodedImages.erase(decoded);
+	}
+
+	upload(image);
+
+	{
+		lock_guard<mutex> lock(queueMutex);
+		pendingTextures.erase(textureID);
+	}
+}
+
+
+size_t TextureLoader::getPendingCount()
+{
+	lock_guard<mutex> lock(queueMutex);
+	return pendingTextures.size();
+}
+
+
+bool TextureLoader::isPending(GLuint textureID)
+{
+	lock_guard<mutex> lock(queueMutex);
+	return pendingTextures.count(textureID) != 0;
+}
+
+
+void TextureLoader::cancel(GLuint textureID)
+{
+	lock_guard<mutex> lock(queueMutex);
+	pendingTextures.erase(textureID);
+}
+
+
+TextureLoader &TextureLoader::global()
+{
+	static TextureLoader loader;
+	return loader;
+}
+
+
+void TextureLoader::upload(const DecodedImage &image)
+{
+	if (!image.pixels)
+	{
+		cerr << "Texture failed to load at path: " << image.path << endl;
+		return;
+	}
+
+	GLenum format;
+	if (image.channels == 1)
+	{
+		format = GL_RED;
+	}
+	else if (image.channels == 2)
+	{
+		format = GL_RG;
+	}
+	else if (image.channels == 3)
+	{
+		format = GL_RGB;
+	}
+	else
+	{
+		format = GL_RGBA;
+	}
+
+	GlState::global().bindTexture(GL_TEXTURE_2D, image.textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
+	glGenerateMipmap(GL_TEXTURE_2D);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, image.wrapMode);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, image.wrapMode);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	stbi_image_free(image.pixels);
+
+	if (image.onUploaded)
+	{
+		// Size of the whole mipmap chain
+		size_t memoryBytes = 0;
+		for (int width = image.width, height = image.height; ; width = max(width / 2, 1), height = max(height / 2, 1))
+		{
+			memoryBytes += (size_t)width * height * image.channels;
+			if (width == 1 && height == 1)
+			{
+				break;
+			}
+		}
+		image.onUploaded(image.textureID, memoryBytes);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+// Loads texture images in the background: files are decoded on the global thread pool,
+// and the decoded pixels are queued for upload on the main thread, which owns the OpenGL context
+class TextureLoader
+{
+public:
+	// Default constructor
+	TextureLoader() = default;
+
+	// Loaders hold a queue shared with worker threads, so they can't be copied
+	TextureLoader(const TextureLoader &) = delete;
+	TextureLoader &operator=(const TextureLoader &) = delete;
+
+	// Called on the main thread once a texture has been uploaded, with the estimated memory it takes up
+	typedef std::function<void(GLuint textureID, size_t memoryBytes)> UploadCallback;
+
+	// Create a texture and queue its image for decoding, the returned texture is empty until its upload is done
+	// Image flipping is set per decoding thread, so it doesn't depend on stbi_set_flip_vertically_on_load
+	GLuint load(const std::string &path, bool flipVertically, GLint wrapMode, UploadCallback onUploaded = nullptr);
+
+	// Upload the images decoded so far without waiting for the others, must be called on the main thread
+	// Stops once the time budget is spent, so uploads can be spread over several frames (at least one image is uploaded)
+	void processUploads(double timeBudgetMs = std::numeric_limits<double>::infinity());
+
+	// Upload images as they get decoded until every queued texture is done, must be called on the main thread
+	void finish();
+
+	// Upload the image of one texture as soon as it's decoded, leaving the other queued textures for later, must be called on the main thread
+	void finish(GLuint textureID);
+
+	// Amount of textures queued but not uploaded yet
+	size_t getPendingCount();
+
+	// Whether a texture is still queued, it stays empty until it isn't anymore
+	bool isPending(GLuint textureID);
+
+	// Drop the queued upload of a texture, must be called before deleting a texture that may still be pending
+	// OpenGL reuses the names of deleted textures, so the image would otherwise end up in whichever texture gets the name next
+	void cancel(GLuint textureID);
+
+	// Loader shared by the whole program
+	static TextureLoader &global();
+
+
+private:
+	// Decoded image waiting for upload
+	struct DecodedImage {
+		GLuint textureID;
+		uint64_t ticket;  // Number of the load, the image is only uploaded if its texture is still pending with it
+		std::string path;
+		GLint wrapMode;
+		UploadCallback onUploaded;
+		unsigned char *pixels;  // NULL if decoding failed
+		int width;
+		int height;
+		int channels;
+	};
+
+	std::deque<DecodedImage> decodedImages;
+	// Textures queued but not uploaded yet, with the number of the load they're waiting for
+	std::unordered_map<GLuint, uint64_t> pendingTextures;
+	uint64_t nextTicket = 0;
+
+	std::mutex queueMutex;
+	std::condition_variable imageDecoded;
+
+	// Upload a decoded image into its texture and free the pixels
+	static void upload(const DecodedImage &image);
+};
+
+#endif
\ No newline at end of file
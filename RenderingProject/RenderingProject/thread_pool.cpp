@@ -0,0 +1,94 @@
+#include "thread_pool.h"
+
+using namespace std;
+
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+	threadCount = threadCount > 0 ? threadCount : 1;
+	for (unsigned i = 0; i < threadCount; i++)
+	{
+		workers.push_back(thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		stopping = true;
+	}
+	taskAvailable.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+}
+
+
+void ThreadPool::submit(function<void()> task)
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		tasks.push_back(move(task));
+	}
+	taskAvailable.notify_one();
+}
+
+
+void ThreadPool::waitIdle()
+{
+	unique_lock<mutex> lock(queueMutex);
+	idle.wait(lock, [this] { return tasks.empty() && runningTasks == 0; });
+}
+
+
+unsigned ThreadPool::getThreadCount() const
+{
+	return (unsigned)workers.size();
+}
+
+
+ThreadPool &ThreadPool::global()
+{
+	// hardware_concurrency may report 0 if it can't tell
+	unsigned hardwareThreads = thread::hardware_concurrency();
+	static ThreadPool pool(hardwareThreads > 1 ? hardwareThreads - 1 : 1);
+	return pool;
+}
+
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(queueMutex);
+			taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+			// Queued tasks are still run when stopping, so nobody waits on a result that never comes
+			if (tasks.empty())
+			{
+				return;
+			}
+
+			task = move(tasks.front());
+			tasks.pop_front();
+			runningTasks++;
+		}
+
+		task();
+
+		{
+			lock_guard<mutex> lock(queueMutex);
+			runningTasks--;
+			if (tasks.empty() && runningTasks == 0)
+			{
+				idle.notify_all();
+			}
+		}
+	}
+}
\ No newline at end of file
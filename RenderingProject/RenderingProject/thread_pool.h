@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of worker threads running queued tasks in submission order
+// NOTE: Tasks never touch OpenGL, the context only lives on the main thread
+class ThreadPool
+{
+public:
+	// Constructor starts the worker threads
+	ThreadPool(unsigned threadCount);
+
+	// Destructor finishes the queued tasks and joins the workers
+	~ThreadPool();
+
+	// Threads can't be copied
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	// Queue a task to be run by one of the workers
+	void submit(std::function<void()> task);
+
+	// Block until every submitted task has finished
+	void waitIdle();
+
+	// Amount of worker threads
+	unsigned getThreadCount() const;
+
+	// Pool shared by the whole program, with one worker per hardware thread except the one running the main thread
+	static ThreadPool &global();
+
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+
+	std::mutex queueMutex;
+	std::condition_variable taskAvailable;
+	std::condition_variable idle;
+
+	unsigned runningTasks = 0;
+	bool stopping = false;
+
+	// Loop run by every worker thread
+	void workerLoop();
+};
+
+#endif
\ No newline at end of file
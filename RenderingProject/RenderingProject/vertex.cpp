@@ -0,0 +1,65 @@
+#include "vertex.h"
+
+using namespace std;
+
+
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex has unexpected padding");
+
+
+size_t getVertexSize(VertexFormat format)
+{
+	return format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+
+size_t getPositionSize(VertexFormat format)
+{
+	return format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex::position) : sizeof(Vertex::position);
+}
+
+
+void setupVertexAttributes(VertexFormat format)
+{
+	if (format == VERTEX_FORMAT_PACKED)
+	{
+		// Vertex positions, the shader scales them back using positionOffset and positionScale
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+		glEnableVertexAttribArray(0);
+
+		// Vertex normals, two components that the shader decodes into a vec3
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+		glEnableVertexAttribArray(1);
+
+		// Vertex texture coordinates
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, texCoords));
+		glEnableVertexAttribArray(2);
+		return;
+	}
+
+	// Vertex positions
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	// Vertex normals
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+	glEnableVertexAttribArray(1);
+
+	// Vertex texture coordinates
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoords));
+	glEnableVertexAttribArray(2);
+}
+
+
+void setupPositionAttributes(VertexFormat format)
+{
+	// The same attribute as in the full vertex, so the position reaches the shader as exactly the same value
+	if (format == VERTEX_FORMAT_PACKED)
+	{
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, (GLsizei)getPositionSize(format), (void*)0);
+	}
+	else
+	{
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, (GLsizei)getPositionSize(format), (void*)0);
+	}
+	glEnableVertexAttribArray(0);
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef VERTEX_H
+#define VERTEX_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <cstddef>
+
+
+struct Vertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texCoords;
+};
+
+
+// Compact vertex layout used on the GPU when a mesh is uploaded with VERTEX_FORMAT_PACKED (16 instead of 32 bytes)
+struct PackedVertex {
+	uint16_t position[4];   // Normalized against the mesh bounds, w is unused padding
+	int16_t normal[2];      // Octahedral encoding, signed normalized
+	uint16_t texCoords[2];  // Half floats
+};
+
+
+// Vertex layouts a mesh can be uploaded with, the shader decodes either one (see Mesh::draw)
+enum VertexFormat {
+	VERTEX_FORMAT_FLOAT,
+	VERTEX_FORMAT_PACKED
+};
+
+// Amount of vertex formats
+const int VERTEX_FORMAT_COUNT = 2;
+
+
+// Size in bytes of a vertex on the GPU
+size_t getVertexSize(VertexFormat format);
+
+// Size in bytes of a vertex position, encoded like in the full vertex of a format (12 bytes for float and 8 for packed vertices)
+// Depth-only passes read positions from a stream of their own, so they don't fetch the normals and texture coordinates
+size_t getPositionSize(VertexFormat format);
+
+// Set up the attributes of the bound vertex array for vertices of a format in the bound array buffer
+void setupVertexAttributes(VertexFormat format);
+
+// Set up the position attribute of the bound vertex array for a position stream of a format in the bound array buffer
+void setupPositionAttributes(VertexFormat format);
+
+#endif
\ No newline at end of file